@@ -0,0 +1,78 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "helper.h"
+#include "MedipixCSM.h"
+#include "MedipixSPM.h"
+
+namespace {
+    std::atomic<unsigned long long> allocations{0};
+}
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+/**
+ * Counts the heap allocations of repeated frames of the same detector and of the Fourier spectrum of each frame.
+ * The transient buffers come from the per-thread arenas of the detector, so after the first frame a frame does not
+ * allocate from the heap.
+ */
+int main() {
+    unsigned int n_frames = 5;
+    double exposure_time = 1E-4;
+    double flux_density = 1E7;
+
+    std::cout << "# detector frame photons frame_allocations allocations/photon spectrum_allocations" << std::endl;
+    std::vector<std::pair<std::string, std::shared_ptr<Medipix>>> detectors = {
+            {"spm", std::make_shared<MedipixSPM>(false, 64, 64)},
+            {"csm", std::make_shared<MedipixCSM>(false, 64, 64)},
+            {"spm_timed", std::make_shared<MedipixSPM>(true, 64, 64)},
+            {"csm_timed", std::make_shared<MedipixCSM>(true, 64, 64)}};
+    for (const auto &[name, m]: detectors) {
+        m->set_th0(10.f);
+        for (unsigned int frame = 0; frame < n_frames; ++frame) {
+            auto before = allocations.load();
+            m->start_frame();
+            homogeneous_exposure(m, 30.f, exposure_time, flux_density, frame);
+            m->finish_frame();
+            auto n = allocations.load() - before;
+            // FFTW allocates in its planner
+            before = allocations.load();
+            auto spectrum = m->get_fourier_spectrum();
+            auto n_spectrum = allocations.load() - before;
+            std::cout << name << " " << frame << " " << m->get_real_photons() << " " << n << " "
+                      << double(n) / double(m->get_real_photons()) << " " << n_spectrum << std::endl;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <omp.h>
+#include "Assembly.h"
+#include "MedipixSPM.h"
+
+/**
+ * Per-chip parallel scaling of a 2x2 and a 4x4 assembly of 256x256 chips.
+ */
+int main() {
+    auto chip = std::make_shared<MedipixSPM>(false);
+    chip->set_psf_sigma(13.0f);
+    chip->set_th0(6.0f);
+    chip->random_threshold_dispersion(1.0f, 42);
+
+    std::cout << "# chips threads photons/s" << std::endl;
+    for (unsigned int n_chips: {2u, 4u}) {
+        Assembly assembly(chip, n_chips, n_chips, 110.f);
+        for (int threads = 1; threads <= omp_get_max_threads(); threads *= 2) {
+            omp_set_num_threads(threads);
+            auto start = std::chrono::steady_clock::now();
+            assembly.start_frame();
+            assembly.exposure(30.f, 1E-3, 1E6, [](float, float) { return true; }, 42);
+            assembly.finish_frame();
+            std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+            std::cout << n_chips << "x" << n_chips << " " << threads << " "
+                      << double(assembly.get_real_photons()) / duration.count() << std::endl;
+        }
+    }
+}
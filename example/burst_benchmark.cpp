@@ -0,0 +1,56 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "burst.h"
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Compares the frame throughput of a serial frame loop with the burst mode for a small timed detector.
+ */
+int main() {
+    auto m = std::make_shared<MedipixSPM>(true, 16, 16);
+    m->random_threshold_dispersion(1.0f);
+    m->set_th0(6.0f);
+    m->set_psf_sigma(13.0);
+    unsigned int n_frames = 64;
+    double exposure_time = 1E-3;
+    double flux_density = 1E7;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int frame = 0; frame < n_frames; ++frame) {
+        m->start_frame();
+        homogeneous_exposure(m, 30.f, exposure_time, flux_density, frame_seed(42, frame));
+        m->finish_frame();
+    }
+    std::chrono::duration<double> serial = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    auto frames = burst(m, n_frames, [&](const std::shared_ptr<Medipix> &replica, unsigned int seed) {
+        homogeneous_exposure(replica, 30.f, exposure_time, flux_density, seed);
+    }, 42);
+    std::chrono::duration<double> parallel = std::chrono::steady_clock::now() - start;
+
+    std::cout << "# mode frames/s" << std::endl;
+    std::cout << "serial " << n_frames / serial.count() << std::endl;
+    std::cout << "burst " << n_frames / parallel.count() << std::endl;
+    std::cout << "counts in last frame " << frames.get_total_counts(n_frames - 1) << " / " << m->get_total_counts()
+              << std::endl;
+}
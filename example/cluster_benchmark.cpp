@@ -0,0 +1,49 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "cluster.h"
+
+/**
+ * Clusters the hits of a data-driven acquisition and prints the throughput in hits/s for several tile sizes, and the
+ * mean cluster energy and size (30 keV photons, charge sharing corrected).
+ */
+int main() {
+    auto m = std::make_shared<MedipixTimepix>(256, 256);
+    m->set_psf_sigma(12.0f);
+    m->set_th0(5.0f);
+    std::vector<Hit> hits;
+    timepix_acquisition(m, 30.f, 1E-3, 100E-6, 5E6, HomogeneousPattern{}, 42,
+                        [&hits](const Hit *h, size_t n) { hits.insert(hits.end(), h, h + n); });
+
+    std::cout << "# tile_rows hits/s clusters mean_energy mean_size" << std::endl;
+    for (unsigned int tile_rows: {4u, 16u, 64u, 256u}) {
+        auto start = std::chrono::steady_clock::now();
+        auto clusters = cluster_hits(*m, hits, 0.5, tile_rows);
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        double energy = 0.;
+        double size = 0.;
+        for (const auto &cluster: clusters) {
+            energy += cluster.energy;
+            size += cluster.size;
+        }
+        std::cout << tile_rows << " " << double(hits.size()) / duration.count() << " " << clusters.size() << " "
+                  << energy / double(clusters.size()) << " " << size / double(clusters.size()) << std::endl;
+    }
+}
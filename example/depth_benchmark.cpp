@@ -0,0 +1,57 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Runs an exposure and prints the number of incident photons per second
+ */
+static void benchmark(const std::string &name, const std::shared_ptr<Medipix> &m) {
+    double exposure_time = 1E-3;
+    double flux_density = 1E6;
+    auto start = std::chrono::steady_clock::now();
+    m->start_frame();
+    exposure(m, 30.f, exposure_time, flux_density, HomogeneousPattern{}, 42);
+    m->finish_frame();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cout << name << " " << double(get_number_of_photons(m, exposure_time, flux_density)) / duration.count()
+              << " " << m->get_total_counts() << std::endl;
+}
+
+/**
+ * Per-photon cost of the depth of interaction model (300 um silicon at 30 keV) against the fixed psf sigma.
+ */
+int main() {
+    auto m = std::make_shared<MedipixSPM>(false);
+    m->set_psf_sigma(13.0f);
+    m->set_th0(6.0f);
+
+    std::cout << "# model photons/s counts" << std::endl;
+    benchmark("fixed_sigma", m);
+    DepthOfInteraction model{};
+    model.mu_norm = 1.436f;
+    model.rho = 2.33f;
+    for (float bias: {50.f, 100.f, 200.f}) {
+        model.bias_voltage = bias;
+        m->set_depth_of_interaction(model);
+        benchmark("depth_of_interaction_" + std::to_string(int(bias)) + "V", m);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Runtime of the expected image of an edge exposure compared to the Monte Carlo simulation of one frame.
+ */
+int main() {
+    auto m = std::make_shared<MedipixSPM>(false);
+    m->set_psf_sigma(13.0f);
+    m->set_th0(8.0f);
+    m->random_threshold_dispersion(1.0f, 42);
+    EdgePattern pattern{-0.5f, 20.f};
+    double exposure_time = 1E-2;
+    double flux_density = 1E6;
+
+    auto start = std::chrono::steady_clock::now();
+    m->start_frame();
+    exposure(m, 30.f, exposure_time, flux_density, pattern, 42);
+    m->finish_frame();
+    std::chrono::duration<double> monte_carlo = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    auto expected = m->expected_image(30.f, exposure_time, flux_density, pattern);
+    auto counts = MedipixSPM::sample_image(expected, 42);
+    std::chrono::duration<double> analytic = std::chrono::steady_clock::now() - start;
+
+    std::cout << "# mode time[s] total_counts" << std::endl;
+    std::cout << "monte_carlo " << monte_carlo.count() << " " << m->get_total_counts() << std::endl;
+    std::cout << "expected_image " << analytic.count() << " "
+              << std::accumulate(counts.begin(), counts.end(), 0ull) << std::endl;
+}
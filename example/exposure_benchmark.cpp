@@ -0,0 +1,58 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Runs an exposure and prints the number of incident photons per second
+ */
+template<typename Pattern>
+static void benchmark(const std::string &name, const std::shared_ptr<Medipix> &m, const Pattern &pattern) {
+    double exposure_time = 1E-3;
+    double flux_density = 1E6;
+    auto start = std::chrono::steady_clock::now();
+    m->start_frame();
+    exposure(m, 30.f, exposure_time, flux_density, pattern, 42);
+    m->finish_frame();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cout << name << " " << double(get_number_of_photons(m, exposure_time, flux_density)) / duration.count()
+              << std::endl;
+}
+
+/**
+ * Photons/s of the exposure for the pattern functors and the std::function interface.
+ * A low threshold keeps the charge sharing cheap, so the pattern evaluation is a larger part of the runtime.
+ */
+int main() {
+    auto m = std::make_shared<MedipixSPM>(false);
+    m->set_psf_sigma(1.0f);
+    m->set_th0(6.0f);
+
+    float period = 550.f;
+    std::cout << "# pattern photons/s" << std::endl;
+    benchmark("homogeneous", m, HomogeneousPattern{});
+    benchmark("edge", m, EdgePattern{-0.5f, 20.f});
+    benchmark("frequency", m, FrequencyPattern{period, 0.f, 1.f, 0.f});
+    benchmark("edge_function", m, std::function<bool(float, float)>([](float x, float y) {
+        return edge(x, y, -0.5f, 20.f);
+    }));
+    benchmark("absorbed", m, [](float, float) { return 0.f; });
+}
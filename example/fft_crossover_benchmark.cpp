@@ -0,0 +1,59 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include "MedipixSPM.h"
+#include "RandomStream.h"
+
+/**
+ * Time of the pile-up evaluation of finish_frame() per pixel with pulse addition and with FFT convolution for
+ * increasing pulse overlap (events per pixel times response length over frame length). The crossover is where the
+ * FFT becomes faster, see Medipix::set_fft_crossover().
+ */
+int main() {
+    unsigned int nx = 4;
+    float frame_time = 1000.f;
+    std::cout << "# photons_per_pixel overlap pulses_s/pixel fft_s/pixel speedup identical" << std::endl;
+    for (unsigned int photons_per_pixel: {250, 500, 1000, 2000, 4000, 16000, 64000}) {
+        double time[2];
+        double overlap = 0.;
+        std::vector<unsigned int> images[2];
+        for (bool fft: {false, true}) {
+            MedipixSPM m(true, nx, nx);
+            m.set_th0(10.f);
+            m.set_fft_crossover(fft ? 0.f : std::numeric_limits<float>::infinity());
+            m.start_frame();
+            for (unsigned int k = 0; k < photons_per_pixel * nx * nx; ++k) {
+                RandomStream rng(8, k);
+                m.add_photon(30.f, rng.uniform(m.get_min_x(), m.get_max_x()), rng.uniform(m.get_min_y(), m.get_max_y()),
+                             3, rng.uniform(0.f, frame_time));
+            }
+            auto start = std::chrono::steady_clock::now();
+            m.finish_frame();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            time[fft] = elapsed.count() / double(nx * nx);
+            images[fft] = m.get_image();
+            // Response of 5 µs
+            overlap = double(m.get_number_of_events()) / double(nx * nx) * 5. / double(frame_time);
+        }
+        std::cout << double(photons_per_pixel) << " " << overlap << " " << time[0] << " " << time[1] << " "
+                  << time[0] / time[1] << " " << (images[0] == images[1] ? "yes" : "no") << std::endl;
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Estimated and measured peak memory and runtime of timed frames of a 256 x 256 detector, then the same frame under
+ * a memory budget of a quarter of its estimate (the events are spilled, the counts do not change).
+ */
+int main() {
+    double exposure_time = 1E-4;
+
+    std::cout << "# flux_density budget_MB spill counts estimated_MB peak_MB estimated_s runtime_s" << std::endl;
+    for (double flux_density: {1E6, 1E7, 5E7}) {
+        for (bool budget: {false, true}) {
+            auto m = std::make_shared<MedipixSPM>(true, 256, 256);
+            m->set_th0(10.f);
+            if (budget) {
+                auto full = m->estimate_frame(exposure_time, flux_density);
+                m->set_memory_budget(full.peak_bytes / 4, BudgetPolicy::Spill);
+            }
+            auto estimate = m->plan_frame(exposure_time, flux_density);
+            auto start = std::chrono::steady_clock::now();
+            m->start_frame();
+            homogeneous_exposure(m, 30.f, exposure_time, flux_density, 42);
+            m->finish_frame();
+            std::chrono::duration<double> runtime = std::chrono::steady_clock::now() - start;
+            auto stats = m->get_memory_stats();
+            std::cout << flux_density << " " << double(stats.budget) / 1048576. << " " << estimate.spill << " "
+                      << m->get_total_counts() << " " << double(estimate.peak_bytes) / 1048576. << " "
+                      << double(stats.peak_bytes) / 1048576. << " " << estimate.runtime << " " << runtime.count()
+                      << std::endl;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Frame rate scan from a single timed acquisition: the events of 1 ms are re-binned into frames of different
+ * lengths with a fixed dead time of 5 us between frames. Prints the live time fraction, the count rate during the
+ * live time and the runtime of the re-binning.
+ */
+int main() {
+    auto m = std::make_shared<MedipixSPM>(true, 32, 32);
+    m->set_th0(10.f);
+    float acquisition_time = 1000.f;
+    float dead_time = 5.f;
+
+    auto start = std::chrono::steady_clock::now();
+    m->start_frame();
+    homogeneous_exposure(m, 30.f, acquisition_time * 1E-6, 2E7, 42);
+    m->finish_frame();
+    std::chrono::duration<double> acquisition = std::chrono::steady_clock::now() - start;
+    std::cout << "# acquisition " << acquisition.count() << " s" << std::endl;
+
+    std::cout << "# frame_time_us live_fraction counts/us rebin_s" << std::endl;
+    for (float frame_time: {5.f, 10.f, 50.f, 100.f, 500.f}) {
+        auto n_frames = static_cast<unsigned int>(acquisition_time / (frame_time + dead_time));
+        start = std::chrono::steady_clock::now();
+        auto frames = m->rebin(frame_windows(n_frames, frame_time, dead_time));
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        unsigned long counts = 0;
+        for (unsigned int frame = 0; frame < n_frames; ++frame)
+            counts += frames.get_total_counts(frame);
+        float live_time = float(n_frames) * frame_time;
+        std::cout << frame_time << " " << live_time / (float(n_frames) * (frame_time + dead_time)) << " "
+                  << double(counts) / live_time << " " << duration.count() << std::endl;
+    }
+}
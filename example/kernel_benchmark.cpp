@@ -0,0 +1,81 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "MedipixCSM.h"
+#include "MedipixSPM.h"
+#include "RandomStream.h"
+
+/**
+ * Throughput of the photon deposition (add_photons() without finish_frame()) with the generic add_photon() path and
+ * with the specialized kernels, for both detector types, counting and timed mode and radius 1 to 4.
+ */
+int main() {
+    constexpr unsigned int batch_size = 256;
+    unsigned int n_batches = 2000;
+    unsigned int nx = 256;
+
+    // Same photons for all configurations
+    std::vector<float> energy(batch_size * n_batches), x(batch_size * n_batches), y(batch_size * n_batches);
+    std::vector<float> depth(batch_size * n_batches, -1.f);
+    std::vector<double> t(batch_size * n_batches);
+    std::vector<char> interacting(batch_size * n_batches, 1);
+    float half_width = 55.f * float(nx) / 2.f;
+    for (size_t k = 0; k < energy.size(); ++k) {
+        RandomStream rng(42, k);
+        energy[k] = 30.f;
+        x[k] = rng.uniform(-half_width, half_width);
+        y[k] = rng.uniform(-half_width, half_width);
+        t[k] = rng.uniform(0.f, 1000.f);
+    }
+
+    std::cout << "# detector timed radius generic_photons/s specialized_photons/s speedup" << std::endl;
+    for (bool csm: {false, true}) {
+        for (bool timed: {false, true}) {
+            for (int radius = 1; radius <= Medipix::max_kernel_radius; ++radius) {
+                double rate[2];
+                for (bool specialized: {false, true}) {
+                    std::shared_ptr<Medipix> m;
+                    if (csm)
+                        m = std::make_shared<MedipixCSM>(timed, nx, nx);
+                    else
+                        m = std::make_shared<MedipixSPM>(timed, nx, nx);
+                    m->set_th0(10.f);
+                    m->set_specialized_kernels(specialized);
+                    m->start_frame();
+                    auto start = std::chrono::steady_clock::now();
+                    #pragma omp parallel for default(none) shared(m, energy, x, y, depth, t, interacting, n_batches, radius)
+                    for (unsigned int b = 0; b < n_batches; ++b) {
+                        size_t first = size_t(b) * batch_size;
+                        m->add_photons(PhotonBatch{energy.data() + first, x.data() + first, y.data() + first,
+                                                   depth.data() + first, t.data() + first,
+                                                   reinterpret_cast<const bool *>(interacting.data()) + first,
+                                                   batch_size, radius});
+                    }
+                    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+                    rate[specialized] = double(batch_size) * n_batches / duration.count();
+                }
+                std::cout << (csm ? "csm" : "spm") << " " << timed << " " << radius << " " << rate[0] << " "
+                          << rate[1] << " " << rate[1] / rate[0] << std::endl;
+            }
+        }
+    }
+}
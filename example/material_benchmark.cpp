@@ -0,0 +1,63 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include "Material.h"
+
+/**
+ * Lookups per second of the attenuation tables: scalar, vectorized and the precomputed interaction probability of a
+ * sensor layer compared to computing it per photon from mu.
+ */
+int main() {
+    auto cdte = Material::cadmium_telluride();
+    SensorLayer sensor(cdte, 1000.f);
+    unsigned int n = 1 << 24;
+    std::vector<float> energies(n);
+    for (unsigned int k = 0; k < n; ++k) {
+        RandomStream rng(1, k);
+        energies[k] = rng.uniform(10.f, 120.f);
+    }
+    std::vector<float> result(n);
+
+    auto report = [n](const std::string &name, std::chrono::steady_clock::time_point start, float checksum) {
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        std::cout << name << " " << double(n) / duration.count() << " " << checksum << std::endl;
+    };
+
+    std::cout << "# lookup lookups/s checksum" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int k = 0; k < n; ++k)
+        result[k] = cdte.mass_attenuation(energies[k]);
+    report("scalar", start, result[n / 2]);
+
+    start = std::chrono::steady_clock::now();
+    cdte.mass_attenuation(energies.data(), result.data(), n);
+    report("vectorized", start, result[n / 2]);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned int k = 0; k < n; ++k)
+        result[k] = -std::expm1(-cdte.linear_attenuation(energies[k]) * 1000.f);
+    report("probability_from_mu", start, result[n / 2]);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned int k = 0; k < n; ++k)
+        result[k] = sensor.interaction_probability(energies[k]);
+    report("probability_table", start, result[n / 2]);
+}
@@ -0,0 +1,54 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <omp.h>
+#include "helper.h"
+#include "MedipixSPM.h"
+#include "placement.h"
+
+/**
+ * Timed frame with the buffers first touched by the constructing thread (remote for the threads of the other nodes)
+ * and with the NUMA placement (pinned threads, buffers on the nodes of their owners). Prints the exposure and the
+ * finish_frame() time and the pile-up throughput in pixels per second. Run it on a multi-socket machine with
+ * OMP_NUM_THREADS covering all nodes.
+ */
+int main() {
+    double exposure_time = 1E-3;
+    double flux_density = 2E6;
+    unsigned int nx = 256;
+
+    std::cout << "# " << get_numa_nodes() << " NUMA nodes, " << omp_get_max_threads() << " threads" << std::endl;
+    std::cout << "# placement exposure_s finish_frame_s pixels/s counts" << std::endl;
+    for (bool placement: {false, true}) {
+        auto m = std::make_shared<MedipixSPM>(true, nx, nx);
+        m->set_th0(10.f);
+        m->set_numa_placement(placement);
+        auto start = std::chrono::steady_clock::now();
+        m->start_frame();
+        homogeneous_exposure(m, 30.f, exposure_time, flux_density, 42);
+        auto finish = std::chrono::steady_clock::now();
+        m->finish_frame();
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double> exposure = finish - start;
+        std::chrono::duration<double> finish_frame = end - finish;
+        std::cout << (placement ? "owner" : "first_touch") << " " << exposure.count() << " " << finish_frame.count()
+                  << " " << double(nx * nx) / finish_frame.count() << " " << m->get_total_counts() << std::endl;
+    }
+}
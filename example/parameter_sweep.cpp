@@ -0,0 +1,41 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include "sweep.h"
+#include "MedipixSPM.h"
+
+/**
+ * Threshold and flux sweep that runs all points in parallel with a shared detector calibration.
+ */
+int main() {
+    auto m = std::make_shared<MedipixSPM>(true, 16, 16);
+    m->random_threshold_dispersion(1.0f);
+    m->set_psf_sigma(13.0f);
+
+    SweepGrid grid;
+    for (float th = 6.0f; th < 30.f; th += 2.f)
+        grid.th0.push_back(th);
+    for (double flux_density = 1E5; flux_density < 1E8; flux_density *= 4)
+        grid.flux_density.push_back(flux_density);
+    grid.energy = {30.f};
+
+    std::ofstream data_file("parameter_sweep.txt");
+    sweep(m, grid, 1E-3, data_file, 42);
+    data_file.close();
+}
@@ -0,0 +1,58 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include "MedipixSPM.h"
+#include "pileup.h"
+#include "RandomStream.h"
+
+/**
+ * Throughput of the pile-up evaluation of finish_frame() in pixels per second, one pixel at a time and in SIMD lanes,
+ * for increasing flux (events per pixel).
+ */
+int main() {
+    unsigned int nx = 128;
+    float frame_time = 1000.f;
+    std::cout << "# instruction set: " << pileup_isa() << ", " << pileup_lanes << " lanes" << std::endl;
+    std::cout << "# photons_per_pixel scalar_pixels/s simd_pixels/s speedup identical" << std::endl;
+    for (float photons_per_pixel: {1.f, 4.f, 16.f}) {
+        double rate[2];
+        std::vector<unsigned int> images[2];
+        for (bool simd: {false, true}) {
+            MedipixSPM m(true, nx, nx);
+            m.set_th0(10.f);
+            m.set_simd_pileup(simd);
+            m.start_frame();
+            auto n_photons = static_cast<unsigned int>(photons_per_pixel * float(nx * nx));
+            for (unsigned int k = 0; k < n_photons; ++k) {
+                RandomStream rng(5, k);
+                m.add_photon(30.f, rng.uniform(m.get_min_x(), m.get_max_x()), rng.uniform(m.get_min_y(), m.get_max_y()),
+                             3, rng.uniform(0.f, frame_time));
+            }
+            auto start = std::chrono::steady_clock::now();
+            m.finish_frame();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            rate[simd] = double(nx * nx) / elapsed.count();
+            images[simd] = m.get_image();
+        }
+        std::cout << photons_per_pixel << " " << rate[0] << " " << rate[1] << " " << rate[1] / rate[0] << " "
+                  << (images[0] == images[1] ? "yes" : "no") << std::endl;
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include "helper.h"
+#include "MedipixRecorder.h"
+#include "MedipixSPM.h"
+
+/**
+ * Threshold scan with 16 thresholds: a new exposure per threshold vs one recorded exposure that is replayed.
+ * Prints the runtime of both and the number of recorded bytes per photon.
+ */
+int main() {
+    unsigned int n_thresholds = 16;
+    double exposure_time = 1E-3;
+    double flux_density = 1E7;
+    std::string filename = "replay_deposits.bin";
+
+    std::vector<std::shared_ptr<Medipix>> detectors;
+    for (unsigned int k = 0; k < n_thresholds; ++k) {
+        auto m = std::make_shared<MedipixSPM>(false, 128, 128);
+        m->set_psf_sigma(12.f);
+        m->set_th0(4.f + 1.5f * float(k));
+        detectors.push_back(m);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &m: detectors) {
+        m->start_frame();
+        exposure(m, 30.f, exposure_time, flux_density, HomogeneousPattern{}, 42);
+        m->finish_frame();
+    }
+    std::chrono::duration<double> direct = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    auto recorder = std::make_shared<MedipixRecorder>(filename, 128, 128);
+    recorder->set_psf_sigma(12.f);
+    recorder->start_frame();
+    exposure(recorder, 30.f, exposure_time, flux_density, HomogeneousPattern{}, 42);
+    recorder->finish_frame();
+    std::chrono::duration<double> recording = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    DepositRecord record(filename);
+    replay(detectors, record);
+    std::chrono::duration<double> replaying = std::chrono::steady_clock::now() - start;
+    std::remove(filename.c_str());
+
+    std::cout << "# direct_s record_s replay_s bytes/photon" << std::endl;
+    std::cout << direct.count() << " " << recording.count() << " " << replaying.count() << " "
+              << double(record.get_number_of_deposits() * sizeof(Deposit)) / double(record.get_number_of_photons())
+              << std::endl;
+}
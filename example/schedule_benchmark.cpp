@@ -0,0 +1,65 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <omp.h>
+#include "MedipixSPM.h"
+#include "RandomStream.h"
+
+/**
+ * Thread utilization and time of the pile-up evaluation of finish_frame() with fixed chunks of pixels and with
+ * cost-balanced tasks, for an edge (transmission 2 % on one half, pixels in index order) and a hot spot (100 times
+ * the flux on 1 % of the area).
+ */
+int main() {
+    unsigned int nx = 128;
+    float frame_time = 1000.f;
+    unsigned int n_photons = 2 * nx * nx;
+    std::cout << "# " << omp_get_max_threads() << " threads" << std::endl;
+    std::cout << "# exposure scheduling tasks finish_frame_s utilization" << std::endl;
+    for (std::string exposure: {"edge", "hot_spot"}) {
+        for (bool balanced: {false, true}) {
+            MedipixSPM m(true, nx, nx);
+            m.set_th0(10.f);
+            m.set_cost_scheduling(balanced);
+            m.start_frame();
+            float spot = 0.05f * (m.get_max_x() - m.get_min_x());
+            for (unsigned int k = 0; k < n_photons; ++k) {
+                RandomStream rng(9, k);
+                float x = rng.uniform(m.get_min_x(), m.get_max_x());
+                float y = rng.uniform(m.get_min_y(), m.get_max_y());
+                if (exposure == "edge") {
+                    if (x > 0.f && rng.uniform() > 0.02f)
+                        continue;
+                } else if (k % 2 == 0) {
+                    x = rng.uniform(-spot, spot);
+                    y = rng.uniform(-spot, spot);
+                }
+                m.add_photon(30.f, x, y, 3, rng.uniform(0.f, frame_time));
+            }
+            auto start = std::chrono::steady_clock::now();
+            m.finish_frame();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            auto utilization = m.get_pileup_utilization();
+            std::cout << exposure << " " << (balanced ? "balanced" : "chunked") << " " << utilization.tasks << " "
+                      << elapsed.count() << " " << utilization.get_utilization() << std::endl;
+        }
+    }
+}
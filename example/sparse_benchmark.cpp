@@ -0,0 +1,51 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Timed frames of a 2048 x 2048 detector at low flux with uncompressed and compact events. Prints the runtime of the frame
+ * and of finish_frame(), which scale with the number of hit pixels and not with the sensor area, and the bytes per
+ * stored event.
+ */
+int main() {
+    double exposure_time = 1E-4;
+
+    std::cout << "# compact flux_density photons counts frame_s finish_frame_s bytes/event" << std::endl;
+    for (bool compact: {false, true}) {
+        auto m = std::make_shared<MedipixSPM>(true, 2048, 2048);
+        m->set_th0(10.f);
+        m->set_compact_events(compact);
+        for (double flux_density: {1E3, 1E4, 1E5}) {
+            auto start = std::chrono::steady_clock::now();
+            m->start_frame();
+            homogeneous_exposure(m, 30.f, exposure_time, flux_density, 42);
+            auto finish = std::chrono::steady_clock::now();
+            m->finish_frame();
+            auto end = std::chrono::steady_clock::now();
+            std::chrono::duration<double> frame = end - start;
+            std::chrono::duration<double> finish_frame = end - finish;
+            std::cout << compact << " " << flux_density << " " << m->get_real_photons() << " "
+                      << m->get_total_counts() << " " << frame.count() << " " << finish_frame.count() << " "
+                      << double(m->get_event_memory_usage()) / double(m->get_number_of_events()) << std::endl;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "helper.h"
+#include "MedipixSPM.h"
+#include "Spectrum.h"
+
+/**
+ * Runs an exposure and prints the number of incident photons per second
+ */
+template<typename Source>
+static void benchmark(const std::string &name, const std::shared_ptr<Medipix> &m, const Source &source) {
+    double exposure_time = 1E-3;
+    double flux_density = 1E6;
+    auto start = std::chrono::steady_clock::now();
+    m->start_frame();
+    exposure(m, source, exposure_time, flux_density, HomogeneousPattern{}, 42);
+    m->finish_frame();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cout << name << " " << double(get_number_of_photons(m, exposure_time, flux_density)) / duration.count()
+              << std::endl;
+}
+
+/**
+ * Overhead of a tabulated spectrum (1 keV bins of a simple Kramers' law tube spectrum) against monochromatic photons
+ * with the same mean energy.
+ */
+int main() {
+    float tube_voltage = 60.f;
+    std::vector<float> energies;
+    std::vector<float> weights;
+    for (float e = 10.f; e < tube_voltage; e += 1.f) {
+        energies.push_back(e);
+        weights.push_back((tube_voltage - e) / e);
+    }
+    Spectrum spectrum(energies, weights);
+
+    auto m = std::make_shared<MedipixSPM>(false);
+    m->set_psf_sigma(13.0f);
+    m->set_th0(6.0f);
+
+    std::cout << "# source photons/s" << std::endl;
+    benchmark("monochromatic", m, spectrum.get_mean_energy());
+    benchmark("spectrum", m, spectrum);
+    // Pattern that absorbs everything: only photon generation and energy sampling
+    std::cout << "# generation only" << std::endl;
+    auto absorbed = [](float, float) { return 0.f; };
+    for (auto name: {"monochromatic", "spectrum"}) {
+        auto start = std::chrono::steady_clock::now();
+        m->start_frame();
+        if (std::string(name) == "spectrum")
+            exposure(m, spectrum, 1E-2, 1E7, absorbed, 42);
+        else
+            exposure(m, spectrum.get_mean_energy(), 1E-2, 1E7, absorbed, 42);
+        m->finish_frame();
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        std::cout << name << " " << double(get_number_of_photons(m, 1E-2, 1E7)) / duration.count() << std::endl;
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <sys/resource.h>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Timed frame of a 2048 x 2048 detector with the events spilled to scratch files above a memory budget and with all
+ * events in memory. Prints the counts (identical for all budgets), the spilled bytes, the runtime and the peak
+ * resident memory. The spilled frames run first, since the peak resident memory of the process never decreases.
+ */
+int main() {
+    double exposure_time = 1E-4;
+    double flux_density = 2E5;
+
+    std::cout << "# budget_MB counts spilled_MB frame_s finish_frame_s peak_rss_MB" << std::endl;
+    for (size_t budget_mb: {16, 64, 0}) {
+        auto m = std::make_shared<MedipixSPM>(true, 2048, 2048);
+        m->set_th0(10.f);
+        m->set_event_spill(budget_mb << 20, "/tmp", 128);
+        auto start = std::chrono::steady_clock::now();
+        m->start_frame();
+        homogeneous_exposure(m, 30.f, exposure_time, flux_density, 42);
+        auto finish = std::chrono::steady_clock::now();
+        m->finish_frame();
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double> frame = end - start;
+        std::chrono::duration<double> finish_frame = end - finish;
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        std::cout << budget_mb << " " << m->get_total_counts() << " " << double(m->get_spilled_bytes()) / 1048576.
+                  << " " << frame.count() << " " << finish_frame.count() << " " << double(usage.ru_maxrss) / 1024.
+                  << std::endl;
+    }
+}
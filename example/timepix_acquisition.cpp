@@ -0,0 +1,48 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "MedipixTimepix.h"
+
+/**
+ * Data-driven acquisition streamed to timepix_hits.bin. Prints the hit rate of the simulation and the number of
+ * hits that had to be held back at most, for several window lengths. The memory of the acquisition is set by the
+ * window length and not by the acquisition time.
+ */
+int main() {
+    auto m = std::make_shared<MedipixTimepix>(64, 64);
+    m->set_th0(10.0f);
+    double acquisition_time = 5E-3;
+    double flux_density = 1E7;
+
+    std::cout << "# window_us hits hits/s max_pending" << std::endl;
+    for (double window_time: {10E-6, 50E-6, 250E-6}) {
+        HitFileWriter writer("timepix_hits.bin");
+        size_t max_pending = 0;
+        auto sink = [&writer, &max_pending, &m](const Hit *hits, size_t n) {
+            max_pending = std::max(max_pending, m->get_pending_hits());
+            writer(hits, n);
+        };
+        auto start = std::chrono::steady_clock::now();
+        timepix_acquisition(m, 20.f, acquisition_time, window_time, flux_density, HomogeneousPattern{}, 42, sink);
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        std::cout << window_time * 1E6 << " " << m->get_number_of_hits() << " "
+                  << double(m->get_number_of_hits()) / duration.count() << " " << max_pending << std::endl;
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+#include "helper.h"
+#include "MedipixSPM.h"
+#include "TransmissionMap.h"
+
+/**
+ * Compares the rejection based edge exposure with the transmission map exposure for decreasing open fractions
+ * of the sensor.
+ */
+int main() {
+    auto m = std::make_shared<MedipixSPM>(false);
+    m->set_psf_sigma(13.0f);
+    m->set_th0(6.0f);
+
+    unsigned int n = 256;
+    std::cout << "# open_fraction rejection[s] transmission_map[s]" << std::endl;
+    for (float open_fraction: {1.f, 0.5f, 0.1f, 0.01f}) {
+        // Edge parallel to the y-axis: everything left of x = c is absorbed
+        float c = m->get_min_x() + (1.f - open_fraction) * (m->get_max_x() - m->get_min_x());
+        std::vector<float> values(n * n, 0.f);
+        for (unsigned int i = 0; i < n; ++i)
+            for (unsigned int j = 0; j < n; ++j)
+                if (m->get_min_x() + (float(i) + 0.5f) * (m->get_max_x() - m->get_min_x()) / float(n) > c)
+                    values[i * n + j] = 1.f;
+        TransmissionMap map(values, n, n, m);
+
+        auto start = std::chrono::steady_clock::now();
+        m->start_frame();
+        exposure(m, 30.f, 1E-3, 1E6, [c](float x, float) { return x > c; }, 42);
+        m->finish_frame();
+        std::chrono::duration<double> rejection = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        m->start_frame();
+        transmission_exposure(m, 30.f, 1E-3, 1E6, map, 42);
+        m->finish_frame();
+        std::chrono::duration<double> transmission = std::chrono::steady_clock::now() - start;
+
+        std::cout << open_fraction << " " << rejection.count() << " " << transmission.count() << std::endl;
+    }
+}
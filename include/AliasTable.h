@@ -0,0 +1,71 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_ALIAS_TABLE_H
+#define MEDIPIX_ALIAS_TABLE_H
+
+#include <cstdint>
+#include <vector>
+#include "RandomStream.h"
+
+/**
+ * Walker/Vose alias table for sampling an index with probability proportional to its weight in constant time.
+ * Built once in O(n).
+ */
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    /**
+     * @param weights Non-negative weights, at least one must be positive
+     */
+    explicit AliasTable(const std::vector<float> &weights);
+
+    /**
+     * Draws an index
+     * @param rng Random stream, a single 64 bit draw is used
+     */
+    [[nodiscard]] inline uint32_t sample(RandomStream &rng) const {
+        uint64_t r = rng();
+        auto index = static_cast<uint32_t>(((r >> 32) * probability.size()) >> 32);
+        float u = float(r & 0xFFFFFFull) * 0x1.0p-24f;
+        return u < probability[index] ? index : alias[index];
+    }
+
+    [[nodiscard]] size_t size() const;
+
+    /**
+     * Sum of all weights
+     */
+    [[nodiscard]] double get_total_weight() const;
+
+private:
+    /**
+     * Probability to keep the index of a bucket
+     */
+    std::vector<float> probability;
+
+    /**
+     * Alternative index of a bucket
+     */
+    std::vector<uint32_t> alias;
+
+    double total_weight = 0.;
+};
+
+#endif //MEDIPIX_ALIAS_TABLE_H
@@ -0,0 +1,131 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_ARENA_H
+#define MEDIPIX_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+/**
+ * Memory resource for the transient buffers of a frame (neighbour lists, waveforms, FFT buffers). Allocations are
+ * taken from large blocks by moving an offset. Deallocation does nothing; reset() and Scope rewind the offset and
+ * keep the blocks, so once the blocks are large enough no heap allocation happens anymore.
+ *
+ * Not thread safe, every thread uses its own arena (see ThreadArenas).
+ */
+class Arena : public std::pmr::memory_resource {
+public:
+    /**
+     * @param block_size Minimal size of the blocks in bytes
+     */
+    explicit Arena(size_t block_size = 1 << 16);
+
+    /**
+     * Copies get their own, empty arena
+     */
+    Arena(const Arena &other);
+
+    Arena &operator=(const Arena &other);
+
+    /**
+     * Rewinds to the start of the first block, all memory of the arena can be reused
+     */
+    void reset();
+
+    /**
+     * Bytes of the blocks
+     */
+    [[nodiscard]] size_t get_capacity() const;
+
+    /**
+     * Rewinds the arena to its position at the construction of the scope when the scope ends. Allocations of a scope
+     * must not be used after its end.
+     */
+    class Scope {
+    public:
+        explicit Scope(Arena &arena);
+
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Arena &arena;
+        size_t block;
+        size_t offset;
+    };
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    size_t block_size;
+    std::vector<Block> blocks;
+
+    /**
+     * Next allocation is at offset in blocks[current]
+     */
+    size_t current = 0;
+    size_t offset = 0;
+};
+
+/**
+ * One arena per OpenMP thread of the outermost parallel region. Copies get their own arenas.
+ */
+class ThreadArenas {
+public:
+    ThreadArenas();
+
+    ThreadArenas(const ThreadArenas &other);
+
+    ThreadArenas &operator=(const ThreadArenas &other);
+
+    /**
+     * Arena of the calling thread. Threads of nested parallel regions use an arena of their own (thread_local), which
+     * is not reset by reset().
+     */
+    Arena &local();
+
+    /**
+     * Rewinds all arenas. Not to be called while other threads use them.
+     */
+    void reset();
+
+    /**
+     * Bytes of the blocks of all arenas
+     */
+    [[nodiscard]] size_t get_capacity() const;
+
+private:
+    std::vector<Arena> arenas;
+};
+
+#endif //MEDIPIX_ARENA_H
@@ -0,0 +1,155 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_ASSEMBLY_H
+#define MEDIPIX_ASSEMBLY_H
+
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Medipix;
+
+/**
+ * Tiled detector made of chips_x * chips_y identical chips (e.g. a quad with 2x2 chips).
+ *
+ * The chips are separated by a gap. As on a real tiled sensor, the pixels at the inner chip borders are wider and
+ * cover half of the gap each (see Medipix::set_edge_extension()), so the whole area of the assembly is sensitive.
+ * The coordinate system is centred on the assembly. Photons are routed to every chip whose area plus a halo of
+ * `radius` pixels contains the interaction, so charge sharing across chip borders is handled by the neighbouring
+ * chips. Charge summing (CSM) does not work across chips, as on the real hardware.
+ *
+ * Pixel (i, j) of the assembly is pixel (i % nx, j % ny) of chip (i / nx, j / ny).
+ */
+class Assembly {
+public:
+    /**
+     * @param chip Chip that defines the configuration, every tile gets its own replica
+     * @param chips_x Number of chips in x direction
+     * @param chips_y Number of chips in y direction
+     * @param gap Gap between the chips in µm
+     */
+    Assembly(const std::shared_ptr<Medipix> &chip, unsigned int chips_x, unsigned int chips_y, float gap);
+
+    /**
+     * Starts a frame on all chips
+     */
+    void start_frame();
+
+    /**
+     * Finishes the frame on all chips (in parallel, one chip per thread, see SerialNestedRegions)
+     */
+    void finish_frame();
+
+    /**
+     * Adds a single photon. Not thread-safe, use exposure() for parallel simulations.
+     * @param energy in keV
+     * @param position_x in µm (assembly coordinates)
+     * @param position_y in µm (assembly coordinates)
+     * @param radius area in *pixel* in which the charge distribution is calculated
+     * @param time interaction time in µs
+     */
+    void add_photon(float energy, float position_x, float position_y, int radius, double time);
+
+    /**
+     * @brief Simulates an exposure of the whole assembly.
+     *
+     * Photons are generated in parallel and sorted into per-chip lists (including the halo), then the chips are
+     * simulated in parallel, each chip by a single thread. No lock is shared between the chips.
+     *
+     * @param energy in keV
+     * @param exposure_time in s
+     * @param flux_density in photons / (s mm^2)
+     * @param photon_interacting see exposure()
+     * @param seed Seed of the random number generator
+     */
+    void exposure(float energy, double exposure_time, double flux_density,
+                  const std::function<bool(float, float)> &photon_interacting, unsigned int seed = time(nullptr));
+
+    /**
+     * Getter for the chip (cx, cy)
+     */
+    [[nodiscard]] std::shared_ptr<Medipix> get_chip(unsigned int cx, unsigned int cy) const;
+
+    /**
+     * Center of the chip (cx, cy) in assembly coordinates in µm
+     */
+    [[nodiscard]] std::pair<float, float> get_chip_center(unsigned int cx, unsigned int cy) const;
+
+    [[nodiscard]] unsigned int get_pixel_value(unsigned int i, unsigned int j) const;
+
+    [[nodiscard]] unsigned int get_total_counts() const;
+
+    /**
+     * Number of photons that interacted with the assembly
+     */
+    [[nodiscard]] unsigned long long get_real_photons() const;
+
+    [[nodiscard]] unsigned int get_num_pixels_x() const;
+
+    [[nodiscard]] unsigned int get_num_pixels_y() const;
+
+    [[nodiscard]] float get_min_x() const;
+
+    [[nodiscard]] float get_max_x() const;
+
+    [[nodiscard]] float get_min_y() const;
+
+    [[nodiscard]] float get_max_y() const;
+
+    /**
+     * Saves the image of the assembly to a raw file (uint32, index i * n_pixel_y + j)
+     * @param filename
+     */
+    void save_image(const std::string &filename) const;
+
+private:
+    /**
+     * Routes a photon to the chips whose area plus halo contains it
+     * @param callback called with the chip index and the position in chip coordinates
+     */
+    template<typename Callback>
+    void route(float position_x, float position_y, int radius, Callback &&callback) const;
+
+    unsigned int chips_x;
+    unsigned int chips_y;
+
+    /**
+     * Gap between chips in µm
+     */
+    float gap;
+
+    /**
+     * Pixels per chip
+     */
+    unsigned int chip_pixels_x;
+    unsigned int chip_pixels_y;
+
+    float pixel_pitch;
+
+    /**
+     * Chips, index cx * chips_y + cy
+     */
+    std::vector<std::shared_ptr<Medipix>> chips;
+
+    unsigned long long real_photons = 0;
+};
+
+#endif //MEDIPIX_ASSEMBLY_H
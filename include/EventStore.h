@@ -0,0 +1,498 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_EVENT_STORE_H
+#define MEDIPIX_EVENT_STORE_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "placement.h"
+
+/**
+ * Event struct that stores the time and deposited energy per pixel.
+ */
+struct Event {
+    /**
+     * Resolution of the time in µs (about 1 ns, a tenth of a sample of the signal)
+     */
+    static constexpr double time_step = 1. / 1024.;
+
+    Event() = default;
+
+    /**
+     * @param time Time in µs, rounded down to a multiple of time_step. Throws std::out_of_range outside of
+     * ±2^63 time steps.
+     * @param energy Energy in keV
+     */
+    Event(double time, float energy) : energy(energy) {
+        double steps = std::floor(time / time_step);
+        if (!(std::abs(steps) < 0x1p63))
+            throw std::out_of_range("Event time outside of the range of the event encoding.");
+        time_steps = static_cast<int64_t>(steps);
+    }
+
+    /**
+     * Time in µs
+     */
+    [[nodiscard]] double get_time() const {
+        return double(time_steps) * time_step;
+    }
+
+    /**
+     * Time in steps of time_step. Unlike a float, a fixed point time resolves the samples of the signal in long
+     * frames, 64 bits cover any exposure time.
+     */
+    int64_t time_steps;
+
+    /**
+     * Energy in keV.
+     */
+    float energy;
+};
+
+/**
+ * Sparse storage of the pixel-wise events of a timed frame. Memory scales with the number of events, not with the
+ * number of pixels.
+ *
+ * Events are appended without locking to per-thread buffers (one per OpenMP thread). finalize() sorts them by pixel
+ * and time into a compressed layout (the events and an index of the active pixels), after that the events of the
+ * active pixels can be read. The order after finalize() does not depend on the threads that added the events.
+ *
+ * The index holds per active pixel the distance to the previous active pixel and its number of events as varints
+ * (7 bits per byte), with a checkpoint (pixel, first event, position in the index) every index_stride active pixels.
+ * An active pixel is located by decoding at most index_stride - 1 others. With about one event per active pixel (low
+ * flux) the index takes about 3 bytes per active pixel instead of 8 for a pixel index and an offset.
+ *
+ * In the compact encoding an event is stored as time in signed 32 bit ticks of the signal sampling and energy in
+ * 16 bit (steps of energy_step keV, up to 256 keV): 6 bytes per event instead of 16. Events are decoded to the center
+ * of their tick, so they start at the same signal sample as the uncompressed events (up to 2^31 ticks). The thread
+ * buffers of the compact encoding are bucketed by the upper 16 bits of the pixel index, a buffered event takes
+ * 8 bytes. Events whose energy quantizes to zero do not contribute to the signal and are not stored.
+ *
+ * At most 2^32 - 1 events can be stored. The compact encoding limits the times to get_max_time().
+ *
+ * With a memory budget (see set_spill()) the buffered events are spilled to scratch files partitioned by pixel tiles,
+ * the events are then read one tile at a time.
+ */
+class EventStore {
+public:
+    EventStore();
+
+    /**
+     * Energy step of the compact encoding in keV
+     */
+    static constexpr float energy_step = 1.f / 256.f;
+
+    /**
+     * Selects the encoding. Removes all events.
+     * @param compact If true, events are stored as ticks and quantized energies
+     * @param samples_per_us Sampling of the signal (length of a tick)
+     */
+    void set_compact(bool compact, unsigned int samples_per_us);
+
+    [[nodiscard]] bool get_compact() const;
+
+    /**
+     * Largest time in µs that the selected encoding can store: 2^31 ticks in the compact encoding (about 21 s at
+     * 100 samples per µs)
+     */
+    [[nodiscard]] double get_max_time() const;
+
+    /**
+     * Enables the spill of events to scratch files. When the buffered events of a thread exceed its share of the
+     * memory budget, they are appended to the scratch file of their tile (pixels_per_tile consecutive pixels).
+     * If anything was spilled, finalize() spills the remaining events as well and the tiles have to be loaded one at
+     * a time with load_tile(), so the memory needed beyond the budget is the one of a single tile.
+     *
+     * The scratch files are created in directory and unlinked right away. A copy of the store gets its own files.
+     * Removes all events.
+     *
+     * @param memory_budget Bytes of the thread buffers, 0 disables the spill
+     * @param directory Directory of the scratch files
+     * @param pixels_per_tile Number of pixels per tile
+     * @param n_pixels Number of pixels
+     */
+    void set_spill(size_t memory_budget, const std::string &directory, uint32_t pixels_per_tile, uint32_t n_pixels);
+
+    /**
+     * Removes all events. The buffers keep their capacity.
+     */
+    void clear();
+
+    /**
+     * Adds an event. Can be called from the threads of an OpenMP parallel region, a nested parallel region falls back
+     * to a locked buffer.
+     * @param pixel Pixel index (in the region of interest)
+     * @param event
+     */
+    void add(uint32_t pixel, const Event &event);
+
+    /**
+     * Sorts the added events into the compressed layout. Events added afterwards need another finalize().
+     */
+    void finalize();
+
+    /**
+     * Number of tiles after finalize(), 1 if nothing was spilled
+     */
+    [[nodiscard]] size_t get_number_of_tiles() const;
+
+    /**
+     * Tile of a pixel after finalize()
+     */
+    [[nodiscard]] size_t get_tile(uint32_t pixel) const;
+
+    /**
+     * Loads the events of a tile into the compressed layout. Without spill the layout holds all events and this does
+     * nothing.
+     */
+    void load_tile(size_t tile);
+
+    /**
+     * Bytes written to the scratch files since the last clear()
+     */
+    [[nodiscard]] size_t get_spilled_bytes() const;
+
+    /**
+     * Number of pixels with events (of the loaded tile), after finalize()
+     */
+    [[nodiscard]] size_t get_number_of_active_pixels() const;
+
+    /**
+     * Pixel index of the k-th active pixel (sorted by pixel index)
+     */
+    [[nodiscard]] uint32_t get_active_pixel(size_t k) const;
+
+    /**
+     * Index of the first active pixel whose pixel index is not smaller than pixel (get_number_of_active_pixels() if
+     * there is none)
+     */
+    [[nodiscard]] size_t find_first_active(uint32_t pixel) const;
+
+    /**
+     * Events of the k-th active pixel, sorted by time
+     * @param buffer Receives the decoded events in the compact encoding
+     */
+    [[nodiscard]] std::span<const Event> get_events(size_t k, std::vector<Event> &buffer) const;
+
+    /**
+     * Events of a pixel, empty if the pixel has no events
+     * @param buffer Receives the decoded events in the compact encoding
+     */
+    [[nodiscard]] std::span<const Event> find(uint32_t pixel, std::vector<Event> &buffer) const;
+
+    /**
+     * Number of events (of the loaded tile), after finalize()
+     */
+    [[nodiscard]] size_t size() const;
+
+    /**
+     * Bytes of the compressed layout (events and index) of the loaded tile, after finalize()
+     */
+    [[nodiscard]] size_t get_memory_usage() const;
+
+    /**
+     * Bytes currently allocated by the thread buffers and the compressed layout. Not to be called while events are
+     * added.
+     */
+    [[nodiscard]] size_t get_allocated_bytes() const;
+
+    /**
+     * Largest allocation of the store (including the temporary sort buffer) since the last clear(), updated by
+     * finalize() and load_tile()
+     */
+    [[nodiscard]] size_t get_peak_bytes() const;
+
+    /**
+     * Bytes per event in the thread buffers (before finalize())
+     */
+    [[nodiscard]] size_t get_buffered_event_bytes() const;
+
+    /**
+     * Bytes per event in the compressed layout
+     */
+    [[nodiscard]] size_t get_stored_event_bytes() const;
+
+    /**
+     * Places the compressed layout on the NUMA nodes of its owners: each OpenMP thread writes the events of the pixels
+     * it owns (for_owned_blocks() with get_owner_tile_pixels()), each page is first touched by the thread that owns
+     * its events.
+     * @param n_pixels Number of pixels
+     */
+    void set_owner_placement(bool enabled, uint32_t n_pixels);
+
+    [[nodiscard]] bool get_owner_placement() const;
+
+    /**
+     * Pixels per tile of the owner blocks: the tiles of the spill, all pixels without spill
+     */
+    [[nodiscard]] size_t get_owner_tile_pixels() const;
+
+private:
+    /**
+     * Event of the compact encoding with its pixel, used for sorting and in the scratch files
+     */
+    struct CompactPixelEvent {
+        uint32_t pixel;
+        int32_t tick;
+        uint16_t energy;
+
+        /**
+         * Record of the scratch files: pixel, tick and energy in native byte order without the 2 bytes of padding
+         * of the struct
+         */
+        static constexpr size_t record_bytes = sizeof(pixel) + sizeof(tick) + sizeof(energy);
+
+        void write_record(unsigned char *record) const;
+
+        static CompactPixelEvent read_record(const unsigned char *record);
+    };
+
+    /**
+     * Event of the compact encoding in a thread buffer. The buffers are split into buckets of 2^bucket_bits pixels,
+     * an event only keeps the lower bits of its pixel index: 8 instead of 12 bytes.
+     */
+    struct BufferedEvent {
+        int32_t tick;
+        uint16_t pixel;
+        uint16_t energy;
+    };
+
+    static constexpr unsigned int bucket_bits = 16;
+
+    /**
+     * Thread buffer of the compact encoding, one bucket per 2^bucket_bits pixels
+     */
+    class BucketBuffer {
+    public:
+        void push_back(const CompactPixelEvent &entry);
+
+        /**
+         * Appends the decoded events to entries, bucket by bucket, and clears the buffer. The buckets keep their
+         * capacity.
+         */
+        void append_to(std::vector<CompactPixelEvent> &entries);
+
+        void clear();
+
+        [[nodiscard]] size_t size() const;
+
+        [[nodiscard]] size_t get_allocated_bytes() const;
+
+    private:
+        std::vector<std::vector<BufferedEvent>> buckets;
+        size_t n_events = 0;
+    };
+
+    struct PixelEvent {
+        uint32_t pixel;
+        Event event;
+
+        /**
+         * Record of the scratch files: pixel, time and energy in native byte order
+         */
+        static constexpr size_t record_bytes = sizeof(pixel) + sizeof(event.time_steps) + sizeof(event.energy);
+
+        void write_record(unsigned char *record) const;
+
+        static PixelEvent read_record(const unsigned char *record);
+    };
+
+    /**
+     * Copying a store gives the copy its own, unlocked mutex
+     */
+    class BufferMutex : public std::mutex {
+    public:
+        BufferMutex() = default;
+
+        BufferMutex(const BufferMutex &) : std::mutex() {}
+
+        BufferMutex &operator=(const BufferMutex &) { return *this; }
+    };
+
+    /**
+     * Unlinked scratch files, one per tile. Appending is thread safe. Copying creates new, empty files.
+     */
+    class SpillFiles {
+    public:
+        SpillFiles() = default;
+
+        SpillFiles(std::string directory, size_t n_tiles);
+
+        SpillFiles(const SpillFiles &other);
+
+        SpillFiles &operator=(const SpillFiles &other);
+
+        SpillFiles(SpillFiles &&other) noexcept;
+
+        SpillFiles &operator=(SpillFiles &&other) noexcept;
+
+        ~SpillFiles();
+
+        void append(size_t tile, const void *data, size_t bytes);
+
+        /**
+         * Copies the content of a tile file (memory mapped) to destination
+         */
+        void read(size_t tile, void *destination) const;
+
+        void truncate();
+
+        [[nodiscard]] size_t get_size(size_t tile) const;
+
+        [[nodiscard]] size_t get_total_size() const;
+
+    private:
+        void open_files();
+
+        void close_files();
+
+        std::string directory;
+        std::vector<int> files;
+        std::vector<size_t> sizes;
+        std::unique_ptr<std::mutex[]> mutexes;
+    };
+
+    /**
+     * Checkpoint of the index, every index_stride active pixels
+     */
+    struct IndexCheckpoint {
+        uint32_t pixel;
+
+        /**
+         * First event of the pixel
+         */
+        uint32_t offset;
+
+        /**
+         * Position of the pixel in index_bytes
+         */
+        uint32_t byte;
+    };
+
+    static constexpr size_t index_stride = 16;
+
+    /**
+     * Active pixel decoded from the index
+     */
+    struct ActivePixel {
+        uint32_t pixel;
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    [[nodiscard]] ActivePixel get_index_entry(size_t k) const;
+
+    /**
+     * First event of active pixel k, size() for k = get_number_of_active_pixels()
+     */
+    [[nodiscard]] size_t get_offset(size_t k) const;
+
+    /**
+     * Appends the next active pixel (by pixel index) with its events offset ... offset + count - 1 to the index
+     */
+    void append_active_pixel(uint32_t pixel, uint32_t offset, uint32_t count);
+
+    /**
+     * Appends the events of the compressed layout to entries
+     */
+    template<typename Entry>
+    void collect(std::vector<Entry> &entries) const;
+
+    /**
+     * Sorts the entries into the compressed layout
+     */
+    template<typename Entry>
+    void build(std::vector<Entry> &entries);
+
+    /**
+     * Appends the entries to the scratch files and clears them
+     */
+    template<typename Entry>
+    void spill(std::vector<Entry> &entries);
+
+    /**
+     * Appends the bucketed events to the scratch files and clears the buffer
+     */
+    void spill(BucketBuffer &buffer);
+
+    template<typename Entry, typename Buffer>
+    void push(Buffer &buffer, const Entry &entry);
+
+    template<typename Entry, typename Buffer>
+    void finalize_entries(std::vector<Buffer> &buffers, Buffer &overflow);
+
+    template<typename Entry>
+    void load_entries(size_t tile);
+
+    [[nodiscard]] CompactPixelEvent encode(uint32_t pixel, const Event &event) const;
+
+    bool compact = false;
+    float samples_per_us = 100.f;
+
+    std::vector<std::vector<PixelEvent>> thread_buffers;
+    std::vector<BucketBuffer> compact_thread_buffers;
+
+    /**
+     * Buffers for events from nested parallel regions
+     */
+    std::vector<PixelEvent> locked_buffer;
+    BucketBuffer compact_locked_buffer;
+    BufferMutex locked_buffer_mutex;
+
+    /**
+     * Varint index of the active pixels, see the class description. Active pixel k starts with the distance to active
+     * pixel k - 1 (0 at a checkpoint), followed by its number of events.
+     */
+    std::vector<uint8_t> index_bytes;
+    std::vector<IndexCheckpoint> index_checkpoints;
+    size_t n_active_pixels = 0;
+    uint32_t last_active_pixel = 0;
+
+    /**
+     * Events of active pixel k are at get_offset(k) ... get_offset(k + 1) - 1 of the event arrays
+     */
+    std::vector<Event, DefaultInitAllocator<Event>> sorted_events;
+    std::vector<int32_t, DefaultInitAllocator<int32_t>> sorted_ticks;
+    std::vector<uint16_t, DefaultInitAllocator<uint16_t>> sorted_energies;
+
+    bool owner_placement = false;
+    uint32_t owner_pixels = 0;
+
+    size_t memory_budget = 0;
+    uint32_t pixels_per_tile = 0;
+    size_t n_tiles = 1;
+    SpillFiles spill_files;
+
+    /**
+     * True if finalize() moved all events to the scratch files
+     */
+    bool spilled = false;
+    size_t loaded_tile = 0;
+
+    size_t peak_bytes = 0;
+};
+
+#endif //MEDIPIX_EVENT_STORE_H
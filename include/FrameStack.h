@@ -0,0 +1,105 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_FRAME_STACK_H
+#define MEDIPIX_FRAME_STACK_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Stack of count images with the same geometry, e.g. the result of a burst or of a re-binned acquisition.
+ * Frames are stored consecutively, each frame row-wise with index i * n_pixel_y + j.
+ */
+class FrameStack {
+public:
+    /**
+     * @param n_frames Number of frames
+     * @param nx Number of pixels in x direction
+     * @param ny Number of pixels in y direction
+     */
+    FrameStack(unsigned int n_frames, unsigned int nx, unsigned int ny);
+
+    /**
+     * Getter for a single pixel of a frame
+     * @param frame frame index
+     * @param i pixel index in x direction
+     * @param j pixel index in y direction
+     */
+    [[nodiscard]] unsigned int get_pixel_value(unsigned int frame, unsigned int i, unsigned int j) const;
+
+    /**
+     * Returns the total number of counts in a frame
+     * @param frame frame index
+     */
+    [[nodiscard]] unsigned long get_total_counts(unsigned int frame) const;
+
+    /**
+     * Pointer to the first pixel of a frame
+     * @param frame frame index
+     */
+    unsigned int *get_frame(unsigned int frame);
+
+    /**
+     * Pointer to the first pixel of a frame
+     * @param frame frame index
+     */
+    [[nodiscard]] const unsigned int *get_frame(unsigned int frame) const;
+
+    /**
+     * Number of real photons that interacted with the sensor in a frame
+     * @param frame frame index
+     */
+    [[nodiscard]] unsigned int get_real_photons(unsigned int frame) const;
+
+    /**
+     * Setter for the number of real photons of a frame
+     * @param frame frame index
+     * @param photons
+     */
+    void set_real_photons(unsigned int frame, unsigned int photons);
+
+    /**
+     * Saves all frames consecutively to a raw file of uint32
+     * @param filename
+     */
+    void save(const std::string &filename) const;
+
+    [[nodiscard]] unsigned int get_num_frames() const;
+
+    [[nodiscard]] unsigned int get_num_pixels_x() const;
+
+    [[nodiscard]] unsigned int get_num_pixels_y() const;
+
+private:
+    unsigned int n_frames;
+    unsigned int n_pixel_x;
+    unsigned int n_pixel_y;
+
+    /**
+     * Counts of all frames
+     */
+    std::vector<unsigned int> counts;
+
+    /**
+     * Real photons per frame
+     */
+    std::vector<unsigned int> real_photons;
+};
+
+#endif //MEDIPIX_FRAME_STACK_H
@@ -20,23 +20,272 @@
 #define MEDIPIX_MEDIPIX_H
 
 #include <utility>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
 #include <memory>
 #include <list>
+#include <memory_resource>
+#include <mutex>
+#include <string>
 #include <vector>
+#include "Arena.h"
+#include "EventStore.h"
+#include "Material.h"
+#include "placement.h"
+#include "RandomStream.h"
+
+class ResponseConvolver;
 
 /**
- * Event struct that stores the time and deposited energy per pixel.
+ * Energy deposited by a photon in a pixel. A recorded exposure (see MedipixRecorder) is a sequence of photons, each
+ * a sequence of deposits. The first deposit of a photon is in the pixel of the interaction position (the summing
+ * node of the charge summing mode).
  */
-struct Event {
+struct Deposit {
     /**
-     * Time in µs.
+     * Interaction time in µs.
      */
-    float time;
+    double time;
 
     /**
      * Energy in keV.
      */
     float energy;
+
+    /**
+     * Pixel i * n_pixel_y + j, no_pixel if the interaction is outside of the pixel matrix
+     */
+    uint32_t pixel;
+
+    /**
+     * Combination of first_deposit and summing_group
+     */
+    uint32_t flags;
+
+    static constexpr uint32_t no_pixel = UINT32_MAX;
+
+    /**
+     * First deposit of a photon
+     */
+    static constexpr uint32_t first_deposit = 1;
+
+    /**
+     * Pixel of the 2x2 group whose energies are summed in the charge summing mode
+     */
+    static constexpr uint32_t summing_group = 2;
+};
+
+/**
+ * Photons of a batch of an exposure (structure of arrays), see Medipix::add_photons()
+ */
+struct PhotonBatch {
+    /**
+     * Energies in keV
+     */
+    const float *energy;
+
+    /**
+     * Positions in µm
+     */
+    const float *x;
+    const float *y;
+
+    /**
+     * Interaction depths in µm, negative for the fixed psf sigma
+     */
+    const float *depth;
+
+    /**
+     * Interaction times in µs
+     */
+    const double *time;
+
+    /**
+     * Only the photons with interacting[k] are added
+     */
+    const bool *interacting;
+
+    unsigned int n;
+
+    /**
+     * Radius in pixel, in which shared charge could be deposited
+     */
+    int radius;
+};
+
+/**
+ * Mutex guarding the image. Copying a detector gives the copy its own, unlocked mutex.
+ */
+class ImageMutex : public std::mutex {
+public:
+    ImageMutex() = default;
+
+    ImageMutex(const ImageMutex &) : std::mutex() {}
+
+    ImageMutex &operator=(const ImageMutex &) { return *this; }
+};
+
+/**
+ * Rectangular pixel region [x0, x0 + nx) x [y0, y0 + ny)
+ */
+struct PixelRegion {
+    unsigned int x0;
+    unsigned int y0;
+    unsigned int nx;
+    unsigned int ny;
+};
+
+/**
+ * What happens when the estimated peak memory of a frame exceeds the memory budget, see Medipix::set_memory_budget()
+ */
+enum class BudgetPolicy {
+    /**
+     * plan_frame() throws
+     */
+    Refuse,
+
+    /**
+     * Events of the timed mode are spilled to scratch files and processed in tiles of pixel rows
+     */
+    Spill
+};
+
+/**
+ * Estimate of the memory and runtime of a planned frame, see Medipix::estimate_frame()
+ */
+struct FrameEstimate {
+    unsigned long long photons;
+
+    /**
+     * Charge deposits in pixels, each is an event in the timed mode
+     */
+    double deposits;
+
+    /**
+     * Expected number of pixels with events (timed)
+     */
+    double active_pixels;
+
+    /**
+     * Length of the full waveform of a pixel (max_time * samples_per_us + response length)
+     */
+    size_t samples_per_pixel;
+
+    /**
+     * Expected number of waveform samples of all active pixels (timed)
+     */
+    double signal_samples;
+
+    /**
+     * Bytes of the image and the threshold dispersion
+     */
+    size_t pixel_bytes;
+
+    /**
+     * Peak bytes of the events (thread buffers, sort buffer and compressed layout)
+     */
+    size_t event_bytes;
+
+    /**
+     * Bytes of the waveforms processed at the same time (one per thread)
+     */
+    size_t signal_bytes;
+
+    size_t peak_bytes;
+
+    /**
+     * Expected runtime of the exposure and finish_frame() in s
+     */
+    double runtime;
+
+    /**
+     * True if the events are spilled to scratch files to stay in the memory budget
+     */
+    bool spill;
+
+    /**
+     * Pixel rows per tile of the spill
+     */
+    unsigned int rows_per_tile;
+};
+
+/**
+ * Memory budget and memory use of a detector, see Medipix::get_memory_stats()
+ */
+struct MemoryStats {
+    /**
+     * Budget in bytes, 0 without budget
+     */
+    size_t budget;
+
+    BudgetPolicy policy;
+
+    /**
+     * Peak bytes estimated by the last plan_frame()
+     */
+    size_t estimated_peak_bytes;
+
+    /**
+     * Bytes allocated by the pixels and the events now
+     */
+    size_t allocated_bytes;
+
+    /**
+     * Largest allocation of the pixels and the events in the current frame
+     */
+    size_t peak_bytes;
+
+    /**
+     * Bytes of events spilled to scratch files in the current frame
+     */
+    size_t spilled_bytes;
+
+    /**
+     * True if the events are spilled (set by the budget or set_event_spill())
+     */
+    bool spill;
+};
+
+/**
+ * Parameters of the depth of interaction model, see Medipix::set_depth_of_interaction()
+ */
+struct DepthOfInteraction {
+    /**
+     * Mass attenuation coefficient of the sensor at the photon energy in cm^2/g
+     */
+    float mu_norm;
+
+    /**
+     * Density of the sensor in g/cm^3
+     */
+    float rho;
+
+    /**
+     * Sensor thickness in µm
+     */
+    float thickness = 300.f;
+
+    /**
+     * Bias voltage in V
+     */
+    float bias_voltage = 100.f;
+
+    /**
+     * Sensor temperature in K
+     */
+    float temperature = 295.f;
+
+    /**
+     * Sigma of the charge cloud directly after the interaction in µm
+     */
+    float initial_sigma = 5.f;
+
+    /**
+     * Number of depth bins for which the charge sharing is tabulated
+     */
+    unsigned int n_depth_bins = 32;
 };
 
 class Medipix {
@@ -50,6 +299,14 @@ public:
      */
     explicit Medipix(bool timed = false, unsigned int nx = 256, unsigned int ny = 256);
 
+    virtual ~Medipix() = default;
+
+    /**
+     * Creates an independent replica of the detector with the same configuration (thresholds, threshold dispersion,
+     * psf, i_krum). The replica has its own image and event buffers.
+     */
+    [[nodiscard]] virtual std::shared_ptr<Medipix> clone() const;
+
     /**
      * Resets the current image
      */
@@ -70,10 +327,60 @@ public:
      * @param radius Radius in pixel, in which shared charge could be deposited
      * @param time interaction Time in µs
      */
-    virtual void add_photon(float energy, float position_x, float position_y, int radius, float time);
+    void add_photon(float energy, float position_x, float position_y, int radius, double time);
+
+    /**
+     * Simulates the interaction of a single photon at a given depth.
+     *
+     * @param energy Energy of the interacting in keV
+     * @param position_x x-component of the position of the interacting photon in µm
+     * @param position_y y-component of the position of the interacting photon in µm
+     * @param depth Interaction depth in µm below the entrance surface of the sensor. Negative values (or a detector
+     *  without depth of interaction model) use the fixed psf sigma.
+     * @param radius Radius in pixel, in which shared charge could be deposited
+     * @param time interaction Time in µs
+     */
+    virtual void add_photon(float energy, float position_x, float position_y, float depth, int radius, double time);
+
+    /**
+     * Counts a photon from its recorded deposits instead of simulating the charge sharing (see replay()). The
+     * deposits were calculated by a detector with the same geometry and charge sharing settings, all threshold,
+     * dispersion, I_krum and counting mode settings of this detector are applied.
+     *
+     * @param deposits Deposits of one photon, the first one with Deposit::first_deposit
+     * @param n Number of deposits
+     */
+    virtual void replay_photon(const Deposit *deposits, size_t n);
+
+    /**
+     * Adds the interacting photons of a batch that reach the region of interest (with the radius as halo). Without a
+     * specialized kernel the photons are added one by one with add_photon(). The SPM, CSM and Timepix detectors have
+     * kernels specialized at compile time on the counting mode and the radius (1 to max_kernel_radius), chosen once
+     * per frame in start_frame(). They compute the erf of each pixel border once per photon and lock the image once
+     * per batch, the counts are the same as with add_photon().
+     */
+    virtual void add_photons(const PhotonBatch &batch);
+
+    /**
+     * Largest radius with a specialized deposition kernel
+     */
+    static constexpr int max_kernel_radius = 4;
+
+    /**
+     * Enables the specialized deposition kernels of add_photons() (default), otherwise the generic add_photon() path
+     * is used. Takes effect with the next start_frame().
+     */
+    void set_specialized_kernels(bool enabled);
+
+    [[nodiscard]] bool get_specialized_kernels() const;
 
     [[nodiscard]] unsigned int get_pixel_value(unsigned int i, unsigned int j) const;
 
+    /**
+     * Getter for the current image, stored row-wise with index i * n_pixel_y + j
+     */
+    [[nodiscard]] const std::vector<unsigned int> &get_image() const;
+
     [[maybe_unused]] [[nodiscard]] bool get_shutter_open() const;
 
     /**
@@ -126,6 +433,104 @@ public:
      */
     [[maybe_unused]] void set_th0(float t);
 
+    /**
+     * Widens the pixels at the borders of the sensor outwards, e.g. the wide edge pixels that cover the gap between
+     * the chips of an assembly.
+     * @param left extension of the pixels with i = 0 in µm
+     * @param right extension of the pixels with i = nx - 1 in µm
+     * @param bottom extension of the pixels with j = 0 in µm
+     * @param top extension of the pixels with j = ny - 1 in µm
+     */
+    void set_edge_extension(float left, float right, float bottom, float top);
+
+    /**
+     * Getter for the edge extensions in µm: left, right, bottom, top (see set_edge_extension())
+     */
+    [[nodiscard]] std::array<float, 4> get_edge_extension() const;
+
+    /**
+     * Enables the depth of interaction model. The exposure functions draw the interaction depth of each photon from
+     * Beer-Lambert's law (conditioned on the photon interacting in the sensor). The charge cloud drifts from the
+     * interaction depth to the pixels at the back of the sensor, its sigma is
+     * \f$\sigma^2 = \sigma_0^2 + 2 \frac{kT}{q} \frac{L (L - z)}{V}\f$ (diffusion in a uniform field).
+     * The charge sharing is tabulated for n_depth_bins depths.
+     * @param model
+     */
+    void set_depth_of_interaction(const DepthOfInteraction &model);
+
+    /**
+     * Disables the depth of interaction model, the fixed psf sigma is used again.
+     */
+    void disable_depth_of_interaction();
+
+    [[nodiscard]] bool has_depth_of_interaction() const;
+
+    /**
+     * Getter for the depth of interaction model (requires the depth of interaction model)
+     */
+    [[nodiscard]] const DepthOfInteraction &get_depth_of_interaction() const;
+
+    /**
+     * Sigma of the charge cloud of a photon interacting at the given depth (quantized to the depth bins)
+     * @param depth in µm
+     * @return sigma in µm
+     */
+    [[nodiscard]] float get_depth_sigma(float depth) const;
+
+    /**
+     * Draws the interaction depth of a photon interacting in the sensor (requires the depth of interaction model).
+     * With a sensor layer (see set_sensor()) the attenuation at the photon energy is used, otherwise the one of the
+     * depth of interaction model.
+     * @param energy in keV
+     * @param rng Random stream of the photon
+     * @return depth in µm
+     */
+    [[nodiscard]] inline float draw_interaction_depth(float energy, RandomStream &rng) const {
+        if (sensor)
+            return sensor->draw_depth(energy, rng);
+        return -std::log1p(-rng.uniform() * depth_tables->absorbed_fraction) / depth_tables->mu;
+    }
+
+    /**
+     * Sets the sensor layer. The exposure functions then let photons interact only with the interaction probability
+     * of the sensor at their energy, and draw the depth of interaction from its attenuation. The thickness has to
+     * match the one of the depth of interaction model.
+     * @param sensor Sensor layer, nullptr to disable
+     */
+    void set_sensor(std::shared_ptr<const SensorLayer> sensor);
+
+    /**
+     * Getter for the sensor layer (nullptr if not set)
+     */
+    [[nodiscard]] const std::shared_ptr<const SensorLayer> &get_sensor() const;
+
+    /**
+     * Restricts the simulation to a region of interest. Only the counters, events and threshold dispersion of the
+     * pixels inside the region are allocated, photons outside of the region plus a halo are skipped by the exposure
+     * functions. Pixel indices stay the ones of the full detector, images (get_image(), save_image()) have the size
+     * of the region. Inside the region the result is identical to a full detector run with the same seeds.
+     * get_real_photons() only counts the photons in the region plus halo.
+     *
+     * @param x0 first pixel in x direction
+     * @param y0 first pixel in y direction
+     * @param nx number of pixels in x direction
+     * @param ny number of pixels in y direction
+     */
+    void set_region_of_interest(unsigned int x0, unsigned int y0, unsigned int nx, unsigned int ny);
+
+    /**
+     * Getter for the region of interest (the full detector by default)
+     */
+    [[nodiscard]] PixelRegion get_region_of_interest() const;
+
+    /**
+     * Returns true if a photon at (position_x, position_y) can deposit charge in the region of interest
+     * @param position_x in µm
+     * @param position_y in µm
+     * @param radius Radius in pixel, in which shared charge could be deposited
+     */
+    [[nodiscard]] bool in_region_of_interest(float position_x, float position_y, int radius) const;
+
     /**
      * Gets pixel index of the pixel where (position_x, position_y) is located in
      * @param position_x in µm
@@ -158,9 +563,21 @@ public:
      * Sets a normal distributed threshold dispersion
      *
      * @param sigma in keV
+     * @param seed Seed of the random number generator. Pixel k is drawn from its own stream (seed, k), so the map
+     *  is reproducible.
+     */
+    virtual void random_threshold_dispersion(float sigma, unsigned int seed = time(nullptr));
+
+    /**
+     * Getter for the sigma of the threshold dispersion (0 without dispersion)
+     * @return in keV
      */
-    virtual void random_threshold_dispersion(float sigma);
+    [[nodiscard]] float get_dispersion_sigma() const;
 
+    /**
+     * Getter for the seed of the threshold dispersion
+     */
+    [[nodiscard]] unsigned int get_dispersion_seed() const;
 
     /**
      * Getter for the number of pixels in x direction
@@ -199,6 +616,118 @@ public:
      */
     [[nodiscard]] bool get_timed() const;
 
+    /**
+     * Selects the compact event encoding of the timed mode (see EventStore): time in ticks of the signal sampling
+     * and 16 bit energies, 6 instead of 16 bytes per event. Only possible with closed shutter.
+     */
+    void set_compact_events(bool compact);
+
+    [[nodiscard]] bool get_compact_events() const;
+
+    /**
+     * Throws std::out_of_range if photon times up to duration can not be stored as events (see
+     * EventStore::get_max_time()). The exposures check this before their parallel region, an exception thrown
+     * inside of it can not be caught.
+     * @param duration in µs
+     */
+    void check_exposure_duration(double duration) const;
+
+    /**
+     * Mean number of overlapping pulses in the signal of a pixel above which the pile-up evaluation builds the signal
+     * by FFT convolution of the binned events (see ResponseConvolver) instead of adding every pulse. The threshold
+     * crossings do not change: samples close to the threshold are recalculated by adding the pulses.
+     * @param overlap 0 for FFT in all pixels, infinity to always add the pulses
+     */
+    void set_fft_crossover(float overlap);
+
+    [[nodiscard]] float get_fft_crossover() const;
+
+    /**
+     * Limits the memory of the buffered events of the timed mode. Above the budget, events are spilled to scratch
+     * files in directory, partitioned by tiles of rows_per_tile pixel rows (x index) of the region of interest, and
+     * finish_frame() processes one tile at a time. The counts do not change. Only possible with closed shutter.
+     * @param memory_budget Bytes, 0 keeps all events in memory
+     * @param directory Directory of the scratch files
+     * @param rows_per_tile
+     */
+    void set_event_spill(size_t memory_budget, const std::string &directory = "/tmp",
+                         unsigned int rows_per_tile = 64);
+
+    /**
+     * Bytes of events spilled to scratch files in the last timed frame
+     */
+    [[nodiscard]] size_t get_spilled_bytes() const;
+
+    /**
+     * Estimates the peak memory and the runtime of a homogeneous exposure before it is started. The number of events
+     * and the waveform lengths follow from the flux, the exposure time, the radius of the charge sharing and the size
+     * of the region of interest; the runtime uses throughputs measured for a single thread, divided by the number of
+     * OpenMP threads. Builds the response function of the current i_krum.
+     * @param exposure_time in s
+     * @param flux_density in photons / (s mm^2)
+     * @param radius Radius of the charge sharing in pixels (as in add_photon())
+     * @return
+     */
+    [[nodiscard]] FrameEstimate estimate_frame(double exposure_time, double flux_density, int radius = 3);
+
+    /**
+     * Sets a memory budget for the frames planned with plan_frame()
+     * @param budget Bytes, 0 removes the budget
+     * @param policy What happens if a frame does not fit
+     * @param directory Directory of the scratch files of BudgetPolicy::Spill
+     */
+    void set_memory_budget(size_t budget, BudgetPolicy policy = BudgetPolicy::Spill,
+                           const std::string &directory = "/tmp");
+
+    /**
+     * Checks a planned exposure against the memory budget before start_frame(). If the estimated peak memory exceeds
+     * the budget, BudgetPolicy::Refuse throws a std::runtime_error and BudgetPolicy::Spill enables the event spill
+     * (see set_event_spill()) with a buffer budget and tile size that fit. A spill enabled by an earlier plan is
+     * removed again if the frame fits. Only possible with closed shutter.
+     * @param exposure_time in s
+     * @param flux_density in photons / (s mm^2)
+     * @param radius Radius of the charge sharing in pixels
+     * @return Estimate of the frame with the chosen strategy
+     */
+    FrameEstimate plan_frame(double exposure_time, double flux_density, int radius = 3);
+
+    /**
+     * Budget and memory use. Not to be called while photons are added.
+     */
+    [[nodiscard]] MemoryStats get_memory_stats() const;
+
+    /**
+     * Bytes of the per-thread arenas of the transient buffers
+     */
+    [[nodiscard]] size_t get_arena_capacity() const;
+
+    /**
+     * Places the frame buffers on the NUMA nodes of the threads that own them (default off). Each tile of the event
+     * spill (the region of interest without spill) is split into equal pixel blocks, one per OpenMP thread. The
+     * image, the threshold dispersion and the events of a block are placed on the node of its thread, and the timed
+     * pile-up evaluation processes the pixels of each block on its owner thread instead of balancing by cost.
+     *
+     * Enabling pins the OpenMP threads, including the calling one, to single CPUs (see ThreadPinning). This also
+     * confines other OpenMP code of the process until the placement of the detector and of its copies is disabled or
+     * they are destroyed, then the threads get their previous affinity back. The image and the dispersion maps are moved when
+     * they are (re-)allocated (with libnuma), not in every frame; a dispersion map shared with replicas is copied
+     * first. If the number of OpenMP threads has changed since, start_frame() pins and moves them again for the new
+     * owner blocks.
+     */
+    void set_numa_placement(bool enabled);
+
+    [[nodiscard]] bool get_numa_placement() const;
+
+    /**
+     * Bytes used by the events of the last finished timed frame (of the last loaded tile with spill)
+     */
+    [[nodiscard]] size_t get_event_memory_usage() const;
+
+    /**
+     * Number of events of the last finished timed frame
+     */
+    [[nodiscard]] size_t get_number_of_events() const;
+
     /**
      * Calculates the fourier spectrum of the current image
      *
@@ -242,6 +771,37 @@ protected:
     [[nodiscard]] float
     calculate_shared_energy(float x, float y, float energy, float pixel_center_x, float pixel_center_y) const;
 
+    /**
+     * Calculates the energy equivalent charge in the pixel (i, j) like calculate_shared_energy(), but with the
+     * real pixel boundaries (wide edge pixels, see set_edge_extension()).
+     * @param x position of the photon interaction in µm
+     * @param y position of the photon interaction in µm
+     * @param energy energy of the photon in keV
+     * @param i pixel index in x direction
+     * @param j pixel index in y direction
+     * @return
+     */
+    [[nodiscard]] float calculate_pixel_energy(float x, float y, float energy, unsigned int i, unsigned int j) const;
+
+    /**
+     * Energy equivalent charge in the pixel (i, j) of a photon interacting at the given depth. Uses the tabulated
+     * charge sharing of the depth bin, see set_depth_of_interaction(). Negative depths use the fixed psf sigma.
+     */
+    [[nodiscard]] float
+    calculate_pixel_energy(float x, float y, float energy, unsigned int i, unsigned int j, float depth) const;
+
+    /**
+     * Integral of the charge cloud over the rectangle [x_a, x_b] x [y_a, y_b]
+     */
+    [[nodiscard]] float
+    integrate_charge(float x, float y, float energy, float x_a, float x_b, float y_a, float y_b) const;
+
+    /**
+     * Integral of a charge cloud with the given sigma over the rectangle [x_a, x_b] x [y_a, y_b]
+     */
+    [[nodiscard]] static float
+    integrate_charge(float x, float y, float energy, float x_a, float x_b, float y_a, float y_b, float sigma);
+
     /**
      * Getter for pixel wise threshold (including threshold dispersion)
      * @param i pixel
@@ -249,9 +809,128 @@ protected:
      * @return threshold in keV
      */
     [[nodiscard]] inline float get_th0(unsigned int i, unsigned int j) const {
-        return th0 + th0_dispersion[i * n_pixel_y + j];
+        return th0 + (*th0_dispersion)[pixel_offset(i, j)];
+    }
+
+    /**
+     * Pixel wise threshold of a pixel outside of the region of interest. The dispersion is recalculated from the
+     * seed, as it is not stored for these pixels.
+     * @param i pixel
+     * @param j pixel
+     * @return threshold in keV
+     */
+    [[nodiscard]] float get_th0_outside_roi(unsigned int i, unsigned int j) const;
+
+    /**
+     * Charge sharing component of pixel column i for a photon at x: difference of the erf at the borders of the column
+     * (edge pixels extended), as in integrate_charge()
+     * @param scale psf_sigma * sqrt(2)
+     */
+    [[nodiscard]] inline float column_component(unsigned int i, float x, float scale) const {
+        float center = pixel_pitch * (float(i) - float(n_pixel_x) / 2.f + 0.5f);
+        float a = center - pixel_pitch / 2.f;
+        float b = center + pixel_pitch / 2.f;
+        if (i == 0)
+            a -= edge_extension_left;
+        if (i == n_pixel_x - 1)
+            b += edge_extension_right;
+        return std::erf((b - x) / scale) - std::erf((a - x) / scale);
     }
 
+    /**
+     * Charge sharing component of pixel row j for a photon at y, see column_component()
+     */
+    [[nodiscard]] inline float row_component(unsigned int j, float y, float scale) const {
+        float center = pixel_pitch * (float(j) - float(n_pixel_y) / 2.f + 0.5f);
+        float a = center - pixel_pitch / 2.f;
+        float b = center + pixel_pitch / 2.f;
+        if (j == 0)
+            a -= edge_extension_bottom;
+        if (j == n_pixel_y - 1)
+            b += edge_extension_top;
+        return std::erf((b - y) / scale) - std::erf((a - y) / scale);
+    }
+
+    /**
+     * Deposition kernel of add_photons()
+     */
+    using DepositKernel = void (*)(Medipix &, const PhotonBatch &);
+
+    /**
+     * Kernels by radius, nullptr for the generic path. Set by select_deposit_kernels() in start_frame().
+     */
+    std::array<DepositKernel, max_kernel_radius + 1> deposit_kernels{};
+
+    bool specialized_kernels = true;
+
+    bool numa_placement = false;
+
+    /**
+     * Pinning of the OpenMP threads while numa_placement is enabled
+     */
+    ThreadPinning pinning;
+
+    /**
+     * Number of OpenMP threads the pixel buffers were placed for
+     */
+    int placed_threads = 0;
+
+    /**
+     * Chooses the deposition kernels for the mode of the frame. The default uses the generic path.
+     */
+    virtual void select_deposit_kernels();
+
+    /**
+     * Timed deposition kernel: adds the events of the (2 Radius)^2 pixels around each photon. The charge sharing
+     * components of the 2 Radius columns and rows are computed once per photon.
+     */
+    template<int Radius>
+    void deposit_events(const PhotonBatch &batch);
+
+    template<int Radius>
+    static void event_kernel(Medipix &medipix, const PhotonBatch &batch) {
+        medipix.deposit_events<Radius>(batch);
+    }
+
+    /**
+     * Bookkeeping of add_photon() for the photons of a batch and the counters of hit pixels, with one lock
+     * @param n_photons Number of added photons
+     * @param last_time Latest interaction time in µs
+     * @param hits Offsets of the pixels whose counter is increased by one
+     */
+    void commit_batch(unsigned int n_photons, double last_time, std::span<const uint32_t> hits);
+
+    /**
+     * Offset of the pixel (i, j) in the image, event and dispersion buffers
+     */
+    [[nodiscard]] inline size_t pixel_offset(unsigned int i, unsigned int j) const {
+        return static_cast<size_t>(i - roi.x0) * roi.ny + (j - roi.y0);
+    }
+
+    /**
+     * Returns true if the pixel (i, j) is inside of the region of interest
+     */
+    [[nodiscard]] inline bool in_roi(int i, int j) const {
+        return i >= int(roi.x0) && i < int(roi.x0 + roi.nx) && j >= int(roi.y0) && j < int(roi.y0 + roi.ny);
+    }
+
+    /**
+     * (Re-)allocates the buffers of the pixels in the region of interest
+     */
+    virtual void allocate_pixels();
+
+    /**
+     * Moves the image and the threshold dispersion to the nodes of their owners (see set_numa_placement()). A
+     * dispersion map shared with replicas is not moved, the detector gets its own copy first. Detectors with further
+     * pixel buffers override it and place them as well.
+     */
+    virtual void place_pixel_buffers();
+
+    /**
+     * Moves the pages of a buffer with one element per pixel of the region of interest to the nodes of their owners
+     */
+    void place_pixels(const void *data, size_t element_size) const;
+
     int i_krum = 20;
 
     /**
@@ -269,6 +948,14 @@ protected:
      */
     float psf_sigma = 13.0;
 
+    /**
+     * Extension of the edge pixels in µm (left, right, bottom, top)
+     */
+    float edge_extension_left = 0.f;
+    float edge_extension_right = 0.f;
+    float edge_extension_bottom = 0.f;
+    float edge_extension_top = 0.f;
+
     /**
      * x dimension of the sensor in pixel
      */
@@ -280,9 +967,21 @@ protected:
     unsigned int n_pixel_y;
 
     /**
-     * Last time of an interaction in the current exposure in µs
+     * Region of interest, see set_region_of_interest()
+     */
+    PixelRegion roi;
+
+    /**
+     * Sigma and seed of the random threshold dispersion (sigma is 0 without dispersion)
+     */
+    float dispersion_sigma = 0.f;
+    unsigned int dispersion_seed = 0;
+
+    /**
+     * Last time of an interaction in the current exposure in µs. Double, so that the 10 ns sampling of the signal is
+     * resolved in long frames.
      */
-    float max_time = 0.f;
+    double max_time = 0.;
 
     /**
      * Current image
@@ -290,9 +989,10 @@ protected:
     std::vector<unsigned int> image;
 
     /**
-     * Threshold dispersion map
+     * Threshold dispersion map. It is shared between replicas of the detector and replaced as a whole when it
+     * changes (copy-on-write).
      */
-    std::vector<float> th0_dispersion;
+    std::shared_ptr<const std::vector<float>> th0_dispersion;
 
     /**
      * Increase the counter of the pixel (i, j) by one
@@ -304,7 +1004,7 @@ protected:
     /**
      * Mutex for image write access
      */
-    std::mutex image_write_mutex;
+    ImageMutex image_write_mutex;
 
     /**
      * Specifies if the current exposure is timed. Times means that pulse-pileup is handled.
@@ -312,14 +1012,92 @@ protected:
     bool timed = false;
 
     /**
-     * Map of lists storing the pixel-wise events
+     * Pixel-wise events of the timed mode (index in the region of interest). Only pixels with events use memory.
+     */
+    EventStore events;
+
+    /**
+     * Per-thread arenas of the transient buffers of a frame (neighbour lists, waveforms, FFT buffers), reset in
+     * start_frame()
+     */
+    mutable ThreadArenas arenas;
+
+    /**
+     * Settings of the event spill, see set_event_spill()
+     */
+    size_t spill_budget = 0;
+    std::string spill_directory = "/tmp";
+    unsigned int spill_rows_per_tile = 64;
+
+    /**
+     * Memory budget, see set_memory_budget()
+     */
+    size_t memory_budget = 0;
+    BudgetPolicy budget_policy = BudgetPolicy::Spill;
+    std::string budget_directory = "/tmp";
+    size_t estimated_peak_bytes = 0;
+
+    /**
+     * True if the event spill was enabled by plan_frame()
+     */
+    bool budget_spill = false;
+
+    /**
+     * Response function of the preamplifier. Responses are cached per i_krum and shared between detectors.
+     */
+    std::shared_ptr<const std::vector<float>> response_function;
+
+    /**
+     * FFT convolution with the response function, cached with it
+     */
+    std::shared_ptr<const ResponseConvolver> response_convolver;
+
+    float fft_crossover = 128.f;
+
+    /**
+     * Tabulated charge sharing of the depth of interaction model
+     */
+    struct DepthTables {
+        DepthOfInteraction model;
+
+        /**
+         * Linear attenuation coefficient in 1/µm
+         */
+        float mu;
+
+        /**
+         * Fraction of the photons interacting in the sensor
+         */
+        float absorbed_fraction;
+
+        /**
+         * Charge cloud sigma per depth bin in µm
+         */
+        std::vector<float> sigma;
+
+        /**
+         * Per depth bin: fraction of the charge between -pitch/2 and pitch/2 for the distance |d| of the charge cloud
+         * center to the pixel center, sampled every step µm up to range µm
+         */
+        std::vector<float> component;
+        float step;
+        unsigned int n_entries;
+    };
+
+    /**
+     * Depth of interaction model (nullptr if disabled), shared between replicas of the detector
      */
-    std::vector<std::list<Event>> events;
+    std::shared_ptr<const DepthTables> depth_tables;
 
     /**
-     * Response function of the preamplifier
+     * Sensor layer, shared between replicas of the detector
      */
-    std::vector<float> response_function;
+    std::shared_ptr<const SensorLayer> sensor;
+
+    /**
+     * Depth bin of an interaction depth
+     */
+    [[nodiscard]] unsigned int get_depth_bin(float depth) const;
 
     /**
      * Calculates the response function of the preamplifier
@@ -348,6 +1126,30 @@ protected:
      */
     std::vector<float> calculate_pixel_signal(unsigned int i, unsigned int j);
 
+    /**
+     * Index of the sample of the signal in which an event starts. It is computed from Event::time_steps, so the
+     * indices cover any exposure time the event store accepts.
+     */
+    [[nodiscard]] size_t get_sample(const Event &event) const;
+
+    /**
+     * Calculates the signal of a pixel from the first sample its events reach to the last one.
+     * @param pixel_events Events of the pixel
+     * @param first_sample Set to the index of the first returned sample in the signal of the frame
+     * @return vector of floats with the signal, samples before first_sample are zero. It is allocated from the arena
+     * of the calling thread, an Arena::Scope around the call releases it.
+     */
+    [[nodiscard]] std::pmr::vector<float> calculate_pixel_signal(std::span<const Event> pixel_events,
+                                                                 size_t &first_sample) const;
+
+    /**
+     * Calculates the signal of a pixel for the comparison with threshold. Above the FFT crossover (see
+     * set_fft_crossover()) the signal is convolved by FFT and only the samples that could be on the other side of
+     * the threshold are exact, the comparisons give the same result as with the other overload.
+     */
+    [[nodiscard]] std::pmr::vector<float> calculate_pixel_signal(std::span<const Event> pixel_events,
+                                                                 size_t &first_sample, float threshold) const;
+
     /**
      * Number of real photons that interacted with the sensor
      */
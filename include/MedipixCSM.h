@@ -39,15 +39,25 @@ public:
      */
     MedipixCSM();
 
+    /**
+     * Creates an independent replica of the detector with the same configuration.
+     */
+    [[nodiscard]] std::shared_ptr<Medipix> clone() const override;
+
     /**
      * Adds a photon to the current frame.
      * @param energy in keV
      * @param position_x in um
      * @param position_y in um
+     * @param depth Interaction depth in um, negative for the fixed psf sigma (see Medipix::set_depth_of_interaction())
      * @param radius area in *pixel* in which the charge distribution is calculated
      * @param time interaction time in us. Only relevant for timed mode.
      */
-    void add_photon(float energy, float position_x, float position_y, int radius, float time) override;
+    void add_photon(float energy, float position_x, float position_y, float depth, int radius, double time) override;
+
+    using Medipix::add_photon;
+
+    void replay_photon(const Deposit *deposits, size_t n) override;
 
     /**
      * Finishes the current frame. In timed mode here the pile-up events are processed.
@@ -58,14 +68,15 @@ public:
     /**
      * Sets a normal distribution for the threshold dispersion.
      * @param sigma in keV
+     * @param seed Seed of the random number generator
      */
-    void random_threshold_dispersion(float sigma) override;
+    void random_threshold_dispersion(float sigma, unsigned int seed = time(nullptr)) override;
 
     /**
      * Getter for the th1
      * @return in keV
      */
-    [[maybe_unused]] float get_th1();
+    [[maybe_unused]] [[nodiscard]] float get_th1() const;
 
     /**
      * Setter for the th1
@@ -73,6 +84,16 @@ public:
      */
     void set_th1(float t);
 protected:
+    /**
+     * Allocates the pixel buffers including the th1 dispersion
+     */
+    void allocate_pixels() override;
+
+    /**
+     * Places the th1 dispersion with the buffers of Medipix
+     */
+    void place_pixel_buffers() override;
+
     /**
      * Getter for the pixel wise th1 value (including the threshold dispersion)
      * @param i pixel index in x direction
@@ -81,15 +102,30 @@ protected:
      */
     float get_th1(unsigned int i, unsigned int j);
 
+    /**
+     * Counting kernel without depth of interaction, timed kernels from Medipix
+     */
+    void select_deposit_kernels() override;
+
+    /**
+     * Counting deposition kernel: the energies above threshold of the 2x2 group next to the photon are summed in the
+     * pixel of the photon. The charge summing always uses radius 1, so there is one kernel for all radii.
+     */
+    void count_photons(const PhotonBatch &batch);
+
+    static void count_kernel(Medipix &medipix, const PhotonBatch &batch) {
+        static_cast<MedipixCSM &>(medipix).count_photons(batch);
+    }
+
     /**
      * Value of the threshold 1 in keV
      */
     float th1 = 6.0;
 
     /**
-     * Vector holding the threshold displacement for each pixel
+     * Vector holding the threshold displacement for each pixel. Shared between replicas (copy-on-write).
      */
-    std::vector<float> th1_dispersion;
+    std::shared_ptr<const std::vector<float>> th1_dispersion;
 
 };
 
@@ -0,0 +1,140 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_MEDIPIX_RECORDER_H
+#define MEDIPIX_MEDIPIX_RECORDER_H
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Medipix.h"
+
+/**
+ * Start of a deposit file. The pixel index of a deposit is i * n_pixel_y + j on the pixel matrix of the recorder, so
+ * a replay needs the same matrix.
+ */
+struct DepositFileHeader {
+    static constexpr char file_magic[8] = {'M', 'P', 'X', 'D', 'E', 'P', '0', '1'};
+
+    char magic[8];
+    uint32_t n_pixel_x;
+    uint32_t n_pixel_y;
+};
+
+/**
+ * Detector that records the deposits of its photons to a file instead of counting them.
+ *
+ * Photon generation and the charge sharing do not depend on the thresholds, the threshold dispersion, I_krum or the
+ * counting mode, so one recorded exposure can be replayed (see replay()) with many of these settings. The recorder
+ * is configured like the replayed detectors (geometry, psf sigma, depth of interaction model, sensor, edge
+ * extensions) and gets the exposure like any detector, e.g. with exposure().
+ *
+ * For each photon the pixels within the radius and the 2x2 summing group are recorded, the file is a
+ * DepositFileHeader followed by a plain sequence of Deposit records. Deposits below min_energy are dropped to keep the file small: replays are exact for
+ * thresholds above min_energy in non-timed mode, in timed mode the pile-up of the dropped deposits is neglected.
+ * The order of the photons depends on the threads of the exposure.
+ */
+class MedipixRecorder : public Medipix {
+public:
+    /**
+     * @param filename File the deposits are written to, it is overwritten
+     * @param nx Number of pixels in x direction
+     * @param ny Number of pixels in y direction
+     * @param min_energy Minimal recorded deposit in keV
+     */
+    explicit MedipixRecorder(const std::string &filename, unsigned int nx = 256, unsigned int ny = 256,
+                             float min_energy = 0.5f);
+
+    /**
+     * A recorder writes to a single file, it can not be cloned
+     */
+    [[nodiscard]] std::shared_ptr<Medipix> clone() const override;
+
+    void add_photon(float energy, float position_x, float position_y, float depth, int radius, double time) override;
+
+    using Medipix::add_photon;
+
+    /**
+     * Finishes the frame and flushes the file. Further frames are appended.
+     */
+    void finish_frame() override;
+
+    /**
+     * Number of deposits written to the file
+     */
+    [[nodiscard]] unsigned long long get_number_of_deposits() const;
+
+private:
+    std::shared_ptr<std::ofstream> file;
+    float min_energy;
+    unsigned long long number_of_deposits = 0;
+};
+
+/**
+ * Memory mapped deposit file written by MedipixRecorder
+ */
+class DepositRecord {
+public:
+    explicit DepositRecord(const std::string &filename);
+
+    [[nodiscard]] size_t get_number_of_photons() const;
+
+    [[nodiscard]] size_t get_number_of_deposits() const;
+
+    /**
+     * Deposits of photon k
+     * @return pointer to the first deposit and number of deposits
+     */
+    [[nodiscard]] std::pair<const Deposit *, size_t> get_photon(size_t k) const;
+
+    /**
+     * Pixel matrix of the recorder
+     */
+    [[nodiscard]] unsigned int get_num_pixels_x() const;
+
+    [[nodiscard]] unsigned int get_num_pixels_y() const;
+
+    /**
+     * Throws std::invalid_argument if the pixel matrix of detector differs from the one of the recorder
+     */
+    void check_geometry(const Medipix &detector) const;
+
+private:
+    std::shared_ptr<const unsigned char> data;
+    const Deposit *deposits = nullptr;
+    size_t n_deposits = 0;
+    std::vector<size_t> photon_start;
+    unsigned int n_pixel_x = 0;
+    unsigned int n_pixel_y = 0;
+};
+
+/**
+ * @brief Counts a recorded exposure with several detectors.
+ *
+ * Every detector gets one frame (start_frame(), Medipix::replay_photon() for every recorded photon, finish_frame()),
+ * afterwards its image holds the counts. Detectors can be SPM or CSM, timed or non-timed, with any thresholds, but
+ * need the pixel matrix of the recorder (std::invalid_argument otherwise). The detectors are processed in parallel,
+ * one detector per thread, their own parallel regions run with one thread (see SerialNestedRegions).
+ *
+ * @param detectors Distinct detectors
+ * @param record Recorded exposure
+ */
+void replay(const std::vector<std::shared_ptr<Medipix>> &detectors, const DepositRecord &record);
+
+#endif //MEDIPIX_MEDIPIX_RECORDER_H
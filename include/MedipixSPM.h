@@ -20,9 +20,37 @@
 #define MEDIPIX_MEDIPIX_SPM_H
 
 
+#include "FrameStack.h"
 #include "Medipix.h"
+#include "schedule.h"
+#include <algorithm>
 #include <list>
+#include <vector>
 
+/**
+ * Time window in which the counter of a pixel is enabled
+ */
+struct ShutterWindow {
+    /**
+     * Opening of the shutter in µs
+     */
+    double start;
+
+    /**
+     * Closing of the shutter in µs
+     */
+    double end;
+};
+
+/**
+ * Windows of consecutive frames
+ * @param n_frames Number of frames
+ * @param frame_time Time the shutter is open per frame in µs
+ * @param dead_time Time between two frames in µs, 0 for continuous read-write
+ * @param start Opening of the first frame in µs
+ */
+std::vector<ShutterWindow> frame_windows(unsigned int n_frames, double frame_time, double dead_time = 0.,
+                                         double start = 0.);
 
 
 class MedipixSPM: public Medipix {
@@ -41,22 +69,185 @@ public:
      */
     MedipixSPM();
 
+    /**
+     * Creates an independent replica of the detector with the same configuration.
+     */
+    [[nodiscard]] std::shared_ptr<Medipix> clone() const override;
+
     /**
      * Adds an interacting photon.
      *
      * @param energy in keV
      * @param position_x Interaction position in um
      * @param position_y Interaction position in um
+     * @param depth Interaction depth in um, negative for the fixed psf sigma (see Medipix::set_depth_of_interaction())
      * @param radius area in *pixel* in which the charge distribution is calculated
      * @param time interaction time in us. Only relevant for timed mode.
      */
-    void add_photon(float energy, float position_x, float position_y, int radius, float time) override;
+    void add_photon(float energy, float position_x, float position_y, float depth, int radius, double time) override;
+
+    using Medipix::add_photon;
+
+    void replay_photon(const Deposit *deposits, size_t n) override;
 
     /**
      * Finishes the current frame. In timed mode here the pile-up events are processed.
      * This can take a while.
      */
     void finish_frame() override;
+
+    /**
+     * Selects the pile-up evaluation of timed frames: the signals of pileup_lanes pixels are scanned together in SIMD
+     * lanes (default, see count_crossings()) or one pixel at a time. The counts are the same.
+     */
+    void set_simd_pileup(bool enabled);
+
+    [[nodiscard]] bool get_simd_pileup() const;
+
+    /**
+     * Selects the scheduling of the pile-up evaluation (finish_frame() and rebin()): tasks balanced by the event count
+     * and signal length of the pixels (default, see balance_tasks()) or fixed chunks of pixels in index order. With
+     * edges or hot spots the work per pixel varies by orders of magnitude. The counts are the same.
+     */
+    void set_cost_scheduling(bool enabled);
+
+    [[nodiscard]] bool get_cost_scheduling() const;
+
+    /**
+     * Thread utilization of the pile-up evaluation of the last timed finish_frame()
+     */
+    [[nodiscard]] Utilization get_pileup_utilization() const;
+
+    /**
+     * Expected (mean) count image of a non-timed frame, calculated without simulating single photons.
+     *
+     * For a photon at the sub-pixel offset (dx, dy) from a pixel center the pixel counts if the shared energy is above
+     * its threshold. These detection kernels are precomputed for a set of threshold bins between the lowest and the
+     * highest threshold of the region of interest and convolved with the fluence map via FFTW. The expected counts of
+     * a pixel are linearly interpolated between the two bins next to its (dispersed) threshold.
+     *
+     * The fluence map is sampled on a grid that is finer than the pixel matrix by the factor oversampling. Cell (a, b)
+     * covers the position min_x + (a + 0.5) * pitch / oversampling, min_y + (b + 0.5) * pitch / oversampling.
+     * Edge extensions are not supported.
+     *
+     * @param energy in keV
+     * @param fluence Number of interacting photons per cell, (n_x * oversampling) x (n_y * oversampling) row-wise
+     * @param oversampling Number of cells per pixel in each direction
+     * @param n_threshold_bins Number of kernels for the threshold dispersion
+     * @return Expected counts of the pixels in the region of interest (same layout as get_image())
+     */
+    [[nodiscard]] std::vector<double> expected_image(float energy, const std::vector<float> &fluence,
+                                                     unsigned int oversampling = 4,
+                                                     unsigned int n_threshold_bins = 16) const;
+
+    /**
+     * Expected count image of an exposure, see expected_image() and exposure()
+     *
+     * @tparam Pattern Functor (x, y) -> interaction probability, e.g. EdgePattern
+     * @param energy in keV
+     * @param exposure_time in s
+     * @param flux_density in photons / (s mm^2)
+     * @param pattern Interaction probability of a photon at (x, y) in um
+     * @param oversampling Number of cells per pixel in each direction
+     * @param n_threshold_bins Number of kernels for the threshold dispersion
+     * @return Expected counts of the pixels in the region of interest
+     */
+    template<typename Pattern>
+    [[nodiscard]] std::vector<double> expected_image(float energy, double exposure_time, double flux_density,
+                                                     const Pattern &pattern, unsigned int oversampling = 4,
+                                                     unsigned int n_threshold_bins = 16) const {
+        unsigned int n_x = n_pixel_x * oversampling;
+        unsigned int n_y = n_pixel_y * oversampling;
+        float cell = pixel_pitch / float(oversampling);
+        auto photons_per_cell = float(flux_density * exposure_time * double(cell) * 0.001 * double(cell) * 0.001);
+        std::vector<float> fluence(static_cast<size_t>(n_x) * n_y);
+        for (unsigned int a = 0; a < n_x; ++a) {
+            float x = get_min_x() + (float(a) + 0.5f) * cell;
+            for (unsigned int b = 0; b < n_y; ++b) {
+                float y = get_min_y() + (float(b) + 0.5f) * cell;
+                fluence[static_cast<size_t>(a) * n_y + b] =
+                        photons_per_cell * std::clamp(float(pattern(x, y)), 0.f, 1.f);
+            }
+        }
+        return expected_image(energy, fluence, oversampling, n_threshold_bins);
+    }
+
+    /**
+     * Draws a count image from an expected image. Pixel k uses the random stream (seed, k).
+     *
+     * @param expected Expected counts, see expected_image()
+     * @param seed Seed of the random number generator
+     * @param number_of_photons If 0, the counts are Poisson distributed. Otherwise the counts are binomial
+     *  distributed with number_of_photons trials (fixed number of photons in the frame).
+     * @return Counts
+     */
+    [[nodiscard]] static std::vector<unsigned int> sample_image(const std::vector<double> &expected, unsigned int seed,
+                                                                unsigned long long number_of_photons = 0);
+
+    /**
+     * Re-bins the events of a finished timed acquisition into frames. The pixel signals are calculated once for the
+     * whole acquisition and every rising threshold crossing is counted in the window it falls into, so the pile-up
+     * state carries across window boundaries: a pulse that rises before a window opens is not counted in it. Photons
+     * that arrive while the shutter is closed still pile up.
+     *
+     * Each pixel is processed with a single sweep over its signal and the sorted windows.
+     *
+     * @param windows Non-overlapping windows sorted by time, see frame_windows()
+     * @return One frame per window (size of the region of interest). The real photons of the frames are not known.
+     */
+    [[nodiscard]] FrameStack rebin(const std::vector<ShutterWindow> &windows);
+
+protected:
+    /**
+     * Counting kernels without depth of interaction, timed kernels from Medipix
+     */
+    void select_deposit_kernels() override;
+
+private:
+    /**
+     * Counts the threshold crossings of the active pixels (of the loaded tile) one pixel at a time
+     */
+    void count_active_pixels();
+
+    /**
+     * Counts the threshold crossings of the active pixels in groups of pileup_lanes pixels of similar signal length
+     */
+    void count_active_pixels_simd();
+
+    /**
+     * Signal length and cost (signal plus convolved response samples) of the active pixels of the loaded tile
+     */
+    void measure_active_pixels(std::vector<uint32_t> &length, std::vector<uint64_t> &cost) const;
+
+    /**
+     * Tasks of active pixels of the loaded tile, see set_cost_scheduling() and set_numa_placement()
+     */
+    [[nodiscard]] TaskList schedule_active_pixels() const;
+
+    /**
+     * One task per OpenMP thread with the active pixels of its pixel blocks (see set_numa_placement())
+     */
+    [[nodiscard]] TaskList owner_tasks() const;
+
+    void add_utilization(size_t n_tasks, double wall_time, const std::vector<double> &busy);
+
+    bool simd_pileup = true;
+
+    bool cost_scheduling = true;
+
+    Utilization pileup_utilization;
+
+    /**
+     * Counting deposition kernel: the counters of the (2 Radius)^2 pixels around each photon whose shared energy is
+     * above their threshold are increased
+     */
+    template<int Radius>
+    void count_photons(const PhotonBatch &batch);
+
+    template<int Radius>
+    static void count_kernel(Medipix &medipix, const PhotonBatch &batch) {
+        static_cast<MedipixSPM &>(medipix).count_photons<Radius>(batch);
+    }
 };
 
 
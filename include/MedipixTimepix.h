@@ -0,0 +1,260 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_MEDIPIX_TIMEPIX_H
+#define MEDIPIX_MEDIPIX_TIMEPIX_H
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Medipix.h"
+#include "burst.h"
+#include "helper.h"
+
+/**
+ * Hit of a data-driven (Timepix3/4 like) readout: one record per threshold crossing of a pixel.
+ * 16 bytes, written as is to hit files.
+ */
+struct Hit {
+    /**
+     * Time of arrival (rising threshold crossing) in ticks of the ToA clock
+     */
+    uint64_t toa;
+
+    /**
+     * Pixel index i * n_pixel_y + j of the full detector
+     */
+    uint32_t pixel;
+
+    /**
+     * Time over threshold in ticks of the ToT clock
+     */
+    uint32_t tot;
+};
+
+/**
+ * Receives the hits of an acquisition in time order (by ToA, then pixel)
+ */
+using HitSink = std::function<void(const Hit *hits, size_t n)>;
+
+/**
+ * Hit sink that streams the hits to a binary file of Hit records
+ */
+class HitFileWriter {
+public:
+    explicit HitFileWriter(const std::string &filename);
+
+    void operator()(const Hit *hits, size_t n);
+
+private:
+    std::shared_ptr<std::ofstream> file;
+};
+
+/**
+ * Reads a hit file written by HitFileWriter
+ */
+std::vector<Hit> read_hits(const std::string &filename);
+
+/**
+ * Data-driven detector in the style of Timepix3/4. Instead of counting in frames every rising threshold crossing of
+ * the preamplifier signal is emitted as a hit with its time of arrival and time over threshold.
+ *
+ * The acquisition is processed in consecutive time windows, so the memory stays bounded for arbitrarily long
+ * acquisitions: between begin_window() and end_window() photons are added with times relative to the start of the
+ * window. end_window() processes the pixel signals of the window in parallel (per-thread hit buffers, merged in
+ * time order with a k-way merge) and passes all hits that can no longer be preceded by a later hit to the sink.
+ * Events that still influence the signal of the next window are carried over.
+ *
+ * The signal is sampled with the sampling of the preamplifier response (10 ns), ToA and ToT are quantized to their
+ * clocks.
+ */
+class MedipixTimepix : public Medipix {
+public:
+    /**
+     * @param nx Number of pixels in x direction
+     * @param ny Number of pixels in y direction
+     */
+    explicit MedipixTimepix(unsigned int nx = 256, unsigned int ny = 256);
+
+    [[nodiscard]] std::shared_ptr<Medipix> clone() const override;
+
+    /**
+     * Adds an interacting photon.
+     *
+     * @param energy in keV
+     * @param position_x Interaction position in um
+     * @param position_y Interaction position in um
+     * @param depth Interaction depth in um, negative for the fixed psf sigma
+     * @param radius area in *pixel* in which the charge distribution is calculated
+     * @param time interaction time in us relative to the start of the current window
+     */
+    void add_photon(float energy, float position_x, float position_y, float depth, int radius, double time) override;
+
+    using Medipix::add_photon;
+
+    /**
+     * Adds a batch of photons with times relative to the start of the current window, see Medipix::add_photons()
+     */
+    void add_photons(const PhotonBatch &batch) override;
+
+    /**
+     * Starts an acquisition. The image counts the hits per pixel.
+     * @param sink Receives the hits in time order
+     */
+    void start_acquisition(HitSink sink);
+
+    /**
+     * Opens the next window of the acquisition
+     * @param length Length of the window in us
+     */
+    void begin_window(float length);
+
+    /**
+     * Processes the current window
+     */
+    void end_window();
+
+    /**
+     * Processes the remaining signals (open hits are closed) and flushes all hits to the sink
+     */
+    void finish_acquisition();
+
+    /**
+     * Sets the clocks
+     * @param toa_clock ToA clock in MHz (40 MHz for the coarse ToA of Timepix3)
+     * @param tot_clock ToT clock in MHz
+     */
+    void set_clocks(double toa_clock, double tot_clock);
+
+    [[nodiscard]] double get_toa_clock() const;
+
+    [[nodiscard]] double get_tot_clock() const;
+
+    /**
+     * Energy deposited in the pixel of a hit, calibrated from its time over threshold. The calibration inverts the
+     * time the scaled preamplifier response spends above the pixel threshold, so it is exact (up to the ToT
+     * quantization) for hits of a single deposit without pile-up. Available after start_acquisition().
+     * @return energy in keV
+     */
+    [[nodiscard]] float get_hit_energy(const Hit &hit) const;
+
+    /**
+     * Number of hits passed to the sink in the current acquisition
+     */
+    [[nodiscard]] unsigned long long get_number_of_hits() const;
+
+    /**
+     * Number of hits that are held back because an earlier hit is still over threshold
+     */
+    [[nodiscard]] size_t get_pending_hits() const;
+
+    /**
+     * Start of the current window in us since the start of the acquisition
+     */
+    [[nodiscard]] double get_window_start() const;
+
+protected:
+    /**
+     * Timed kernels from Medipix without depth of interaction
+     */
+    void select_deposit_kernels() override;
+
+private:
+    /**
+     * Finds the threshold crossings of the k-th active pixel in the current window and collects the events that
+     * reach into the next window
+     * @param buffer Decoding buffer of the events
+     */
+    void process_pixel(size_t k, std::vector<Hit> &hits, std::vector<std::pair<uint32_t, Event>> &carry,
+                       std::vector<Event> &buffer);
+
+    /**
+     * Merges the per-thread hits into the pending hits and passes the hits before safe_time (in us) to the sink
+     */
+    void merge_and_flush(double safe_time);
+
+    HitSink sink;
+    double toa_clock = 40.;
+    double tot_clock = 40.;
+    double window_start = 0.;
+    float window_length = 0.f;
+    bool window_open = false;
+    unsigned long long number_of_hits = 0;
+
+    /**
+     * Per pixel of the region of interest: rising crossing of an open hit in us since the start of the acquisition,
+     * negative if the signal is below threshold
+     */
+    std::vector<double> open_hit;
+
+    /**
+     * Per-thread hit buffers, reused between windows
+     */
+    std::vector<std::vector<Hit>> thread_hits;
+
+    /**
+     * Per-thread buffers of the events carried over to the next window
+     */
+    std::vector<std::vector<std::pair<uint32_t, Event>>> thread_carry;
+
+    /**
+     * Hits in time order that are not yet passed to the sink
+     */
+    std::vector<Hit> pending_hits;
+
+    /**
+     * Preamplifier response sorted in descending order: a deposit E stays n samples above the threshold th if
+     * tot_calibration[n] <= th / E < tot_calibration[n - 1]
+     */
+    std::vector<float> tot_calibration;
+};
+
+/**
+ * @brief Data-driven acquisition of a Timepix detector.
+ *
+ * The acquisition is split into windows, window k is exposed with frame_seed(seed, k), so the hits only depend on the
+ * seed and the window length, not on the number of threads.
+ *
+ * @param detector
+ * @param source Energy in keV or Spectrum
+ * @param acquisition_time in s
+ * @param window_time Length of a processing window in s, bounds the memory
+ * @param flux_density in photons / (s mm^2)
+ * @param pattern Interaction probability of a photon at (x, y) in um
+ * @param seed Seed of the random number generator
+ * @param sink Receives the hits in time order, e.g. HitFileWriter
+ */
+template<typename Source, typename Pattern>
+void timepix_acquisition(const std::shared_ptr<MedipixTimepix> &detector, const Source &source,
+                         double acquisition_time, double window_time, double flux_density, const Pattern &pattern,
+                         unsigned int seed, HitSink sink) {
+    detector->start_acquisition(std::move(sink));
+    auto n_windows = static_cast<unsigned int>(std::ceil(acquisition_time / window_time - 1E-9));
+    for (unsigned int window = 0; window < n_windows; ++window) {
+        double length = std::min(window_time, acquisition_time - window * window_time);
+        detector->begin_window(float(length * 1E6));
+        exposure(std::static_pointer_cast<Medipix>(detector), source, length, flux_density, pattern,
+                 frame_seed(seed, window));
+        detector->end_window();
+    }
+    detector->finish_acquisition();
+}
+
+#endif //MEDIPIX_MEDIPIX_TIMEPIX_H
@@ -0,0 +1,105 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_RANDOM_STREAM_H
+#define MEDIPIX_RANDOM_STREAM_H
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <numbers>
+
+/**
+ * Small counter based random number generator (SplitMix64).
+ *
+ * A stream is fully defined by (seed, stream), so every photon, frame or pixel can get its own independent stream
+ * without sharing state between threads. Constructing a stream is as cheap as copying an integer.
+ * Satisfies UniformRandomBitGenerator, so it can be used with the distributions of <random>.
+ */
+class RandomStream {
+public:
+    using result_type = uint64_t;
+
+    /**
+     * @param seed Seed of the simulation
+     * @param stream Index of the stream (e.g. photon, frame or pixel index)
+     */
+    RandomStream(uint64_t seed, uint64_t stream) : state(mix(seed + mix(stream + 0x632BE59BD9B4E019ull))) {}
+
+    static constexpr result_type min() { return 0; }
+
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        state += 0x9E3779B97F4A7C15ull;
+        return mix(state);
+    }
+
+    /**
+     * Uniform random number in [0, 1)
+     */
+    float uniform() {
+        return float((*this)() >> 40) * 0x1.0p-24f;
+    }
+
+    /**
+     * Uniform random number in [a, b)
+     */
+    float uniform(float a, float b) {
+        return a + (b - a) * uniform();
+    }
+
+    /**
+     * Uniform random number in [0, 1) with 53 bits, uses one number of the stream like uniform()
+     */
+    double uniform_double() {
+        return double((*this)() >> 11) * 0x1.0p-53;
+    }
+
+    /**
+     * Uniform random number in [a, b) with 53 bits, e.g. for interaction times in long frames
+     */
+    double uniform_double(double a, double b) {
+        return a + (b - a) * uniform_double();
+    }
+
+    /**
+     * Normal distributed random number (Box-Muller)
+     * @param mean
+     * @param sigma
+     */
+    float normal(float mean, float sigma) {
+        float u1 = 1.f - uniform();
+        float u2 = uniform();
+        return mean + sigma * std::sqrt(-2.f * std::log(u1)) * std::cos(2.f * std::numbers::pi_v<float> * u2);
+    }
+
+    /**
+     * SplitMix64 finalizer, also used to derive seeds for sub streams
+     */
+    static constexpr uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t state;
+};
+
+#endif //MEDIPIX_RANDOM_STREAM_H
@@ -0,0 +1,81 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_RESPONSE_CONVOLVER_H
+#define MEDIPIX_RESPONSE_CONVOLVER_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+struct fftw_plan_s;
+
+/**
+ * @brief FFT convolution of a sampled impulse train with the preamplifier response.
+ *
+ * Long signals are split into blocks that are transformed with the cached response spectrum and overlap-added, so the
+ * cost per sample does not depend on the number of pulses. Used by Medipix::calculate_pixel_signal() for dense pixels.
+ * The plans are created once, convolve() can be called from several threads.
+ */
+class ResponseConvolver {
+public:
+    /**
+     * @param response Sampled response function. The FFT length is the smallest power of two of at least 4 times
+     * its size.
+     */
+    explicit ResponseConvolver(const std::vector<float> &response);
+
+    ~ResponseConvolver();
+
+    ResponseConvolver(const ResponseConvolver &) = delete;
+
+    ResponseConvolver &operator=(const ResponseConvolver &) = delete;
+
+    /**
+     * Calculates signal[s] = sum_t impulses[t] * response[s - t] for s < n_samples.
+     * @param impulses Sum of the pulse heights starting at each sample, n_samples values
+     * @param n_samples
+     * @param signal Receives n_samples values
+     * @param resource Memory of the work buffers
+     */
+    void convolve(const double *impulses, size_t n_samples, float *signal, std::pmr::memory_resource &resource) const;
+
+    [[nodiscard]] size_t get_response_size() const;
+
+    [[nodiscard]] size_t get_fft_size() const;
+
+    /**
+     * Samples per overlap-add block (FFT length - response size + 1)
+     */
+    [[nodiscard]] size_t get_block_size() const;
+
+private:
+    size_t response_size;
+    size_t fft_size;
+    size_t block_size;
+
+    /**
+     * Spectrum of the response divided by the FFT length, (real, imaginary) of fft_size / 2 + 1 frequencies
+     */
+    std::vector<double> spectrum;
+
+    fftw_plan_s *forward = nullptr;
+    fftw_plan_s *backward = nullptr;
+};
+
+#endif //MEDIPIX_RESPONSE_CONVOLVER_H
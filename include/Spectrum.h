@@ -0,0 +1,73 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_SPECTRUM_H
+#define MEDIPIX_SPECTRUM_H
+
+#include <string>
+#include <vector>
+#include "AliasTable.h"
+
+/**
+ * Tabulated photon spectrum (e.g. of an X-ray tube). The energies are drawn with an alias table, so drawing the
+ * energy of a photon takes constant time independent of the number of spectral bins.
+ */
+class Spectrum {
+public:
+    /**
+     * @param energies Energies of the bins in keV
+     * @param weights Relative number of photons per bin, non-negative
+     */
+    Spectrum(std::vector<float> energies, const std::vector<float> &weights);
+
+    /**
+     * Reads a spectrum from a text file with two columns: energy in keV and weight. Empty lines and lines starting
+     * with # are ignored.
+     * @param filename
+     * @return
+     */
+    static Spectrum from_file(const std::string &filename);
+
+    /**
+     * Draws the energy of a photon
+     * @param rng Random stream of the photon, a single 64 bit draw is used
+     * @return energy in keV
+     */
+    [[nodiscard]] inline float sample(RandomStream &rng) const {
+        return energies[table.sample(rng)];
+    }
+
+    /**
+     * Weighted mean energy in keV
+     */
+    [[nodiscard]] float get_mean_energy() const;
+
+    [[nodiscard]] const std::vector<float> &get_energies() const;
+
+    /**
+     * Normalized probability of each bin
+     */
+    [[nodiscard]] std::vector<float> get_probabilities() const;
+
+private:
+    std::vector<float> energies;
+    std::vector<float> probabilities;
+    AliasTable table;
+};
+
+#endif //MEDIPIX_SPECTRUM_H
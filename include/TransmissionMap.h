@@ -0,0 +1,138 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_TRANSMISSION_MAP_H
+#define MEDIPIX_TRANSMISSION_MAP_H
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AliasTable.h"
+
+class Medipix;
+
+/**
+ * 2D map of the transmission (or relative fluence) in front of the detector.
+ *
+ * The map has nx * ny cells stored row-wise (index i * ny + j) and covers the rectangle
+ * [min_x, max_x) x [min_y, max_y) in µm. A value of 1 means the full flux density reaches the sensor.
+ * The alias table over the cells is built once on construction.
+ */
+class TransmissionMap {
+public:
+    /**
+     * @param values Transmission per cell, non-negative
+     * @param nx Number of cells in x direction
+     * @param ny Number of cells in y direction
+     * @param min_x in µm
+     * @param max_x in µm
+     * @param min_y in µm
+     * @param max_y in µm
+     */
+    TransmissionMap(std::vector<float> values, unsigned int nx, unsigned int ny, float min_x, float max_x,
+                    float min_y, float max_y);
+
+    /**
+     * Map that covers the sensor of the detector
+     */
+    TransmissionMap(std::vector<float> values, unsigned int nx, unsigned int ny,
+                    const std::shared_ptr<Medipix> &medipix);
+
+    /**
+     * Memory maps a raw file of nx * ny floats (row-wise)
+     * @param filename
+     * @param nx Number of cells in x direction
+     * @param ny Number of cells in y direction
+     * @param medipix Detector, the map covers its sensor
+     */
+    static TransmissionMap from_file(const std::string &filename, unsigned int nx, unsigned int ny,
+                                     const std::shared_ptr<Medipix> &medipix);
+
+    /**
+     * Transmission of the cell (i, j)
+     */
+    [[nodiscard]] float get_value(unsigned int i, unsigned int j) const;
+
+    /**
+     * Mean transmission of all cells
+     */
+    [[nodiscard]] double get_mean() const;
+
+    /**
+     * Maximal transmission of all cells
+     */
+    [[nodiscard]] float get_max() const;
+
+    /**
+     * Draws the position of an interacting photon: the cell from the alias table and the position inside the cell
+     * uniformly.
+     * @param rng
+     * @return x, y in µm
+     */
+    [[nodiscard]] inline std::pair<float, float> sample_position(RandomStream &rng) const {
+        uint32_t cell = table.sample(rng);
+        float x = min_x + (float(cell / n_cells_y) + rng.uniform()) * cell_width;
+        float y = min_y + (float(cell % n_cells_y) + rng.uniform()) * cell_height;
+        return std::make_pair(x, y);
+    }
+
+    /**
+     * Area covered by the map in mm^2
+     */
+    [[nodiscard]] double get_area() const;
+
+private:
+    TransmissionMap(std::shared_ptr<const float> data, unsigned int nx, unsigned int ny, float min_x, float max_x,
+                    float min_y, float max_y);
+
+    /**
+     * Cell values, either owned or memory mapped
+     */
+    std::shared_ptr<const float> data;
+
+    unsigned int n_cells_x;
+    unsigned int n_cells_y;
+    float min_x;
+    float min_y;
+    float cell_width;
+    float cell_height;
+
+    AliasTable table;
+    float max_value = 0.f;
+};
+
+/**
+ * @brief Exposure through a transmission map.
+ *
+ * Instead of drawing photons on the whole sensor and rejecting the absorbed ones, the number of interacting
+ * photons is drawn once (binomial for transmissions <= 1, Poisson otherwise) and only these photons are
+ * generated, their positions are drawn from the alias table of the map. The cost per interacting photon is
+ * independent of the transmission pattern.
+ *
+ * @param medipix
+ * @param energy in keV
+ * @param exposure_time in s
+ * @param flux_density in front of the map in photons / (s mm^2)
+ * @param map Transmission map
+ * @param seed Seed of the random number generator
+ */
+void transmission_exposure(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time,
+                           double flux_density, const TransmissionMap &map, unsigned int seed = time(nullptr));
+
+#endif //MEDIPIX_TRANSMISSION_MAP_H
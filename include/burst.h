@@ -0,0 +1,63 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_BURST_H
+#define MEDIPIX_BURST_H
+
+#include <functional>
+#include <memory>
+#include "FrameStack.h"
+
+class Medipix;
+
+/**
+ * Exposure of a single frame. Gets the detector replica and the seed of the frame.
+ * Example: [](const std::shared_ptr<Medipix> &m, unsigned int seed) { homogeneous_exposure(m, 30.f, 1E-3, 1E7, seed); }
+ */
+using FrameExposure = std::function<void(const std::shared_ptr<Medipix> &, unsigned int)>;
+
+/**
+ * Seed of a frame in a burst. Frames get independent random streams derived from the burst seed.
+ * @param seed Seed of the burst
+ * @param frame frame index
+ */
+unsigned int frame_seed(unsigned int seed, unsigned int frame);
+
+/**
+ * @brief Simulates n_frames independent frames of the same detector configuration.
+ *
+ * Parallelism is over frames instead of photons/pixels: every worker thread works on its own replica of the
+ * detector (see Medipix::clone()) and takes the next unprocessed frame when it is done (dynamic scheduling), so no
+ * mutex is shared between threads. This pays off for small detectors where the parallelization inside a frame is
+ * dominated by overhead. The exposure of each frame runs single threaded: the parallel regions inside the exposure
+ * and finish_frame() are nested in the frame loop, burst() limits the active levels to one for its duration
+ * (omp_set_max_active_levels()), so they get a team of one thread instead of oversubscribing the cores. Only with a
+ * single worker thread the frames use the parallel regions of the detector.
+ *
+ * The result only depends on the seed, not on the number of threads.
+ *
+ * @param medipix Detector that defines the configuration. It is not modified.
+ * @param n_frames Number of frames
+ * @param frame_exposure Exposure of a single frame, called between start_frame() and finish_frame()
+ * @param seed Seed of the burst, frame k uses frame_seed(seed, k)
+ * @return stack with all frames (size of the region of interest)
+ */
+FrameStack burst(const std::shared_ptr<Medipix> &medipix, unsigned int n_frames, const FrameExposure &frame_exposure,
+                 unsigned int seed);
+
+#endif //MEDIPIX_BURST_H
@@ -0,0 +1,68 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_CLUSTER_H
+#define MEDIPIX_CLUSTER_H
+
+#include <vector>
+#include "MedipixTimepix.h"
+
+/**
+ * Hits of neighbouring pixels that belong to one photon
+ */
+struct Cluster {
+    /**
+     * Time of arrival of the earliest hit in us
+     */
+    double toa;
+
+    /**
+     * Sum of the calibrated hit energies in keV (charge sharing corrected energy of the photon)
+     */
+    float energy;
+
+    /**
+     * Energy weighted centroid in um, the mean of the pixel centers if the hits have no energy
+     */
+    float x;
+    float y;
+
+    /**
+     * Number of hits
+     */
+    unsigned int size;
+};
+
+/**
+ * @brief Clusters a time ordered hit stream into photons.
+ *
+ * Hits of 8-connected pixels whose times of arrival differ by at most time_window are joined (union-find). The
+ * detector is split into tiles of tile_rows pixel rows that are clustered in parallel with a time sorted sweep,
+ * afterwards the rows at the tile borders are stitched. The result does not depend on the tile size or the number of
+ * threads.
+ *
+ * @param detector Geometry and ToT calibration (see MedipixTimepix::get_hit_energy()), after start_acquisition()
+ * @param hits Hits sorted by time of arrival, e.g. read with read_hits()
+ * @param time_window Maximum difference of the times of arrival of neighbouring hits in us
+ * @param tile_rows Number of pixel rows per tile
+ * @return clusters sorted by time of arrival
+ */
+std::vector<Cluster> cluster_hits(const MedipixTimepix &detector, const std::vector<Hit> &hits,
+                                  double time_window = 0.5, unsigned int tile_rows = 16);
+
+#endif //MEDIPIX_CLUSTER_H
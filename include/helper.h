@@ -19,10 +19,56 @@
 #ifndef MEDIPIX_HELPER_H
 #define MEDIPIX_HELPER_H
 
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <functional>
+#include <ctime>
+#include <numbers>
+#include <type_traits>
+#include "Medipix.h"
+#include "RandomStream.h"
+#include "Spectrum.h"
 
-class Medipix;
+/**
+ * Pattern functors for the exposure templates. A pattern returns the probability in [0, 1] that a photon at (x, y)
+ * (in um) interacts with the detector. Plain predicates returning bool work as well.
+ * The patterns are inlined into the batched exposure loop, so they should be cheap and free of side effects.
+ */
+
+/**
+ * Every photon interacts
+ */
+struct HomogeneousPattern {
+    float operator()(float, float) const { return 1.f; }
+};
+
+/**
+ * Photons right of the line y = m * x + c interact
+ */
+struct EdgePattern {
+    float m;
+    float c;
+
+    float operator()(float x, float y) const { return y > m * x + c ? 1.f : 0.f; }
+};
+
+/**
+ * Sinusoidal transmission, see frequency_transmission()
+ */
+struct FrequencyPattern {
+    float period;
+    float phase;
+    /**
+     * Normalized normal of the sin-wave
+     */
+    float n_x;
+    float n_y;
+
+    float operator()(float x, float y) const {
+        return std::sin(2.f * std::numbers::pi_v<float> * (n_x * x + n_y * y) / period + phase);
+    }
+};
 
 /**
  * @brief Simulates a homogeneous exposure of the Medipix
@@ -30,8 +76,9 @@ class Medipix;
  * @param energy in keV
  * @param exposure_time in s
  * @param flux_density Flux density is used to calculate the time period in which number_of_photons are emitted in photons / (s mm^2)
+ * @param seed Seed of the random number generator. The same seed gives the same photons.
  */
-[[maybe_unused]] void homogeneous_exposure(const std::shared_ptr<Medipix>& medipix, float energy, double exposure_time, double flux_density);
+[[maybe_unused]] void homogeneous_exposure(const std::shared_ptr<Medipix>& medipix, float energy, double exposure_time, double flux_density, unsigned int seed = time(nullptr));
 
 /**
  *
@@ -41,8 +88,9 @@ class Medipix;
  * @param c y-intercept of the edge in um
  * @param exposure_time in s
  * @param flux_density Flux density is used to calculate the time period in which number_of_photons are emitted in photons / (s mm^2)
+ * @param seed Seed of the random number generator
  */
-[[maybe_unused]] void edge_exposure(const std::shared_ptr<Medipix>& medipix, float energy, float m, float c, double exposure_time, double flux_density);
+[[maybe_unused]] void edge_exposure(const std::shared_ptr<Medipix>& medipix, float energy, float m, float c, double exposure_time, double flux_density, unsigned int seed = time(nullptr));
 
 /**
  *
@@ -54,8 +102,113 @@ class Medipix;
  * @param n_x Vector of the normal of the sin-wave in x-direction
  * @param n_y Vector of the normal of the sin-wave in y-direction
  * @param flux_density Flux density is used to calculate the time period in which number_of_photons are emitted in photons / (s mm^2)
+ * @param seed Seed of the random number generator
  */
-[[maybe_unused]] void frequency_exposure(const std::shared_ptr<Medipix>& medipix, float energy, double exposure_time, float period, float phase, float n_x, float n_y, double flux_density);
+[[maybe_unused]] void frequency_exposure(const std::shared_ptr<Medipix>& medipix, float energy, double exposure_time, float period, float phase, float n_x, float n_y, double flux_density, unsigned int seed = time(nullptr));
+
+/**
+ * Number of photons that hit the sensor during an exposure
+ * @param medipix
+ * @param exposure_time in s
+ * @param flux_density in photons / (s mm^2)
+ * @return
+ */
+unsigned long long get_number_of_photons(const std::shared_ptr<Medipix>& medipix, double exposure_time, double flux_density);
+
+/**
+ * Simulates only the photons with index in [first_photon, last_photon) of an exposure.
+ * Photon k is the same photon as in the full exposure with the same seed, so disjoint ranges can be simulated
+ * independently (e.g. in different processes) and their non-timed count images add up to the full exposure.
+ *
+ * The photons are processed in batches: positions are drawn for the whole batch, the pattern is evaluated for the
+ * batch in one SIMD loop and the batch is added to the detector with one call (see Medipix::add_photons()). With a
+ * region of interest only the photons within it (plus a halo) draw their time, energy and depth and are evaluated.
+ *
+ * @tparam Source float for monochromatic photons or Spectrum
+ * @tparam Pattern Functor (x, y) -> interaction probability, e.g. EdgePattern
+ * @param medipix
+ * @param source Energy in keV or spectrum. The energy of a photon is drawn from its own stream.
+ * @param exposure_time in s
+ * @param pattern Interaction probability of a photon at (x, y) in um
+ * @param seed Seed of the random number generator
+ * @param first_photon Index of the first photon
+ * @param last_photon Index after the last photon
+ */
+template<typename Source, typename Pattern>
+void partial_exposure(const std::shared_ptr<Medipix>& medipix, const Source& source, double exposure_time, const Pattern& pattern, unsigned int seed, unsigned long long first_photon, unsigned long long last_photon) {
+    static constexpr unsigned int batch_size = 256;
+    double duration = exposure_time * 1E6;
+    medipix->check_exposure_duration(duration);
+    float min_x = medipix->get_min_x();
+    float max_x = medipix->get_max_x();
+    float min_y = medipix->get_min_y();
+    float max_y = medipix->get_max_y();
+    unsigned long long n_batches = last_photon > first_photon ? (last_photon - first_photon + batch_size - 1) / batch_size : 0;
+    bool depth_of_interaction = medipix->has_depth_of_interaction();
+    const SensorLayer *sensor = medipix->get_sensor().get();
+
+    #pragma omp parallel for default(none) shared(medipix, source, first_photon, last_photon, pattern, duration, seed, min_x, max_x, min_y, max_y, n_batches, depth_of_interaction, sensor)
+    for (unsigned long long b = 0; b < n_batches; ++b) {
+        unsigned long long first = first_photon + b * batch_size;
+        auto n = static_cast<unsigned int>(std::min<unsigned long long>(batch_size, last_photon - first));
+        float x[batch_size];
+        float y[batch_size];
+        double t[batch_size];
+        float u[batch_size];
+        float energy[batch_size];
+        float depth[batch_size];
+        float v[batch_size];
+        float sensor_probability[batch_size];
+        bool interacting[batch_size];
+
+        // Photon k always uses stream (seed, k): x, y, t, the number for the interaction, the energy, the number for
+        // the interaction in the sensor (if set), then the depth. Photons outside of the region of interest (plus
+        // halo) stop after x and y, the photons of the region are moved to the front of the batch.
+        unsigned int n_roi = 0;
+        for (unsigned int k = 0; k < n; ++k) {
+            RandomStream rng(seed, first + k);
+            float photon_x = rng.uniform(min_x, max_x);
+            float photon_y = rng.uniform(min_y, max_y);
+            if (!medipix->in_region_of_interest(photon_x, photon_y, 3))
+                continue;
+            unsigned int l = n_roi++;
+            x[l] = photon_x;
+            y[l] = photon_y;
+            t[l] = rng.uniform_double(0., duration);
+            u[l] = rng.uniform();
+            if constexpr (std::is_arithmetic_v<Source>)
+                energy[l] = float(source);
+            else
+                energy[l] = source.sample(rng);
+            v[l] = sensor ? rng.uniform() : 0.f;
+            sensor_probability[l] = sensor ? sensor->interaction_probability(energy[l]) : 1.f;
+            depth[l] = depth_of_interaction ? medipix->draw_interaction_depth(energy[l], rng) : -1.f;
+        }
+        #pragma omp simd
+        for (unsigned int k = 0; k < n_roi; ++k) {
+            interacting[k] = u[k] < float(pattern(x[k], y[k])) && v[k] < sensor_probability[k];
+        }
+        medipix->add_photons(PhotonBatch{energy, x, y, depth, t, interacting, n_roi, 3});
+    }
+}
+
+/**
+ *
+ * @tparam Source float for monochromatic photons or Spectrum
+ * @tparam Pattern Functor (x, y) -> interaction probability, e.g. EdgePattern
+ * @param medipix
+ * @param source Energy in keV or spectrum
+ * @param exposure_time in s
+ * @param flux_density in photons / (s mm^2)
+ * @param pattern Interaction probability of a photon at (x, y) in um
+ * @param seed Seed of the random number generator. Photon k is drawn from its own stream (seed, k), so the result
+ *  does not depend on the number of threads.
+ */
+template<typename Source, typename Pattern>
+void exposure(const std::shared_ptr<Medipix>& medipix, const Source& source, double exposure_time, double flux_density, const Pattern& pattern, unsigned int seed = time(nullptr)) {
+    partial_exposure(medipix, source, exposure_time, pattern, seed, 0,
+                     get_number_of_photons(medipix, exposure_time, flux_density));
+}
 
 /**
  *
@@ -65,8 +218,16 @@ class Medipix;
  * @param flux_density in photons / (s mm^2)
  * @param photon_interacting Function that returns true if the photon is interacting with the detector.
  *  The function takes the x and y position of the photon in um as arguments.
+ *  Prefer a pattern functor (template overload) in hot loops, a std::function can not be inlined.
+ * @param seed Seed of the random number generator. Photon k is drawn from its own stream (seed, k), so the result
+ *  does not depend on the number of threads.
+ */
+void exposure(const std::shared_ptr<Medipix>& medipix, float energy, double exposure_time, double flux_density, const std::function<bool (float, float)>& photon_interacting, unsigned int seed = time(nullptr));
+
+/**
+ * std::function version of partial_exposure(), see the template above
  */
-void exposure(const std::shared_ptr<Medipix>& medipix, float energy, double exposure_time, double flux_density, const std::function<bool (float, float)>& photon_interacting);
+void partial_exposure(const std::shared_ptr<Medipix>& medipix, float energy, double exposure_time, const std::function<bool (float, float)>& photon_interacting, unsigned int seed, unsigned long long first_photon, unsigned long long last_photon);
 
 
 /**
@@ -80,7 +241,7 @@ void exposure(const std::shared_ptr<Medipix>& medipix, float energy, double expo
 bool edge(float x, float y, float m, float c);
 
 /**
- * Makes a random guess if the photon is interacting with the detector depending on the "attenuation" of the sin-wave.
+ * Transmission of the sin-wave at (x, y), negative values mean no transmission
  *
  * @param x
  * @param y
@@ -90,14 +251,31 @@ bool edge(float x, float y, float m, float c);
  * @param n_y Normalized vector of the normal of the sin-wave in y-direction
  * @return
  */
-bool frequency(float x, float y, float period, float phase, float n_x, float n_y);
+float frequency_transmission(float x, float y, float period, float phase, float n_x, float n_y);
 
 /**
- * Draws a random interaction depth for a mu rho
+ * Decides if the photon is interacting with the detector depending on the "attenuation" of the sin-wave.
+ *
+ * @param x
+ * @param y
+ * @param period
+ * @param phase
+ * @param n_x Normalized vector of the normal of the sin-wave in x-direction
+ * @param n_y Normalized vector of the normal of the sin-wave in y-direction
+ * @param u Uniform random number in [0, 1), e.g. from the RandomStream of the photon
+ * @return
+ */
+bool frequency(float x, float y, float period, float phase, float n_x, float n_y, float u);
+
+/**
+ * Draws a random interaction depth from Beer-Lambert's law for a photon that interacts in a sensor of the given
+ * thickness (inverse transform sampling of the truncated exponential distribution)
  * @param mu_norm in cm^2/g
  * @param rho in g/cm^3
- * @return
+ * @param thickness in um
+ * @param rng Random stream of the photon
+ * @return depth in um
  */
-[[maybe_unused]] float get_random_free_path(float mu_norm, float rho);
+[[maybe_unused]] float get_random_free_path(float mu_norm, float rho, float thickness, RandomStream &rng);
 
 #endif //MEDIPIX_HELPER_H
@@ -0,0 +1,42 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_PARALLEL_H
+#define MEDIPIX_PARALLEL_H
+
+/**
+ * Limits the active levels of parallel regions to one (omp_set_max_active_levels()) while it exists and restores the
+ * previous limit afterwards. Loops that give every thread its own detector (burst(), sweep(), replay(),
+ * Assembly::finish_frame()) use it, so the parallel regions of the detector nested in the loop get a team of one
+ * thread instead of oversubscribing the cores.
+ */
+class SerialNestedRegions {
+public:
+    SerialNestedRegions();
+
+    ~SerialNestedRegions();
+
+    SerialNestedRegions(const SerialNestedRegions &) = delete;
+
+    SerialNestedRegions &operator=(const SerialNestedRegions &) = delete;
+
+private:
+    int max_active_levels;
+};
+
+#endif //MEDIPIX_PARALLEL_H
@@ -0,0 +1,56 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_PILEUP_H
+#define MEDIPIX_PILEUP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Number of pixels whose signals are scanned together by count_crossings(), one per SIMD lane (16 floats of AVX-512,
+ * two registers with AVX2)
+ */
+constexpr unsigned int pileup_lanes = 16;
+
+/**
+ * @brief Counts the rising threshold crossings of pileup_lanes pixel signals at once.
+ *
+ * Each lane has its own signal, threshold, start value and length. The signals are transposed in blocks of a few
+ * cache lines so that sample s of all lanes is compared in one vector operation; samples from length[l] on are masked.
+ * A crossing is a sample above the threshold after one below it, as in the scalar scan of MedipixSPM::finish_frame().
+ *
+ * The function is compiled for AVX-512, AVX2 and the baseline instruction set; the variant is selected at runtime
+ * (see pileup_isa()).
+ *
+ * @param signal Signal per lane, length[l] values (may be nullptr if the length is 0)
+ * @param length Number of samples per lane
+ * @param threshold Threshold per lane
+ * @param previous Value before the first sample per lane
+ * @param counts Receives the number of crossings per lane
+ */
+void count_crossings(const float *const *signal, const uint32_t *length, const float *threshold,
+                     const float *previous, uint32_t *counts);
+
+/**
+ * Instruction set of the count_crossings() variant selected for this CPU: "avx512f", "avx2" or "default"
+ */
+std::string pileup_isa();
+
+#endif //MEDIPIX_PILEUP_H
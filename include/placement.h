@@ -0,0 +1,132 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_PLACEMENT_H
+#define MEDIPIX_PLACEMENT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/**
+ * Allocator that leaves new elements default-initialized, so resizing a vector does not touch its pages. The thread
+ * that writes an element first then places the page on its NUMA node (first touch).
+ */
+template<typename T>
+struct DefaultInitAllocator : std::allocator<T> {
+    template<typename U>
+    struct rebind {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    DefaultInitAllocator() = default;
+
+    template<typename U>
+    explicit DefaultInitAllocator(const DefaultInitAllocator<U> &) noexcept {}
+
+    template<typename U>
+    void construct(U *p) noexcept {
+        ::new(static_cast<void *>(p)) U;
+    }
+
+    template<typename U, typename... Args>
+    void construct(U *p, Args &&... args) {
+        ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+/**
+ * Range [first, last) of n items owned by thread t of n_threads: contiguous blocks of equal size in thread order, the
+ * static ownership of the NUMA placement (see Medipix::set_numa_placement())
+ */
+std::pair<size_t, size_t> owner_range(size_t n, unsigned int t, unsigned int n_threads);
+
+/**
+ * Calls f(first, last) for the blocks [first, last) of n items owned by thread t of n_threads: the items are split
+ * into tiles of tile_size items, each tile into owner_range() blocks. This is the pixel ownership of the NUMA
+ * placement (tiles of the event spill, one tile without spill), image, threshold dispersion and events use the same
+ * blocks.
+ * @param tile_size 0 for a single tile
+ */
+template<typename F>
+void for_owned_blocks(size_t n, size_t tile_size, unsigned int t, unsigned int n_threads, F f) {
+    if (tile_size == 0)
+        tile_size = n;
+    for (size_t tile = 0; tile < n; tile += tile_size) {
+        auto [first, last] = owner_range(std::min(tile_size, n - tile), t, n_threads);
+        if (first < last)
+            f(tile + first, tile + last);
+    }
+}
+
+/**
+ * Number of NUMA nodes, 1 without libnuma (MEDIPIX_HAVE_NUMA)
+ */
+unsigned int get_numa_nodes();
+
+/**
+ * NUMA node of the CPU the calling thread runs on, 0 without libnuma
+ */
+unsigned int get_numa_node();
+
+/**
+ * Reference to the pinning of the OpenMP threads: thread t is pinned to the t-th CPU of the affinity mask of the
+ * calling thread (threads of one node are adjacent), so the owner of a buffer stays on the node of its memory. This
+ * includes the calling thread, it owns the first block of every buffer. The first reference of the process saves the
+ * affinity mask, the threads get it back when the last reference is released. Copies hold a reference of their own.
+ * While a reference is held the pinning also applies to other OpenMP code of the process. Nothing is pinned if the
+ * OpenMP runtime binds the threads (OMP_PROC_BIND) or outside Linux.
+ */
+class ThreadPinning {
+public:
+    ThreadPinning() = default;
+
+    ThreadPinning(const ThreadPinning &other);
+
+    ThreadPinning &operator=(const ThreadPinning &other);
+
+    ~ThreadPinning();
+
+    /**
+     * Takes a reference if this does not hold one and pins the threads. A call pins again if the team
+     * (omp_get_max_threads()) is larger than at the previous one. Must be called outside of parallel regions.
+     */
+    void pin();
+
+    /**
+     * Drops the reference. The last one restores the affinity of the pinned threads, outside of parallel regions.
+     */
+    void release();
+
+    [[nodiscard]] bool is_pinned() const;
+
+private:
+    bool pinned = false;
+};
+
+/**
+ * Moves the pages of [data, data + bytes) to the node of their owner thread (for_owned_blocks() of the bytes over
+ * the OpenMP threads, a page belongs to the owner of its first byte). The content does not change. Needs libnuma,
+ * without it the placement is the one of the first touch.
+ * @param tile_bytes Bytes per tile, 0 for a single tile
+ * @return Number of pages on the node of their owner
+ */
+size_t move_to_owners(const void *data, size_t bytes, size_t tile_bytes = 0);
+
+#endif //MEDIPIX_PLACEMENT_H
@@ -0,0 +1,84 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_SCHEDULE_H
+#define MEDIPIX_SCHEDULE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * Work items grouped into tasks for `schedule(dynamic, 1)`. Task t consists of the items
+ * items[offsets[t]] ... items[offsets[t + 1] - 1].
+ */
+struct TaskList {
+    std::vector<uint32_t> items;
+
+    std::vector<size_t> offsets{0};
+
+    [[nodiscard]] size_t size() const;
+
+    [[nodiscard]] std::span<const uint32_t> get_task(size_t t) const;
+};
+
+/**
+ * @brief Cost-balanced tasks (longest processing time first).
+ *
+ * The items are sorted by decreasing cost and packed into tasks of about total / (n_threads * tasks_per_thread). An
+ * item above that cost is a task of its own. Handed out in order, the expensive tasks start first and the cheap ones
+ * fill the gaps at the end, so a few heavily loaded items do not keep the other threads waiting.
+ *
+ * @param cost Cost of each item (any unit)
+ * @param n_threads
+ * @param tasks_per_thread
+ */
+TaskList balance_tasks(std::span<const uint64_t> cost, unsigned int n_threads, unsigned int tasks_per_thread = 8);
+
+/**
+ * Items 0 ... n_items - 1 in order, chunk items per task (like `schedule(dynamic, chunk)`)
+ */
+TaskList uniform_tasks(size_t n_items, unsigned int chunk);
+
+/**
+ * Thread utilization of parallel task loops. A thread is busy from the start of the loop until it finished its last
+ * task, afterwards it waits for the others.
+ */
+struct Utilization {
+    unsigned int threads = 0;
+
+    size_t tasks = 0;
+
+    /**
+     * Elapsed time of the loops in s
+     */
+    double wall_time = 0.;
+
+    /**
+     * Busy time of all threads in s
+     */
+    double busy_time = 0.;
+
+    /**
+     * Fraction of the thread time spent on tasks, 1 for a perfect balance
+     */
+    [[nodiscard]] double get_utilization() const;
+};
+
+#endif //MEDIPIX_SCHEDULE_H
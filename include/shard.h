@@ -0,0 +1,218 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_SHARD_H
+#define MEDIPIX_SHARD_H
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Medipix.h"
+
+/**
+ * Metadata of a partial count image of a sharded run. It is stored as a text sidecar ("key value" per line) next
+ * to the raw image of the shard.
+ */
+struct ShardInfo {
+    /**
+     * Index of the shard
+     */
+    unsigned int shard = 0;
+
+    /**
+     * Number of shards of the run
+     */
+    unsigned int n_shards = 1;
+
+    /**
+     * Seed of the run. All shards must use the same seed.
+     */
+    unsigned int seed = 0;
+
+    /**
+     * Photon index range [first_photon, last_photon) of the shard
+     */
+    unsigned long long first_photon = 0;
+    unsigned long long last_photon = 0;
+
+    /**
+     * Number of photons of the whole frame
+     */
+    unsigned long long total_photons = 0;
+
+    /**
+     * Number of photons of the shard that interacted with the sensor
+     */
+    unsigned long long real_photons = 0;
+
+    /**
+     * Size of the image (the region of interest of the detector)
+     */
+    unsigned int n_pixel_x = 0;
+    unsigned int n_pixel_y = 0;
+
+    /**
+     * Origin of the region of interest on the detector
+     */
+    unsigned int roi_x0 = 0;
+    unsigned int roi_y0 = 0;
+
+    /**
+     * Size of the pixel matrix of the detector
+     */
+    unsigned int n_chip_x = 0;
+    unsigned int n_chip_y = 0;
+
+    /**
+     * Energy in keV
+     */
+    float energy = 0.f;
+
+    /**
+     * Exposure time in s
+     */
+    double exposure_time = 0.;
+
+    /**
+     * Flux density in photons / (s mm^2)
+     */
+    double flux_density = 0.;
+
+    /**
+     * Name of the photon pattern passed to run_shard()
+     */
+    std::string pattern;
+
+    /**
+     * Counting mode of the detector ("spm" or "csm")
+     */
+    std::string mode;
+
+    /**
+     * Thresholds in keV, th1 is 0 in single pixel mode
+     */
+    float th0 = 0.f;
+    float th1 = 0.f;
+
+    /**
+     * Sigma of the psf in µm
+     */
+    float psf_sigma = 0.f;
+
+    /**
+     * Threshold dispersion sigma in keV and seed
+     */
+    float dispersion_sigma = 0.f;
+    unsigned int dispersion_seed = 0;
+
+    /**
+     * True if the depth of interaction model is enabled, depth_model is only used then
+     */
+    bool depth_of_interaction = false;
+    DepthOfInteraction depth_model{};
+
+    /**
+     * True if a sensor layer is set (see Medipix::set_sensor()), its material name, density in g/cm^3 and thickness
+     * in µm are only used then
+     */
+    bool sensor = false;
+    std::string sensor_material;
+    float sensor_density = 0.f;
+    float sensor_thickness = 0.f;
+
+    /**
+     * Edge extensions in µm: left, right, bottom, top (see Medipix::set_edge_extension())
+     */
+    std::array<float, 4> edge_extension{};
+
+    /**
+     * File name of the raw image (uint32) relative to the sidecar
+     */
+    std::string image_file;
+};
+
+/**
+ * Photon index range of a shard. The photons of the frame are split into n_shards contiguous ranges.
+ * @param total_photons Number of photons of the frame
+ * @param shard Index of the shard
+ * @param n_shards Number of shards
+ * @return [first_photon, last_photon)
+ */
+std::pair<unsigned long long, unsigned long long>
+shard_range(unsigned long long total_photons, unsigned int shard, unsigned int n_shards);
+
+/**
+ * @brief Simulates one shard of a frame.
+ *
+ * The shard simulates its photon index range between start_frame() and finish_frame(). Because every photon has
+ * its own random stream, the sum of all shards is identical to a single process run with the same seed. The
+ * detector configuration (including the threshold dispersion seed) must be the same for all shards.
+ * Only non-timed detectors can be sharded, pile-up is not additive.
+ *
+ * @param medipix Non-timed detector
+ * @param energy in keV
+ * @param exposure_time in s
+ * @param flux_density in photons / (s mm^2)
+ * @param photon_interacting see exposure()
+ * @param seed Seed of the run
+ * @param shard Index of the shard
+ * @param n_shards Number of shards
+ * @param pattern Name of photon_interacting, recorded so that merge_shards() can check it
+ * @return metadata of the shard, image_file is empty
+ */
+ShardInfo run_shard(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time, double flux_density,
+                    const std::function<bool(float, float)> &photon_interacting, unsigned int seed,
+                    unsigned int shard, unsigned int n_shards, const std::string &pattern);
+
+/**
+ * Saves the image of a finished shard to prefix.raw and its metadata to prefix.txt
+ * @param medipix Detector after run_shard()
+ * @param info Metadata returned by run_shard()
+ * @param prefix Path without extension
+ */
+void save_shard(const std::shared_ptr<Medipix> &medipix, ShardInfo info, const std::string &prefix);
+
+/**
+ * Writes the metadata sidecar of a shard
+ * @param info
+ * @param filename
+ */
+void save_shard_info(const ShardInfo &info, const std::string &filename);
+
+/**
+ * Reads the metadata sidecar of a shard
+ * @param filename
+ */
+ShardInfo read_shard_info(const std::string &filename);
+
+/**
+ * @brief Sums the partial images of a sharded run.
+ *
+ * Checks that all shards belong to the same run (including the detector configuration and the pattern) and that
+ * their photon ranges cover the frame exactly once.
+ *
+ * @param sidecars Metadata files of all shards
+ * @param counts Summed image, row-wise with index i * n_pixel_y + j
+ * @return metadata of the merged frame (shard 0 of 1)
+ */
+ShardInfo merge_shards(const std::vector<std::string> &sidecars, std::vector<unsigned int> &counts);
+
+#endif //MEDIPIX_SHARD_H
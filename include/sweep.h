@@ -0,0 +1,102 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIPIX_SWEEP_H
+#define MEDIPIX_SWEEP_H
+
+#include <memory>
+#include <ostream>
+#include <vector>
+
+class Medipix;
+
+/**
+ * A single point of a parameter sweep.
+ */
+struct SweepPoint {
+    /**
+     * Threshold zero in keV
+     */
+    float th0;
+
+    /**
+     * Threshold one in keV (only used for the charge summing mode)
+     */
+    float th1;
+
+    /**
+     * Flux density in photons / (s mm^2)
+     */
+    double flux_density;
+
+    /**
+     * Sigma of the psf in µm
+     */
+    float psf_sigma;
+
+    /**
+     * I_krum in DAC units
+     */
+    int i_krum;
+
+    /**
+     * Photon energy in keV
+     */
+    float energy;
+};
+
+/**
+ * Values of the swept parameters. The sweep runs over the cartesian product of all values.
+ * Empty parameters keep the value of the detector. flux_density and energy must be set.
+ */
+struct SweepGrid {
+    std::vector<float> th0;
+    std::vector<float> th1;
+    std::vector<double> flux_density;
+    std::vector<float> psf_sigma;
+    std::vector<int> i_krum;
+    std::vector<float> energy;
+
+    /**
+     * Expands the grid to a list of points. th0 is the slowest and energy the fastest changing parameter.
+     * @param medipix Detector that provides the values of the parameters that are not swept
+     */
+    [[nodiscard]] std::vector<SweepPoint> points(const std::shared_ptr<Medipix> &medipix) const;
+};
+
+/**
+ * @brief Runs a homogeneous exposure for every point of the grid.
+ *
+ * Points are distributed dynamically on the OpenMP threads. Each thread works on its own replica of the detector,
+ * the parallel regions of the exposure and finish_frame() run with one thread (see SerialNestedRegions).
+ * The replicas share the immutable calibration (threshold dispersion maps and preamplifier responses) with the
+ * given detector, nothing is rebuilt per point.
+ *
+ * One line per point is written to table as soon as the point and all previous points are finished:
+ * "index th0 th1 flux_density psf_sigma i_krum energy real_photons counts"
+ *
+ * @param medipix Detector that defines the configuration. It is not modified.
+ * @param grid Swept parameters
+ * @param exposure_time in s
+ * @param table Output stream of the result table
+ * @param seed Seed of the sweep, point k uses frame_seed(seed, k)
+ */
+void sweep(const std::shared_ptr<Medipix> &medipix, const SweepGrid &grid, double exposure_time, std::ostream &table,
+           unsigned int seed);
+
+#endif //MEDIPIX_SWEEP_H
@@ -0,0 +1,75 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "AliasTable.h"
+
+#include <stdexcept>
+
+AliasTable::AliasTable(const std::vector<float> &weights) {
+    size_t n = weights.size();
+    for (auto w: weights) {
+        // Also rejects NaN, e.g. from a corrupt map or spectrum file
+        if (!(w >= 0.f))
+            throw std::invalid_argument("Weights must not be negative.");
+        total_weight += w;
+    }
+    if (n == 0 || !(total_weight > 0.))
+        throw std::invalid_argument("At least one weight must be positive.");
+
+    probability.resize(n);
+    alias.resize(n);
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (size_t k = 0; k < n; ++k) {
+        scaled[k] = double(weights[k]) * double(n) / total_weight;
+        if (scaled[k] < 1.)
+            small.push_back(k);
+        else
+            large.push_back(k);
+    }
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back();
+        small.pop_back();
+        uint32_t l = large.back();
+        probability[s] = float(scaled[s]);
+        alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.;
+        if (scaled[l] < 1.) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Remaining buckets are full (up to rounding)
+    for (auto k: large) {
+        probability[k] = 1.f;
+        alias[k] = k;
+    }
+    for (auto k: small) {
+        probability[k] = 1.f;
+        alias[k] = k;
+    }
+}
+
+size_t AliasTable::size() const {
+    return probability.size();
+}
+
+double AliasTable::get_total_weight() const {
+    return total_weight;
+}
@@ -0,0 +1,124 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Arena.h"
+
+#include <algorithm>
+#include <omp.h>
+
+Arena::Arena(size_t block_size) : block_size(block_size) {
+}
+
+Arena::Arena(const Arena &other) : block_size(other.block_size) {
+}
+
+Arena &Arena::operator=(const Arena &other) {
+    if (this != &other) {
+        block_size = other.block_size;
+        blocks.clear();
+        current = 0;
+        offset = 0;
+    }
+    return *this;
+}
+
+void Arena::reset() {
+    current = 0;
+    offset = 0;
+}
+
+size_t Arena::get_capacity() const {
+    size_t capacity = 0;
+    for (const auto &block: blocks)
+        capacity += block.size;
+    return capacity;
+}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment) {
+    while (true) {
+        if (current < blocks.size()) {
+            auto &block = blocks[current];
+            void *p = block.data.get() + offset;
+            size_t space = block.size - offset;
+            if (std::align(alignment, bytes, p, space)) {
+                offset = static_cast<size_t>(static_cast<std::byte *>(p) - block.data.get()) + bytes;
+                return p;
+            }
+            // Blocks after the current one are free
+            if (current + 1 < blocks.size() && blocks[current + 1].size >= bytes + alignment) {
+                ++current;
+                offset = 0;
+                continue;
+            }
+        }
+        size_t size = std::max(block_size, bytes + alignment);
+        size_t position = blocks.empty() ? 0 : current + 1;
+        blocks.insert(blocks.begin() + static_cast<std::ptrdiff_t>(position),
+                      Block{std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+        current = position;
+        offset = 0;
+    }
+}
+
+void Arena::do_deallocate(void *, size_t, size_t) {
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+Arena::Scope::Scope(Arena &arena) : arena(arena), block(arena.current), offset(arena.offset) {
+}
+
+Arena::Scope::~Scope() {
+    arena.current = block;
+    arena.offset = offset;
+}
+
+ThreadArenas::ThreadArenas() : arenas(omp_get_max_threads()) {
+}
+
+ThreadArenas::ThreadArenas(const ThreadArenas &) : ThreadArenas() {
+}
+
+ThreadArenas &ThreadArenas::operator=(const ThreadArenas &) {
+    return *this;
+}
+
+Arena &ThreadArenas::local() {
+    auto thread = static_cast<size_t>(omp_get_thread_num());
+    // Thread numbers are only unique in the outermost parallel region
+    if (omp_get_level() <= 1 && thread < arenas.size())
+        return arenas[thread];
+    thread_local Arena nested_arena;
+    return nested_arena;
+}
+
+void ThreadArenas::reset() {
+    if (arenas.size() < static_cast<size_t>(omp_get_max_threads()))
+        arenas.resize(omp_get_max_threads());
+    for (auto &arena: arenas)
+        arena.reset();
+}
+
+size_t ThreadArenas::get_capacity() const {
+    size_t capacity = 0;
+    for (const auto &arena: arenas)
+        capacity += arena.get_capacity();
+    return capacity;
+}
@@ -0,0 +1,205 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Assembly.h"
+#include "Medipix.h"
+#include "RandomStream.h"
+#include "helper.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <omp.h>
+
+Assembly::Assembly(const std::shared_ptr<Medipix> &chip, unsigned int chips_x, unsigned int chips_y, float gap)
+        : chips_x(chips_x), chips_y(chips_y), gap(gap), chip_pixels_x(chip->get_num_pixels_x()),
+          chip_pixels_y(chip->get_num_pixels_y()), pixel_pitch(chip->get_pixel_pitch()) {
+    for (unsigned int cx = 0; cx < chips_x; ++cx) {
+        for (unsigned int cy = 0; cy < chips_y; ++cy) {
+            auto tile = chip->clone();
+            // The wide pixels at the inner chip borders cover half of the gap each
+            tile->set_edge_extension(cx > 0 ? gap / 2.f : 0.f, cx < chips_x - 1 ? gap / 2.f : 0.f,
+                                     cy > 0 ? gap / 2.f : 0.f, cy < chips_y - 1 ? gap / 2.f : 0.f);
+            chips.push_back(tile);
+        }
+    }
+}
+
+void Assembly::start_frame() {
+    for (auto &chip: chips)
+        chip->start_frame();
+    real_photons = 0;
+}
+
+void Assembly::finish_frame() {
+    SerialNestedRegions serial_nested_regions;
+#pragma omp parallel for default(none) schedule(dynamic, 1)
+    for (size_t index = 0; index < chips.size(); ++index)
+        chips[index]->finish_frame();
+}
+
+template<typename Callback>
+void Assembly::route(float position_x, float position_y, int radius, Callback &&callback) const {
+    float halo = float(radius) * pixel_pitch;
+    int center_x = int(std::floor((position_x - get_min_x()) / (float(chip_pixels_x) * pixel_pitch + gap)));
+    int center_y = int(std::floor((position_y - get_min_y()) / (float(chip_pixels_y) * pixel_pitch + gap)));
+    for (int cx = std::max(center_x - 1, 0); cx <= std::min(center_x + 1, int(chips_x) - 1); ++cx) {
+        for (int cy = std::max(center_y - 1, 0); cy <= std::min(center_y + 1, int(chips_y) - 1); ++cy) {
+            auto [chip_center_x, chip_center_y] = get_chip_center(cx, cy);
+            const auto &chip = chips[cx * chips_y + cy];
+            float x = position_x - chip_center_x;
+            float y = position_y - chip_center_y;
+            if (x >= chip->get_min_x() - halo && x < chip->get_max_x() + halo &&
+                y >= chip->get_min_y() - halo && y < chip->get_max_y() + halo)
+                callback(cx * chips_y + cy, x, y);
+        }
+    }
+}
+
+void Assembly::add_photon(float energy, float position_x, float position_y, int radius, double time) {
+    real_photons++;
+    route(position_x, position_y, radius, [&](unsigned int index, float x, float y) {
+        chips[index]->add_photon(energy, x, y, radius, time);
+    });
+}
+
+void Assembly::exposure(float energy, double exposure_time, double flux_density,
+                        const std::function<bool(float, float)> &photon_interacting, unsigned int seed) {
+    struct Photon {
+        float x;
+        float y;
+        double time;
+        float depth;
+    };
+    int radius = 3;
+    bool depth_of_interaction = chips.front()->has_depth_of_interaction();
+    const SensorLayer *sensor = chips.front()->get_sensor().get();
+    double area = (get_max_x() - get_min_x()) * 0.001 * (get_max_y() - get_min_y()) * 0.001;
+    auto number_of_photons = static_cast<unsigned long long>(flux_density * area * exposure_time);
+    double duration = exposure_time * 1E6;
+    for (const auto &chip: chips)
+        chip->check_exposure_duration(duration);
+    float min_x = get_min_x();
+    float max_x = get_max_x();
+    float min_y = get_min_y();
+    float max_y = get_max_y();
+
+    // Photons are processed in batches to bound the memory of the per-chip lists
+    const unsigned long long batch_size = 1 << 20;
+    std::vector<std::vector<std::vector<Photon>>> chip_photons(
+            omp_get_max_threads(), std::vector<std::vector<Photon>>(chips.size()));
+    for (unsigned long long first = 0; first < number_of_photons; first += batch_size) {
+        unsigned long long last = std::min(number_of_photons, first + batch_size);
+        unsigned long long interacting = 0;
+
+#pragma omp parallel default(none) shared(chip_photons, first, last, seed, photon_interacting, duration, radius, min_x, max_x, min_y, max_y, depth_of_interaction, sensor, energy) reduction(+:interacting)
+        {
+            auto &thread_photons = chip_photons[omp_get_thread_num()];
+            for (auto &photons: thread_photons)
+                photons.clear();
+#pragma omp for
+            for (unsigned long long k = first; k < last; ++k) {
+                RandomStream rng(seed, k);
+                float x = rng.uniform(min_x, max_x);
+                float y = rng.uniform(min_y, max_y);
+                double t = rng.uniform_double(0., duration);
+                if (sensor && rng.uniform() >= sensor->interaction_probability(energy))
+                    continue;
+                if (photon_interacting(x, y)) {
+                    interacting++;
+                    float depth = depth_of_interaction ? chips.front()->draw_interaction_depth(energy, rng) : -1.f;
+                    route(x, y, radius, [&](unsigned int index, float chip_x, float chip_y) {
+                        thread_photons[index].push_back(Photon{chip_x, chip_y, t, depth});
+                    });
+                }
+            }
+        }
+        real_photons += interacting;
+
+#pragma omp parallel for default(none) shared(chip_photons, energy, radius) schedule(dynamic, 1)
+        for (size_t index = 0; index < chips.size(); ++index) {
+            for (auto &thread_photons: chip_photons) {
+                for (auto &photon: thread_photons[index])
+                    chips[index]->add_photon(energy, photon.x, photon.y, photon.depth, radius, photon.time);
+            }
+        }
+    }
+}
+
+std::shared_ptr<Medipix> Assembly::get_chip(unsigned int cx, unsigned int cy) const {
+    return chips.at(cx * chips_y + cy);
+}
+
+std::pair<float, float> Assembly::get_chip_center(unsigned int cx, unsigned int cy) const {
+    float chip_width = float(chip_pixels_x) * pixel_pitch;
+    float chip_height = float(chip_pixels_y) * pixel_pitch;
+    float x = get_min_x() + float(cx) * (chip_width + gap) + chip_width / 2.f;
+    float y = get_min_y() + float(cy) * (chip_height + gap) + chip_height / 2.f;
+    return std::make_pair(x, y);
+}
+
+unsigned int Assembly::get_pixel_value(unsigned int i, unsigned int j) const {
+    return get_chip(i / chip_pixels_x, j / chip_pixels_y)->get_pixel_value(i % chip_pixels_x, j % chip_pixels_y);
+}
+
+unsigned int Assembly::get_total_counts() const {
+    unsigned int counts = 0;
+    for (auto &chip: chips)
+        counts += chip->get_total_counts();
+    return counts;
+}
+
+unsigned long long Assembly::get_real_photons() const {
+    return real_photons;
+}
+
+unsigned int Assembly::get_num_pixels_x() const {
+    return chips_x * chip_pixels_x;
+}
+
+unsigned int Assembly::get_num_pixels_y() const {
+    return chips_y * chip_pixels_y;
+}
+
+float Assembly::get_min_x() const {
+    return -(float(chips_x * chip_pixels_x) * pixel_pitch + float(chips_x - 1) * gap) / 2.f;
+}
+
+float Assembly::get_max_x() const {
+    return -get_min_x();
+}
+
+float Assembly::get_min_y() const {
+    return -(float(chips_y * chip_pixels_y) * pixel_pitch + float(chips_y - 1) * gap) / 2.f;
+}
+
+float Assembly::get_max_y() const {
+    return -get_min_y();
+}
+
+void Assembly::save_image(const std::string &filename) const {
+    std::ofstream image_file(filename, std::ios::out | std::ios::binary);
+    for (unsigned int i = 0; i < get_num_pixels_x(); ++i) {
+        for (unsigned int j = 0; j < get_num_pixels_y(); ++j) {
+            uint32_t pixel_value = get_pixel_value(i, j);
+            image_file.write((char *) &pixel_value, sizeof(pixel_value));
+        }
+    }
+    image_file.close();
+}
@@ -0,0 +1,627 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "EventStore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <omp.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace {
+    /**
+     * Appends value as varint: 7 bits per byte starting with the lowest, the high bit marks a following byte
+     */
+    void write_varint(std::vector<uint8_t> &bytes, uint32_t value) {
+        while (value >= 0x80) {
+            bytes.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(value));
+    }
+
+    /**
+     * Reads a varint and advances position behind it
+     */
+    uint32_t read_varint(const uint8_t *&position) {
+        uint32_t value = 0;
+        for (unsigned int shift = 0;; shift += 7) {
+            uint8_t byte = *position++;
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+}
+
+EventStore::SpillFiles::SpillFiles(std::string directory, size_t n_tiles) : directory(std::move(directory)),
+                                                                           files(n_tiles, -1), sizes(n_tiles, 0) {
+    open_files();
+}
+
+EventStore::SpillFiles::SpillFiles(const SpillFiles &other) : directory(other.directory),
+                                                             files(other.files.size(), -1),
+                                                             sizes(other.files.size(), 0) {
+    open_files();
+}
+
+EventStore::SpillFiles &EventStore::SpillFiles::operator=(const SpillFiles &other) {
+    if (this != &other) {
+        close_files();
+        directory = other.directory;
+        files.assign(other.files.size(), -1);
+        sizes.assign(other.files.size(), 0);
+        open_files();
+    }
+    return *this;
+}
+
+EventStore::SpillFiles::SpillFiles(SpillFiles &&other) noexcept: directory(std::move(other.directory)),
+                                                                files(std::move(other.files)),
+                                                                sizes(std::move(other.sizes)),
+                                                                mutexes(std::move(other.mutexes)) {
+    other.files.clear();
+    other.sizes.clear();
+}
+
+EventStore::SpillFiles &EventStore::SpillFiles::operator=(SpillFiles &&other) noexcept {
+    if (this != &other) {
+        close_files();
+        directory = std::move(other.directory);
+        files = std::move(other.files);
+        sizes = std::move(other.sizes);
+        mutexes = std::move(other.mutexes);
+        other.files.clear();
+        other.sizes.clear();
+    }
+    return *this;
+}
+
+EventStore::SpillFiles::~SpillFiles() {
+    close_files();
+}
+
+void EventStore::SpillFiles::open_files() {
+    mutexes = files.empty() ? nullptr : std::make_unique<std::mutex[]>(files.size());
+    for (auto &file: files) {
+        std::string name = directory + "/medipix_events_XXXXXX";
+        file = mkstemp(name.data());
+        if (file < 0)
+            throw std::runtime_error("Could not create scratch file in " + directory);
+        unlink(name.c_str());
+    }
+}
+
+void EventStore::SpillFiles::close_files() {
+    for (auto file: files)
+        if (file >= 0)
+            close(file);
+    files.clear();
+    sizes.clear();
+}
+
+void EventStore::SpillFiles::append(size_t tile, const void *data, size_t bytes) {
+    std::lock_guard<std::mutex> lk(mutexes[tile]);
+    auto position = static_cast<const char *>(data);
+    while (bytes > 0) {
+        auto written = write(files[tile], position, bytes);
+        if (written < 0)
+            throw std::runtime_error("Could not write scratch file.");
+        position += written;
+        bytes -= written;
+        sizes[tile] += written;
+    }
+}
+
+void EventStore::SpillFiles::read(size_t tile, void *destination) const {
+    if (sizes[tile] == 0)
+        return;
+    void *mapped = mmap(nullptr, sizes[tile], PROT_READ, MAP_PRIVATE, files[tile], 0);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Could not map scratch file.");
+    std::memcpy(destination, mapped, sizes[tile]);
+    munmap(mapped, sizes[tile]);
+}
+
+void EventStore::SpillFiles::truncate() {
+    for (size_t tile = 0; tile < files.size(); ++tile) {
+        if (sizes[tile] == 0)
+            continue;
+        if (ftruncate(files[tile], 0) != 0 || lseek(files[tile], 0, SEEK_SET) != 0)
+            throw std::runtime_error("Could not truncate scratch file.");
+        sizes[tile] = 0;
+    }
+}
+
+size_t EventStore::SpillFiles::get_size(size_t tile) const {
+    return sizes[tile];
+}
+
+size_t EventStore::SpillFiles::get_total_size() const {
+    size_t size = 0;
+    for (auto s: sizes)
+        size += s;
+    return size;
+}
+
+void EventStore::BucketBuffer::push_back(const CompactPixelEvent &entry) {
+    size_t bucket = entry.pixel >> bucket_bits;
+    if (bucket >= buckets.size())
+        buckets.resize(bucket + 1);
+    buckets[bucket].push_back(BufferedEvent{entry.tick, static_cast<uint16_t>(entry.pixel & ((1u << bucket_bits) - 1)),
+                                            entry.energy});
+    ++n_events;
+}
+
+void EventStore::BucketBuffer::append_to(std::vector<CompactPixelEvent> &entries) {
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        auto high = static_cast<uint32_t>(bucket << bucket_bits);
+        for (const auto &event: buckets[bucket])
+            entries.push_back(CompactPixelEvent{high | event.pixel, event.tick, event.energy});
+        buckets[bucket].clear();
+    }
+    n_events = 0;
+}
+
+void EventStore::BucketBuffer::clear() {
+    for (auto &bucket: buckets)
+        bucket.clear();
+    n_events = 0;
+}
+
+size_t EventStore::BucketBuffer::size() const {
+    return n_events;
+}
+
+size_t EventStore::BucketBuffer::get_allocated_bytes() const {
+    size_t bytes = buckets.capacity() * sizeof(std::vector<BufferedEvent>);
+    for (const auto &bucket: buckets)
+        bytes += bucket.capacity() * sizeof(BufferedEvent);
+    return bytes;
+}
+
+EventStore::EventStore() : thread_buffers(omp_get_max_threads()), compact_thread_buffers(omp_get_max_threads()) {
+}
+
+void EventStore::set_compact(bool _compact, unsigned int _samples_per_us) {
+    compact = _compact;
+    samples_per_us = float(_samples_per_us);
+    clear();
+}
+
+bool EventStore::get_compact() const {
+    return compact;
+}
+
+double EventStore::get_max_time() const {
+    if (compact)
+        return double(std::numeric_limits<int32_t>::max()) / samples_per_us;
+    return 0x1p63 * Event::time_step;
+}
+
+void EventStore::set_spill(size_t _memory_budget, const std::string &directory, uint32_t _pixels_per_tile,
+                           uint32_t n_pixels) {
+    if (_memory_budget > 0 && _pixels_per_tile == 0)
+        throw std::invalid_argument("Tiles need at least one pixel.");
+    memory_budget = _memory_budget;
+    pixels_per_tile = _pixels_per_tile;
+    n_tiles = memory_budget > 0 ? (size_t(n_pixels) + pixels_per_tile - 1) / pixels_per_tile : 1;
+    spill_files = memory_budget > 0 ? SpillFiles(directory, n_tiles) : SpillFiles();
+    clear();
+}
+
+void EventStore::clear() {
+    if (thread_buffers.size() < static_cast<size_t>(omp_get_max_threads())) {
+        thread_buffers.resize(omp_get_max_threads());
+        compact_thread_buffers.resize(omp_get_max_threads());
+    }
+    for (auto &buffer: thread_buffers)
+        buffer.clear();
+    for (auto &buffer: compact_thread_buffers)
+        buffer.clear();
+    locked_buffer.clear();
+    compact_locked_buffer.clear();
+    index_bytes.clear();
+    index_checkpoints.clear();
+    n_active_pixels = 0;
+    sorted_events.clear();
+    sorted_ticks.clear();
+    sorted_energies.clear();
+    spill_files.truncate();
+    spilled = false;
+    loaded_tile = 0;
+    peak_bytes = 0;
+}
+
+void EventStore::CompactPixelEvent::write_record(unsigned char *record) const {
+    std::memcpy(record, &pixel, sizeof(pixel));
+    std::memcpy(record + sizeof(pixel), &tick, sizeof(tick));
+    std::memcpy(record + sizeof(pixel) + sizeof(tick), &energy, sizeof(energy));
+}
+
+EventStore::CompactPixelEvent EventStore::CompactPixelEvent::read_record(const unsigned char *record) {
+    CompactPixelEvent entry{};
+    std::memcpy(&entry.pixel, record, sizeof(entry.pixel));
+    std::memcpy(&entry.tick, record + sizeof(entry.pixel), sizeof(entry.tick));
+    std::memcpy(&entry.energy, record + sizeof(entry.pixel) + sizeof(entry.tick), sizeof(entry.energy));
+    return entry;
+}
+
+void EventStore::PixelEvent::write_record(unsigned char *record) const {
+    std::memcpy(record, &pixel, sizeof(pixel));
+    std::memcpy(record + sizeof(pixel), &event.time_steps, sizeof(event.time_steps));
+    std::memcpy(record + sizeof(pixel) + sizeof(event.time_steps), &event.energy, sizeof(event.energy));
+}
+
+EventStore::PixelEvent EventStore::PixelEvent::read_record(const unsigned char *record) {
+    PixelEvent entry{};
+    std::memcpy(&entry.pixel, record, sizeof(entry.pixel));
+    std::memcpy(&entry.event.time_steps, record + sizeof(entry.pixel), sizeof(entry.event.time_steps));
+    std::memcpy(&entry.event.energy, record + sizeof(entry.pixel) + sizeof(entry.event.time_steps),
+                sizeof(entry.event.energy));
+    return entry;
+}
+
+EventStore::CompactPixelEvent EventStore::encode(uint32_t pixel, const Event &event) const {
+    double tick = std::floor(event.get_time() * samples_per_us);
+    float energy = std::round(event.energy / energy_step);
+    if (!(std::abs(tick) <= double(std::numeric_limits<int32_t>::max())))
+        throw std::out_of_range("Event time outside of the range of the compact encoding.");
+    return {pixel, static_cast<int32_t>(tick),
+            static_cast<uint16_t>(std::clamp(energy, 0.f, float(std::numeric_limits<uint16_t>::max())))};
+}
+
+template<typename Entry, typename Buffer>
+void EventStore::push(Buffer &buffer, const Entry &entry) {
+    buffer.push_back(entry);
+    if (memory_budget > 0 && buffer.size() * get_buffered_event_bytes() > memory_budget / (thread_buffers.size() + 1))
+        spill(buffer);
+}
+
+void EventStore::add(uint32_t pixel, const Event &event) {
+    auto thread = static_cast<size_t>(omp_get_thread_num());
+    if (compact && event.energy < energy_step / 2.f)
+        return;
+    // Thread numbers are only unique in the outermost parallel region
+    if (omp_get_level() <= 1 && thread < thread_buffers.size()) {
+        if (compact)
+            push(compact_thread_buffers[thread], encode(pixel, event));
+        else
+            push(thread_buffers[thread], PixelEvent{pixel, event});
+    } else {
+        std::lock_guard<std::mutex> lk(locked_buffer_mutex);
+        if (compact)
+            push(compact_locked_buffer, encode(pixel, event));
+        else
+            push(locked_buffer, PixelEvent{pixel, event});
+    }
+}
+
+template<typename Entry>
+void EventStore::collect(std::vector<Entry> &entries) const {
+    const uint8_t *position = index_bytes.data();
+    uint32_t pixel = 0;
+    size_t e = 0;
+    for (size_t k = 0; k < n_active_pixels; ++k) {
+        pixel += read_varint(position);
+        if (k % index_stride == 0)
+            pixel = index_checkpoints[k / index_stride].pixel;
+        for (size_t end = e + read_varint(position); e < end; ++e) {
+            if constexpr (std::is_same_v<Entry, CompactPixelEvent>)
+                entries.push_back(CompactPixelEvent{pixel, sorted_ticks[e], sorted_energies[e]});
+            else
+                entries.push_back(PixelEvent{pixel, sorted_events[e]});
+        }
+    }
+}
+
+template<typename Entry>
+void EventStore::build(std::vector<Entry> &entries) {
+    if (entries.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Too many events.");
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        if (a.pixel != b.pixel)
+            return a.pixel < b.pixel;
+        if constexpr (std::is_same_v<Entry, CompactPixelEvent>)
+            return a.tick < b.tick || (a.tick == b.tick && a.energy < b.energy);
+        else
+            return a.event.time_steps < b.event.time_steps ||
+                   (a.event.time_steps == b.event.time_steps && a.event.energy < b.event.energy);
+    });
+
+    index_bytes.clear();
+    index_checkpoints.clear();
+    n_active_pixels = 0;
+    sorted_events.clear();
+    sorted_ticks.clear();
+    sorted_energies.clear();
+    if constexpr (std::is_same_v<Entry, CompactPixelEvent>) {
+        sorted_ticks.resize(entries.size());
+        sorted_energies.resize(entries.size());
+    } else {
+        sorted_events.resize(entries.size());
+    }
+    for (size_t e = 0; e < entries.size();) {
+        size_t end = e + 1;
+        while (end < entries.size() && entries[end].pixel == entries[e].pixel)
+            ++end;
+        append_active_pixel(entries[e].pixel, static_cast<uint32_t>(e), static_cast<uint32_t>(end - e));
+        e = end;
+    }
+
+    // The resized arrays are not initialized, the copy touches their pages first
+    auto copy = [this, &entries](size_t first, size_t last) {
+        for (size_t e = first; e < last; ++e) {
+            if constexpr (std::is_same_v<Entry, CompactPixelEvent>) {
+                sorted_ticks[e] = entries[e].tick;
+                sorted_energies[e] = entries[e].energy;
+            } else {
+                sorted_events[e] = entries[e].event;
+            }
+        }
+    };
+    if (owner_placement) {
+        // Every event is copied, even with pixels beyond owner_pixels
+        size_t n_pixels = std::max<size_t>(owner_pixels, n_active_pixels == 0 ? 0 : size_t(last_active_pixel) + 1);
+        #pragma omp parallel default(none) shared(copy, n_pixels)
+        {
+            for_owned_blocks(n_pixels, get_owner_tile_pixels(), omp_get_thread_num(), omp_get_num_threads(),
+                             [this, &copy](size_t first, size_t last) {
+                copy(get_offset(find_first_active(uint32_t(first))), get_offset(find_first_active(uint32_t(last))));
+            });
+        }
+    } else {
+        copy(0, entries.size());
+    }
+    peak_bytes = std::max(peak_bytes, get_allocated_bytes() + entries.capacity() * sizeof(Entry));
+}
+
+template<typename Entry>
+void EventStore::spill(std::vector<Entry> &entries) {
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.pixel < b.pixel; });
+    std::vector<unsigned char> records;
+    size_t begin = 0;
+    while (begin < entries.size()) {
+        size_t tile = entries[begin].pixel / pixels_per_tile;
+        size_t end = begin;
+        while (end < entries.size() && entries[end].pixel / pixels_per_tile == tile)
+            ++end;
+        records.resize((end - begin) * Entry::record_bytes);
+        for (size_t e = begin; e < end; ++e)
+            entries[e].write_record(records.data() + (e - begin) * Entry::record_bytes);
+        spill_files.append(tile, records.data(), records.size());
+        begin = end;
+    }
+    entries.clear();
+}
+
+void EventStore::spill(BucketBuffer &buffer) {
+    std::vector<CompactPixelEvent> entries;
+    entries.reserve(buffer.size());
+    buffer.append_to(entries);
+    spill(entries);
+}
+
+template<typename Entry, typename Buffer>
+void EventStore::finalize_entries(std::vector<Buffer> &buffers, Buffer &overflow) {
+    std::vector<Entry> entries;
+    if (spill_files.get_total_size() == 0) {
+        // Events of a previous finalize() are merged with the new ones
+        size_t n_events = size() + overflow.size();
+        for (const auto &buffer: buffers)
+            n_events += buffer.size();
+        entries.reserve(n_events);
+        collect(entries);
+        for (auto &buffer: buffers) {
+            if constexpr (std::is_same_v<Buffer, BucketBuffer>) {
+                buffer.append_to(entries);
+            } else {
+                entries.insert(entries.end(), buffer.begin(), buffer.end());
+                buffer.clear();
+            }
+        }
+        if constexpr (std::is_same_v<Buffer, BucketBuffer>) {
+            overflow.append_to(entries);
+        } else {
+            entries.insert(entries.end(), overflow.begin(), overflow.end());
+            overflow.clear();
+        }
+        build(entries);
+        return;
+    }
+
+    // Everything goes to the scratch files, the tiles are loaded one at a time
+    if (!spilled)
+        collect(entries);
+    spill(entries);
+    for (auto &buffer: buffers)
+        spill(buffer);
+    spill(overflow);
+    build(entries);
+    spilled = true;
+    loaded_tile = n_tiles;
+}
+
+void EventStore::finalize() {
+    if (compact)
+        finalize_entries<CompactPixelEvent>(compact_thread_buffers, compact_locked_buffer);
+    else
+        finalize_entries<PixelEvent>(thread_buffers, locked_buffer);
+}
+
+size_t EventStore::get_number_of_tiles() const {
+    return spilled ? n_tiles : 1;
+}
+
+size_t EventStore::get_tile(uint32_t pixel) const {
+    return spilled ? pixel / pixels_per_tile : 0;
+}
+
+template<typename Entry>
+void EventStore::load_entries(size_t tile) {
+    std::vector<unsigned char> records(spill_files.get_size(tile));
+    spill_files.read(tile, records.data());
+    std::vector<Entry> entries(records.size() / Entry::record_bytes);
+    for (size_t e = 0; e < entries.size(); ++e)
+        entries[e] = Entry::read_record(records.data() + e * Entry::record_bytes);
+    records = {};
+    build(entries);
+}
+
+void EventStore::load_tile(size_t tile) {
+    if (!spilled || tile == loaded_tile)
+        return;
+    if (compact)
+        load_entries<CompactPixelEvent>(tile);
+    else
+        load_entries<PixelEvent>(tile);
+    loaded_tile = tile;
+}
+
+size_t EventStore::get_spilled_bytes() const {
+    return spill_files.get_total_size();
+}
+
+void EventStore::append_active_pixel(uint32_t pixel, uint32_t offset, uint32_t count) {
+    if (n_active_pixels % index_stride == 0) {
+        if (index_bytes.size() > std::numeric_limits<uint32_t>::max())
+            throw std::length_error("Index of the active pixels too large.");
+        index_checkpoints.push_back(IndexCheckpoint{pixel, offset, static_cast<uint32_t>(index_bytes.size())});
+        last_active_pixel = pixel;
+    }
+    write_varint(index_bytes, pixel - last_active_pixel);
+    write_varint(index_bytes, count);
+    last_active_pixel = pixel;
+    ++n_active_pixels;
+}
+
+EventStore::ActivePixel EventStore::get_index_entry(size_t k) const {
+    const auto &checkpoint = index_checkpoints[k / index_stride];
+    ActivePixel entry{checkpoint.pixel, checkpoint.offset, 0};
+    const uint8_t *position = index_bytes.data() + checkpoint.byte;
+    for (size_t l = k - k % index_stride;; ++l) {
+        entry.pixel += read_varint(position);
+        entry.count = read_varint(position);
+        if (l == k)
+            return entry;
+        entry.offset += entry.count;
+    }
+}
+
+size_t EventStore::get_offset(size_t k) const {
+    return k < n_active_pixels ? get_index_entry(k).offset : size();
+}
+
+size_t EventStore::get_number_of_active_pixels() const {
+    return n_active_pixels;
+}
+
+uint32_t EventStore::get_active_pixel(size_t k) const {
+    return get_index_entry(k).pixel;
+}
+
+size_t EventStore::find_first_active(uint32_t pixel) const {
+    // Block of the last checkpoint not after pixel
+    auto it = std::upper_bound(index_checkpoints.begin(), index_checkpoints.end(), pixel,
+                               [](uint32_t p, const IndexCheckpoint &checkpoint) { return p < checkpoint.pixel; });
+    if (it == index_checkpoints.begin())
+        return 0;
+    --it;
+    size_t first = size_t(it - index_checkpoints.begin()) * index_stride;
+    size_t last = std::min(first + index_stride, n_active_pixels);
+    uint32_t current = it->pixel;
+    const uint8_t *position = index_bytes.data() + it->byte;
+    for (size_t k = first; k < last; ++k) {
+        current += read_varint(position);
+        if (current >= pixel)
+            return k;
+        (void) read_varint(position);
+    }
+    return last;
+}
+
+std::span<const Event> EventStore::get_events(size_t k, std::vector<Event> &buffer) const {
+    auto entry = get_index_entry(k);
+    if (!compact)
+        return {sorted_events.data() + entry.offset, entry.count};
+    buffer.resize(entry.count);
+    for (size_t e = 0; e < entry.count; ++e) {
+        buffer[e] = Event{(double(sorted_ticks[entry.offset + e]) + 0.5) / samples_per_us,
+                          float(sorted_energies[entry.offset + e]) * energy_step};
+    }
+    return buffer;
+}
+
+std::span<const Event> EventStore::find(uint32_t pixel, std::vector<Event> &buffer) const {
+    auto k = find_first_active(pixel);
+    if (k == n_active_pixels || get_active_pixel(k) != pixel)
+        return {};
+    return get_events(k, buffer);
+}
+
+size_t EventStore::size() const {
+    return compact ? sorted_ticks.size() : sorted_events.size();
+}
+
+size_t EventStore::get_memory_usage() const {
+    return size() * get_stored_event_bytes() + index_bytes.size() +
+           index_checkpoints.size() * sizeof(IndexCheckpoint);
+}
+
+size_t EventStore::get_allocated_bytes() const {
+    size_t bytes = locked_buffer.capacity() * sizeof(PixelEvent) + compact_locked_buffer.get_allocated_bytes();
+    for (const auto &buffer: thread_buffers)
+        bytes += buffer.capacity() * sizeof(PixelEvent);
+    for (const auto &buffer: compact_thread_buffers)
+        bytes += buffer.get_allocated_bytes();
+    bytes += index_bytes.capacity() + index_checkpoints.capacity() * sizeof(IndexCheckpoint);
+    bytes += sorted_events.capacity() * sizeof(Event) + sorted_ticks.capacity() * sizeof(int32_t) +
+             sorted_energies.capacity() * sizeof(uint16_t);
+    return bytes;
+}
+
+size_t EventStore::get_peak_bytes() const {
+    return std::max(peak_bytes, get_allocated_bytes());
+}
+
+size_t EventStore::get_buffered_event_bytes() const {
+    return compact ? sizeof(BufferedEvent) : sizeof(PixelEvent);
+}
+
+size_t EventStore::get_stored_event_bytes() const {
+    return compact ? sizeof(int32_t) + sizeof(uint16_t) : sizeof(Event);
+}
+
+void EventStore::set_owner_placement(bool enabled, uint32_t n_pixels) {
+    owner_placement = enabled;
+    owner_pixels = n_pixels;
+}
+
+bool EventStore::get_owner_placement() const {
+    return owner_placement;
+}
+
+size_t EventStore::get_owner_tile_pixels() const {
+    return memory_budget > 0 ? pixels_per_tile : owner_pixels;
+}
@@ -0,0 +1,80 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "FrameStack.h"
+
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+FrameStack::FrameStack(unsigned int n_frames, unsigned int nx, unsigned int ny) : n_frames(n_frames), n_pixel_x(nx),
+                                                                                  n_pixel_y(ny) {
+    counts.resize(static_cast<std::vector<unsigned int>::size_type>(n_frames) * nx * ny, 0);
+    real_photons.resize(n_frames, 0);
+}
+
+unsigned int FrameStack::get_pixel_value(unsigned int frame, unsigned int i, unsigned int j) const {
+    return get_frame(frame)[i * n_pixel_y + j];
+}
+
+unsigned long FrameStack::get_total_counts(unsigned int frame) const {
+    const unsigned int *data = get_frame(frame);
+    return std::accumulate(data, data + static_cast<size_t>(n_pixel_x) * n_pixel_y, 0ul);
+}
+
+unsigned int *FrameStack::get_frame(unsigned int frame) {
+    if (frame >= n_frames)
+        throw std::out_of_range("Frame index out of range.");
+    return counts.data() + static_cast<size_t>(frame) * n_pixel_x * n_pixel_y;
+}
+
+const unsigned int *FrameStack::get_frame(unsigned int frame) const {
+    if (frame >= n_frames)
+        throw std::out_of_range("Frame index out of range.");
+    return counts.data() + static_cast<size_t>(frame) * n_pixel_x * n_pixel_y;
+}
+
+unsigned int FrameStack::get_real_photons(unsigned int frame) const {
+    return real_photons.at(frame);
+}
+
+void FrameStack::set_real_photons(unsigned int frame, unsigned int photons) {
+    real_photons.at(frame) = photons;
+}
+
+void FrameStack::save(const std::string &filename) const {
+    std::ofstream image_file(filename, std::ios::out | std::ios::binary);
+    for (auto &count: counts) {
+        uint32_t pixel_value = count;
+        image_file.write((char *) &pixel_value, sizeof(pixel_value));
+    }
+    image_file.close();
+}
+
+unsigned int FrameStack::get_num_frames() const {
+    return n_frames;
+}
+
+unsigned int FrameStack::get_num_pixels_x() const {
+    return n_pixel_x;
+}
+
+unsigned int FrameStack::get_num_pixels_y() const {
+    return n_pixel_y;
+}
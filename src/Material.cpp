@@ -0,0 +1,149 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Material.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+Material::Material(std::string name, float density, const std::vector<float> &energies,
+                   const std::vector<float> &mass_attenuation, unsigned int n_grid)
+        : name(std::move(name)), density(density), n_grid(n_grid) {
+    if (energies.size() != mass_attenuation.size() || energies.size() < 2)
+        throw std::invalid_argument("At least two tabulated energies with one attenuation coefficient each needed.");
+    if (n_grid < 2 || density <= 0.f)
+        throw std::invalid_argument("Invalid grid size or density.");
+    for (size_t k = 0; k < energies.size(); ++k) {
+        if (energies[k] <= 0.f || mass_attenuation[k] <= 0.f || (k > 0 && energies[k] < energies[k - 1]))
+            throw std::invalid_argument("Energies must be positive and ascending, coefficients positive.");
+    }
+
+    log_min_energy = std::log(energies.front());
+    float log_step = (std::log(energies.back()) - log_min_energy) / float(n_grid - 1);
+    inverse_log_step = 1.f / log_step;
+    log_mass_attenuation.resize(n_grid);
+    for (unsigned int k = 0; k < n_grid; ++k) {
+        float energy = std::exp(log_min_energy + float(k) * log_step);
+        // Last tabulated entry <= energy, at an edge this is the value above the edge
+        auto upper = std::upper_bound(energies.begin(), energies.end(), energy);
+        size_t i = std::clamp<size_t>(size_t(upper - energies.begin()), 1, energies.size() - 1) - 1;
+        float w = (std::log(energy) - std::log(energies[i])) / (std::log(energies[i + 1]) - std::log(energies[i]));
+        log_mass_attenuation[k] = std::log(mass_attenuation[i]) +
+                                  w * (std::log(mass_attenuation[i + 1]) - std::log(mass_attenuation[i]));
+    }
+}
+
+Material Material::from_file(const std::string &name, float density, const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file)
+        throw std::runtime_error("Could not open attenuation table " + filename);
+    std::vector<float> energies;
+    std::vector<float> mass_attenuation;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream columns(line);
+        float energy, mu;
+        if (!(columns >> energy >> mu))
+            throw std::runtime_error("Invalid line in attenuation table " + filename + ": " + line);
+        energies.push_back(energy);
+        mass_attenuation.push_back(mu);
+    }
+    return {name, density, energies, mass_attenuation};
+}
+
+Material Material::silicon() {
+    return {"Si", 2.33f,
+            {1.f, 1.5f, 1.8389f, 1.8389f, 2.f, 3.f, 4.f, 5.f, 6.f, 8.f, 10.f, 15.f, 20.f, 30.f, 40.f, 50.f, 60.f, 80.f,
+             100.f, 150.f, 200.f},
+            {1570.f, 535.5f, 309.2f, 3192.f, 2777.f, 978.4f, 452.9f, 245.f, 147.f, 64.68f, 33.89f, 10.34f, 4.464f,
+             1.436f, 0.7012f, 0.4385f, 0.3207f, 0.2228f, 0.1835f, 0.1448f, 0.1227f}};
+}
+
+Material Material::gallium_arsenide() {
+    // Ga K-edge 10.367 keV, As K-edge 11.867 keV
+    return {"GaAs", 5.32f,
+            {5.f, 6.f, 8.f, 10.f, 10.367f, 10.367f, 11.867f, 11.867f, 15.f, 20.f, 30.f, 40.f, 50.f, 60.f, 80.f, 100.f,
+             150.f, 200.f},
+            {240.f, 147.f, 68.f, 37.6f, 34.5f, 131.f, 93.f, 186.f, 99.f, 45.5f, 15.3f, 7.f, 3.85f, 2.38f, 1.13f,
+             0.65f, 0.29f, 0.19f}};
+}
+
+Material Material::cadmium_telluride() {
+    // Cd K-edge 26.711 keV, Te K-edge 31.814 keV
+    return {"CdTe", 5.85f,
+            {5.f, 6.f, 8.f, 10.f, 15.f, 20.f, 26.711f, 26.711f, 30.f, 31.814f, 31.814f, 40.f, 50.f, 60.f, 80.f, 100.f,
+             150.f, 200.f},
+            {690.f, 430.f, 200.f, 112.f, 37.5f, 17.4f, 8.f, 34.5f, 25.4f, 21.9f, 41.f, 21.9f, 12.1f, 7.4f, 3.45f,
+             1.92f, 0.68f, 0.36f}};
+}
+
+void Material::mass_attenuation(const float *energies, float *mass_attenuation, size_t n) const {
+    const float *table = log_mass_attenuation.data();
+#pragma omp simd
+    for (size_t k = 0; k < n; ++k) {
+        mass_attenuation[k] = std::exp(interpolate(table, energies[k]));
+    }
+}
+
+const std::string &Material::get_name() const {
+    return name;
+}
+
+float Material::get_density() const {
+    return density;
+}
+
+float Material::get_min_energy() const {
+    return get_grid_energy(0);
+}
+
+float Material::get_max_energy() const {
+    return get_grid_energy(n_grid - 1);
+}
+
+float Material::get_grid_energy(unsigned int k) const {
+    return std::exp(log_min_energy + float(k) / inverse_log_step);
+}
+
+unsigned int Material::get_grid_size() const {
+    return n_grid;
+}
+
+SensorLayer::SensorLayer(Material material, float thickness) : material(std::move(material)), thickness(thickness) {
+    if (thickness <= 0.f)
+        throw std::invalid_argument("Sensor thickness must be positive.");
+    unsigned int n = this->material.get_grid_size();
+    probability.resize(n);
+    log_mean_free_path.resize(n);
+    for (unsigned int k = 0; k < n; ++k) {
+        float mu = this->material.linear_attenuation(this->material.get_grid_energy(k));
+        probability[k] = -std::expm1(-mu * thickness);
+        log_mean_free_path[k] = -std::log(mu);
+    }
+}
+
+const Material &SensorLayer::get_material() const {
+    return material;
+}
+
+float SensorLayer::get_thickness() const {
+    return thickness;
+}
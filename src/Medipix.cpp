@@ -17,43 +17,66 @@
  */
 
 #include "Medipix.h"
+#include "placement.h"
+#include "RandomStream.h"
+#include "ResponseConvolver.h"
 
+#include <algorithm>
 #include <cmath>
 #include <list>
 #include <random>
 #include <fstream>
 #include <iostream>
 #include <ctime>
+#include <map>
+#include <numbers>
 #include <fftw3.h>
+#include <omp.h>
+#include <stdexcept>
 
 [[maybe_unused]] void Medipix::start_frame() {
-    image.resize(static_cast<std::vector<unsigned int>::size_type>(n_pixel_x) * n_pixel_y);
+    image.resize(static_cast<std::vector<unsigned int>::size_type>(roi.nx) * roi.ny);
     for (auto &pixel: image) {
         pixel = 0;
     }
-    max_time = 0.0f;
+    max_time = 0.;
     real_photons = 0;
 
-    for (auto &event: events) {
-        event.clear();
+    events.clear();
+    arenas.reset();
+    select_deposit_kernels();
+    if (numa_placement && omp_get_max_threads() != placed_threads) {
+        pinning.pin();
+        place_pixel_buffers();
     }
     shutter_open = true;
 }
 
 float Medipix::get_min_x() const {
-    return -pixel_pitch * float(n_pixel_x) / 2.f;
+    return -pixel_pitch * float(n_pixel_x) / 2.f - edge_extension_left;
 }
 
 float Medipix::get_max_x() const {
-    return pixel_pitch * float(n_pixel_x) / 2.f;
+    return pixel_pitch * float(n_pixel_x) / 2.f + edge_extension_right;
 }
 
 float Medipix::get_min_y() const {
-    return -pixel_pitch * float(n_pixel_y) / 2.f;
+    return -pixel_pitch * float(n_pixel_y) / 2.f - edge_extension_bottom;
 }
 
 float Medipix::get_max_y() const {
-    return pixel_pitch * float(n_pixel_y) / 2.f;
+    return pixel_pitch * float(n_pixel_y) / 2.f + edge_extension_top;
+}
+
+void Medipix::set_edge_extension(float left, float right, float bottom, float top) {
+    edge_extension_left = left;
+    edge_extension_right = right;
+    edge_extension_bottom = bottom;
+    edge_extension_top = top;
+}
+
+std::array<float, 4> Medipix::get_edge_extension() const {
+    return {edge_extension_left, edge_extension_right, edge_extension_bottom, edge_extension_top};
 }
 
 [[maybe_unused]] float Medipix::get_th0() const {
@@ -69,8 +92,18 @@ float Medipix::get_max_y() const {
 }
 
 std::pair<unsigned int, unsigned int> Medipix::get_pixel_index(float position_x, float position_y) const {
-    int i = int(position_x / pixel_pitch + float(n_pixel_x) / 2.f - 0.5f);
-    int j = int(position_y / pixel_pitch + float(n_pixel_y) / 2.f - 0.5f);
+    // Positions outside of the sensor give indices outside of [0, n_pixel) (as int), e.g. for the halo of a chip.
+    int i = int(std::floor(position_x / pixel_pitch + float(n_pixel_x) / 2.f));
+    int j = int(std::floor(position_y / pixel_pitch + float(n_pixel_y) / 2.f));
+    // Wide edge pixels
+    if (i < 0 && position_x >= get_min_x())
+        i = 0;
+    if (i >= int(n_pixel_x) && position_x < get_max_x())
+        i = int(n_pixel_x) - 1;
+    if (j < 0 && position_y >= get_min_y())
+        j = 0;
+    if (j >= int(n_pixel_y) && position_y < get_max_y())
+        j = int(n_pixel_y) - 1;
     return std::make_pair(i, j);
 }
 
@@ -86,27 +119,156 @@ Medipix::calculate_shared_energy(float x, float y, float energy, float pixel_cen
     float x_a = (pixel_center_x - pixel_pitch / 2.f);
     float y_b = (pixel_center_y + pixel_pitch / 2.f);
     float y_a = (pixel_center_y - pixel_pitch / 2.f);
+    return integrate_charge(x, y, energy, x_a, x_b, y_a, y_b);
+}
 
-    float x_component = std::erf((x_b - x) / (psf_sigma * float(std::numbers::sqrt2))) -
-                        std::erf((x_a - x) / (psf_sigma * float(std::numbers::sqrt2)));
-    float y_component = std::erf((y_b - y) / (psf_sigma * float(std::numbers::sqrt2))) -
-                        std::erf((y_a - y) / (psf_sigma * float(std::numbers::sqrt2)));
+float Medipix::calculate_pixel_energy(float x, float y, float energy, unsigned int i, unsigned int j) const {
+    auto [pixel_center_x, pixel_center_y] = get_pixel_center(i, j);
+    float x_b = (pixel_center_x + pixel_pitch / 2.f);
+    float x_a = (pixel_center_x - pixel_pitch / 2.f);
+    float y_b = (pixel_center_y + pixel_pitch / 2.f);
+    float y_a = (pixel_center_y - pixel_pitch / 2.f);
+    if (i == 0)
+        x_a -= edge_extension_left;
+    if (i == n_pixel_x - 1)
+        x_b += edge_extension_right;
+    if (j == 0)
+        y_a -= edge_extension_bottom;
+    if (j == n_pixel_y - 1)
+        y_b += edge_extension_top;
+    return integrate_charge(x, y, energy, x_a, x_b, y_a, y_b);
+}
+
+float Medipix::integrate_charge(float x, float y, float energy, float x_a, float x_b, float y_a, float y_b) const {
+    return integrate_charge(x, y, energy, x_a, x_b, y_a, y_b, psf_sigma);
+}
+
+float Medipix::integrate_charge(float x, float y, float energy, float x_a, float x_b, float y_a, float y_b,
+                                float sigma) {
+    float x_component = std::erf((x_b - x) / (sigma * float(std::numbers::sqrt2))) -
+                        std::erf((x_a - x) / (sigma * float(std::numbers::sqrt2)));
+    float y_component = std::erf((y_b - y) / (sigma * float(std::numbers::sqrt2))) -
+                        std::erf((y_a - y) / (sigma * float(std::numbers::sqrt2)));
 
     return 0.25f * energy * x_component * y_component;
 
 }
 
+float Medipix::calculate_pixel_energy(float x, float y, float energy, unsigned int i, unsigned int j,
+                                      float depth) const {
+    if (depth < 0.f || !depth_tables)
+        return calculate_pixel_energy(x, y, energy, i, j);
+    unsigned int bin = get_depth_bin(depth);
+    bool edge_pixel = (i == 0 && edge_extension_left != 0.f) || (i == n_pixel_x - 1 && edge_extension_right != 0.f) ||
+                      (j == 0 && edge_extension_bottom != 0.f) || (j == n_pixel_y - 1 && edge_extension_top != 0.f);
+    auto [pixel_center_x, pixel_center_y] = get_pixel_center(i, j);
+    if (edge_pixel) {
+        float x_a = pixel_center_x - pixel_pitch / 2.f - (i == 0 ? edge_extension_left : 0.f);
+        float x_b = pixel_center_x + pixel_pitch / 2.f + (i == n_pixel_x - 1 ? edge_extension_right : 0.f);
+        float y_a = pixel_center_y - pixel_pitch / 2.f - (j == 0 ? edge_extension_bottom : 0.f);
+        float y_b = pixel_center_y + pixel_pitch / 2.f + (j == n_pixel_y - 1 ? edge_extension_top : 0.f);
+        return integrate_charge(x, y, energy, x_a, x_b, y_a, y_b, depth_tables->sigma[bin]);
+    }
+
+    // Linear interpolation in the tabulated components
+    auto component = [this, bin](float distance) {
+        float position = std::abs(distance) / depth_tables->step;
+        auto k = static_cast<unsigned int>(position);
+        if (k + 1 >= depth_tables->n_entries)
+            return 0.f;
+        const float *table = depth_tables->component.data() + static_cast<size_t>(bin) * depth_tables->n_entries;
+        float w = position - float(k);
+        return (1.f - w) * table[k] + w * table[k + 1];
+    };
+    return 0.25f * energy * component(x - pixel_center_x) * component(y - pixel_center_y);
+}
+
+void Medipix::set_depth_of_interaction(const DepthOfInteraction &model) {
+    if (model.thickness <= 0.f || model.bias_voltage <= 0.f || model.n_depth_bins == 0 ||
+        model.mu_norm * model.rho <= 0.f)
+        throw std::invalid_argument("Invalid depth of interaction model.");
+    if (sensor && sensor->get_thickness() != model.thickness)
+        throw std::invalid_argument("Thickness of the sensor and of the depth of interaction model differ.");
+    auto tables = std::make_shared<DepthTables>();
+    tables->model = model;
+    tables->mu = model.mu_norm * model.rho * 1E-4f;
+    tables->absorbed_fraction = -std::expm1(-tables->mu * model.thickness);
+
+    // Diffusion during the drift in a uniform field: sigma^2 = 2 D t = 2 kT/q * L * drift / V
+    const double boltzmann_over_charge = 8.617333262E-5; // V / K
+    double thermal_voltage = boltzmann_over_charge * model.temperature;
+    float bin_height = model.thickness / float(model.n_depth_bins);
+    tables->sigma.resize(model.n_depth_bins);
+    for (unsigned int bin = 0; bin < model.n_depth_bins; ++bin) {
+        double drift = model.thickness - (float(bin) + 0.5f) * bin_height;
+        tables->sigma[bin] = float(std::sqrt(double(model.initial_sigma) * model.initial_sigma +
+                                             2. * thermal_voltage * model.thickness * drift / model.bias_voltage));
+    }
+
+    // Charge can be shared up to max_kernel_radius pixels away, the photon lies anywhere within its own pixel. Beyond
+    // the range the table gives no charge.
+    float range = (float(max_kernel_radius) + 0.5f) * pixel_pitch;
+    tables->step = 0.25f;
+    tables->n_entries = static_cast<unsigned int>(range / tables->step) + 2;
+    tables->component.resize(static_cast<size_t>(model.n_depth_bins) * tables->n_entries);
+    for (unsigned int bin = 0; bin < model.n_depth_bins; ++bin) {
+        float scale = 1.f / (tables->sigma[bin] * float(std::numbers::sqrt2));
+        for (unsigned int k = 0; k < tables->n_entries; ++k) {
+            float distance = float(k) * tables->step;
+            tables->component[static_cast<size_t>(bin) * tables->n_entries + k] =
+                    std::erf((pixel_pitch / 2.f - distance) * scale) - std::erf((-pixel_pitch / 2.f - distance) * scale);
+        }
+    }
+    depth_tables = tables;
+}
+
+void Medipix::set_sensor(std::shared_ptr<const SensorLayer> layer) {
+    if (layer && depth_tables && layer->get_thickness() != depth_tables->model.thickness)
+        throw std::invalid_argument("Thickness of the sensor and of the depth of interaction model differ.");
+    sensor = std::move(layer);
+}
+
+const std::shared_ptr<const SensorLayer> &Medipix::get_sensor() const {
+    return sensor;
+}
+
+void Medipix::disable_depth_of_interaction() {
+    depth_tables.reset();
+}
+
+bool Medipix::has_depth_of_interaction() const {
+    return depth_tables != nullptr;
+}
+
+const DepthOfInteraction &Medipix::get_depth_of_interaction() const {
+    if (!depth_tables)
+        throw std::logic_error("The depth of interaction model is disabled.");
+    return depth_tables->model;
+}
+
+unsigned int Medipix::get_depth_bin(float depth) const {
+    const auto &model = depth_tables->model;
+    auto bin = static_cast<unsigned int>(std::max(depth, 0.f) / model.thickness * float(model.n_depth_bins));
+    return std::min(bin, model.n_depth_bins - 1);
+}
+
+float Medipix::get_depth_sigma(float depth) const {
+    if (!depth_tables)
+        return psf_sigma;
+    return depth_tables->sigma[get_depth_bin(depth)];
+}
+
 
 void Medipix::increase_counter(unsigned int x, unsigned int y) {
     std::lock_guard<std::mutex> lk(image_write_mutex);
-    image[x * n_pixel_y + y] += 1;
+    image[pixel_offset(x, y)] += 1;
 }
 
 unsigned int Medipix::get_total_counts() {
     std::lock_guard<std::mutex> lk(image_write_mutex);
 
     unsigned int counts = 0;
-    for (unsigned int i = 0; i < n_pixel_y * n_pixel_x; ++i) {
+    for (unsigned int i = 0; i < image.size(); ++i) {
         counts += image[i];
     }
     return counts;
@@ -115,7 +277,7 @@ unsigned int Medipix::get_total_counts() {
 void Medipix::save_image(const std::string &filename) {
     std::ofstream image_file(filename, std::ios::out | std::ios::binary);
     std::lock_guard<std::mutex> lk(image_write_mutex);
-    for (unsigned int i = 0; i < n_pixel_y * n_pixel_x; ++i) {
+    for (unsigned int i = 0; i < image.size(); ++i) {
         uint32_t pixel_value = image[i];
         image_file.write((char *) &pixel_value, sizeof(pixel_value));
     }
@@ -132,76 +294,338 @@ void Medipix::set_th0(float s) {
 }
 
 
-void Medipix::random_threshold_dispersion(float sigma) {
-    std::normal_distribution<float> distribution(0.f, sigma);
-    unsigned int seed = time(nullptr);
-    std::default_random_engine generator(seed);
+void Medipix::random_threshold_dispersion(float sigma, unsigned int seed) {
+    auto dispersion = std::make_shared<std::vector<float>>(static_cast<size_t>(roi.nx) * roi.ny);
+    dispersion_sigma = sigma;
+    dispersion_seed = seed;
 
-#pragma omp parallel for default(none) shared(generator, distribution)
-    for (unsigned int i = 0; i < n_pixel_y * n_pixel_x; ++i) {
-        th0_dispersion[i] = distribution(generator);
+    // Streams are indexed with the pixel index of the full detector, so a region of interest sees the same values
+#pragma omp parallel for default(none) shared(sigma, seed, dispersion)
+    for (unsigned int k = 0; k < roi.nx * roi.ny; ++k) {
+        unsigned int i = roi.x0 + k / roi.ny;
+        unsigned int j = roi.y0 + k % roi.ny;
+        RandomStream rng(seed, i * n_pixel_y + j);
+        (*dispersion)[k] = rng.normal(0.f, sigma);
     }
+    th0_dispersion = dispersion;
+    if (numa_placement)
+        place_pixels(th0_dispersion->data(), sizeof(float));
 }
 
-Medipix::Medipix(bool timed, unsigned int nx, unsigned int ny) : timed(timed), n_pixel_x(nx), n_pixel_y(ny) {
-    th0_dispersion.resize(static_cast<std::vector<float>::size_type>(n_pixel_x) * n_pixel_y);
-    for (auto &pixel: th0_dispersion) {
-        pixel = 0.0f;
-    }
+float Medipix::get_dispersion_sigma() const {
+    return dispersion_sigma;
+}
 
-    if (timed) {
-        events.resize(static_cast<std::vector<Event>::size_type>(n_pixel_x) * n_pixel_y);
-        for (auto &pixel_events: events) {
-            pixel_events.clear();
-        }
-    }
+unsigned int Medipix::get_dispersion_seed() const {
+    return dispersion_seed;
+}
+
+float Medipix::get_th0_outside_roi(unsigned int i, unsigned int j) const {
+    if (dispersion_sigma == 0.f)
+        return th0;
+    RandomStream rng(dispersion_seed, i * n_pixel_y + j);
+    return th0 + rng.normal(0.f, dispersion_sigma);
+}
+
+Medipix::Medipix(bool timed, unsigned int nx, unsigned int ny) : timed(timed), n_pixel_x(nx), n_pixel_y(ny),
+                                                                 roi{0, 0, nx, ny} {
+    allocate_pixels();
+}
+
+void Medipix::allocate_pixels() {
+    image.assign(static_cast<size_t>(roi.nx) * roi.ny, 0);
+    th0_dispersion = std::make_shared<const std::vector<float>>(static_cast<size_t>(roi.nx) * roi.ny, 0.0f);
+
+    if (spill_budget > 0)
+        events.set_spill(spill_budget, spill_directory, spill_rows_per_tile * roi.ny, roi.nx * roi.ny);
+    else
+        events.clear();
+    events.set_owner_placement(numa_placement, roi.nx * roi.ny);
+    if (numa_placement)
+        place_pixel_buffers();
+}
+
+void Medipix::place_pixel_buffers() {
+    placed_threads = omp_get_max_threads();
+    place_pixels(image.data(), sizeof(unsigned int));
+    if (th0_dispersion.use_count() > 1)
+        th0_dispersion = std::make_shared<const std::vector<float>>(*th0_dispersion);
+    place_pixels(th0_dispersion->data(), sizeof(float));
+}
+
+void Medipix::place_pixels(const void *data, size_t element_size) const {
+    move_to_owners(data, size_t(roi.nx) * roi.ny * element_size, events.get_owner_tile_pixels() * element_size);
+}
+
+void Medipix::set_region_of_interest(unsigned int x0, unsigned int y0, unsigned int nx, unsigned int ny) {
+    if (shutter_open)
+        throw std::logic_error("Shutter open. Call finish_frame() before.");
+    if (nx == 0 || ny == 0 || x0 + nx > n_pixel_x || y0 + ny > n_pixel_y)
+        throw std::invalid_argument("Region of interest must be inside of the detector.");
+    roi = PixelRegion{x0, y0, nx, ny};
+    allocate_pixels();
+    if (dispersion_sigma > 0.f)
+        random_threshold_dispersion(dispersion_sigma, dispersion_seed);
+}
+
+PixelRegion Medipix::get_region_of_interest() const {
+    return roi;
+}
+
+bool Medipix::in_region_of_interest(float position_x, float position_y, int radius) const {
+    auto [i, j] = get_pixel_index(position_x, position_y);
+    return int(i) >= int(roi.x0) - radius && int(i) < int(roi.x0 + roi.nx) + radius &&
+           int(j) >= int(roi.y0) - radius && int(j) < int(roi.y0 + roi.ny) + radius;
 }
 
 void Medipix::finish_frame() {
     if (timed) {
         build_i_krum_response(i_krum);
+        events.finalize();
     }
     shutter_open = false;
 }
 
-void Medipix::add_photon(float energy, float position_x, float position_y, int radius, float time) {
+void Medipix::add_photon(float energy, float position_x, float position_y, int radius, double time) {
+    add_photon(energy, position_x, position_y, -1.f, radius, time);
+}
+
+void Medipix::add_photon([[maybe_unused]] float energy, [[maybe_unused]] float position_x,
+                         [[maybe_unused]] float position_y, [[maybe_unused]] float depth, [[maybe_unused]] int radius,
+                         double time) {
     if (!shutter_open)
         throw std::logic_error("Shutter not open. Call start_frame() before.");
+    std::lock_guard<std::mutex> lk(image_write_mutex);
     if (timed)
         max_time = std::max(max_time, time);
+    real_photons++;
+}
+
+void Medipix::replay_photon(const Deposit *deposits, size_t n) {
+    if (!shutter_open)
+        throw std::logic_error("Shutter not open. Call start_frame() before.");
+    if (n == 0)
+        return;
     std::lock_guard<std::mutex> lk(image_write_mutex);
+    if (timed)
+        max_time = std::max(max_time, deposits[0].time);
     real_photons++;
 }
 
+void Medipix::add_photons(const PhotonBatch &batch) {
+    if (!shutter_open)
+        throw std::logic_error("Shutter not open. Call start_frame() before.");
+    if (batch.radius >= 1 && batch.radius <= max_kernel_radius && deposit_kernels[batch.radius] && !depth_tables) {
+        deposit_kernels[batch.radius](*this, batch);
+        return;
+    }
+    for (unsigned int k = 0; k < batch.n; ++k) {
+        if (batch.interacting[k] && in_region_of_interest(batch.x[k], batch.y[k], batch.radius))
+            add_photon(batch.energy[k], batch.x[k], batch.y[k], batch.depth[k], batch.radius, batch.time[k]);
+    }
+}
+
+void Medipix::set_specialized_kernels(bool enabled) {
+    specialized_kernels = enabled;
+}
+
+bool Medipix::get_specialized_kernels() const {
+    return specialized_kernels;
+}
+
+void Medipix::select_deposit_kernels() {
+    deposit_kernels = {};
+}
+
+template<int Radius>
+void Medipix::deposit_events(const PhotonBatch &batch) {
+    constexpr int width = 2 * Radius;
+    float scale = psf_sigma * float(std::numbers::sqrt2);
+    unsigned int n_photons = 0;
+    double last_time = 0.;
+    for (unsigned int k = 0; k < batch.n; ++k) {
+        float x = batch.x[k];
+        float y = batch.y[k];
+        if (!batch.interacting[k] || !in_region_of_interest(x, y, batch.radius))
+            continue;
+        ++n_photons;
+        last_time = std::max(last_time, batch.time[k]);
+        auto [center_i, center_j] = get_pixel_index(x, y);
+        std::array<float, width> x_component;
+        std::array<float, width> y_component;
+        for (int a = 0; a < width; ++a) {
+            x_component[a] = column_component(unsigned(int(center_i) - Radius + a), x, scale);
+            y_component[a] = row_component(unsigned(int(center_j) - Radius + a), y, scale);
+        }
+        for (int a = 0; a < width; ++a) {
+            int i = int(center_i) - Radius + a;
+            for (int b = 0; b < width; ++b) {
+                int j = int(center_j) - Radius + b;
+                if (!in_roi(i, j))
+                    continue;
+                events.add(pixel_offset(i, j), Event{batch.time[k], 0.25f * batch.energy[k] * x_component[a] *
+                                                                    y_component[b]});
+            }
+        }
+    }
+    commit_batch(n_photons, last_time, {});
+}
+
+template void Medipix::deposit_events<1>(const PhotonBatch &);
+template void Medipix::deposit_events<2>(const PhotonBatch &);
+template void Medipix::deposit_events<3>(const PhotonBatch &);
+template void Medipix::deposit_events<4>(const PhotonBatch &);
+
+void Medipix::commit_batch(unsigned int n_photons, double last_time, std::span<const uint32_t> hits) {
+    std::lock_guard<std::mutex> lk(image_write_mutex);
+    if (timed && n_photons > 0)
+        max_time = std::max(max_time, last_time);
+    real_photons += n_photons;
+    for (auto hit: hits)
+        image[hit] += 1;
+}
+
 void Medipix::build_i_krum_response() {
     // We sample the response function at 100 points per us
     float max_resp_time = 2.f;
     unsigned int n_response_points = int(max_resp_time * float(samples_per_us));
-    response_function.clear();
-    response_function.resize(n_response_points, 0.f);
+    auto response = std::make_shared<std::vector<float>>(n_response_points, 0.f);
 
     // Extremely rough estimation for IKrum 20 setting
     // # TODO: make this configurable
     for (unsigned int i = 0; i < samples_per_us * 1; ++i) {
-        response_function[i] = 1.f - float(i) / float(samples_per_us * 1);
+        (*response)[i] = 1.f - float(i) / float(samples_per_us * 1);
     }
     for (unsigned int i = samples_per_us * 1; i < n_response_points; ++i) {
-        response_function[i] = 0.f;
+        (*response)[i] = 0.f;
     }
+    response_function = response;
+    response_convolver = nullptr;
 }
 
 std::vector<float> Medipix::calculate_pixel_signal(unsigned int i, unsigned int j) {
-    auto pixel_events = events[i * n_pixel_y + j];
-    std::vector<float> pixel_signal(int(max_time * float(samples_per_us)) + response_function.size(), 0.f);
-
-    for (auto event: pixel_events) {
-        unsigned int start_index = int(event.time * float(samples_per_us));
-        for (unsigned int index = 0; index < response_function.size(); ++index) {
-            if (start_index + index < pixel_signal.size()) {
-                pixel_signal[start_index + index] += event.energy * response_function[index];
+    const auto &response = *response_function;
+    std::vector<float> pixel_signal(size_t(max_time * double(samples_per_us)) + response.size(), 0.f);
+    size_t first_sample = 0;
+    std::vector<Event> buffer;
+    events.load_tile(events.get_tile(pixel_offset(i, j)));
+    Arena::Scope scope(arenas.local());
+    auto signal = calculate_pixel_signal(events.find(pixel_offset(i, j), buffer), first_sample);
+    std::copy(signal.begin(), signal.end(), pixel_signal.begin() + first_sample);
+    return pixel_signal;
+}
+
+size_t Medipix::get_sample(const Event &event) const {
+    // A time step is an exact fraction of a µs, the index is exact in integers. The whole µs are scaled separately,
+    // so that no product overflows.
+    constexpr auto steps_per_us = static_cast<size_t>(1. / Event::time_step);
+    auto steps = static_cast<size_t>(event.time_steps);
+    return steps / steps_per_us * samples_per_us + steps % steps_per_us * samples_per_us / steps_per_us;
+}
+
+std::pmr::vector<float> Medipix::calculate_pixel_signal(std::span<const Event> pixel_events,
+                                                        size_t &first_sample) const {
+    const auto &response = *response_function;
+    size_t n_samples = size_t(max_time * double(samples_per_us)) + response.size();
+    first_sample = 0;
+    if (pixel_events.empty())
+        return std::pmr::vector<float>(&arenas.local());
+    size_t first = n_samples;
+    size_t last = 0;
+    for (const auto &event: pixel_events) {
+        size_t start_index = get_sample(event);
+        first = std::min(first, start_index);
+        last = std::max(last, start_index + response.size());
+    }
+    last = std::min(last, n_samples);
+    std::pmr::vector<float> pixel_signal(last - first, 0.f, &arenas.local());
+
+    for (const auto &event: pixel_events) {
+        size_t start_index = get_sample(event);
+        for (size_t index = 0; index < response.size() && start_index + index < last; ++index) {
+            pixel_signal[start_index + index - first] += event.energy * response[index];
+        }
+    }
+    first_sample = first;
+    return pixel_signal;
+}
+
+std::pmr::vector<float> Medipix::calculate_pixel_signal(std::span<const Event> pixel_events,
+                                                        size_t &first_sample, float threshold) const {
+    const auto &response = *response_function;
+    size_t n_samples = size_t(max_time * double(samples_per_us)) + response.size();
+    first_sample = 0;
+    if (pixel_events.empty())
+        return std::pmr::vector<float>(&arenas.local());
+    size_t first = n_samples;
+    size_t last = 0;
+    for (const auto &event: pixel_events) {
+        size_t start_index = get_sample(event);
+        first = std::min(first, start_index);
+        last = std::max(last, start_index + response.size());
+    }
+    last = std::min(last, n_samples);
+    size_t length = last - first;
+    // Below the crossover (mean number of overlapping pulses) adding the pulses is faster
+    if (!response_convolver ||
+        double(pixel_events.size()) * double(response.size()) < double(fft_crossover) * double(length))
+        return calculate_pixel_signal(pixel_events, first_sample);
+
+    auto &arena = arenas.local();
+    std::pmr::vector<float> pixel_signal(length, &arena);
+    {
+        Arena::Scope scope(arena);
+        // Pulse heights binned by start sample, and the events sorted by start sample (in their order per sample)
+        std::pmr::vector<double> impulses(length, 0., &arena);
+        std::pmr::vector<uint32_t> offsets(length + 1, 0, &arena);
+        float max_energy = 0.f;
+        for (const auto &event: pixel_events) {
+            size_t sample = get_sample(event) - first;
+            impulses[sample] += event.energy;
+            offsets[sample + 1] += 1;
+            max_energy = std::max(max_energy, std::abs(event.energy));
+        }
+        for (size_t s = 0; s < length; ++s)
+            offsets[s + 1] += offsets[s];
+        std::pmr::vector<uint32_t> sorted(pixel_events.size(), &arena);
+        {
+            std::pmr::vector<uint32_t> position(offsets.begin(), offsets.end() - 1, &arena);
+            for (size_t k = 0; k < pixel_events.size(); ++k) {
+                size_t sample = get_sample(pixel_events[k]) - first;
+                sorted[position[sample]++] = static_cast<uint32_t>(k);
             }
         }
+        response_convolver->convolve(impulses.data(), length, pixel_signal.data(), arena);
+
+        // Bound of the difference to the pulse sum: rounding of the float sum of up to max_overlap pulses, of the
+        // FFT and of the conversion to float
+        size_t max_overlap = 0;
+        for (size_t s = 0; s < length; ++s)
+            max_overlap = std::max<size_t>(max_overlap, offsets[s + 1] - offsets[s + 1 - std::min(s + 1, response.size())]);
+        float max_response = 0.f;
+        for (auto value: response)
+            max_response = std::max(max_response, std::abs(value));
+        double magnitude = double(max_overlap) * double(max_energy) * double(max_response);
+        double tolerance = (double(max_overlap + 2) * std::ldexp(1., -22) + 1E-9) * magnitude +
+                           1E-9 * double(pixel_events.size()) * double(max_energy) * double(max_response);
+
+        // Samples that could be on the other side of the threshold are added up as in the overload without threshold
+        std::pmr::vector<uint32_t> overlapping(&arena);
+        for (size_t s = 0; s < length; ++s) {
+            if (std::abs(double(pixel_signal[s]) - double(threshold)) > tolerance)
+                continue;
+            size_t first_start = s + 1 - std::min(s + 1, response.size());
+            overlapping.assign(sorted.begin() + offsets[first_start], sorted.begin() + offsets[s + 1]);
+            std::sort(overlapping.begin(), overlapping.end());
+            float value = 0.f;
+            for (auto k: overlapping) {
+                size_t start = get_sample(pixel_events[k]) - first;
+                value += pixel_events[k].energy * response[s - start];
+            }
+            pixel_signal[s] = value;
+        }
     }
+    first_sample = first;
     return pixel_signal;
 }
 
@@ -232,10 +656,213 @@ bool Medipix::get_timed() const {
     return timed;
 }
 
+void Medipix::set_compact_events(bool compact) {
+    if (shutter_open)
+        throw std::logic_error("Shutter open. Call finish_frame() before.");
+    events.set_compact(compact, samples_per_us);
+}
+
+bool Medipix::get_compact_events() const {
+    return events.get_compact();
+}
+
+void Medipix::check_exposure_duration(double duration) const {
+    if (timed && !(duration <= events.get_max_time()))
+        throw std::out_of_range("Exposure longer than the range of the event encoding.");
+}
+
+void Medipix::set_fft_crossover(float overlap) {
+    if (!(overlap >= 0.f))
+        throw std::invalid_argument("The FFT crossover must not be negative.");
+    fft_crossover = overlap;
+}
+
+float Medipix::get_fft_crossover() const {
+    return fft_crossover;
+}
+
+void Medipix::set_event_spill(size_t memory_budget, const std::string &directory, unsigned int rows_per_tile) {
+    if (shutter_open)
+        throw std::logic_error("Shutter open. Call finish_frame() before.");
+    if (rows_per_tile == 0)
+        throw std::invalid_argument("Tiles need at least one row.");
+    spill_budget = memory_budget;
+    spill_directory = directory;
+    spill_rows_per_tile = rows_per_tile;
+    events.set_spill(spill_budget, spill_directory, spill_rows_per_tile * roi.ny, roi.nx * roi.ny);
+    // The owner blocks follow the tiles
+    if (numa_placement)
+        place_pixel_buffers();
+}
+
+size_t Medipix::get_spilled_bytes() const {
+    return events.get_spilled_bytes();
+}
+
+namespace {
+    /**
+     * Single thread throughputs of the timed mode (s per unit) for the runtime estimate: photon generation and
+     * energy of a deposit, adding the response of an event to the waveform and the threshold scan of a sample
+     */
+    constexpr double seconds_per_deposit = 1.5E-7;
+    constexpr double seconds_per_response_sample = 1E-9;
+    constexpr double seconds_per_scan_sample = 1E-9;
+
+    /**
+     * Expected waveform length of a pixel with events: n events uniform in [0, n_samples) span
+     * n_samples (n - 1) / (n + 1), plus the response after the last event. n is Poisson distributed with mean lambda.
+     */
+    double expected_window(double lambda, double n_samples, double response_length) {
+        if (lambda <= 0.)
+            return 0.;
+        double spread = 10. * std::sqrt(lambda) + 10.;
+        auto first = static_cast<unsigned long long>(std::max(1., lambda - spread));
+        auto last = static_cast<unsigned long long>(lambda + spread);
+        double window = 0.;
+        double probability = 0.;
+        for (auto n = first; n <= last; ++n) {
+            double p = std::exp(double(n) * std::log(lambda) - lambda - std::lgamma(double(n) + 1.));
+            window += p * (n_samples * double(n - 1) / double(n + 1) + response_length);
+            probability += p;
+        }
+        return window / probability;
+    }
+}
+
+FrameEstimate Medipix::estimate_frame(double exposure_time, double flux_density, int radius) {
+    FrameEstimate estimate{};
+    double area = double(get_max_x() - get_min_x()) * 0.001 * double(get_max_y() - get_min_y()) * 0.001;
+    estimate.photons = static_cast<unsigned long long>(flux_density * area * exposure_time);
+
+    // Photons outside of the region of interest are not simulated
+    double n_pixels = double(roi.nx) * double(roi.ny);
+    double fraction = std::min(1., n_pixels / (double(n_pixel_x) * double(n_pixel_y)));
+    estimate.deposits = double(estimate.photons) * fraction * 4. * double(radius) * double(radius);
+    estimate.pixel_bytes = static_cast<size_t>(n_pixels) * (sizeof(unsigned int) + sizeof(float));
+    auto n_threads = double(omp_get_max_threads());
+
+    double seconds = estimate.deposits * seconds_per_deposit;
+    if (timed) {
+        build_i_krum_response(i_krum);
+        auto response_length = double(response_function->size());
+        double n_samples = exposure_time * 1E6 * double(samples_per_us);
+        double lambda = estimate.deposits / n_pixels;
+        estimate.active_pixels = n_pixels * -std::expm1(-lambda);
+        estimate.samples_per_pixel = static_cast<size_t>(n_samples + response_length);
+        estimate.signal_samples = estimate.active_pixels * expected_window(lambda, n_samples, response_length);
+
+        // Thread buffers, sort buffer and compressed layout exist at the same time in finalize(). The capacity of
+        // the thread buffers can be twice their size.
+        auto n_events = static_cast<size_t>(estimate.deposits);
+        estimate.event_bytes = n_events * (3 * events.get_buffered_event_bytes() + events.get_stored_event_bytes()) +
+                               static_cast<size_t>(estimate.active_pixels) * 2 * sizeof(uint32_t);
+        estimate.signal_bytes = static_cast<size_t>(n_threads) * estimate.samples_per_pixel * sizeof(float);
+        seconds += estimate.deposits * response_length * seconds_per_response_sample +
+                   estimate.signal_samples * seconds_per_scan_sample;
+    }
+    estimate.peak_bytes = estimate.pixel_bytes + estimate.event_bytes + estimate.signal_bytes;
+    estimate.runtime = seconds / n_threads;
+    return estimate;
+}
+
+void Medipix::set_memory_budget(size_t budget, BudgetPolicy policy, const std::string &directory) {
+    memory_budget = budget;
+    budget_policy = policy;
+    budget_directory = directory;
+}
+
+FrameEstimate Medipix::plan_frame(double exposure_time, double flux_density, int radius) {
+    if (shutter_open)
+        throw std::logic_error("Shutter open. Call finish_frame() before.");
+    auto estimate = estimate_frame(exposure_time, flux_density, radius);
+    if (budget_spill) {
+        set_event_spill(0);
+        budget_spill = false;
+    }
+    estimated_peak_bytes = estimate.peak_bytes;
+    if (memory_budget == 0 || estimate.peak_bytes <= memory_budget)
+        return estimate;
+
+    auto fixed_bytes = estimate.pixel_bytes + estimate.signal_bytes;
+    if (budget_policy == BudgetPolicy::Refuse || !timed || fixed_bytes >= memory_budget) {
+        throw std::runtime_error("Estimated peak memory of " + std::to_string(estimate.peak_bytes) +
+                                 " bytes exceeds the memory budget of " + std::to_string(memory_budget) + " bytes.");
+    }
+
+    // Half of the remaining memory for the thread buffers, half for a tile. The buffers spill at half of their part,
+    // since their capacity can be twice their size.
+    size_t available = (memory_budget - fixed_bytes) / 2;
+    double events_per_row = estimate.deposits / double(roi.nx);
+    double row_bytes = events_per_row * double(events.get_buffered_event_bytes() + events.get_stored_event_bytes()) +
+                       double(roi.ny) * 2. * sizeof(uint32_t);
+    auto rows_per_tile = static_cast<unsigned int>(std::min(double(roi.nx), double(available) / row_bytes));
+    if (rows_per_tile == 0) {
+        throw std::runtime_error("A single pixel row of the frame does not fit into the memory budget of " +
+                                 std::to_string(memory_budget) + " bytes.");
+    }
+    set_event_spill(available / 2, budget_directory, rows_per_tile);
+    budget_spill = true;
+
+    estimate.spill = true;
+    estimate.rows_per_tile = rows_per_tile;
+    estimate.event_bytes = available + static_cast<size_t>(double(rows_per_tile) * row_bytes);
+    estimate.peak_bytes = fixed_bytes + estimate.event_bytes;
+    estimated_peak_bytes = estimate.peak_bytes;
+    return estimate;
+}
+
+MemoryStats Medipix::get_memory_stats() const {
+    size_t pixel_bytes = image.capacity() * sizeof(unsigned int) + th0_dispersion->capacity() * sizeof(float);
+    return MemoryStats{memory_budget, budget_policy, estimated_peak_bytes,
+                       pixel_bytes + events.get_allocated_bytes(), pixel_bytes + events.get_peak_bytes(),
+                       events.get_spilled_bytes(), spill_budget > 0};
+}
+
+size_t Medipix::get_arena_capacity() const {
+    return arenas.get_capacity();
+}
+
+void Medipix::set_numa_placement(bool enabled) {
+    if (shutter_open)
+        throw std::logic_error("Shutter open. Call finish_frame() before.");
+    numa_placement = enabled;
+    events.set_owner_placement(enabled, roi.nx * roi.ny);
+    if (enabled) {
+        pinning.pin();
+        place_pixel_buffers();
+    } else {
+        pinning.release();
+    }
+}
+
+bool Medipix::get_numa_placement() const {
+    return numa_placement;
+}
+
+size_t Medipix::get_event_memory_usage() const {
+    return events.get_memory_usage();
+}
+
+size_t Medipix::get_number_of_events() const {
+    return events.size();
+}
+
 unsigned int Medipix::get_pixel_value(unsigned int i, unsigned int j) const {
     if (shutter_open)
         throw std::logic_error("Shutter open. Call finish_frame() before.");
-    return image[i * n_pixel_y + j];
+    if (!in_roi(int(i), int(j)))
+        throw std::out_of_range("Pixel is outside of the region of interest.");
+    return image[pixel_offset(i, j)];
+}
+
+const std::vector<unsigned int> &Medipix::get_image() const {
+    if (shutter_open)
+        throw std::logic_error("Shutter open. Call finish_frame() before.");
+    return image;
+}
+
+std::shared_ptr<Medipix> Medipix::clone() const {
+    return std::make_shared<Medipix>(*this);
 }
 
 bool Medipix::get_shutter_open() const {
@@ -245,21 +872,25 @@ bool Medipix::get_shutter_open() const {
 std::vector<float> Medipix::get_fourier_spectrum() {
     if (shutter_open)
         throw std::logic_error("Shutter open. Call finish_frame() before.");
-    std::vector<fftw_complex> fourier_spectrum((size_t) n_pixel_x * n_pixel_y);
-    std::vector<double> image_float((size_t) n_pixel_x * n_pixel_y);
-    for (unsigned int k = 0; k < n_pixel_x * n_pixel_y; ++k) {
+    auto &arena = arenas.local();
+    Arena::Scope scope(arena);
+    // fftw_complex is double[2]
+    std::pmr::vector<double> fourier_values(2 * (size_t) roi.nx * roi.ny, &arena);
+    auto *fourier_spectrum = reinterpret_cast<fftw_complex *>(fourier_values.data());
+    std::pmr::vector<double> image_float((size_t) roi.nx * roi.ny, &arena);
+    for (unsigned int k = 0; k < roi.nx * roi.ny; ++k) {
         image_float[k] = double(image[k]);
     }
-    auto plan = fftw_plan_dft_r2c_2d(int(n_pixel_x), int(n_pixel_y), image_float.data(), fourier_spectrum.data(),
+    auto plan = fftw_plan_dft_r2c_2d(int(roi.nx), int(roi.ny), image_float.data(), fourier_spectrum,
                                      FFTW_ESTIMATE);
     fftw_execute(plan);
     fftw_destroy_plan(plan);
-    unsigned int n_k = std::min(n_pixel_x, n_pixel_y) / 2;
+    unsigned int n_k = std::min(roi.nx, roi.ny) / 2;
     std::vector<float> spectrum(n_k, 0.f);
-    std::vector<unsigned int> spectrum_count(n_k, 0);
-    float center[2] = {static_cast<float>(n_pixel_x / 2.0), static_cast<float>((n_pixel_y) / 2.0)};
-    for (int i = 0; i < n_pixel_x; ++i) {
-        for (int j = 0; j < n_pixel_y; ++j) {
+    std::pmr::vector<unsigned int> spectrum_count(n_k, 0, &arena);
+    float center[2] = {static_cast<float>(roi.nx / 2.0), static_cast<float>((roi.ny) / 2.0)};
+    for (int i = 0; i < roi.nx; ++i) {
+        for (int j = 0; j < roi.ny; ++j) {
             double x_distance, y_distance;
             if (i < int(center[0])) {
                 x_distance = double(i);
@@ -271,13 +902,13 @@ std::vector<float> Medipix::get_fourier_spectrum() {
             } else {
                 y_distance = double(j) - center[1];
             }
-            x_distance = x_distance / n_pixel_x * n_k * 2;
-            y_distance = y_distance / n_pixel_y * n_k * 2;
+            x_distance = x_distance / roi.nx * n_k * 2;
+            y_distance = y_distance / roi.ny * n_k * 2;
             unsigned int r = int(std::sqrt(x_distance * x_distance + y_distance * y_distance));
             if (r > n_k)
                 continue;
-            spectrum[r] += float(std::sqrt(fourier_spectrum[i * n_pixel_y + j][0] * fourier_spectrum[i * n_pixel_y + j][0] +
-                                     fourier_spectrum[i * n_pixel_y + j][1] * fourier_spectrum[i * n_pixel_y + j][1]));
+            spectrum[r] += float(std::sqrt(fourier_spectrum[i * roi.ny + j][0] * fourier_spectrum[i * roi.ny + j][0] +
+                                     fourier_spectrum[i * roi.ny + j][1] * fourier_spectrum[i * roi.ny + j][1]));
             spectrum_count[r] += 1;
         }
     }
@@ -308,6 +939,18 @@ void Medipix::build_i_krum_response(int _i_krum) {
     if (_i_krum < 1 or _i_krum > 100)
         throw std::invalid_argument("i_krum must be between 1 and 100.");
 
+    // The response only depends on i_krum and the sampling, so it is calculated once and shared.
+    static std::mutex cache_mutex;
+    static std::map<std::pair<int, unsigned int>,
+            std::pair<std::shared_ptr<const std::vector<float>>, std::shared_ptr<const ResponseConvolver>>> cache;
+    std::lock_guard<std::mutex> lk(cache_mutex);
+    auto &[cached_response, cached_convolver] = cache[std::make_pair(_i_krum, samples_per_us)];
+    if (cached_response) {
+        response_function = cached_response;
+        response_convolver = cached_convolver;
+        return;
+    }
+
     // Fitted values from the paper https://iopscience.iop.org/article/10.1088/1748-0221/10/01/C01047/
     // with the response function "response" below.
     std::vector<int> i_krum_model = {1, 10, 20, 50, 70, 100};
@@ -350,17 +993,20 @@ void Medipix::build_i_krum_response(int _i_krum) {
 
     float max_resp_time = 5.f;
     unsigned int n_response_points = int(max_resp_time * float(samples_per_us));
-    response_function.clear();
-    response_function.resize(n_response_points, 0.f);
+    auto response_values = std::make_shared<std::vector<float>>(n_response_points, 0.f);
     float max_response = 0.f;
     for(unsigned int i = 0; i < n_response_points; ++i){
         float x = float(i) / float(samples_per_us);
-        response_function[i] = response(x, wn_i, wd_i, d_i);
-        if(response_function[i] > max_response)
-            max_response = response_function[i];
+        (*response_values)[i] = response(x, wn_i, wd_i, d_i);
+        if((*response_values)[i] > max_response)
+            max_response = (*response_values)[i];
     }
-    for(auto &r: response_function)
+    for(auto &r: *response_values)
         r /= max_response;
+    cached_response = response_values;
+    cached_convolver = std::make_shared<const ResponseConvolver>(*response_values);
+    response_function = response_values;
+    response_convolver = cached_convolver;
 }
 
 int Medipix::get_i_krum() const {
@@ -16,28 +16,51 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <array>
 #include <map>
+#include <memory_resource>
+#include <numbers>
 #include <random>
 #include "MedipixCSM.h"
+#include "RandomStream.h"
 
 MedipixCSM::MedipixCSM(bool timed, unsigned int nx, unsigned ny): Medipix(timed, nx, ny){
-    th1_dispersion.resize(static_cast<std::vector<float>::size_type>(n_pixel_x) * n_pixel_y);
+    th1_dispersion = std::make_shared<const std::vector<float>>(static_cast<size_t>(roi.nx) * roi.ny, 0.f);
 
 }
 
 MedipixCSM::MedipixCSM(): Medipix(false) {
-    th1_dispersion.resize(static_cast<std::vector<float>::size_type>(n_pixel_x) * n_pixel_y);
+    th1_dispersion = std::make_shared<const std::vector<float>>(static_cast<size_t>(roi.nx) * roi.ny, 0.f);
 }
 
-void MedipixCSM::add_photon(float energy, float position_x, float position_y, int radius, float time) {
-    Medipix::add_photon(energy, position_x, position_y, radius, time);
+void MedipixCSM::allocate_pixels() {
+    // Before the base, which places the pixel buffers
+    th1_dispersion = std::make_shared<const std::vector<float>>(static_cast<size_t>(roi.nx) * roi.ny, 0.f);
+    Medipix::allocate_pixels();
+}
+
+void MedipixCSM::place_pixel_buffers() {
+    Medipix::place_pixel_buffers();
+    if (th1_dispersion.use_count() > 1)
+        th1_dispersion = std::make_shared<const std::vector<float>>(*th1_dispersion);
+    place_pixels(th1_dispersion->data(), sizeof(float));
+}
+
+std::shared_ptr<Medipix> MedipixCSM::clone() const {
+    return std::make_shared<MedipixCSM>(*this);
+}
+
+void MedipixCSM::add_photon(float energy, float position_x, float position_y, float depth, int radius, double time) {
+    Medipix::add_photon(energy, position_x, position_y, depth, radius, time);
 
 
     if (!timed) {
         // NOTE: We assume that the charge is only be shared between 4 pixel -> only one summing node is activated!
         // TODO: Implement a more general solution
         radius = 1;
-        std::list<std::pair<unsigned int, unsigned int>> pixels;
+        auto &arena = arenas.local();
+        Arena::Scope scope(arena);
+        std::pmr::list<std::pair<unsigned int, unsigned int>> pixels(&arena);
         auto [center_position_x, center_position_y] = get_pixel_index(position_x, position_y);
         auto [pixel_center_index_x, pixel_center_index_y] = get_pixel_center(center_position_x, center_position_y);
         unsigned int x_shift = 0;
@@ -55,20 +78,23 @@ void MedipixCSM::add_photon(float energy, float position_x, float position_y, in
             y_shift = 1;
         }
         float summed_energy = 0;
-        std::vector<unsigned int> index_i { center_position_x, center_position_x + x_shift};
-        std::vector<unsigned int> index_j { center_position_y, center_position_y + y_shift};
+        std::pmr::vector<unsigned int> index_i({center_position_x, center_position_x + x_shift}, &arena);
+        std::pmr::vector<unsigned int> index_j({center_position_y, center_position_y + y_shift}, &arena);
         for(auto& i: index_i){
             for(auto& j: index_j){
                 if (i >= 0 && i < n_pixel_x && j >=0 && j < n_pixel_y){
-                    auto pixel_center = get_pixel_center(i, j);
-                    float dep_energy = calculate_shared_energy(position_x, position_y, energy, pixel_center.first, pixel_center.second);
-                    if(dep_energy > get_th0(i, j)){
+                    float dep_energy = calculate_pixel_energy(position_x, position_y, energy, i, j, depth);
+                    float threshold = in_roi(int(i), int(j)) ? get_th0(i, j) : get_th0_outside_roi(i, j);
+                    if(dep_energy > threshold){
                         summed_energy += dep_energy;
                     }
                 }
             }
         }
-        if (summed_energy > get_th1(center_position_x, center_position_y)){
+        // The summing node of a photon outside of the chip (halo of an assembly) is on another chip,
+        // outside of the region of interest it is not simulated
+        if (in_roi(int(center_position_x), int(center_position_y)) &&
+            summed_energy > get_th1(center_position_x, center_position_y)){
             increase_counter(center_position_x, center_position_y);
         }
 
@@ -76,42 +102,137 @@ void MedipixCSM::add_photon(float energy, float position_x, float position_y, in
     }
 
     else{
-        std::list<std::pair<unsigned int, unsigned int>> pixels;
+        auto &arena = arenas.local();
+        Arena::Scope scope(arena);
+        std::pmr::list<std::pair<unsigned int, unsigned int>> pixels(&arena);
         auto [center_position_x, center_position_y] = get_pixel_index(position_x, position_y);
         for (int i = -radius; i<radius; ++i){
             for (int j = -radius; j < radius; ++j){
                 int x_index = int(center_position_x) + i;
                 int y_index = int(center_position_y) + j;
-                if (x_index >= 0 && x_index < n_pixel_x && y_index >=0 && y_index < n_pixel_y)
+                if (in_roi(x_index, y_index))
                     pixels.emplace_back(x_index, y_index);
             }
         }
         for (auto& pixel : pixels){
             unsigned int i = pixel.first;
             unsigned int j = pixel.second;
-            auto pixel_center = get_pixel_center(i, j);
-            float dep_energy = calculate_shared_energy(position_x, position_y, energy, pixel_center.first, pixel_center.second);
+            float dep_energy = calculate_pixel_energy(position_x, position_y, energy, i, j, depth);
             Event event(time, dep_energy);
-            events[i*n_pixel_y + j].emplace_back(event);
+            events.add(pixel_offset(i, j), event);
+        }
+    }
+
+}
+
+void MedipixCSM::select_deposit_kernels() {
+    deposit_kernels = {};
+    if (!specialized_kernels || depth_tables)
+        return;
+    if (timed)
+        deposit_kernels = {nullptr, &event_kernel<1>, &event_kernel<2>, &event_kernel<3>, &event_kernel<4>};
+    else
+        deposit_kernels = {nullptr, &count_kernel, &count_kernel, &count_kernel, &count_kernel};
+}
+
+void MedipixCSM::count_photons(const PhotonBatch &batch) {
+    float scale = psf_sigma * float(std::numbers::sqrt2);
+    auto &arena = arenas.local();
+    Arena::Scope scope(arena);
+    std::pmr::vector<uint32_t> hits(&arena);
+    unsigned int n_photons = 0;
+    for (unsigned int k = 0; k < batch.n; ++k) {
+        float x = batch.x[k];
+        float y = batch.y[k];
+        if (!batch.interacting[k] || !in_region_of_interest(x, y, batch.radius))
+            continue;
+        ++n_photons;
+        auto [center_i, center_j] = get_pixel_index(x, y);
+        auto [center_x, center_y] = get_pixel_center(center_i, center_j);
+        // Group of the center pixel and its neighbours towards the photon
+        std::array<unsigned int, 2> index_i{center_i, center_i + (x < center_x ? -1u : 1u)};
+        std::array<unsigned int, 2> index_j{center_j, center_j + (y < center_y ? -1u : 1u)};
+        std::array<float, 2> x_component{};
+        std::array<float, 2> y_component{};
+        for (int a = 0; a < 2; ++a) {
+            if (index_i[a] < n_pixel_x)
+                x_component[a] = column_component(index_i[a], x, scale);
+            if (index_j[a] < n_pixel_y)
+                y_component[a] = row_component(index_j[a], y, scale);
+        }
+        float summed_energy = 0.f;
+        for (int a = 0; a < 2; ++a) {
+            unsigned int i = index_i[a];
+            for (int b = 0; b < 2; ++b) {
+                unsigned int j = index_j[b];
+                if (i >= n_pixel_x || j >= n_pixel_y)
+                    continue;
+                float dep_energy = 0.25f * batch.energy[k] * x_component[a] * y_component[b];
+                float threshold = in_roi(int(i), int(j)) ? get_th0(i, j) : get_th0_outside_roi(i, j);
+                if (dep_energy > threshold)
+                    summed_energy += dep_energy;
+            }
         }
+        if (in_roi(int(center_i), int(center_j)) && summed_energy > get_th1(center_i, center_j))
+            hits.push_back(static_cast<uint32_t>(pixel_offset(center_i, center_j)));
     }
+    commit_batch(n_photons, 0.f, hits);
+}
+
+void MedipixCSM::replay_photon(const Deposit *deposits, size_t n) {
+    Medipix::replay_photon(deposits, n);
+    if (n == 0)
+        return;
 
+    if (!timed) {
+        float summed_energy = 0;
+        for (size_t k = 0; k < n; ++k) {
+            const auto &deposit = deposits[k];
+            if (!(deposit.flags & Deposit::summing_group))
+                continue;
+            unsigned int i = deposit.pixel / n_pixel_y;
+            unsigned int j = deposit.pixel % n_pixel_y;
+            float threshold = in_roi(int(i), int(j)) ? get_th0(i, j) : get_th0_outside_roi(i, j);
+            if (deposit.energy > threshold)
+                summed_energy += deposit.energy;
+        }
+        unsigned int node = deposits[0].pixel;
+        if (node != Deposit::no_pixel && in_roi(int(node / n_pixel_y), int(node % n_pixel_y)) &&
+            summed_energy > get_th1(node / n_pixel_y, node % n_pixel_y)) {
+            increase_counter(node / n_pixel_y, node % n_pixel_y);
+        }
+    } else {
+        for (size_t k = 0; k < n; ++k) {
+            const auto &deposit = deposits[k];
+            if (deposit.pixel == Deposit::no_pixel ||
+                !in_roi(int(deposit.pixel / n_pixel_y), int(deposit.pixel % n_pixel_y)))
+                continue;
+            Event event(deposit.time, deposit.energy);
+            events.add(pixel_offset(deposit.pixel / n_pixel_y, deposit.pixel % n_pixel_y), event);
+        }
+    }
 }
 
 void MedipixCSM::finish_frame() {
     Medipix::finish_frame();
 }
 
-void MedipixCSM::random_threshold_dispersion(float sigma) {
-    Medipix::random_threshold_dispersion(sigma);
-    std::normal_distribution<float> distribution(0.f, sigma);
-    unsigned int seed = time(nullptr);
-    std::default_random_engine generator(seed);
-
-#pragma omp parallel for default(none) shared(generator, distribution)
-    for (unsigned int i = 0; i < n_pixel_y * n_pixel_x; ++i) {
-        th1_dispersion[i] = distribution(generator);
+void MedipixCSM::random_threshold_dispersion(float sigma, unsigned int seed) {
+    Medipix::random_threshold_dispersion(sigma, seed);
+    auto dispersion = std::make_shared<std::vector<float>>(static_cast<size_t>(roi.nx) * roi.ny);
+    unsigned int n_pixels = n_pixel_y * n_pixel_x;
+
+    // th1 uses the streams after the ones of th0
+#pragma omp parallel for default(none) shared(sigma, seed, dispersion, n_pixels)
+    for (unsigned int k = 0; k < roi.nx * roi.ny; ++k) {
+        unsigned int i = roi.x0 + k / roi.ny;
+        unsigned int j = roi.y0 + k % roi.ny;
+        RandomStream rng(seed, n_pixels + i * n_pixel_y + j);
+        (*dispersion)[k] = rng.normal(0.f, sigma);
     }
+    th1_dispersion = dispersion;
+    if (numa_placement)
+        place_pixels(th1_dispersion->data(), sizeof(float));
 }
 
 void MedipixCSM::set_th1(float t) {
@@ -119,9 +240,9 @@ void MedipixCSM::set_th1(float t) {
 }
 
 float MedipixCSM::get_th1(unsigned int i, unsigned int j) {
-    return th1 + th1_dispersion[i*n_pixel_y + j];
+    return th1 + (*th1_dispersion)[pixel_offset(i, j)];
 }
 
-[[maybe_unused]] float MedipixCSM::get_th1() {
+[[maybe_unused]] float MedipixCSM::get_th1() const {
     return th1;
 }
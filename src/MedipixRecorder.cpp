@@ -0,0 +1,189 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "MedipixRecorder.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MedipixRecorder::MedipixRecorder(const std::string &filename, unsigned int nx, unsigned int ny, float min_energy)
+        : Medipix(false, nx, ny),
+          file(std::make_shared<std::ofstream>(filename, std::ios::out | std::ios::binary | std::ios::trunc)),
+          min_energy(min_energy) {
+    if (!*file)
+        throw std::runtime_error("Could not open deposit file " + filename);
+    DepositFileHeader header{};
+    std::copy(std::begin(DepositFileHeader::file_magic), std::end(DepositFileHeader::file_magic), header.magic);
+    header.n_pixel_x = nx;
+    header.n_pixel_y = ny;
+    file->write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+std::shared_ptr<Medipix> MedipixRecorder::clone() const {
+    throw std::logic_error("A recorder can not be cloned.");
+}
+
+void MedipixRecorder::add_photon(float energy, float position_x, float position_y, float depth, int radius,
+                                 double time) {
+    Medipix::add_photon(energy, position_x, position_y, depth, radius, time);
+
+    auto [index_x, index_y] = get_pixel_index(position_x, position_y);
+    int center_i = int(index_x);
+    int center_j = int(index_y);
+    auto in_detector = [this](int i, int j) {
+        return i >= 0 && i < int(n_pixel_x) && j >= 0 && j < int(n_pixel_y);
+    };
+
+    auto &arena = arenas.local();
+    Arena::Scope scope(arena);
+    std::pmr::vector<Deposit> deposits(&arena);
+    deposits.reserve(static_cast<size_t>(4 * radius * radius + 1));
+    Deposit node{time, 0.f, Deposit::no_pixel, Deposit::first_deposit};
+    int shift_x = 1;
+    int shift_y = 1;
+    if (in_detector(center_i, center_j)) {
+        node.pixel = center_i * n_pixel_y + center_j;
+        node.energy = calculate_pixel_energy(position_x, position_y, energy, center_i, center_j, depth);
+        node.flags |= Deposit::summing_group;
+        auto [center_x, center_y] = get_pixel_center(center_i, center_j);
+        shift_x = position_x < center_x ? -1 : 1;
+        shift_y = position_y < center_y ? -1 : 1;
+    }
+    deposits.push_back(node);
+
+    // The radius always includes the summing group
+    int upper = std::max(radius, 2);
+    for (int i = -radius; i < upper; ++i) {
+        for (int j = -radius; j < upper; ++j) {
+            int x_index = center_i + i;
+            int y_index = center_j + j;
+            if ((i == 0 && j == 0) || !in_detector(x_index, y_index))
+                continue;
+            float dep_energy = calculate_pixel_energy(position_x, position_y, energy, x_index, y_index, depth);
+            if (dep_energy <= min_energy)
+                continue;
+            bool in_group = (i == 0 || i == shift_x) && (j == 0 || j == shift_y) && node.pixel != Deposit::no_pixel;
+            deposits.push_back(Deposit{time, dep_energy, uint32_t(x_index) * n_pixel_y + uint32_t(y_index),
+                                       in_group ? Deposit::summing_group : 0u});
+        }
+    }
+
+    std::lock_guard<std::mutex> lk(image_write_mutex);
+    file->write(reinterpret_cast<const char *>(deposits.data()), std::streamsize(deposits.size() * sizeof(Deposit)));
+    number_of_deposits += deposits.size();
+}
+
+void MedipixRecorder::finish_frame() {
+    Medipix::finish_frame();
+    file->flush();
+}
+
+unsigned long long MedipixRecorder::get_number_of_deposits() const {
+    return number_of_deposits;
+}
+
+DepositRecord::DepositRecord(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open deposit file " + filename);
+    struct stat file_stat{};
+    if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(DepositFileHeader) ||
+        (static_cast<size_t>(file_stat.st_size) - sizeof(DepositFileHeader)) % sizeof(Deposit) != 0) {
+        close(fd);
+        throw std::runtime_error("Size of " + filename + " does not match a header and whole deposits.");
+    }
+    size_t size = file_stat.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Could not map deposit file " + filename);
+    data = std::shared_ptr<const unsigned char>(static_cast<const unsigned char *>(mapped),
+                                                [size](const unsigned char *p) {
+                                                    munmap(const_cast<unsigned char *>(p), size);
+                                                });
+
+    DepositFileHeader header{};
+    std::memcpy(&header, data.get(), sizeof(header));
+    if (!std::equal(std::begin(header.magic), std::end(header.magic), std::begin(DepositFileHeader::file_magic)))
+        throw std::runtime_error(filename + " is not a deposit file.");
+    n_pixel_x = header.n_pixel_x;
+    n_pixel_y = header.n_pixel_y;
+    deposits = reinterpret_cast<const Deposit *>(data.get() + sizeof(DepositFileHeader));
+    n_deposits = (size - sizeof(DepositFileHeader)) / sizeof(Deposit);
+    if (n_deposits == 0)
+        return;
+
+    if (!(deposits[0].flags & Deposit::first_deposit))
+        throw std::runtime_error("Deposit file " + filename + " does not start with a photon.");
+    for (size_t k = 0; k < n_deposits; ++k) {
+        if (deposits[k].flags & Deposit::first_deposit)
+            photon_start.push_back(k);
+    }
+    photon_start.push_back(n_deposits);
+}
+
+size_t DepositRecord::get_number_of_photons() const {
+    return photon_start.empty() ? 0 : photon_start.size() - 1;
+}
+
+size_t DepositRecord::get_number_of_deposits() const {
+    return n_deposits;
+}
+
+std::pair<const Deposit *, size_t> DepositRecord::get_photon(size_t k) const {
+    if (k >= get_number_of_photons())
+        throw std::out_of_range("Photon index out of range.");
+    return {deposits + photon_start[k], photon_start[k + 1] - photon_start[k]};
+}
+
+unsigned int DepositRecord::get_num_pixels_x() const {
+    return n_pixel_x;
+}
+
+unsigned int DepositRecord::get_num_pixels_y() const {
+    return n_pixel_y;
+}
+
+void DepositRecord::check_geometry(const Medipix &detector) const {
+    if (detector.get_num_pixels_x() != n_pixel_x || detector.get_num_pixels_y() != n_pixel_y)
+        throw std::invalid_argument("Pixel matrix of the detector differs from the recorded one.");
+}
+
+void replay(const std::vector<std::shared_ptr<Medipix>> &detectors, const DepositRecord &record) {
+    for (const auto &detector: detectors)
+        record.check_geometry(*detector);
+    size_t n_photons = record.get_number_of_photons();
+
+    SerialNestedRegions serial_nested_regions;
+    #pragma omp parallel for default(none) shared(detectors, record, n_photons) schedule(dynamic, 1)
+    for (size_t d = 0; d < detectors.size(); ++d) {
+        const auto &detector = detectors[d];
+        detector->start_frame();
+        for (size_t k = 0; k < n_photons; ++k) {
+            auto [deposits, n] = record.get_photon(k);
+            detector->replay_photon(deposits, n);
+        }
+        detector->finish_frame();
+    }
+}
@@ -16,8 +16,46 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <list>
+#include <memory_resource>
+#include <numbers>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <fftw3.h>
+#include <omp.h>
 #include "MedipixSPM.h"
+#include "pileup.h"
+#include "RandomStream.h"
+
+namespace {
+    /**
+     * Smallest size >= n with only the prime factors 2, 3, 5 and 7 (fast FFTW sizes)
+     */
+    unsigned int fft_size(unsigned int n) {
+        for (;; ++n) {
+            unsigned int m = n;
+            for (unsigned int p: {2u, 3u, 5u, 7u})
+                while (m % p == 0)
+                    m /= p;
+            if (m == 1)
+                return n;
+        }
+    }
+}
+
+std::vector<ShutterWindow> frame_windows(unsigned int n_frames, double frame_time, double dead_time, double start) {
+    if (frame_time <= 0. || dead_time < 0.)
+        throw std::invalid_argument("Frame time must be positive and dead time non-negative.");
+    std::vector<ShutterWindow> windows(n_frames);
+    for (unsigned int frame = 0; frame < n_frames; ++frame) {
+        windows[frame].start = start + double(frame) * (frame_time + dead_time);
+        windows[frame].end = windows[frame].start + frame_time;
+    }
+    return windows;
+}
 
 MedipixSPM::MedipixSPM(bool timed, unsigned nx, unsigned int ny) : Medipix(timed, nx, ny) {
 
@@ -27,51 +65,117 @@ MedipixSPM::MedipixSPM() : Medipix(false) {
 
 }
 
-void MedipixSPM::add_photon(float energy, float position_x, float position_y, int radius, float time) {
-    Medipix::add_photon(energy, position_x, position_y, radius, time);
+std::shared_ptr<Medipix> MedipixSPM::clone() const {
+    return std::make_shared<MedipixSPM>(*this);
+}
+
+void MedipixSPM::add_photon(float energy, float position_x, float position_y, float depth, int radius, double time) {
+    Medipix::add_photon(energy, position_x, position_y, depth, radius, time);
 
     if (!timed) {
-        std::list<std::pair<unsigned int, unsigned int>> pixels;
+        auto &arena = arenas.local();
+        Arena::Scope scope(arena);
+        std::pmr::list<std::pair<unsigned int, unsigned int>> pixels(&arena);
         auto [center_position_x, center_position_y] = get_pixel_index(position_x, position_y);
         for (int i = -radius; i < radius; ++i) {
             for (int j = -radius; j < radius; ++j) {
                 int x_index = int(center_position_x) + i;
                 int y_index = int(center_position_y) + j;
-                if (x_index >= 0 && x_index < n_pixel_x && y_index >= 0 && y_index < n_pixel_y)
+                if (in_roi(x_index, y_index))
                     pixels.emplace_back(x_index, y_index);
             }
         }
         for (auto &pixel: pixels) {
             unsigned int i = pixel.first;
             unsigned int j = pixel.second;
-            auto pixel_center = get_pixel_center(i, j);
-            float dep_energy = calculate_shared_energy(position_x, position_y, energy, pixel_center.first,
-                                                       pixel_center.second);
+            float dep_energy = calculate_pixel_energy(position_x, position_y, energy, i, j, depth);
             if (dep_energy > get_th0(i, j)) {
                 increase_counter(i, j);
             }
         }
     } else {
-        std::list<std::pair<unsigned int, unsigned int>> pixels;
+        auto &arena = arenas.local();
+        Arena::Scope scope(arena);
+        std::pmr::list<std::pair<unsigned int, unsigned int>> pixels(&arena);
         auto [center_position_x, center_position_y] = get_pixel_index(position_x, position_y);
         for (int i = -radius; i < radius; ++i) {
             for (int j = -radius; j < radius; ++j) {
                 int x_index = int(center_position_x) + i;
                 int y_index = int(center_position_y) + j;
-                if (x_index >= 0 && x_index < n_pixel_x && y_index >= 0 && y_index < n_pixel_y)
+                if (in_roi(x_index, y_index))
                     pixels.emplace_back(x_index, y_index);
             }
         }
         for (auto &pixel: pixels) {
             unsigned int i = pixel.first;
             unsigned int j = pixel.second;
-            auto pixel_center = get_pixel_center(i, j);
-            float dep_energy = calculate_shared_energy(position_x, position_y, energy, pixel_center.first,
-                                                       pixel_center.second);
-            Event event{};
-            event.time=time;
-            event.energy=dep_energy;
-            events[i * n_pixel_y + j].emplace_back(event);
+            float dep_energy = calculate_pixel_energy(position_x, position_y, energy, i, j, depth);
+            events.add(pixel_offset(i, j), Event{time, dep_energy});
+        }
+    }
+}
+
+void MedipixSPM::select_deposit_kernels() {
+    deposit_kernels = {};
+    if (!specialized_kernels || depth_tables)
+        return;
+    if (timed)
+        deposit_kernels = {nullptr, &event_kernel<1>, &event_kernel<2>, &event_kernel<3>, &event_kernel<4>};
+    else
+        deposit_kernels = {nullptr, &count_kernel<1>, &count_kernel<2>, &count_kernel<3>, &count_kernel<4>};
+}
+
+template<int Radius>
+void MedipixSPM::count_photons(const PhotonBatch &batch) {
+    constexpr int width = 2 * Radius;
+    float scale = psf_sigma * float(std::numbers::sqrt2);
+    auto &arena = arenas.local();
+    Arena::Scope scope(arena);
+    std::pmr::vector<uint32_t> hits(&arena);
+    unsigned int n_photons = 0;
+    for (unsigned int k = 0; k < batch.n; ++k) {
+        float x = batch.x[k];
+        float y = batch.y[k];
+        if (!batch.interacting[k] || !in_region_of_interest(x, y, batch.radius))
+            continue;
+        ++n_photons;
+        auto [center_i, center_j] = get_pixel_index(x, y);
+        std::array<float, width> x_component;
+        std::array<float, width> y_component;
+        for (int a = 0; a < width; ++a) {
+            x_component[a] = column_component(unsigned(int(center_i) - Radius + a), x, scale);
+            y_component[a] = row_component(unsigned(int(center_j) - Radius + a), y, scale);
+        }
+        for (int a = 0; a < width; ++a) {
+            int i = int(center_i) - Radius + a;
+            for (int b = 0; b < width; ++b) {
+                int j = int(center_j) - Radius + b;
+                if (!in_roi(i, j))
+                    continue;
+                float dep_energy = 0.25f * batch.energy[k] * x_component[a] * y_component[b];
+                if (dep_energy > get_th0(i, j))
+                    hits.push_back(static_cast<uint32_t>(pixel_offset(i, j)));
+            }
+        }
+    }
+    commit_batch(n_photons, 0.f, hits);
+}
+
+void MedipixSPM::replay_photon(const Deposit *deposits, size_t n) {
+    Medipix::replay_photon(deposits, n);
+    for (size_t k = 0; k < n; ++k) {
+        const auto &deposit = deposits[k];
+        if (deposit.pixel == Deposit::no_pixel)
+            continue;
+        unsigned int i = deposit.pixel / n_pixel_y;
+        unsigned int j = deposit.pixel % n_pixel_y;
+        if (!in_roi(int(i), int(j)))
+            continue;
+        if (!timed) {
+            if (deposit.energy > get_th0(i, j))
+                increase_counter(i, j);
+        } else {
+            events.add(pixel_offset(i, j), Event{deposit.time, deposit.energy});
         }
     }
 }
@@ -80,17 +184,446 @@ void MedipixSPM::finish_frame() {
     Medipix::finish_frame();
     if (timed) {
         std::lock_guard<std::mutex> lk(image_write_mutex);
-        #pragma omp parallel for default(none) shared(events)
-        for (unsigned int index = 0; index < n_pixel_x * n_pixel_y; ++index) {
-            unsigned int i = index / n_pixel_y;
-            unsigned int j = index % n_pixel_y;
-            float threshold = get_th0(i, j);
-            auto pixel_response = calculate_pixel_signal(i, j);
-            for (unsigned int t = 1; t < pixel_response.size(); ++t) {
-                if (pixel_response[t - 1] < threshold && pixel_response[t] > threshold) {
-                    image[i * n_pixel_y + j] += 1;
+        pileup_utilization = Utilization{};
+        pileup_utilization.threads = static_cast<unsigned int>(omp_get_max_threads());
+        // With spilled events the tiles are loaded one at a time
+        for (size_t tile = 0; tile < events.get_number_of_tiles(); ++tile) {
+            events.load_tile(tile);
+            if (simd_pileup)
+                count_active_pixels_simd();
+            else
+                count_active_pixels();
+        }
+    }
+}
+
+void MedipixSPM::measure_active_pixels(std::vector<uint32_t> &length, std::vector<uint64_t> &cost) const {
+    auto n_active = events.get_number_of_active_pixels();
+    const auto &response = *response_function;
+    size_t n_samples = size_t(max_time * double(samples_per_us)) + response.size();
+    length.resize(n_active);
+    cost.resize(n_active);
+    // Signal length as in calculate_pixel_signal(). The cost adds the convolution of the response of every event,
+    // limited by the FFT crossover.
+    #pragma omp parallel default(none) shared(n_active, response, n_samples, length, cost)
+    {
+        std::vector<Event> buffer;
+        #pragma omp for schedule(static)
+        for (size_t k = 0; k < n_active; ++k) {
+            auto pixel_events = events.get_events(k, buffer);
+            size_t first = n_samples;
+            size_t last = 0;
+            for (const auto &event: pixel_events) {
+                size_t start_index = get_sample(event);
+                first = std::min(first, start_index);
+                last = std::max(last, start_index + response.size());
+            }
+            length[k] = static_cast<uint32_t>(std::min(last, n_samples) - first);
+            double pulses = double(pixel_events.size()) * double(response.size());
+            cost[k] = length[k] + static_cast<uint64_t>(std::min(pulses, double(fft_crossover) * double(length[k])));
+        }
+    }
+}
+
+TaskList MedipixSPM::schedule_active_pixels() const {
+    if (numa_placement)
+        return owner_tasks();
+    if (!cost_scheduling)
+        return uniform_tasks(events.get_number_of_active_pixels(), 16);
+    std::vector<uint32_t> length;
+    std::vector<uint64_t> cost;
+    measure_active_pixels(length, cost);
+    return balance_tasks(cost, static_cast<unsigned int>(omp_get_max_threads()));
+}
+
+TaskList MedipixSPM::owner_tasks() const {
+    auto n_threads = static_cast<unsigned int>(omp_get_max_threads());
+    TaskList tasks;
+    tasks.items.reserve(events.get_number_of_active_pixels());
+    // The pixel blocks of the image, the threshold dispersion and the events
+    for (unsigned int t = 0; t < n_threads; ++t) {
+        for_owned_blocks(size_t(roi.nx) * roi.ny, events.get_owner_tile_pixels(), t, n_threads,
+                         [this, &tasks](size_t first, size_t last) {
+            auto end = events.find_first_active(uint32_t(last));
+            for (auto k = events.find_first_active(uint32_t(first)); k < end; ++k)
+                tasks.items.push_back(static_cast<uint32_t>(k));
+        });
+        tasks.offsets.push_back(tasks.items.size());
+    }
+    return tasks;
+}
+
+void MedipixSPM::count_active_pixels() {
+    // Pixels without events have no signal, only the active pixels are processed
+    auto tasks = schedule_active_pixels();
+    auto n_tasks = tasks.size();
+    std::vector<double> busy(omp_get_max_threads(), 0.);
+    double start = omp_get_wtime();
+    #pragma omp parallel default(none) shared(tasks, n_tasks, busy, start)
+    {
+        std::vector<Event> buffer;
+        auto count_task = [this, &tasks, &buffer](size_t t) {
+            for (auto k: tasks.get_task(t)) {
+                unsigned int index = events.get_active_pixel(k);
+                unsigned int i = roi.x0 + index / roi.ny;
+                unsigned int j = roi.y0 + index % roi.ny;
+                float threshold = get_th0(i, j);
+                size_t first_sample;
+                Arena::Scope scope(arenas.local());
+                auto pixel_response = calculate_pixel_signal(events.get_events(k, buffer), first_sample, threshold);
+                // The signal before first_sample is zero
+                float previous = first_sample > 0 ? 0.f : threshold;
+                for (auto value: pixel_response) {
+                    if (previous < threshold && value > threshold) {
+                        image[index] += 1;
+                    }
+                    previous = value;
                 }
             }
+        };
+        if (numa_placement) {
+            // Task t is the block of thread t
+            #pragma omp for schedule(static, 1) nowait
+            for (size_t t = 0; t < n_tasks; ++t)
+                count_task(t);
+        } else {
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (size_t t = 0; t < n_tasks; ++t)
+                count_task(t);
+        }
+        busy[omp_get_thread_num()] = omp_get_wtime() - start;
+    }
+    add_utilization(n_tasks, omp_get_wtime() - start, busy);
+}
+
+void MedipixSPM::count_active_pixels_simd() {
+    auto n_active = events.get_number_of_active_pixels();
+    std::vector<uint32_t> length;
+    std::vector<uint64_t> cost;
+    measure_active_pixels(length, cost);
+
+    // Pixels of similar signal length share a group of pileup_lanes pixels. With the NUMA placement the groups do
+    // not cross the blocks of the owners.
+    std::vector<uint32_t> owner(n_active, 0);
+    TaskList owned_pixels;
+    if (numa_placement) {
+        owned_pixels = owner_tasks();
+        for (size_t t = 0; t < owned_pixels.size(); ++t) {
+            for (auto k: owned_pixels.get_task(t))
+                owner[k] = static_cast<uint32_t>(t);
+        }
+    }
+    std::vector<uint32_t> order(n_active);
+    std::iota(order.begin(), order.end(), uint32_t(0));
+    std::stable_sort(order.begin(), order.end(), [&owner, &length](uint32_t a, uint32_t b) {
+        return owner[a] < owner[b] || (owner[a] == owner[b] && length[a] > length[b]);
+    });
+    std::vector<size_t> group_first;
+    std::vector<uint64_t> group_cost;
+    for (size_t k = 0; k < n_active; ++k) {
+        if (group_first.empty() || k - group_first.back() == pileup_lanes || owner[order[k]] != owner[order[k - 1]]) {
+            group_first.push_back(k);
+            group_cost.push_back(0);
+        }
+        group_cost.back() += cost[order[k]];
+    }
+    size_t n_groups = group_first.size();
+    group_first.push_back(n_active);
+
+    TaskList tasks;
+    if (numa_placement) {
+        tasks.items.resize(n_groups);
+        std::iota(tasks.items.begin(), tasks.items.end(), uint32_t(0));
+        for (size_t t = 0, g = 0; t < owned_pixels.size(); ++t) {
+            while (g < n_groups && owner[order[group_first[g]]] == t)
+                ++g;
+            tasks.offsets.push_back(g);
+        }
+    } else if (cost_scheduling) {
+        tasks = balance_tasks(group_cost, static_cast<unsigned int>(omp_get_max_threads()));
+    } else {
+        tasks = uniform_tasks(n_groups, 4);
+    }
+    auto n_tasks = tasks.size();
+
+    std::vector<double> busy(omp_get_max_threads(), 0.);
+    double start = omp_get_wtime();
+    #pragma omp parallel default(none) shared(order, group_first, tasks, n_tasks, busy, start)
+    {
+        std::vector<Event> buffer;
+        auto &arena = arenas.local();
+        auto count_task = [this, &order, &group_first, &tasks, &buffer, &arena](size_t t) {
+            for (auto g: tasks.get_task(t)) {
+                Arena::Scope scope(arena);
+                std::pmr::vector<std::pmr::vector<float>> pixel_response(&arena);
+                pixel_response.reserve(pileup_lanes);
+                const float *signal[pileup_lanes] = {};
+                float threshold[pileup_lanes] = {};
+                float previous[pileup_lanes] = {};
+                uint32_t lane_length[pileup_lanes] = {};
+                uint32_t index[pileup_lanes] = {};
+                uint32_t counts[pileup_lanes];
+                auto n_lanes = static_cast<unsigned int>(group_first[g + 1] - group_first[g]);
+                for (unsigned int l = 0; l < n_lanes; ++l) {
+                    size_t k = order[group_first[g] + l];
+                    index[l] = events.get_active_pixel(k);
+                    threshold[l] = get_th0(roi.x0 + index[l] / roi.ny, roi.y0 + index[l] % roi.ny);
+                    size_t first_sample;
+                    pixel_response.push_back(
+                            calculate_pixel_signal(events.get_events(k, buffer), first_sample, threshold[l]));
+                    // The signal before first_sample is zero
+                    previous[l] = first_sample > 0 ? 0.f : threshold[l];
+                    signal[l] = pixel_response[l].data();
+                    lane_length[l] = static_cast<uint32_t>(pixel_response[l].size());
+                }
+                count_crossings(signal, lane_length, threshold, previous, counts);
+                for (unsigned int l = 0; l < n_lanes; ++l)
+                    image[index[l]] += counts[l];
+            }
+        };
+        if (numa_placement) {
+            // Task t holds the groups of thread t
+            #pragma omp for schedule(static, 1) nowait
+            for (size_t t = 0; t < n_tasks; ++t)
+                count_task(t);
+        } else {
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (size_t t = 0; t < n_tasks; ++t)
+                count_task(t);
+        }
+        busy[omp_get_thread_num()] = omp_get_wtime() - start;
+    }
+    add_utilization(n_tasks, omp_get_wtime() - start, busy);
+}
+
+void MedipixSPM::add_utilization(size_t n_tasks, double wall_time, const std::vector<double> &busy) {
+    pileup_utilization.tasks += n_tasks;
+    pileup_utilization.wall_time += wall_time;
+    for (auto time: busy)
+        pileup_utilization.busy_time += time;
+}
+
+void MedipixSPM::set_simd_pileup(bool enabled) {
+    simd_pileup = enabled;
+}
+
+bool MedipixSPM::get_simd_pileup() const {
+    return simd_pileup;
+}
+
+void MedipixSPM::set_cost_scheduling(bool enabled) {
+    cost_scheduling = enabled;
+}
+
+bool MedipixSPM::get_cost_scheduling() const {
+    return cost_scheduling;
+}
+
+Utilization MedipixSPM::get_pileup_utilization() const {
+    return pileup_utilization;
+}
+
+FrameStack MedipixSPM::rebin(const std::vector<ShutterWindow> &windows) {
+    if (!timed)
+        throw std::logic_error("Re-binning needs the events of a timed detector.");
+    if (get_shutter_open())
+        throw std::logic_error("Shutter open. Call finish_frame() before.");
+    for (size_t w = 0; w < windows.size(); ++w) {
+        if (!(windows[w].start < windows[w].end) || (w > 0 && windows[w].start < windows[w - 1].end))
+            throw std::invalid_argument("Windows must be non-empty, sorted and non-overlapping.");
+    }
+
+    FrameStack frames(static_cast<unsigned int>(windows.size()), roi.nx, roi.ny);
+    auto n_windows = windows.size();
+    for (size_t tile = 0; tile < events.get_number_of_tiles(); ++tile) {
+        events.load_tile(tile);
+        auto tasks = schedule_active_pixels();
+        auto n_tasks = tasks.size();
+        #pragma omp parallel default(none) shared(frames, windows, n_windows, tasks, n_tasks)
+        {
+            std::vector<Event> buffer;
+            auto rebin_task = [this, &frames, &windows, n_windows, &tasks, &buffer](size_t t) {
+                for (auto k: tasks.get_task(t)) {
+                    unsigned int index = events.get_active_pixel(k);
+                    unsigned int i = roi.x0 + index / roi.ny;
+                    unsigned int j = roi.y0 + index % roi.ny;
+                    float threshold = get_th0(i, j);
+                    size_t first_sample;
+                    Arena::Scope scope(arenas.local());
+                    auto pixel_response = calculate_pixel_signal(events.get_events(k, buffer), first_sample,
+                                                                 threshold);
+                    float previous = first_sample > 0 ? 0.f : threshold;
+                    size_t w = 0;
+                    for (size_t s = 0; s < pixel_response.size() && w < n_windows; ++s) {
+                        if (previous < threshold && pixel_response[s] > threshold) {
+                            double time = double(first_sample + s) / double(samples_per_us);
+                            while (w < n_windows && windows[w].end <= time)
+                                ++w;
+                            if (w < n_windows && windows[w].start <= time)
+                                frames.get_frame(w)[index] += 1;
+                        }
+                        previous = pixel_response[s];
+                    }
+                }
+            };
+            if (numa_placement) {
+                #pragma omp for schedule(static, 1)
+                for (size_t t = 0; t < n_tasks; ++t)
+                    rebin_task(t);
+            } else {
+                #pragma omp for schedule(dynamic, 1)
+                for (size_t t = 0; t < n_tasks; ++t)
+                    rebin_task(t);
+            }
+        }
+    }
+    return frames;
+}
+
+std::vector<double>
+MedipixSPM::expected_image(float energy, const std::vector<float> &fluence, unsigned int oversampling,
+                           unsigned int n_threshold_bins) const {
+    if (timed)
+        throw std::logic_error("The expected image is only available in non-timed mode.");
+    if (edge_extension_left != 0.f || edge_extension_right != 0.f || edge_extension_bottom != 0.f ||
+        edge_extension_top != 0.f)
+        throw std::logic_error("The expected image does not support edge extensions.");
+    if (depth_tables)
+        throw std::logic_error("The expected image does not support the depth of interaction model.");
+    if (oversampling == 0 || n_threshold_bins == 0)
+        throw std::invalid_argument("Oversampling and number of threshold bins must be positive.");
+    unsigned int n_x = n_pixel_x * oversampling;
+    unsigned int n_y = n_pixel_y * oversampling;
+    if (fluence.size() != static_cast<size_t>(n_x) * n_y)
+        throw std::invalid_argument("Size of the fluence map does not match the oversampled pixel matrix.");
+
+    // Kernel offsets d in [-half, half) cells. Cell a = oversampling * i + d has the distance
+    // pitch / oversampling * (d + 0.5 - oversampling / 2) to the center of pixel i. The detection probability of a
+    // cell is the fraction of sub-samples in which the shared energy is above the threshold, the shared energy
+    // factorizes in an x and a y component (see integrate_charge()).
+    const int radius = 3;
+    const int n_sub_samples = 16;
+    int half = (radius + 1) * int(oversampling);
+    int kernel_size = 2 * half;
+    float cell = pixel_pitch / float(oversampling);
+    std::vector<float> component(static_cast<size_t>(kernel_size) * n_sub_samples);
+    for (int m = 0; m < kernel_size; ++m) {
+        for (int r = 0; r < n_sub_samples; ++r) {
+            float offset = cell * (float(m - half) + (float(r) + 0.5f) / n_sub_samples - float(oversampling) / 2.f);
+            component[m * n_sub_samples + r] = std::erf((pixel_pitch / 2.f - offset) / (psf_sigma * float(std::numbers::sqrt2))) -
+                                               std::erf((-pixel_pitch / 2.f - offset) / (psf_sigma * float(std::numbers::sqrt2)));
+        }
+    }
+
+    // Threshold bins
+    size_t n_roi = static_cast<size_t>(roi.nx) * roi.ny;
+    float min_threshold = get_th0(roi.x0, roi.y0);
+    float max_threshold = min_threshold;
+    for (unsigned int i = roi.x0; i < roi.x0 + roi.nx; ++i) {
+        for (unsigned int j = roi.y0; j < roi.y0 + roi.ny; ++j) {
+            min_threshold = std::min(min_threshold, get_th0(i, j));
+            max_threshold = std::max(max_threshold, get_th0(i, j));
+        }
+    }
+    if (max_threshold - min_threshold <= 0.f)
+        n_threshold_bins = 1;
+    float bin_width = n_threshold_bins > 1 ? (max_threshold - min_threshold) / float(n_threshold_bins - 1) : 1.f;
+    std::vector<unsigned int> pixel_bin(n_roi);
+    std::vector<double> pixel_weight(n_roi);
+    for (size_t index = 0; index < n_roi; ++index) {
+        float position = (get_th0(roi.x0 + index / roi.ny, roi.y0 + index % roi.ny) - min_threshold) / bin_width;
+        auto bin = std::min(static_cast<unsigned int>(position), n_threshold_bins - 1);
+        pixel_bin[index] = bin;
+        pixel_weight[index] = bin + 1 < n_threshold_bins ? double(position) - double(bin) : 0.;
+    }
+
+    // Zero padded linear convolution of the fluence with the flipped kernel
+    int l_x = int(fft_size(n_x + kernel_size));
+    int l_y = int(fft_size(n_y + kernel_size));
+    int l_y_complex = l_y / 2 + 1;
+    size_t n_real = static_cast<size_t>(l_x) * l_y;
+    size_t n_complex = static_cast<size_t>(l_x) * l_y_complex;
+    double *real = fftw_alloc_real(n_real);
+    fftw_complex *spectrum = fftw_alloc_complex(n_complex);
+    fftw_complex *fluence_spectrum = fftw_alloc_complex(n_complex);
+    auto forward = fftw_plan_dft_r2c_2d(l_x, l_y, real, spectrum, FFTW_ESTIMATE);
+    auto backward = fftw_plan_dft_c2r_2d(l_x, l_y, spectrum, real, FFTW_ESTIMATE);
+
+    std::fill(real, real + n_real, 0.);
+    for (unsigned int a = 0; a < n_x; ++a)
+        for (unsigned int b = 0; b < n_y; ++b)
+            real[static_cast<size_t>(a) * l_y + b] = fluence[static_cast<size_t>(a) * n_y + b];
+    fftw_execute(forward);
+    for (size_t k = 0; k < n_complex; ++k) {
+        fluence_spectrum[k][0] = spectrum[k][0];
+        fluence_spectrum[k][1] = spectrum[k][1];
+    }
+
+    std::vector<double> expected(n_roi, 0.);
+    auto normalization = 1. / double(n_real);
+    for (unsigned int bin = 0; bin < n_threshold_bins; ++bin) {
+        float threshold = min_threshold + float(bin) * bin_width;
+        std::fill(real, real + n_real, 0.);
+        for (int m = 0; m < kernel_size; ++m) {
+            for (int n = 0; n < kernel_size; ++n) {
+                unsigned int detected = 0;
+                for (int r = 0; r < n_sub_samples; ++r)
+                    for (int q = 0; q < n_sub_samples; ++q)
+                        detected += 0.25f * energy * component[m * n_sub_samples + r] *
+                                    component[n * n_sub_samples + q] > threshold;
+                real[static_cast<size_t>(kernel_size - 1 - m) * l_y + (kernel_size - 1 - n)] =
+                        double(detected) / (n_sub_samples * n_sub_samples);
+            }
+        }
+        fftw_execute(forward);
+        for (size_t k = 0; k < n_complex; ++k) {
+            double re = spectrum[k][0] * fluence_spectrum[k][0] - spectrum[k][1] * fluence_spectrum[k][1];
+            double im = spectrum[k][0] * fluence_spectrum[k][1] + spectrum[k][1] * fluence_spectrum[k][0];
+            spectrum[k][0] = re;
+            spectrum[k][1] = im;
+        }
+        fftw_execute(backward);
+
+        for (size_t index = 0; index < n_roi; ++index) {
+            double weight;
+            if (pixel_bin[index] == bin)
+                weight = 1. - pixel_weight[index];
+            else if (pixel_bin[index] + 1 == bin)
+                weight = pixel_weight[index];
+            else
+                continue;
+            size_t a = static_cast<size_t>(roi.x0 + index / roi.ny) * oversampling + half - 1;
+            size_t b = static_cast<size_t>(roi.y0 + index % roi.ny) * oversampling + half - 1;
+            expected[index] += weight * std::max(0., real[a * l_y + b] * normalization);
+        }
+    }
+
+    fftw_destroy_plan(forward);
+    fftw_destroy_plan(backward);
+    fftw_free(real);
+    fftw_free(spectrum);
+    fftw_free(fluence_spectrum);
+    return expected;
+}
+
+std::vector<unsigned int>
+MedipixSPM::sample_image(const std::vector<double> &expected, unsigned int seed, unsigned long long number_of_photons) {
+    std::vector<unsigned int> counts(expected.size());
+    #pragma omp parallel for default(none) shared(expected, counts, seed, number_of_photons)
+    for (size_t k = 0; k < expected.size(); ++k) {
+        RandomStream rng(seed, k);
+        if (number_of_photons == 0) {
+            if (expected[k] > 0.) {
+                std::poisson_distribution<unsigned int> distribution(expected[k]);
+                counts[k] = distribution(rng);
+            } else {
+                counts[k] = 0;
+            }
+        } else {
+            double p = std::clamp(expected[k] / double(number_of_photons), 0., 1.);
+            std::binomial_distribution<unsigned long long> distribution(number_of_photons, p);
+            counts[k] = static_cast<unsigned int>(distribution(rng));
         }
     }
+    return counts;
 }
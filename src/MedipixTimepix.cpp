@@ -0,0 +1,332 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "MedipixTimepix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <omp.h>
+#include <queue>
+#include <stdexcept>
+
+namespace {
+    bool hit_before(const Hit &a, const Hit &b) {
+        return a.toa < b.toa || (a.toa == b.toa && a.pixel < b.pixel);
+    }
+}
+
+HitFileWriter::HitFileWriter(const std::string &filename)
+        : file(std::make_shared<std::ofstream>(filename, std::ios::out | std::ios::binary)) {
+    if (!*file)
+        throw std::runtime_error("Could not open hit file " + filename);
+}
+
+void HitFileWriter::operator()(const Hit *hits, size_t n) {
+    file->write(reinterpret_cast<const char *>(hits), std::streamsize(n * sizeof(Hit)));
+    file->flush();
+}
+
+std::vector<Hit> read_hits(const std::string &filename) {
+    std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file)
+        throw std::runtime_error("Could not open hit file " + filename);
+    auto size = static_cast<size_t>(file.tellg());
+    if (size % sizeof(Hit) != 0)
+        throw std::runtime_error("Size of " + filename + " is not a multiple of the hit record size.");
+    std::vector<Hit> hits(size / sizeof(Hit));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(hits.data()), std::streamsize(size));
+    return hits;
+}
+
+MedipixTimepix::MedipixTimepix(unsigned int nx, unsigned int ny) : Medipix(true, nx, ny) {
+
+}
+
+std::shared_ptr<Medipix> MedipixTimepix::clone() const {
+    return std::make_shared<MedipixTimepix>(*this);
+}
+
+void MedipixTimepix::add_photon(float energy, float position_x, float position_y, float depth, int radius,
+                                double time) {
+    if (!window_open)
+        throw std::logic_error("No window open. Call begin_window() before.");
+    Medipix::add_photon(energy, position_x, position_y, depth, radius, time);
+
+    auto [center_position_x, center_position_y] = get_pixel_index(position_x, position_y);
+    for (int i = -radius; i < radius; ++i) {
+        for (int j = -radius; j < radius; ++j) {
+            int x_index = int(center_position_x) + i;
+            int y_index = int(center_position_y) + j;
+            if (!in_roi(x_index, y_index))
+                continue;
+            float dep_energy = calculate_pixel_energy(position_x, position_y, energy, x_index, y_index, depth);
+            events.add(pixel_offset(x_index, y_index), Event{time, dep_energy});
+        }
+    }
+}
+
+void MedipixTimepix::add_photons(const PhotonBatch &batch) {
+    if (!window_open)
+        throw std::logic_error("No window open. Call begin_window() before.");
+    Medipix::add_photons(batch);
+}
+
+void MedipixTimepix::select_deposit_kernels() {
+    deposit_kernels = {};
+    if (specialized_kernels && !depth_tables)
+        deposit_kernels = {nullptr, &event_kernel<1>, &event_kernel<2>, &event_kernel<3>, &event_kernel<4>};
+}
+
+void MedipixTimepix::start_acquisition(HitSink hit_sink) {
+    build_i_krum_response(i_krum);
+    std::vector<float> calibration = *response_function;
+    std::sort(calibration.begin(), calibration.end(), std::greater<>());
+    // A deposit can not stay longer above threshold than the response is positive
+    calibration.erase(std::find_if(calibration.begin(), calibration.end(), [](float r) { return r <= 0.f; }),
+                      calibration.end());
+    // get_hit_energy() interpolates between two calibration points
+    if (calibration.size() < 2)
+        throw std::invalid_argument("The ToT calibration needs at least two positive samples of the response.");
+
+    start_frame();
+    sink = std::move(hit_sink);
+    window_start = 0.;
+    window_length = 0.f;
+    window_open = false;
+    number_of_hits = 0;
+    open_hit.assign(static_cast<size_t>(roi.nx) * roi.ny, -1.);
+    thread_hits.assign(omp_get_max_threads(), {});
+    thread_carry.assign(omp_get_max_threads(), {});
+    pending_hits.clear();
+    tot_calibration = std::move(calibration);
+}
+
+void MedipixTimepix::begin_window(float length) {
+    if (!get_shutter_open())
+        throw std::logic_error("No acquisition running. Call start_acquisition() before.");
+    if (window_open)
+        throw std::logic_error("Window already open. Call end_window() before.");
+    window_length = length;
+    window_open = true;
+}
+
+void MedipixTimepix::end_window() {
+    if (!window_open)
+        throw std::logic_error("No window open. Call begin_window() before.");
+    events.finalize();
+    for (auto &hits: thread_hits)
+        hits.clear();
+    for (auto &carry: thread_carry)
+        carry.clear();
+
+    // A pixel with an open hit always has carried events, so only the active pixels are processed
+    for (size_t tile = 0; tile < events.get_number_of_tiles(); ++tile) {
+        events.load_tile(tile);
+        size_t n_active = events.get_number_of_active_pixels();
+        #pragma omp parallel default(none) shared(n_active)
+        {
+            auto &hits = thread_hits[omp_get_thread_num()];
+            auto &carry = thread_carry[omp_get_thread_num()];
+            std::vector<Event> buffer;
+            #pragma omp for schedule(dynamic, 64)
+            for (size_t k = 0; k < n_active; ++k) {
+                process_pixel(k, hits, carry, buffer);
+            }
+        }
+    }
+    #pragma omp parallel for default(none)
+    for (size_t t = 0; t < thread_hits.size(); ++t)
+        std::sort(thread_hits[t].begin(), thread_hits[t].end(), hit_before);
+
+    events.clear();
+    for (const auto &carry: thread_carry)
+        for (const auto &[index, event]: carry)
+            events.add(index, event);
+
+    window_start += window_length;
+    window_open = false;
+
+    // Hits starting before the earliest open hit can not be preceded by a later hit anymore
+    double safe_time = window_start;
+    for (auto rise: open_hit)
+        if (rise >= 0.)
+            safe_time = std::min(safe_time, rise);
+    merge_and_flush(safe_time);
+}
+
+void MedipixTimepix::finish_acquisition() {
+    if (window_open)
+        end_window();
+    // Window without photons in which all remaining signals decay
+    begin_window(float(response_function->size() + 1) / float(samples_per_us));
+    end_window();
+    merge_and_flush(std::numeric_limits<double>::infinity());
+    Medipix::finish_frame();
+}
+
+void MedipixTimepix::process_pixel(size_t k, std::vector<Hit> &hits, std::vector<std::pair<uint32_t, Event>> &carry,
+                                   std::vector<Event> &buffer) {
+    uint32_t index = events.get_active_pixel(k);
+    auto pixel_events = events.get_events(k, buffer);
+    bool open = open_hit[index] >= 0.;
+    const auto &response = *response_function;
+    auto n_response = static_cast<long>(response.size());
+    auto n_window = static_cast<long>(window_length * float(samples_per_us));
+
+    // Samples of the window that can be above threshold, the signal is zero from end on
+    long first = n_window;
+    long end = 0;
+    for (const auto &event: pixel_events) {
+        auto start = static_cast<long>(std::floor(event.get_time() * float(samples_per_us)));
+        first = std::min(first, start);
+        end = std::max(end, start + n_response);
+    }
+    first = open ? 0 : std::max(first, 0l);
+    long last = std::min(end, n_window);
+
+    auto &arena = arenas.local();
+    Arena::Scope scope(arena);
+    std::pmr::vector<float> signal(std::max(last - first, 0l), 0.f, &arena);
+    for (const auto &event: pixel_events) {
+        auto start = static_cast<long>(std::floor(event.get_time() * float(samples_per_us)));
+        long begin = std::max(start, first);
+        long stop = std::min(start + n_response, last);
+        for (long s = begin; s < stop; ++s)
+            signal[s - first] += event.energy * response[s - start];
+    }
+
+    unsigned int i = roi.x0 + index / roi.ny;
+    unsigned int j = roi.y0 + index % roi.ny;
+    float threshold = get_th0(i, j);
+    auto emit = [&](long fall_sample) {
+        double fall = window_start + double(fall_sample) / samples_per_us;
+        Hit hit{};
+        hit.toa = static_cast<uint64_t>(open_hit[index] * toa_clock);
+        hit.pixel = i * n_pixel_y + j;
+        hit.tot = static_cast<uint32_t>(std::lround((fall - open_hit[index]) * tot_clock));
+        hits.push_back(hit);
+        image[index]++;
+        open_hit[index] = -1.;
+    };
+    for (long s = first; s < last; ++s) {
+        bool above = signal[s - first] > threshold;
+        if (!open && above) {
+            open_hit[index] = window_start + double(s) / samples_per_us;
+            open = true;
+        } else if (open && !above) {
+            emit(s);
+            open = false;
+        }
+    }
+    // All events decayed until the end of the window
+    if (open && end <= n_window)
+        emit(end);
+
+    // Carry over the events that still influence the next window
+    for (const auto &event: pixel_events) {
+        if (static_cast<long>(std::floor(event.get_time() * float(samples_per_us))) + n_response > n_window)
+            carry.emplace_back(index, Event{event.get_time() - window_length, event.energy});
+    }
+}
+
+void MedipixTimepix::merge_and_flush(double safe_time) {
+    // k-way merge of the sorted per-thread buffers
+    using Head = std::pair<size_t, size_t>; // thread, position
+    auto later = [this](const Head &a, const Head &b) {
+        return hit_before(thread_hits[b.first][b.second], thread_hits[a.first][a.second]);
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    size_t n_new = 0;
+    for (size_t thread = 0; thread < thread_hits.size(); ++thread) {
+        if (!thread_hits[thread].empty())
+            heads.emplace(thread, 0);
+        n_new += thread_hits[thread].size();
+    }
+    std::vector<Hit> merged;
+    merged.reserve(n_new);
+    while (!heads.empty()) {
+        auto [thread, position] = heads.top();
+        heads.pop();
+        merged.push_back(thread_hits[thread][position]);
+        if (position + 1 < thread_hits[thread].size())
+            heads.emplace(thread, position + 1);
+    }
+    for (auto &hits: thread_hits)
+        hits.clear();
+
+    std::vector<Hit> all_hits;
+    all_hits.reserve(pending_hits.size() + merged.size());
+    std::merge(pending_hits.begin(), pending_hits.end(), merged.begin(), merged.end(), std::back_inserter(all_hits),
+               hit_before);
+
+    size_t n_flush = all_hits.size();
+    if (std::isfinite(safe_time)) {
+        auto limit = static_cast<uint64_t>(safe_time * toa_clock);
+        n_flush = std::partition_point(all_hits.begin(), all_hits.end(),
+                                       [limit](const Hit &hit) { return hit.toa < limit; }) - all_hits.begin();
+    }
+    if (n_flush > 0 && sink)
+        sink(all_hits.data(), n_flush);
+    number_of_hits += n_flush;
+    pending_hits.assign(all_hits.begin() + long(n_flush), all_hits.end());
+}
+
+void MedipixTimepix::set_clocks(double toa, double tot) {
+    if (toa <= 0. || tot <= 0.)
+        throw std::invalid_argument("Clocks must be positive.");
+    toa_clock = toa;
+    tot_clock = tot;
+}
+
+double MedipixTimepix::get_toa_clock() const {
+    return toa_clock;
+}
+
+double MedipixTimepix::get_tot_clock() const {
+    return tot_clock;
+}
+
+float MedipixTimepix::get_hit_energy(const Hit &hit) const {
+    if (tot_calibration.size() < 2)
+        throw std::logic_error("No ToT calibration. Call start_acquisition() before.");
+    unsigned int i = hit.pixel / n_pixel_y;
+    unsigned int j = hit.pixel % n_pixel_y;
+    float threshold = in_roi(int(i), int(j)) ? get_th0(i, j) : get_th0_outside_roi(i, j);
+
+    // Middle of the response interval that gives the number of samples over threshold
+    float samples = float(double(hit.tot) / tot_clock * samples_per_us) - 0.5f;
+    float position = std::clamp(samples, 0.f, float(tot_calibration.size() - 1));
+    auto index = std::min(static_cast<size_t>(position), tot_calibration.size() - 2);
+    float fraction = position - float(index);
+    float level = (1.f - fraction) * tot_calibration[index] + fraction * tot_calibration[index + 1];
+    return threshold / level;
+}
+
+unsigned long long MedipixTimepix::get_number_of_hits() const {
+    return number_of_hits;
+}
+
+size_t MedipixTimepix::get_pending_hits() const {
+    return pending_hits.size();
+}
+
+double MedipixTimepix::get_window_start() const {
+    return window_start;
+}
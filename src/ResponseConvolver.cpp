@@ -0,0 +1,115 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ResponseConvolver.h"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <fftw3.h>
+
+namespace {
+    /**
+     * Alignment of the FFT buffers, the plans are executed on buffers of other threads
+     */
+    constexpr size_t fft_alignment = 64;
+
+    /**
+     * The FFTW planner is not thread-safe
+     */
+    std::mutex planner_mutex;
+}
+
+ResponseConvolver::ResponseConvolver(const std::vector<float> &response) : response_size(response.size()) {
+    if (response.empty())
+        throw std::invalid_argument("The response must not be empty.");
+    fft_size = 1;
+    while (fft_size < 4 * response_size)
+        fft_size *= 2;
+    block_size = fft_size - response_size + 1;
+    size_t n_frequencies = fft_size / 2 + 1;
+    spectrum.resize(2 * n_frequencies);
+
+    double *real = fftw_alloc_real(fft_size);
+    fftw_complex *complex = fftw_alloc_complex(n_frequencies);
+    {
+        std::lock_guard<std::mutex> lk(planner_mutex);
+        forward = fftw_plan_dft_r2c_1d(int(fft_size), real, complex, FFTW_ESTIMATE);
+        backward = fftw_plan_dft_c2r_1d(int(fft_size), complex, real, FFTW_ESTIMATE);
+    }
+    std::fill(real, real + fft_size, 0.);
+    std::copy(response.begin(), response.end(), real);
+    fftw_execute_dft_r2c(forward, real, complex);
+    for (size_t k = 0; k < n_frequencies; ++k) {
+        spectrum[2 * k] = complex[k][0] / double(fft_size);
+        spectrum[2 * k + 1] = complex[k][1] / double(fft_size);
+    }
+    fftw_free(real);
+    fftw_free(complex);
+}
+
+ResponseConvolver::~ResponseConvolver() {
+    std::lock_guard<std::mutex> lk(planner_mutex);
+    fftw_destroy_plan(forward);
+    fftw_destroy_plan(backward);
+}
+
+void ResponseConvolver::convolve(const double *impulses, size_t n_samples, float *signal,
+                                 std::pmr::memory_resource &resource) const {
+    size_t n_frequencies = fft_size / 2 + 1;
+    auto *real = static_cast<double *>(resource.allocate(fft_size * sizeof(double), fft_alignment));
+    auto *complex = static_cast<fftw_complex *>(resource.allocate(n_frequencies * sizeof(fftw_complex),
+                                                                    fft_alignment));
+    auto *sum = static_cast<double *>(resource.allocate(n_samples * sizeof(double), alignof(double)));
+    std::fill(sum, sum + n_samples, 0.);
+
+    for (size_t first = 0; first < n_samples; first += block_size) {
+        size_t n = std::min(block_size, n_samples - first);
+        std::copy(impulses + first, impulses + first + n, real);
+        std::fill(real + n, real + fft_size, 0.);
+        fftw_execute_dft_r2c(forward, real, complex);
+        for (size_t k = 0; k < n_frequencies; ++k) {
+            double re = complex[k][0] * spectrum[2 * k] - complex[k][1] * spectrum[2 * k + 1];
+            double im = complex[k][0] * spectrum[2 * k + 1] + complex[k][1] * spectrum[2 * k];
+            complex[k][0] = re;
+            complex[k][1] = im;
+        }
+        fftw_execute_dft_c2r(backward, complex, real);
+        // The block reaches response_size - 1 samples into the next one
+        size_t end = std::min(n_samples, first + n + response_size - 1);
+        for (size_t s = first; s < end; ++s)
+            sum[s] += real[s - first];
+    }
+    for (size_t s = 0; s < n_samples; ++s)
+        signal[s] = float(sum[s]);
+
+    resource.deallocate(sum, n_samples * sizeof(double), alignof(double));
+    resource.deallocate(complex, n_frequencies * sizeof(fftw_complex), fft_alignment);
+    resource.deallocate(real, fft_size * sizeof(double), fft_alignment);
+}
+
+size_t ResponseConvolver::get_response_size() const {
+    return response_size;
+}
+
+size_t ResponseConvolver::get_fft_size() const {
+    return fft_size;
+}
+
+size_t ResponseConvolver::get_block_size() const {
+    return block_size;
+}
@@ -0,0 +1,67 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Spectrum.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+Spectrum::Spectrum(std::vector<float> energies, const std::vector<float> &weights)
+        : energies(std::move(energies)), table(weights) {
+    if (this->energies.size() != weights.size())
+        throw std::invalid_argument("Number of energies and weights differ.");
+    probabilities.reserve(weights.size());
+    for (auto w: weights)
+        probabilities.push_back(float(double(w) / table.get_total_weight()));
+}
+
+Spectrum Spectrum::from_file(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file)
+        throw std::runtime_error("Could not open spectrum " + filename);
+    std::vector<float> energies;
+    std::vector<float> weights;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream columns(line);
+        float energy, weight;
+        if (!(columns >> energy >> weight))
+            throw std::runtime_error("Invalid line in spectrum " + filename + ": " + line);
+        energies.push_back(energy);
+        weights.push_back(weight);
+    }
+    return {std::move(energies), weights};
+}
+
+float Spectrum::get_mean_energy() const {
+    double mean = 0.;
+    for (size_t k = 0; k < energies.size(); ++k)
+        mean += double(energies[k]) * probabilities[k];
+    return float(mean);
+}
+
+const std::vector<float> &Spectrum::get_energies() const {
+    return energies;
+}
+
+std::vector<float> Spectrum::get_probabilities() const {
+    return probabilities;
+}
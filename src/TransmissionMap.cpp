@@ -0,0 +1,121 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "TransmissionMap.h"
+#include "Medipix.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TransmissionMap::TransmissionMap(std::shared_ptr<const float> data, unsigned int nx, unsigned int ny, float min_x,
+                                 float max_x, float min_y, float max_y)
+        : data(std::move(data)), n_cells_x(nx), n_cells_y(ny), min_x(min_x), min_y(min_y),
+          cell_width((max_x - min_x) / float(nx)), cell_height((max_y - min_y) / float(ny)) {
+    std::vector<float> weights(this->data.get(), this->data.get() + static_cast<size_t>(nx) * ny);
+    table = AliasTable(weights);
+    max_value = *std::max_element(weights.begin(), weights.end());
+}
+
+TransmissionMap::TransmissionMap(std::vector<float> values, unsigned int nx, unsigned int ny, float min_x,
+                                 float max_x, float min_y, float max_y)
+        : TransmissionMap([&]() {
+    if (values.size() != static_cast<size_t>(nx) * ny)
+        throw std::invalid_argument("Size of the transmission map does not match nx * ny.");
+    auto owned = std::make_shared<std::vector<float>>(std::move(values));
+    return std::shared_ptr<const float>(owned, owned->data());
+}(), nx, ny, min_x, max_x, min_y, max_y) {}
+
+TransmissionMap::TransmissionMap(std::vector<float> values, unsigned int nx, unsigned int ny,
+                                 const std::shared_ptr<Medipix> &medipix)
+        : TransmissionMap(std::move(values), nx, ny, medipix->get_min_x(), medipix->get_max_x(),
+                          medipix->get_min_y(), medipix->get_max_y()) {}
+
+TransmissionMap TransmissionMap::from_file(const std::string &filename, unsigned int nx, unsigned int ny,
+                                           const std::shared_ptr<Medipix> &medipix) {
+    size_t size = static_cast<size_t>(nx) * ny * sizeof(float);
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open transmission map " + filename);
+    struct stat file_stat{};
+    if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) != size) {
+        close(fd);
+        throw std::runtime_error("Size of " + filename + " does not match nx * ny floats.");
+    }
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Could not map transmission map " + filename);
+    std::shared_ptr<const float> data(static_cast<const float *>(mapped),
+                                      [size](const float *p) { munmap(const_cast<float *>(p), size); });
+    return {data, nx, ny, medipix->get_min_x(), medipix->get_max_x(), medipix->get_min_y(), medipix->get_max_y()};
+}
+
+float TransmissionMap::get_value(unsigned int i, unsigned int j) const {
+    return data.get()[static_cast<size_t>(i) * n_cells_y + j];
+}
+
+double TransmissionMap::get_mean() const {
+    return table.get_total_weight() / double(table.size());
+}
+
+float TransmissionMap::get_max() const {
+    return max_value;
+}
+
+double TransmissionMap::get_area() const {
+    return double(cell_width) * n_cells_x * 0.001 * double(cell_height) * n_cells_y * 0.001;
+}
+
+void transmission_exposure(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time,
+                           double flux_density, const TransmissionMap &map, unsigned int seed) {
+    auto incident_photons = static_cast<unsigned long long>(flux_density * map.get_area() * exposure_time);
+    double duration = exposure_time * double(1E6);
+    medipix->check_exposure_duration(duration);
+
+    // The number of interacting photons is drawn from its own stream, after the photon streams
+    RandomStream count_rng(seed, ~0ull);
+    double sensor_probability = medipix->get_sensor() ? medipix->get_sensor()->interaction_probability(energy) : 1.;
+    unsigned long long number_of_photons;
+    if (map.get_max() <= 1.f) {
+        std::binomial_distribution<unsigned long long> distribution(incident_photons,
+                                                                    map.get_mean() * sensor_probability);
+        number_of_photons = distribution(count_rng);
+    } else {
+        std::poisson_distribution<unsigned long long> distribution(
+                double(incident_photons) * map.get_mean() * sensor_probability);
+        number_of_photons = distribution(count_rng);
+    }
+
+    bool depth_of_interaction = medipix->has_depth_of_interaction();
+#pragma omp parallel for default(none) shared(medipix, energy, number_of_photons, map, duration, seed, depth_of_interaction)
+    for (unsigned long long k = 0; k < number_of_photons; ++k) {
+        RandomStream rng(seed, k);
+        auto [x, y] = map.sample_position(rng);
+        if (!medipix->in_region_of_interest(x, y, 3))
+            continue;
+        double t = rng.uniform_double(0., duration);
+        float depth = depth_of_interaction ? medipix->draw_interaction_depth(energy, rng) : -1.f;
+        medipix->add_photon(energy, x, y, depth, 3, t);
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "burst.h"
+#include "Medipix.h"
+#include "RandomStream.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+unsigned int frame_seed(unsigned int seed, unsigned int frame) {
+    RandomStream rng(seed, frame);
+    return static_cast<unsigned int>(rng() >> 32);
+}
+
+FrameStack burst(const std::shared_ptr<Medipix> &medipix, unsigned int n_frames, const FrameExposure &frame_exposure,
+                 unsigned int seed) {
+    auto roi = medipix->get_region_of_interest();
+    FrameStack frames(n_frames, roi.nx, roi.ny);
+
+    SerialNestedRegions serial_nested_regions;
+#pragma omp parallel default(none) shared(medipix, n_frames, frame_exposure, seed, frames)
+    {
+        auto replica = medipix->clone();
+#pragma omp for schedule(dynamic, 1)
+        for (unsigned int frame = 0; frame < n_frames; ++frame) {
+            replica->start_frame();
+            frame_exposure(replica, frame_seed(seed, frame));
+            replica->finish_frame();
+            const auto &image = replica->get_image();
+            std::copy(image.begin(), image.end(), frames.get_frame(frame));
+            frames.set_real_photons(frame, replica->get_real_photons());
+        }
+    }
+    return frames;
+}
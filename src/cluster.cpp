@@ -0,0 +1,170 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cluster.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    size_t find_root(std::vector<size_t> &parent, size_t k) {
+        while (parent[k] != k) {
+            parent[k] = parent[parent[k]];
+            k = parent[k];
+        }
+        return k;
+    }
+
+    /**
+     * Joins the sets of a and b. The earlier hit becomes the root, so roots are the earliest hits of their clusters.
+     */
+    void unite(std::vector<size_t> &parent, size_t a, size_t b) {
+        a = find_root(parent, a);
+        b = find_root(parent, b);
+        if (a < b)
+            parent[b] = a;
+        else if (b < a)
+            parent[a] = b;
+    }
+}
+
+std::vector<Cluster> cluster_hits(const MedipixTimepix &detector, const std::vector<Hit> &hits,
+                                  double time_window, unsigned int tile_rows) {
+    if (tile_rows == 0)
+        throw std::invalid_argument("Tiles need at least one row.");
+    if (!std::is_sorted(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) { return a.toa < b.toa; }))
+        throw std::invalid_argument("Hits must be sorted by time of arrival.");
+
+    unsigned int n_x = detector.get_num_pixels_x();
+    unsigned int n_y = detector.get_num_pixels_y();
+    auto window = static_cast<uint64_t>(time_window * detector.get_toa_clock());
+    unsigned int n_tiles = (n_x + tile_rows - 1) / tile_rows;
+
+    std::vector<std::vector<size_t>> tile_hits(n_tiles);
+    for (size_t k = 0; k < hits.size(); ++k) {
+        if (hits[k].pixel >= n_x * n_y)
+            throw std::out_of_range("Hit pixel outside of the detector.");
+        tile_hits[hits[k].pixel / n_y / tile_rows].push_back(k);
+    }
+
+    std::vector<size_t> parent(hits.size());
+    for (size_t k = 0; k < hits.size(); ++k)
+        parent[k] = k;
+
+    // Time sorted sweep per tile: a hit is joined with the latest hit of each neighbouring pixel in the tile. The
+    // sets of different tiles are disjoint, so the tiles do not share any state.
+    #pragma omp parallel for default(none) shared(hits, tile_hits, parent, n_tiles, n_x, n_y, tile_rows, window) \
+            schedule(dynamic, 1)
+    for (unsigned int tile = 0; tile < n_tiles; ++tile) {
+        unsigned int first_row = tile * tile_rows;
+        unsigned int n_rows = std::min(tile_rows, n_x - first_row);
+        std::vector<long> latest(static_cast<size_t>(n_rows) * n_y, -1);
+        for (auto k: tile_hits[tile]) {
+            int i = int(hits[k].pixel / n_y - first_row);
+            int j = int(hits[k].pixel % n_y);
+            for (int di = -1; di <= 1; ++di) {
+                for (int dj = -1; dj <= 1; ++dj) {
+                    int ii = i + di;
+                    int jj = j + dj;
+                    if ((di == 0 && dj == 0) || ii < 0 || ii >= int(n_rows) || jj < 0 || jj >= int(n_y))
+                        continue;
+                    long l = latest[size_t(ii) * n_y + jj];
+                    if (l >= 0 && hits[k].toa - hits[l].toa <= window)
+                        unite(parent, k, size_t(l));
+                }
+            }
+            latest[size_t(i) * n_y + j] = long(k);
+        }
+    }
+
+    // Stitch the last row of each tile with the first row of the next tile
+    std::vector<long> latest(2 * static_cast<size_t>(n_y));
+    std::vector<size_t> border_hits;
+    for (unsigned int tile = 1; tile < n_tiles; ++tile) {
+        unsigned int row = tile * tile_rows;
+        border_hits.clear();
+        for (auto k: tile_hits[tile - 1])
+            if (hits[k].pixel / n_y == row - 1)
+                border_hits.push_back(k);
+        auto middle = long(border_hits.size());
+        for (auto k: tile_hits[tile])
+            if (hits[k].pixel / n_y == row)
+                border_hits.push_back(k);
+        std::inplace_merge(border_hits.begin(), border_hits.begin() + middle, border_hits.end());
+
+        std::fill(latest.begin(), latest.end(), -1);
+        for (auto k: border_hits) {
+            int side = hits[k].pixel / n_y == row ? 1 : 0;
+            int j = int(hits[k].pixel % n_y);
+            for (int dj = -1; dj <= 1; ++dj) {
+                int jj = j + dj;
+                if (jj < 0 || jj >= int(n_y))
+                    continue;
+                long l = latest[size_t(1 - side) * n_y + jj];
+                if (l >= 0 && hits[k].toa - hits[l].toa <= window)
+                    unite(parent, k, size_t(l));
+            }
+            latest[size_t(side) * n_y + j] = long(k);
+        }
+    }
+
+    std::vector<size_t> root(hits.size());
+    std::vector<float> energy(hits.size());
+    #pragma omp parallel for default(none) shared(hits, parent, root, energy, detector)
+    for (size_t k = 0; k < hits.size(); ++k) {
+        size_t r = k;
+        while (parent[r] != r)
+            r = parent[r];
+        root[k] = r;
+        energy[k] = detector.get_hit_energy(hits[k]);
+    }
+
+    // Roots are the earliest hits of the clusters, numbering them in hit order sorts the clusters in time
+    std::vector<size_t> cluster_index(hits.size());
+    std::vector<Cluster> clusters;
+    // Unweighted sums of the pixel centers, the centroid of clusters without energy (e.g. for th0 = 0)
+    std::vector<std::pair<float, float>> center_sums;
+    for (size_t k = 0; k < hits.size(); ++k) {
+        if (root[k] == k) {
+            cluster_index[k] = clusters.size();
+            clusters.push_back(Cluster{double(hits[k].toa) / detector.get_toa_clock(), 0.f, 0.f, 0.f, 0});
+            center_sums.emplace_back(0.f, 0.f);
+        }
+        auto &cluster = clusters[cluster_index[root[k]]];
+        auto &center_sum = center_sums[cluster_index[root[k]]];
+        auto [x, y] = detector.get_pixel_center(hits[k].pixel / n_y, hits[k].pixel % n_y);
+        cluster.energy += energy[k];
+        cluster.x += energy[k] * x;
+        cluster.y += energy[k] * y;
+        center_sum.first += x;
+        center_sum.second += y;
+        cluster.size++;
+    }
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        auto &cluster = clusters[c];
+        if (cluster.energy == 0.f) {
+            cluster.x = center_sums[c].first / float(cluster.size);
+            cluster.y = center_sums[c].second / float(cluster.size);
+        } else {
+            cluster.x /= cluster.energy;
+            cluster.y /= cluster.energy;
+        }
+    }
+    return clusters;
+}
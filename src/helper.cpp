@@ -19,6 +19,7 @@
 #include <random>
 #include "helper.h"
 #include "Medipix.h"
+#include "RandomStream.h"
 #include <ctime>
 #include <iostream>
 #include <omp.h>
@@ -26,92 +27,68 @@
 
 
 void exposure(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time, double flux_density,
-              const std::function<bool(float, float)> &photon_interacting) {
-    //flux density in photons per second per square mm
-
-    float total_area =
-            float(medipix->get_num_pixels_x() * medipix->get_num_pixels_y()) * (medipix->get_pixel_pitch() * 0.001f) *
-            (medipix->get_pixel_pitch() * 0.001f);
-    double duration = exposure_time * double(1E6);
-    unsigned int number_of_photons = int(flux_density * total_area * exposure_time);
-
-    unsigned int seed = time(nullptr);
-    #pragma omp parallel for default(none) shared(medipix, energy, number_of_photons, photon_interacting, duration, seed)
-    for (unsigned int i = 0; i < number_of_photons; ++i) {
-        std::random_device randomDevice;
-        std::mt19937 twisterEngine(randomDevice());
-        twisterEngine.seed(seed + i);
-        std::uniform_real_distribution<float> distribution_x(medipix->get_min_x(), medipix->get_max_x());
-        std::uniform_real_distribution<float> distribution_y(medipix->get_min_y(), medipix->get_max_y());
-        std::uniform_real_distribution<float> distribution_t(0.f, float(duration));
-        float x = distribution_x(twisterEngine);
-        float y = distribution_y(twisterEngine);
-        float t = distribution_t(twisterEngine);
+              const std::function<bool(float, float)> &photon_interacting, unsigned int seed) {
+    partial_exposure(medipix, energy, exposure_time, photon_interacting, seed, 0,
+                     get_number_of_photons(medipix, exposure_time, flux_density));
+}
 
-        if (photon_interacting(x, y)) {
-            medipix->add_photon(energy, x, y, 3, t);
-        }
-    }
+unsigned long long
+get_number_of_photons(const std::shared_ptr<Medipix> &medipix, double exposure_time, double flux_density) {
+    //flux density in photons per second per square mm
+    float total_area = (medipix->get_max_x() - medipix->get_min_x()) * 0.001f *
+                       (medipix->get_max_y() - medipix->get_min_y()) * 0.001f;
+    return static_cast<unsigned long long>(flux_density * total_area * exposure_time);
+}
 
+void partial_exposure(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time,
+                      const std::function<bool(float, float)> &photon_interacting, unsigned int seed,
+                      unsigned long long first_photon, unsigned long long last_photon) {
+    partial_exposure<float, std::function<bool(float, float)>>(medipix, energy, exposure_time, photon_interacting,
+                                                              seed, first_photon, last_photon);
 }
 
 [[maybe_unused]] void
-homogeneous_exposure(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time, double flux_density) {
-    exposure(medipix, energy, exposure_time, flux_density, [](float x, float y) { return true; });
+homogeneous_exposure(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time, double flux_density,
+                     unsigned int seed) {
+    exposure(medipix, energy, exposure_time, flux_density, HomogeneousPattern{}, seed);
 }
 
 [[maybe_unused]] void
 edge_exposure(const std::shared_ptr<Medipix> &medipix, float energy, float m, float c, double exposure_time,
-              double flux_density) {
-    std::function<bool(float, float)> g = [m, c](float _x, float _y) { return edge(_x, _y, m, c); };
-    exposure(medipix, energy, exposure_time, flux_density, g);
+              double flux_density, unsigned int seed) {
+    exposure(medipix, energy, exposure_time, flux_density, EdgePattern{m, c}, seed);
 }
 
 [[maybe_unused]] void
 frequency_exposure(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time, float period,
-                   float phase, float n_x, float n_y, double flux_density) {
+                   float phase, float n_x, float n_y, double flux_density, unsigned int seed) {
     float r = std::sqrt(n_x * n_x + n_y * n_y);
     n_x /= r;
     n_y /= r;
-    std::function<bool(float, float)> g = [period, phase, n_x, n_y](float _x, float _y) {
-        return frequency(_x, _y, period, phase, n_x, n_y);
-    };
-    exposure(medipix, energy, exposure_time, flux_density, g);
+    exposure(medipix, energy, exposure_time, flux_density, FrequencyPattern{period, phase, n_x, n_y}, seed);
 }
 
 bool edge(float x, float y, float m, float c) {
     return y > m * x + c;
 }
 
-float get_random_free_path(float mu_norm, float rho) {
-    float mu = mu_norm * rho;
+float get_random_free_path(float mu_norm, float rho, float thickness, RandomStream &rng) {
+    float mu = mu_norm * rho * 1E-4f; // in 1/um
 
-    // From beer-lambert:
-    // PDF(x) = exp(-mu * x) / mu
-    // CTF(x) =  (-1/mu) * (exp(-mu * x) - 1)
-    // CTF^-1(y) = -ln(1 - y * mu) / mu.
+    // From beer-lambert, truncated to the sensor:
+    // PDF(x) = mu * exp(-mu * x) / (1 - exp(-mu * d))
+    // CDF(x) = (1 - exp(-mu * x)) / (1 - exp(-mu * d))
+    // CDF^-1(u) = -ln(1 - u * (1 - exp(-mu * d))) / mu.
 
     // With the inverse transfer method we sample now the interaction depth.
-
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    float max_range = std::min(1.0f, 1.0f/mu);
-    static std::uniform_real_distribution<float> dis(0.0, max_range);
-    float u = dis(gen);
-    float x = -std::log(1 - u * mu) / mu;
-    //while (x <= 0 || x!=x) {
-    //    u = dis(gen);
-    //    x = -std::log(1 - u * mu) / mu;
-    //}
-    return x * 1E4f; // in um
+    return -std::log1p(rng.uniform() * std::expm1(-mu * thickness)) / mu;
 }
 
 
-bool frequency(float x, float y, float period, float phase, float n_x, float n_y) {
-    float a1 = n_x * x + n_y * y;
-    float probability = sinf(2.f * M_PIf * a1 / period + phase);
-    std::uniform_real_distribution<float> distribution(0, 1);
-    unsigned int seed = time(nullptr);
-    std::default_random_engine freq_generator(seed);
-    return (distribution(freq_generator) < probability);
+float frequency_transmission(float x, float y, float period, float phase, float n_x, float n_y) {
+    return FrequencyPattern{period, phase, n_x, n_y}(x, y);
+}
+
+bool frequency(float x, float y, float period, float phase, float n_x, float n_y, float u) {
+    return u < frequency_transmission(x, y, period, phase, n_x, n_y);
 }
@@ -0,0 +1,84 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pileup.h"
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MEDIPIX_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define MEDIPIX_TARGET_CLONES
+#endif
+
+namespace {
+    /**
+     * Samples per lane of a transposed block, 4 KiB for 16 lanes
+     */
+    constexpr size_t block_samples = 64;
+}
+
+MEDIPIX_TARGET_CLONES
+void count_crossings(const float *const *signal, const uint32_t *length, const float *threshold,
+                     const float *previous, uint32_t *counts) {
+    alignas(64) float block[block_samples * pileup_lanes];
+    alignas(64) float last[pileup_lanes];
+    alignas(64) float lane_threshold[pileup_lanes];
+    alignas(64) uint32_t lane_length[pileup_lanes];
+    alignas(64) uint32_t crossings[pileup_lanes];
+    size_t n_samples = 0;
+    for (unsigned int l = 0; l < pileup_lanes; ++l) {
+        last[l] = previous[l];
+        lane_threshold[l] = threshold[l];
+        lane_length[l] = length[l];
+        crossings[l] = 0;
+        n_samples = std::max<size_t>(n_samples, length[l]);
+    }
+    for (size_t first = 0; first < n_samples; first += block_samples) {
+        size_t n = std::min(block_samples, n_samples - first);
+        for (unsigned int l = 0; l < pileup_lanes; ++l) {
+            size_t available = lane_length[l] > first ? std::min<size_t>(n, lane_length[l] - first) : 0;
+            for (size_t s = 0; s < available; ++s)
+                block[s * pileup_lanes + l] = signal[l][first + s];
+            for (size_t s = available; s < n; ++s)
+                block[s * pileup_lanes + l] = 0.f;
+        }
+        for (size_t s = 0; s < n; ++s) {
+            const float *values = block + s * pileup_lanes;
+            auto sample = static_cast<uint32_t>(first + s);
+            #pragma omp simd
+            for (unsigned int l = 0; l < pileup_lanes; ++l) {
+                bool rising = last[l] < lane_threshold[l] && values[l] > lane_threshold[l] && sample < lane_length[l];
+                crossings[l] += rising ? 1u : 0u;
+                last[l] = values[l];
+            }
+        }
+    }
+    for (unsigned int l = 0; l < pileup_lanes; ++l)
+        counts[l] = crossings[l];
+}
+
+std::string pileup_isa() {
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return "avx512f";
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+#endif
+    return "default";
+}
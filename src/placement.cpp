@@ -0,0 +1,187 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "placement.h"
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <omp.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#ifdef MEDIPIX_HAVE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+std::pair<size_t, size_t> owner_range(size_t n, unsigned int t, unsigned int n_threads) {
+    return {n * t / n_threads, n * (t + 1) / n_threads};
+}
+
+unsigned int get_numa_nodes() {
+#ifdef MEDIPIX_HAVE_NUMA
+    if (numa_available() >= 0)
+        return static_cast<unsigned int>(numa_num_configured_nodes());
+#endif
+    return 1;
+}
+
+unsigned int get_numa_node() {
+#if defined(MEDIPIX_HAVE_NUMA) && defined(__linux__)
+    if (numa_available() >= 0) {
+        int node = numa_node_of_cpu(sched_getcpu());
+        if (node >= 0)
+            return static_cast<unsigned int>(node);
+    }
+#endif
+    return 0;
+}
+
+namespace {
+/**
+ * Process-wide state of ThreadPinning
+ */
+struct PinningState {
+    std::mutex mutex;
+    int references = 0;
+    int pinned_threads = 0;
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t original;
+#endif
+};
+
+PinningState &pinning_state() {
+    static PinningState state;
+    return state;
+}
+}
+
+ThreadPinning::ThreadPinning(const ThreadPinning &other) {
+    *this = other;
+}
+
+ThreadPinning &ThreadPinning::operator=(const ThreadPinning &other) {
+    if (other.pinned && !pinned) {
+        auto &state = pinning_state();
+        std::lock_guard<std::mutex> lk(state.mutex);
+        ++state.references;
+        pinned = true;
+    } else if (!other.pinned) {
+        release();
+    }
+    return *this;
+}
+
+ThreadPinning::~ThreadPinning() {
+    release();
+}
+
+void ThreadPinning::pin() {
+    auto &state = pinning_state();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    if (!pinned) {
+        pinned = true;
+        if (state.references++ == 0) {
+            // The CPUs are taken from the affinity of the first reference, before the calling thread is pinned
+            state.pinned_threads = 0;
+            state.cpus.clear();
+#ifdef __linux__
+            CPU_ZERO(&state.original);
+            if (sched_getaffinity(0, sizeof(state.original), &state.original) == 0) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &state.original))
+                        state.cpus.push_back(cpu);
+                }
+            }
+#endif
+        }
+    }
+#ifdef __linux__
+    if (omp_get_proc_bind() != omp_proc_bind_false || omp_get_max_threads() <= state.pinned_threads ||
+        state.cpus.empty())
+        return;
+    #pragma omp parallel default(none) shared(state)
+    {
+        auto t = static_cast<size_t>(omp_get_thread_num());
+        cpu_set_t thread_set;
+        CPU_ZERO(&thread_set);
+        CPU_SET(state.cpus[t % state.cpus.size()], &thread_set);
+        sched_setaffinity(0, sizeof(thread_set), &thread_set);
+        #pragma omp single
+        state.pinned_threads = omp_get_num_threads();
+    }
+#endif
+}
+
+void ThreadPinning::release() {
+    if (!pinned)
+        return;
+    auto &state = pinning_state();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    pinned = false;
+    if (--state.references > 0 || state.pinned_threads == 0)
+        return;
+#ifdef __linux__
+    // The team of the pinning reuses the pinned threads
+    #pragma omp parallel num_threads(state.pinned_threads) default(none) shared(state)
+    sched_setaffinity(0, sizeof(state.original), &state.original);
+#endif
+    state.pinned_threads = 0;
+}
+
+bool ThreadPinning::is_pinned() const {
+    return pinned;
+}
+
+size_t move_to_owners(const void *data, size_t bytes, size_t tile_bytes) {
+#ifdef MEDIPIX_HAVE_NUMA
+    if (bytes == 0 || numa_available() < 0)
+        return 0;
+    auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto begin = reinterpret_cast<uintptr_t>(data);
+    size_t on_node = 0;
+    #pragma omp parallel default(none) shared(begin, bytes, tile_bytes, page_size) reduction(+: on_node)
+    {
+        std::vector<void *> pages;
+        for_owned_blocks(bytes, tile_bytes, omp_get_thread_num(), omp_get_num_threads(),
+                         [&pages, begin, page_size](size_t first, size_t last) {
+            // Pages are assigned to the owner of their first byte
+            uintptr_t page = (begin + first + page_size - 1) / page_size * page_size;
+            if (first == 0)
+                page = begin / page_size * page_size;
+            for (; page < begin + last; page += page_size)
+                pages.push_back(reinterpret_cast<void *>(page));
+        });
+        if (!pages.empty()) {
+            std::vector<int> nodes(pages.size(), static_cast<int>(get_numa_node()));
+            std::vector<int> status(pages.size(), -1);
+            numa_move_pages(0, pages.size(), pages.data(), nodes.data(), status.data(), MPOL_MF_MOVE);
+            for (size_t p = 0; p < pages.size(); ++p)
+                on_node += status[p] == nodes[p] ? 1 : 0;
+        }
+    }
+    return on_node;
+#else
+    (void) data;
+    (void) bytes;
+    (void) tile_bytes;
+    return 0;
+#endif
+}
@@ -0,0 +1,67 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "schedule.h"
+#include <algorithm>
+#include <numeric>
+
+size_t TaskList::size() const {
+    return offsets.size() - 1;
+}
+
+std::span<const uint32_t> TaskList::get_task(size_t t) const {
+    return {items.data() + offsets[t], offsets[t + 1] - offsets[t]};
+}
+
+TaskList balance_tasks(std::span<const uint64_t> cost, unsigned int n_threads, unsigned int tasks_per_thread) {
+    TaskList tasks;
+    tasks.items.resize(cost.size());
+    std::iota(tasks.items.begin(), tasks.items.end(), uint32_t(0));
+    std::stable_sort(tasks.items.begin(), tasks.items.end(),
+                     [&cost](uint32_t a, uint32_t b) { return cost[a] > cost[b]; });
+    uint64_t total = std::accumulate(cost.begin(), cost.end(), uint64_t(0));
+    uint64_t target = std::max<uint64_t>(total / std::max(1u, n_threads * tasks_per_thread), 1);
+    uint64_t task_cost = 0;
+    for (size_t k = 0; k < tasks.items.size(); ++k) {
+        task_cost += cost[tasks.items[k]];
+        if (task_cost >= target) {
+            tasks.offsets.push_back(k + 1);
+            task_cost = 0;
+        }
+    }
+    if (tasks.offsets.back() < tasks.items.size())
+        tasks.offsets.push_back(tasks.items.size());
+    return tasks;
+}
+
+TaskList uniform_tasks(size_t n_items, unsigned int chunk) {
+    TaskList tasks;
+    tasks.items.resize(n_items);
+    std::iota(tasks.items.begin(), tasks.items.end(), uint32_t(0));
+    for (size_t first = chunk; first < n_items; first += chunk)
+        tasks.offsets.push_back(first);
+    if (n_items > 0)
+        tasks.offsets.push_back(n_items);
+    return tasks;
+}
+
+double Utilization::get_utilization() const {
+    if (threads == 0 || wall_time <= 0.)
+        return 1.;
+    return busy_time / (threads * wall_time);
+}
@@ -0,0 +1,287 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "shard.h"
+#include "helper.h"
+#include "Medipix.h"
+#include "MedipixCSM.h"
+#include "MedipixSPM.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+    /**
+     * Reads the rest of the line after a key, so values may contain spaces
+     */
+    std::string read_line_value(std::istream &sidecar) {
+        std::string value;
+        std::getline(sidecar, value);
+        if (!value.empty() && value.front() == ' ')
+            value.erase(0, 1);
+        return value;
+    }
+
+    bool same_detector(const ShardInfo &a, const ShardInfo &b) {
+        if (a.mode != b.mode || a.pattern != b.pattern || a.th0 != b.th0 || a.th1 != b.th1 ||
+            a.psf_sigma != b.psf_sigma || a.dispersion_sigma != b.dispersion_sigma ||
+            a.dispersion_seed != b.dispersion_seed || a.depth_of_interaction != b.depth_of_interaction ||
+            a.sensor != b.sensor || a.edge_extension != b.edge_extension)
+            return false;
+        if (a.sensor && (a.sensor_material != b.sensor_material || a.sensor_density != b.sensor_density ||
+                         a.sensor_thickness != b.sensor_thickness))
+            return false;
+        if (!a.depth_of_interaction)
+            return true;
+        const auto &x = a.depth_model;
+        const auto &y = b.depth_model;
+        return x.mu_norm == y.mu_norm && x.rho == y.rho && x.thickness == y.thickness &&
+               x.bias_voltage == y.bias_voltage && x.temperature == y.temperature &&
+               x.initial_sigma == y.initial_sigma && x.n_depth_bins == y.n_depth_bins;
+    }
+}
+
+std::pair<unsigned long long, unsigned long long>
+shard_range(unsigned long long total_photons, unsigned int shard, unsigned int n_shards) {
+    if (n_shards == 0 || shard >= n_shards)
+        throw std::invalid_argument("Shard index must be smaller than the number of shards.");
+    unsigned long long base = total_photons / n_shards;
+    unsigned long long remainder = total_photons % n_shards;
+    unsigned long long first = shard * base + std::min<unsigned long long>(shard, remainder);
+    unsigned long long last = first + base + (shard < remainder ? 1 : 0);
+    return std::make_pair(first, last);
+}
+
+ShardInfo run_shard(const std::shared_ptr<Medipix> &medipix, float energy, double exposure_time, double flux_density,
+                    const std::function<bool(float, float)> &photon_interacting, unsigned int seed,
+                    unsigned int shard, unsigned int n_shards, const std::string &pattern) {
+    if (medipix->get_timed())
+        throw std::logic_error("Timed detectors can not be sharded, pile-up is not additive.");
+    auto csm = std::dynamic_pointer_cast<MedipixCSM>(medipix);
+    if (!csm && !std::dynamic_pointer_cast<MedipixSPM>(medipix))
+        throw std::logic_error("Only SPM and CSM detectors can be sharded.");
+
+    ShardInfo info;
+    info.shard = shard;
+    info.n_shards = n_shards;
+    info.seed = seed;
+    info.total_photons = get_number_of_photons(medipix, exposure_time, flux_density);
+    std::tie(info.first_photon, info.last_photon) = shard_range(info.total_photons, shard, n_shards);
+    info.n_pixel_x = medipix->get_region_of_interest().nx;
+    info.n_pixel_y = medipix->get_region_of_interest().ny;
+    info.roi_x0 = medipix->get_region_of_interest().x0;
+    info.roi_y0 = medipix->get_region_of_interest().y0;
+    info.n_chip_x = medipix->get_num_pixels_x();
+    info.n_chip_y = medipix->get_num_pixels_y();
+    info.energy = energy;
+    info.exposure_time = exposure_time;
+    info.flux_density = flux_density;
+    info.pattern = pattern;
+    info.mode = csm ? "csm" : "spm";
+    info.th0 = medipix->get_th0();
+    info.th1 = csm ? csm->get_th1() : 0.f;
+    info.psf_sigma = medipix->get_psf_sigma();
+    info.dispersion_sigma = medipix->get_dispersion_sigma();
+    info.dispersion_seed = medipix->get_dispersion_seed();
+    info.depth_of_interaction = medipix->has_depth_of_interaction();
+    if (info.depth_of_interaction)
+        info.depth_model = medipix->get_depth_of_interaction();
+    if (const auto &sensor = medipix->get_sensor()) {
+        info.sensor = true;
+        info.sensor_material = sensor->get_material().get_name();
+        info.sensor_density = sensor->get_material().get_density();
+        info.sensor_thickness = sensor->get_thickness();
+    }
+    info.edge_extension = medipix->get_edge_extension();
+
+    medipix->start_frame();
+    partial_exposure(medipix, energy, exposure_time, photon_interacting, seed, info.first_photon, info.last_photon);
+    medipix->finish_frame();
+    info.real_photons = medipix->get_real_photons();
+    return info;
+}
+
+void save_shard(const std::shared_ptr<Medipix> &medipix, ShardInfo info, const std::string &prefix) {
+    std::filesystem::path image_path(prefix + ".raw");
+    medipix->save_image(image_path.string());
+    info.image_file = image_path.filename().string();
+    save_shard_info(info, prefix + ".txt");
+}
+
+void save_shard_info(const ShardInfo &info, const std::string &filename) {
+    std::ofstream sidecar(filename);
+    sidecar.precision(std::numeric_limits<double>::max_digits10);
+    sidecar << "shard " << info.shard << '\n'
+            << "n_shards " << info.n_shards << '\n'
+            << "seed " << info.seed << '\n'
+            << "first_photon " << info.first_photon << '\n'
+            << "last_photon " << info.last_photon << '\n'
+            << "total_photons " << info.total_photons << '\n'
+            << "real_photons " << info.real_photons << '\n'
+            << "n_pixel_x " << info.n_pixel_x << '\n'
+            << "n_pixel_y " << info.n_pixel_y << '\n'
+            << "roi_x0 " << info.roi_x0 << '\n'
+            << "roi_y0 " << info.roi_y0 << '\n'
+            << "n_chip_x " << info.n_chip_x << '\n'
+            << "n_chip_y " << info.n_chip_y << '\n'
+            << "energy " << info.energy << '\n'
+            << "exposure_time " << info.exposure_time << '\n'
+            << "flux_density " << info.flux_density << '\n'
+            << "pattern " << info.pattern << '\n'
+            << "mode " << info.mode << '\n'
+            << "th0 " << info.th0 << '\n'
+            << "th1 " << info.th1 << '\n'
+            << "psf_sigma " << info.psf_sigma << '\n'
+            << "dispersion_sigma " << info.dispersion_sigma << '\n'
+            << "dispersion_seed " << info.dispersion_seed << '\n'
+            << "depth_of_interaction " << info.depth_of_interaction << '\n';
+    if (info.depth_of_interaction) {
+        sidecar << "depth_mu_norm " << info.depth_model.mu_norm << '\n'
+                << "depth_rho " << info.depth_model.rho << '\n'
+                << "depth_thickness " << info.depth_model.thickness << '\n'
+                << "depth_bias_voltage " << info.depth_model.bias_voltage << '\n'
+                << "depth_temperature " << info.depth_model.temperature << '\n'
+                << "depth_initial_sigma " << info.depth_model.initial_sigma << '\n'
+                << "depth_bins " << info.depth_model.n_depth_bins << '\n';
+    }
+    sidecar << "sensor " << info.sensor << '\n';
+    if (info.sensor) {
+        sidecar << "sensor_material " << info.sensor_material << '\n'
+                << "sensor_density " << info.sensor_density << '\n'
+                << "sensor_thickness " << info.sensor_thickness << '\n';
+    }
+    sidecar << "edge_extension " << info.edge_extension[0] << ' ' << info.edge_extension[1] << ' '
+            << info.edge_extension[2] << ' ' << info.edge_extension[3] << '\n';
+    sidecar << "image_file " << info.image_file << '\n';
+    sidecar.close();
+}
+
+ShardInfo read_shard_info(const std::string &filename) {
+    std::ifstream sidecar(filename);
+    if (!sidecar)
+        throw std::runtime_error("Could not open shard metadata " + filename);
+    ShardInfo info;
+    std::string key;
+    while (sidecar >> key) {
+        if (key == "shard") sidecar >> info.shard;
+        else if (key == "n_shards") sidecar >> info.n_shards;
+        else if (key == "seed") sidecar >> info.seed;
+        else if (key == "first_photon") sidecar >> info.first_photon;
+        else if (key == "last_photon") sidecar >> info.last_photon;
+        else if (key == "total_photons") sidecar >> info.total_photons;
+        else if (key == "real_photons") sidecar >> info.real_photons;
+        else if (key == "n_pixel_x") sidecar >> info.n_pixel_x;
+        else if (key == "n_pixel_y") sidecar >> info.n_pixel_y;
+        else if (key == "roi_x0") sidecar >> info.roi_x0;
+        else if (key == "roi_y0") sidecar >> info.roi_y0;
+        else if (key == "n_chip_x") sidecar >> info.n_chip_x;
+        else if (key == "n_chip_y") sidecar >> info.n_chip_y;
+        else if (key == "energy") sidecar >> info.energy;
+        else if (key == "exposure_time") sidecar >> info.exposure_time;
+        else if (key == "flux_density") sidecar >> info.flux_density;
+        else if (key == "pattern") info.pattern = read_line_value(sidecar);
+        else if (key == "mode") sidecar >> info.mode;
+        else if (key == "th0") sidecar >> info.th0;
+        else if (key == "th1") sidecar >> info.th1;
+        else if (key == "psf_sigma") sidecar >> info.psf_sigma;
+        else if (key == "dispersion_sigma") sidecar >> info.dispersion_sigma;
+        else if (key == "dispersion_seed") sidecar >> info.dispersion_seed;
+        else if (key == "depth_of_interaction") sidecar >> info.depth_of_interaction;
+        else if (key == "depth_mu_norm") sidecar >> info.depth_model.mu_norm;
+        else if (key == "depth_rho") sidecar >> info.depth_model.rho;
+        else if (key == "depth_thickness") sidecar >> info.depth_model.thickness;
+        else if (key == "depth_bias_voltage") sidecar >> info.depth_model.bias_voltage;
+        else if (key == "depth_temperature") sidecar >> info.depth_model.temperature;
+        else if (key == "depth_initial_sigma") sidecar >> info.depth_model.initial_sigma;
+        else if (key == "depth_bins") sidecar >> info.depth_model.n_depth_bins;
+        else if (key == "sensor") sidecar >> info.sensor;
+        else if (key == "sensor_material") info.sensor_material = read_line_value(sidecar);
+        else if (key == "sensor_density") sidecar >> info.sensor_density;
+        else if (key == "sensor_thickness") sidecar >> info.sensor_thickness;
+        else if (key == "edge_extension") {
+            for (auto &extension: info.edge_extension)
+                sidecar >> extension;
+        }
+        else if (key == "image_file") info.image_file = read_line_value(sidecar);
+        else
+            throw std::runtime_error("Unknown key " + key + " in shard metadata " + filename);
+    }
+    return info;
+}
+
+ShardInfo merge_shards(const std::vector<std::string> &sidecars, std::vector<unsigned int> &counts) {
+    if (sidecars.empty())
+        throw std::invalid_argument("No shards to merge.");
+
+    std::vector<ShardInfo> shards;
+    for (auto &sidecar: sidecars)
+        shards.push_back(read_shard_info(sidecar));
+
+    ShardInfo merged = shards.front();
+    for (auto &info: shards) {
+        if (info.n_shards != merged.n_shards || info.seed != merged.seed ||
+            info.total_photons != merged.total_photons || info.n_pixel_x != merged.n_pixel_x ||
+            info.n_pixel_y != merged.n_pixel_y || info.roi_x0 != merged.roi_x0 || info.roi_y0 != merged.roi_y0 ||
+            info.n_chip_x != merged.n_chip_x || info.n_chip_y != merged.n_chip_y || info.energy != merged.energy ||
+            info.exposure_time != merged.exposure_time || info.flux_density != merged.flux_density)
+            throw std::invalid_argument("Shards do not belong to the same run.");
+        if (!same_detector(info, merged))
+            throw std::invalid_argument("Shards were simulated with different detector configurations.");
+    }
+
+    // The photon ranges must cover the frame exactly once
+    std::vector<size_t> order(shards.size());
+    for (size_t k = 0; k < order.size(); ++k)
+        order[k] = k;
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return shards[a].first_photon < shards[b].first_photon; });
+    unsigned long long next_photon = 0;
+    for (auto k: order) {
+        if (shards[k].first_photon != next_photon)
+            throw std::invalid_argument("Photon ranges of the shards are not contiguous.");
+        next_photon = shards[k].last_photon;
+    }
+    if (next_photon != merged.total_photons)
+        throw std::invalid_argument("Shards do not cover all photons of the frame.");
+
+    size_t n_pixels = static_cast<size_t>(merged.n_pixel_x) * merged.n_pixel_y;
+    counts.assign(n_pixels, 0);
+    merged.real_photons = 0;
+    for (size_t k = 0; k < shards.size(); ++k) {
+        auto image_path = std::filesystem::path(sidecars[k]).parent_path() / shards[k].image_file;
+        std::ifstream image_file(image_path, std::ios::in | std::ios::binary);
+        for (size_t index = 0; index < n_pixels; ++index) {
+            uint32_t pixel_value;
+            if (!image_file.read((char *) &pixel_value, sizeof(pixel_value)))
+                throw std::runtime_error("Image of shard " + image_path.string() + " is too short.");
+            counts[index] += pixel_value;
+        }
+        merged.real_photons += shards[k].real_photons;
+    }
+
+    merged.shard = 0;
+    merged.n_shards = 1;
+    merged.first_photon = 0;
+    merged.last_photon = merged.total_photons;
+    merged.image_file.clear();
+    return merged;
+}
@@ -0,0 +1,100 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "sweep.h"
+#include "burst.h"
+#include "helper.h"
+#include "Medipix.h"
+#include "MedipixCSM.h"
+#include "parallel.h"
+
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+std::vector<SweepPoint> SweepGrid::points(const std::shared_ptr<Medipix> &medipix) const {
+    if (flux_density.empty() || energy.empty())
+        throw std::invalid_argument("flux_density and energy of the sweep must be set.");
+    auto csm = std::dynamic_pointer_cast<MedipixCSM>(medipix);
+    if (!th1.empty() && !csm)
+        throw std::invalid_argument("th1 can only be swept for a MedipixCSM.");
+
+    auto values = [](const auto &swept, auto fixed) {
+        return swept.empty() ? std::vector<decltype(fixed)>{fixed} : swept;
+    };
+    auto th0_values = values(th0, medipix->get_th0());
+    auto th1_values = values(th1, csm ? csm->get_th1() : 0.f);
+    auto psf_sigma_values = values(psf_sigma, medipix->get_psf_sigma());
+    auto i_krum_values = values(i_krum, medipix->get_i_krum());
+
+    std::vector<SweepPoint> result;
+    for (auto t0: th0_values)
+        for (auto t1: th1_values)
+            for (auto f: flux_density)
+                for (auto s: psf_sigma_values)
+                    for (auto k: i_krum_values)
+                        for (auto e: energy)
+                            result.push_back(SweepPoint{t0, t1, f, s, k, e});
+    return result;
+}
+
+void sweep(const std::shared_ptr<Medipix> &medipix, const SweepGrid &grid, double exposure_time, std::ostream &table,
+           unsigned int seed) {
+    auto points = grid.points(medipix);
+    std::map<size_t, std::string> pending_rows;
+    size_t next_row = 0;
+
+    table << "# index th0 th1 flux_density psf_sigma i_krum energy real_photons counts" << std::endl;
+
+    SerialNestedRegions serial_nested_regions;
+#pragma omp parallel default(none) shared(medipix, points, exposure_time, table, seed, pending_rows, next_row)
+    {
+        auto replica = medipix->clone();
+        auto replica_csm = std::dynamic_pointer_cast<MedipixCSM>(replica);
+#pragma omp for schedule(dynamic, 1)
+        for (size_t index = 0; index < points.size(); ++index) {
+            const auto &point = points[index];
+            replica->set_th0(point.th0);
+            replica->set_psf_sigma(point.psf_sigma);
+            replica->set_i_krum(point.i_krum);
+            if (replica_csm)
+                replica_csm->set_th1(point.th1);
+
+            replica->start_frame();
+            homogeneous_exposure(replica, point.energy, exposure_time, point.flux_density,
+                                 frame_seed(seed, static_cast<unsigned int>(index)));
+            replica->finish_frame();
+
+            std::ostringstream row;
+            row << index << ' ' << point.th0 << ' ' << point.th1 << ' ' << point.flux_density << ' '
+                << point.psf_sigma << ' ' << point.i_krum << ' ' << point.energy << ' '
+                << replica->get_real_photons() << ' ' << replica->get_total_counts() << '\n';
+
+#pragma omp critical(sweep_table)
+            {
+                pending_rows[index] = row.str();
+                for (auto it = pending_rows.begin(); it != pending_rows.end() && it->first == next_row;
+                     it = pending_rows.erase(it)) {
+                    table << it->second;
+                    ++next_row;
+                }
+                table.flush();
+            }
+        }
+    }
+}
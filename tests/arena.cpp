@@ -0,0 +1,71 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <memory>
+#include "Arena.h"
+#include "helper.h"
+#include "MedipixSPM.h"
+
+TEST(Arena, ScopeAndReset) {
+    Arena arena(1024);
+    void *first;
+    {
+        Arena::Scope scope(arena);
+        std::pmr::vector<float> values(100, 1.f, &arena);
+        first = values.data();
+    }
+    {
+        Arena::Scope scope(arena);
+        std::pmr::vector<float> values(100, 2.f, &arena);
+        // The scope released the memory of the first vector
+        EXPECT_EQ(values.data(), first);
+    }
+    EXPECT_EQ(arena.get_capacity(), 1024);
+
+    // Larger than a block and over-aligned
+    auto p = arena.allocate(5000, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % 64, 0);
+    EXPECT_GE(arena.get_capacity(), 1024 + 5000);
+    auto capacity = arena.get_capacity();
+    arena.reset();
+    EXPECT_EQ(arena.allocate(400, 4), first);
+    EXPECT_NE(arena.allocate(5000, 64), nullptr);
+    EXPECT_EQ(arena.get_capacity(), capacity);
+
+    // Copies are empty
+    Arena copy(arena);
+    EXPECT_EQ(copy.get_capacity(), 0);
+}
+
+TEST(Arena, SteadyStateFrames) {
+    auto m = std::make_shared<MedipixSPM>(true, 32, 32);
+    m->set_th0(10.f);
+    size_t capacity = 0;
+    for (unsigned int frame = 0; frame < 3; ++frame) {
+        m->start_frame();
+        homogeneous_exposure(m, 30.f, 1E-4, 1E7, frame);
+        m->finish_frame();
+        auto spectrum = m->get_fourier_spectrum();
+        if (frame == 0)
+            capacity = m->get_arena_capacity();
+        EXPECT_GT(m->get_arena_capacity(), 0);
+        EXPECT_EQ(m->get_arena_capacity(), capacity);
+    }
+}
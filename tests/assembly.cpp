@@ -0,0 +1,84 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include "Assembly.h"
+#include "helper.h"
+#include "test_utils.h"
+
+TEST(Assembly, Geometry) {
+    auto chip = std::make_shared<MedipixSPM>(false, 8, 8);
+    Assembly assembly(chip, 2, 2, 110.f);
+    EXPECT_EQ(assembly.get_num_pixels_x(), 16);
+    EXPECT_FLOAT_EQ(assembly.get_max_x() - assembly.get_min_x(), 16 * 55.f + 110.f);
+
+    // A photon in the middle of the gap is detected by the wide edge pixel of one chip
+    auto [center_x, center_y] = assembly.get_chip_center(0, 0);
+    float gap_x = center_x + 4 * 55.f + 50.f;
+    chip->set_psf_sigma(0.1f);
+    Assembly sharp(chip, 2, 2, 110.f);
+    sharp.start_frame();
+    sharp.add_photon(30.f, gap_x, center_y + 27.5f, 3, 0.f);
+    sharp.finish_frame();
+    EXPECT_EQ(sharp.get_pixel_value(7, 4), 1);
+    EXPECT_EQ(sharp.get_total_counts(), 1);
+}
+
+TEST(Assembly, ChargeSharingAcrossChips) {
+    /**
+     * Without a gap, an assembly of two chips gives the same image as one chip of the same size.
+     */
+    auto chip = std::make_shared<MedipixSPM>(false, 8, 16);
+    chip->set_psf_sigma(15.f);
+    chip->set_th0(8.f);
+    Assembly assembly(chip, 2, 1, 0.f);
+    auto single = std::make_shared<MedipixSPM>(false, 16, 16);
+    single->set_psf_sigma(15.f);
+    single->set_th0(8.f);
+    ASSERT_FLOAT_EQ(assembly.get_min_x(), single->get_min_x());
+
+    assembly.start_frame();
+    assembly.exposure(30.f, 1E-2, 1E6, [](float, float) { return true; }, 17);
+    assembly.finish_frame();
+    single->start_frame();
+    homogeneous_exposure(single, 30.f, 1E-2, 1E6, 17);
+    single->finish_frame();
+
+    EXPECT_EQ(assembly.get_real_photons(), single->get_real_photons());
+    unsigned int differences = 0;
+    for (unsigned int i = 0; i < 16; ++i) {
+        for (unsigned int j = 0; j < 16; ++j) {
+            differences += assembly.get_pixel_value(i, j) != single->get_pixel_value(i, j);
+        }
+    }
+    // Only float rounding of the chip coordinates may flip single counts
+    EXPECT_LE(differences, 2);
+    EXPECT_NEAR(assembly.get_total_counts(), single->get_total_counts(), 2);
+    EXPECT_GT(assembly.get_pixel_value(7, 8) + assembly.get_pixel_value(8, 8), 0);
+}
+
+TEST(Assembly, SingleThreadedChips) {
+    auto max_team_size = std::make_shared<std::atomic<int>>(0);
+    auto chip = std::make_shared<TeamSizeProbe>(8, 8, max_team_size);
+    Assembly assembly(chip, 2, 2, 110.f);
+    NestedParallelism nested_parallelism;
+    assembly.start_frame();
+    assembly.finish_frame();
+    NestedParallelism::expect_inactive(*max_team_size);
+}
@@ -0,0 +1,87 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+TEST(Budget, Estimate) {
+    auto m = std::make_shared<MedipixSPM>(true, 64, 64);
+    m->set_th0(10.f);
+    auto estimate = m->estimate_frame(1E-4, 1E7);
+    EXPECT_EQ(estimate.photons, get_number_of_photons(m, 1E-4, 1E7));
+    EXPECT_GT(estimate.runtime, 0.);
+    EXPECT_GT(estimate.samples_per_pixel, 10000);
+
+    m->start_frame();
+    homogeneous_exposure(m, 30.f, 1E-4, 1E7, 42);
+    m->finish_frame();
+    // Deposits at the border of the detector are lost
+    EXPECT_NEAR(double(m->get_number_of_events()), estimate.deposits, 0.1 * estimate.deposits);
+    auto stats = m->get_memory_stats();
+    EXPECT_LE(stats.peak_bytes, estimate.peak_bytes);
+    EXPECT_GT(stats.peak_bytes, estimate.peak_bytes / 4);
+    EXPECT_EQ(stats.budget, 0);
+
+    MedipixSPM counting(false, 64, 64);
+    EXPECT_EQ(counting.estimate_frame(1E-4, 1E7).event_bytes, 0);
+}
+
+TEST(Budget, Refuse) {
+    MedipixSPM m(true, 64, 64);
+    auto estimate = m.estimate_frame(1E-4, 1E7);
+    m.set_memory_budget(estimate.peak_bytes / 2, BudgetPolicy::Refuse);
+    EXPECT_THROW(m.plan_frame(1E-4, 1E7), std::runtime_error);
+    EXPECT_NO_THROW(m.plan_frame(1E-4, 1E6));
+    EXPECT_EQ(m.get_memory_stats().policy, BudgetPolicy::Refuse);
+
+    // The pixels alone do not fit
+    m.set_memory_budget(1000, BudgetPolicy::Spill);
+    EXPECT_THROW(m.plan_frame(1E-4, 1E7), std::runtime_error);
+}
+
+TEST(Budget, Spill) {
+    auto m = std::make_shared<MedipixSPM>(true, 64, 64);
+    auto budget = std::make_shared<MedipixSPM>(true, 64, 64);
+    auto estimate = budget->estimate_frame(1E-4, 2E7);
+    budget->set_memory_budget(estimate.peak_bytes / 4, BudgetPolicy::Spill, ".");
+    auto planned = budget->plan_frame(1E-4, 2E7);
+    EXPECT_TRUE(planned.spill);
+    EXPECT_GT(planned.rows_per_tile, 0);
+    EXPECT_LE(planned.peak_bytes, estimate.peak_bytes / 4);
+
+    for (const auto &detector: {m, budget}) {
+        detector->set_th0(10.f);
+        detector->start_frame();
+        homogeneous_exposure(detector, 30.f, 1E-4, 2E7, 42);
+        detector->finish_frame();
+    }
+    auto stats = budget->get_memory_stats();
+    EXPECT_TRUE(stats.spill);
+    EXPECT_GT(stats.spilled_bytes, 0);
+    EXPECT_LE(stats.peak_bytes, stats.budget);
+    for (unsigned int i = 0; i < 64; ++i)
+        for (unsigned int j = 0; j < 64; ++j)
+            ASSERT_EQ(budget->get_pixel_value(i, j), m->get_pixel_value(i, j));
+
+    // A frame that fits removes the spill again
+    EXPECT_FALSE(budget->plan_frame(1E-4, 1E5).spill);
+    EXPECT_FALSE(budget->get_memory_stats().spill);
+}
@@ -0,0 +1,80 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include "burst.h"
+#include "helper.h"
+#include "test_utils.h"
+
+TEST(Burst, MatchesSerialFrames) {
+    /**
+     * Every frame of a burst must be identical to a serial run with the frame seed.
+     */
+    auto m = std::make_shared<MedipixSPM>(true, 8, 8);
+    m->set_th0(6.0f);
+    auto exposure = [](const std::shared_ptr<Medipix> &replica, unsigned int seed) {
+        homogeneous_exposure(replica, 30.f, 1E-3, 1E7, seed);
+    };
+    auto frames = burst(m, 6, exposure, 7);
+
+    for (unsigned int frame = 0; frame < frames.get_num_frames(); ++frame) {
+        m->start_frame();
+        exposure(m, frame_seed(7, frame));
+        m->finish_frame();
+        EXPECT_EQ(frames.get_real_photons(frame), m->get_real_photons());
+        for (unsigned int i = 0; i < 8; ++i) {
+            for (unsigned int j = 0; j < 8; ++j) {
+                EXPECT_EQ(frames.get_pixel_value(frame, i, j), m->get_pixel_value(i, j));
+            }
+        }
+    }
+}
+
+TEST(Burst, IndependentFrames) {
+    /**
+     * Frames use independent random streams, bursts with the same seed are reproducible.
+     */
+    auto m = std::make_shared<MedipixSPM>(false, 16, 16);
+    auto exposure = [](const std::shared_ptr<Medipix> &replica, unsigned int seed) {
+        homogeneous_exposure(replica, 30.f, 1E-2, 1E6, seed);
+    };
+    auto frames = burst(m, 2, exposure, 3);
+    auto frames_repeated = burst(m, 2, exposure, 3);
+
+    EXPECT_GT(frames.get_total_counts(0), 0);
+    bool identical = true;
+    for (unsigned int i = 0; i < 16; ++i) {
+        for (unsigned int j = 0; j < 16; ++j) {
+            identical &= frames.get_pixel_value(0, i, j) == frames.get_pixel_value(1, i, j);
+            EXPECT_EQ(frames.get_pixel_value(1, i, j), frames_repeated.get_pixel_value(1, i, j));
+        }
+    }
+    EXPECT_FALSE(identical);
+}
+
+TEST(Burst, SingleThreadedFrames) {
+    auto max_team_size = std::make_shared<std::atomic<int>>(0);
+    auto m = std::make_shared<TeamSizeProbe>(8, 8, max_team_size);
+    NestedParallelism nested_parallelism;
+    (void) burst(m, 4, [](const std::shared_ptr<Medipix> &replica, unsigned int seed) {
+        homogeneous_exposure(replica, 30.f, 1E-3, 1E6, seed);
+    }, 1);
+    NestedParallelism::expect_inactive(*max_team_size);
+}
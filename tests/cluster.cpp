@@ -0,0 +1,97 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "cluster.h"
+
+namespace {
+    std::vector<Hit> acquire(MedipixTimepix &m, const std::vector<std::pair<float, float>> &positions, float time) {
+        std::vector<Hit> hits;
+        m.start_acquisition([&hits](const Hit *h, size_t n) { hits.insert(hits.end(), h, h + n); });
+        m.begin_window(100.f);
+        for (auto [x, y]: positions)
+            m.add_photon(30.f, x, y, 3, time);
+        m.end_window();
+        m.finish_acquisition();
+        return hits;
+    }
+}
+
+TEST(Cluster, CalibratedEnergy) {
+    MedipixTimepix m(8, 8);
+    m.set_psf_sigma(1.0f);
+    m.set_th0(6.0f);
+    auto hits = acquire(m, {m.get_pixel_center(4, 4)}, 10.f);
+    ASSERT_EQ(hits.size(), 1);
+    EXPECT_NEAR(m.get_hit_energy(hits[0]), 30.f, 1.f);
+}
+
+TEST(Cluster, ChargeSharing) {
+    MedipixTimepix m(8, 8);
+    m.set_psf_sigma(10.0f);
+    m.set_th0(3.0f);
+    auto [x, y] = m.get_pixel_center(3, 4);
+    x += 0.5f * m.get_pixel_pitch();
+    auto hits = acquire(m, {{x, y}}, 10.f);
+    ASSERT_EQ(hits.size(), 2);
+
+    auto clusters = cluster_hits(m, hits);
+    ASSERT_EQ(clusters.size(), 1);
+    EXPECT_EQ(clusters[0].size, 2);
+    EXPECT_NEAR(clusters[0].energy, 30.f, 2.f);
+    EXPECT_NEAR(clusters[0].x, x, 1.f);
+    EXPECT_NEAR(clusters[0].y, y, 1.f);
+    // Single pixel hits have only a fraction of the energy
+    EXPECT_LT(m.get_hit_energy(hits[0]), 20.f);
+
+    // Separated in space
+    auto [x2, y2] = m.get_pixel_center(0, 0);
+    EXPECT_EQ(cluster_hits(m, acquire(m, {{x, y}, {x2, y2}}, 10.f)).size(), 2);
+
+    // Without threshold the hits have no energy, the centroid is the mean of the pixel centers
+    m.set_th0(0.f);
+    clusters = cluster_hits(m, hits);
+    ASSERT_EQ(clusters.size(), 1);
+    EXPECT_EQ(clusters[0].energy, 0.f);
+    EXPECT_NEAR(clusters[0].x, x, 1.f);
+    EXPECT_NEAR(clusters[0].y, y, 1.f);
+}
+
+TEST(Cluster, TileIndependent) {
+    auto m = std::make_shared<MedipixTimepix>(48, 32);
+    m->set_psf_sigma(12.0f);
+    m->set_th0(4.0f);
+    std::vector<Hit> hits;
+    timepix_acquisition(m, 30.f, 2E-4, 50E-6, 2E7, HomogeneousPattern{}, 42,
+                        [&hits](const Hit *h, size_t n) { hits.insert(hits.end(), h, h + n); });
+    ASSERT_GT(hits.size(), 1000);
+
+    auto reference = cluster_hits(*m, hits, 0.5, 48);
+    EXPECT_LT(reference.size(), hits.size());
+    for (unsigned int tile_rows: {1u, 5u, 16u}) {
+        auto clusters = cluster_hits(*m, hits, 0.5, tile_rows);
+        ASSERT_EQ(clusters.size(), reference.size());
+        for (size_t k = 0; k < clusters.size(); ++k) {
+            EXPECT_EQ(clusters[k].size, reference[k].size);
+            EXPECT_EQ(clusters[k].toa, reference[k].toa);
+            EXPECT_FLOAT_EQ(clusters[k].x, reference[k].x);
+        }
+    }
+}
@@ -0,0 +1,135 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include "helper.h"
+#include "test_utils.h"
+
+/**
+ * Silicon at 30 keV
+ */
+static DepthOfInteraction silicon() {
+    DepthOfInteraction model{};
+    model.mu_norm = 1.436f;
+    model.rho = 2.33f;
+    model.thickness = 300.f;
+    model.bias_voltage = 100.f;
+    return model;
+}
+
+TEST(DepthOfInteraction, DepthDistribution) {
+    auto model = silicon();
+    auto m = std::make_shared<MedipixSPM>(false, 16, 16);
+    m->set_depth_of_interaction(model);
+    float mu = model.mu_norm * model.rho * 1E-4f;
+    double d = model.thickness;
+    // Mean of the exponential distribution truncated to [0, d]
+    double expected_mean = 1. / mu - d * std::exp(-mu * d) / (1. - std::exp(-mu * d));
+
+    double mean = 0.;
+    double mean_helper = 0.;
+    unsigned int n = 200000;
+    for (unsigned int k = 0; k < n; ++k) {
+        RandomStream rng(3, k);
+        float depth = m->draw_interaction_depth(30.f, rng);
+        ASSERT_GE(depth, 0.f);
+        ASSERT_LE(depth, model.thickness);
+        mean += depth / n;
+        RandomStream rng_helper(4, k);
+        mean_helper += get_random_free_path(model.mu_norm, model.rho, model.thickness, rng_helper) / n;
+    }
+    EXPECT_NEAR(mean, expected_mean, 0.5);
+    EXPECT_NEAR(mean_helper, expected_mean, 0.5);
+}
+
+TEST(DepthOfInteraction, SigmaFollowsDriftAndBias) {
+    auto model = silicon();
+    auto m = std::make_shared<MedipixSPM>(false, 16, 16);
+    EXPECT_FLOAT_EQ(m->get_depth_sigma(0.f), m->get_psf_sigma());
+    m->set_depth_of_interaction(model);
+    // Photons interacting at the entrance drift through the whole sensor
+    EXPECT_GT(m->get_depth_sigma(1.f), m->get_depth_sigma(150.f));
+    EXPECT_GT(m->get_depth_sigma(150.f), m->get_depth_sigma(299.f));
+    EXPECT_NEAR(m->get_depth_sigma(299.f), model.initial_sigma, 0.5f);
+    float low_bias = m->get_depth_sigma(1.f);
+    model.bias_voltage = 400.f;
+    m->set_depth_of_interaction(model);
+    EXPECT_NEAR(m->get_depth_sigma(1.f) / low_bias, std::sqrt((25.f + (low_bias * low_bias - 25.f) / 4.f)) / low_bias,
+                1E-3);
+    EXPECT_THROW(m->set_depth_of_interaction(DepthOfInteraction{0.f, 2.33f}), std::invalid_argument);
+}
+
+TEST(DepthOfInteraction, TabulatedChargeSharing) {
+    auto model = silicon();
+    MedipixTest<MedipixSPM> m(false, 16, 16);
+    m.set_depth_of_interaction(model);
+    auto [center_x, center_y] = m.get_pixel_center(8, 8);
+    for (float depth: {2.f, 100.f, 290.f}) {
+        float sigma = m.get_depth_sigma(depth);
+        m.set_psf_sigma(sigma);
+        for (float dx: {0.f, 13.f, 27.f, 40.f, -61.f}) {
+            for (float dy: {0.f, -20.f, 30.f}) {
+                float tabulated = m.calculate_pixel_energy(center_x + dx, center_y + dy, 30.f, 8, 8, depth);
+                float direct = m.calculate_pixel_energy(center_x + dx, center_y + dy, 30.f, 8, 8, -1.f);
+                EXPECT_NEAR(tabulated, direct, 1E-3f);
+            }
+        }
+    }
+}
+
+TEST(DepthOfInteraction, TabulatedOuterRing) {
+    /**
+     * A broad charge cloud reaches the outer ring of the largest kernel radius, up to half a pixel beyond it.
+     */
+    auto model = silicon();
+    model.initial_sigma = 100.f;
+    MedipixTest<MedipixSPM> m(false, 16, 16);
+    m.set_depth_of_interaction(model);
+    auto [center_x, center_y] = m.get_pixel_center(8, 8);
+    float depth = 150.f;
+    m.set_psf_sigma(m.get_depth_sigma(depth));
+    float dx = (float(Medipix::max_kernel_radius) + 0.45f) * m.get_pixel_pitch();
+    float tabulated = m.calculate_pixel_energy(center_x + dx, center_y, 30.f, 8, 8, depth);
+    float direct = m.calculate_pixel_energy(center_x + dx, center_y, 30.f, 8, 8, -1.f);
+    EXPECT_GT(direct, 0.01f);
+    EXPECT_NEAR(tabulated, direct, 1E-3f);
+}
+
+TEST(DepthOfInteraction, Exposure) {
+    auto model = silicon();
+    std::shared_ptr<Medipix> m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(10.f);
+    m->set_psf_sigma(5.f);
+    auto fixed = m->clone();
+    m->set_depth_of_interaction(model);
+    auto replica = m->clone();
+    EXPECT_TRUE(replica->has_depth_of_interaction());
+
+    for (const auto &d: {m, replica, fixed}) {
+        d->start_frame();
+        exposure(d, 30.f, 1E-2, 1E6, HomogeneousPattern{}, 5);
+        d->finish_frame();
+    }
+    EXPECT_EQ(m->get_image(), replica->get_image());
+    // The wider charge clouds of the photons interacting far from the pixels are shared more often
+    EXPECT_GT(m->get_total_counts(), fixed->get_total_counts());
+    EXPECT_THROW((void) std::dynamic_pointer_cast<MedipixSPM>(m)->expected_image(30.f, 1E-3, 1E6, HomogeneousPattern{}),
+                 std::logic_error);
+}
@@ -0,0 +1,311 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include "helper.h"
+#include "EventStore.h"
+#include "MedipixSPM.h"
+#include "MedipixTimepix.h"
+
+TEST(EventStore, CompressedLayout) {
+    EventStore store;
+    #pragma omp parallel for default(none) shared(store)
+    for (int k = 0; k < 1000; ++k)
+        store.add(uint32_t(7 * (k % 10)), Event{float(1000 - k), 1.f});
+    store.finalize();
+
+    std::vector<Event> buffer;
+    EXPECT_EQ(store.size(), 1000);
+    ASSERT_EQ(store.get_number_of_active_pixels(), 10);
+    for (size_t k = 0; k < store.get_number_of_active_pixels(); ++k) {
+        EXPECT_EQ(store.get_active_pixel(k), 7 * k);
+        auto events = store.get_events(k, buffer);
+        ASSERT_EQ(events.size(), 100);
+        for (size_t e = 1; e < events.size(); ++e)
+            EXPECT_LT(events[e - 1].get_time(), events[e].get_time());
+    }
+    EXPECT_EQ(store.find(14, buffer).size(), 100);
+    EXPECT_TRUE(store.find(15, buffer).empty());
+
+    // Events added after finalize() are merged
+    store.add(15, Event{0.f, 1.f});
+    store.finalize();
+    EXPECT_EQ(store.get_number_of_active_pixels(), 11);
+    EXPECT_EQ(store.find(15, buffer).size(), 1);
+
+    store.clear();
+    EXPECT_EQ(store.size(), 0);
+    EXPECT_EQ(store.get_number_of_active_pixels(), 0);
+}
+
+TEST(EventStore, VarintIndex) {
+    /**
+     * Active pixels across several checkpoints, with distances of one to three varint bytes.
+     */
+    for (bool compact: {false, true}) {
+        EventStore store;
+        store.set_compact(compact, 100);
+        const uint32_t n_active = 1000;
+        for (uint32_t k = 0; k < n_active; ++k) {
+            for (uint32_t e = 0; e <= k % 5; ++e)
+                store.add(2 * k * k + 1, Event{double(e), 1.f});
+        }
+        store.finalize();
+
+        std::vector<Event> buffer;
+        ASSERT_EQ(store.get_number_of_active_pixels(), n_active);
+        for (uint32_t k = 0; k < n_active; ++k) {
+            EXPECT_EQ(store.get_active_pixel(k), 2 * k * k + 1);
+            EXPECT_EQ(store.get_events(k, buffer).size(), k % 5 + 1);
+            EXPECT_EQ(store.find_first_active(2 * k * k), k);
+            EXPECT_EQ(store.find_first_active(2 * k * k + 1), k);
+            EXPECT_EQ(store.find_first_active(2 * k * k + 2), k + 1);
+        }
+        EXPECT_EQ(store.find(2 * 998 * 998 + 1, buffer).size(), 998 % 5 + 1);
+        EXPECT_TRUE(store.find(2 * 998 * 998 + 2, buffer).empty());
+        EXPECT_LT(store.get_memory_usage(), store.size() * store.get_stored_event_bytes() + 4 * n_active);
+    }
+}
+
+TEST(EventStore, LargeSparseDetector) {
+    MedipixSPM m(true, 2048, 2048);
+    m.set_psf_sigma(1.0f);
+    m.set_th0(6.0f);
+    m.start_frame();
+    for (unsigned int k = 0; k < 100; ++k) {
+        auto [x, y] = m.get_pixel_center(20 * k, 2047 - 20 * k);
+        m.add_photon(30.f, x, y, 3, 10.f * float(k));
+    }
+    // Pile-up in one pixel
+    auto [x, y] = m.get_pixel_center(1000, 1000);
+    m.add_photon(30.f, x, y, 3, 500.f);
+    m.add_photon(30.f, x, y, 3, 500.2f);
+    m.finish_frame();
+    EXPECT_EQ(m.get_total_counts(), 101);
+    EXPECT_EQ(m.get_pixel_value(1000, 1000), 1);
+    EXPECT_EQ(m.get_pixel_value(20, 2027), 1);
+}
+
+TEST(EventStore, CompactEncoding) {
+    EventStore store;
+    store.set_compact(true, 100);
+    store.add(3, Event{12.3456f, 29.99f});
+    store.add(3, Event{-0.015f, 0.5f});
+    // Zero after quantization
+    store.add(4, Event{1.f, 0.001f});
+    store.finalize();
+
+    std::vector<Event> buffer;
+    auto events = store.find(3, buffer);
+    ASSERT_EQ(events.size(), 2);
+    // Time of the center of the tick, the signal starts at the same sample
+    EXPECT_EQ(int(std::floor(events[0].get_time() * 100.f)), -2);
+    EXPECT_EQ(int(std::floor(events[1].get_time() * 100.f)), 1234);
+    EXPECT_NEAR(events[1].energy, 29.99f, EventStore::energy_step / 2.f);
+    EXPECT_EQ(store.get_number_of_active_pixels(), 1);
+    // Two events, the varint distance and event count of the pixel and one checkpoint
+    EXPECT_EQ(store.get_memory_usage(), 2 * 6 + 2 + 12);
+}
+
+TEST(EventStore, CompactBuckets) {
+    /**
+     * The compact thread buffers keep the lower 16 bits of the pixel index per event, the bucket adds the rest.
+     */
+    EventStore store;
+    store.set_compact(true, 100);
+    EXPECT_EQ(store.get_buffered_event_bytes(), 8);
+    std::vector<uint32_t> pixels = {3, 65535, 65536, 65539, 4000000};
+    #pragma omp parallel for default(none) shared(store, pixels)
+    for (int k = 0; k < 100; ++k)
+        store.add(pixels[k % pixels.size()], Event{double(k), 1.f});
+    store.finalize();
+
+    std::vector<Event> buffer;
+    ASSERT_EQ(store.get_number_of_active_pixels(), pixels.size());
+    for (size_t k = 0; k < pixels.size(); ++k) {
+        EXPECT_EQ(store.get_active_pixel(k), pixels[k]);
+        EXPECT_EQ(store.get_events(k, buffer).size(), 20);
+    }
+}
+
+TEST(EventStore, LongFrameTicks) {
+    /**
+     * In a frame of one second the 10 ns ticks are still resolved (a float time in µs has steps of 0.0625 µs there).
+     */
+    for (bool compact: {false, true}) {
+        EventStore store;
+        store.set_compact(compact, 100);
+        store.add(3, Event{1E6 + 0.045, 1.f});
+        store.add(3, Event{1E6 + 0.015, 1.f});
+        store.finalize();
+
+        std::vector<Event> buffer;
+        auto events = store.find(3, buffer);
+        ASSERT_EQ(events.size(), 2);
+        EXPECT_EQ(static_cast<long>(std::floor(events[0].get_time() * 100.)), 100000001);
+        EXPECT_EQ(static_cast<long>(std::floor(events[1].get_time() * 100.)), 100000004);
+    }
+}
+
+TEST(EventStore, LongExposure) {
+    /**
+     * The times of the uncompressed events are not limited, the compact encoding is checked before the exposure.
+     */
+    EventStore store;
+    store.add(3, Event{3E6 + 0.5, 1.f});
+    store.finalize();
+    std::vector<Event> buffer;
+    ASSERT_EQ(store.find(3, buffer).size(), 1);
+    EXPECT_EQ(store.find(3, buffer)[0].get_time(), 3E6 + 0.5);
+
+    // A few photons, far apart on the detector, within 3 s
+    auto m = std::make_shared<MedipixSPM>(true, 256, 256);
+    m->set_th0(10.f);
+    m->start_frame();
+    homogeneous_exposure(m, 30.f, 3., 0.02, 42);
+    m->finish_frame();
+    EXPECT_GT(m->get_total_counts(), 0);
+
+    auto compact = std::make_shared<MedipixSPM>(true, 16, 16);
+    compact->set_compact_events(true);
+    compact->start_frame();
+    EXPECT_THROW(homogeneous_exposure(compact, 30.f, 30., 1E3, 42), std::out_of_range);
+    compact->finish_frame();
+}
+
+TEST(EventStore, LongTimedFrame) {
+    /**
+     * Beyond 2^31 samples (21.4 s at 100 samples per µs) the signal of a pixel still starts at the sample of its
+     * events.
+     */
+    MedipixSPM m(true, 4, 4);
+    m.set_psf_sigma(1.0f);
+    m.set_th0(6.0f);
+    EXPECT_NO_THROW(m.check_exposure_duration(3E7));
+    auto [x0, y0] = m.get_pixel_center(0, 0);
+    auto [x1, y1] = m.get_pixel_center(3, 3);
+    m.start_frame();
+    m.add_photon(30.f, x0, y0, 1, 5.);
+    m.add_photon(30.f, x1, y1, 1, 3E7);
+    m.finish_frame();
+    EXPECT_EQ(m.get_pixel_value(0, 0), 1);
+    EXPECT_EQ(m.get_pixel_value(3, 3), 1);
+}
+
+TEST(EventStore, CompactMatchesFloat) {
+    auto m = std::make_shared<MedipixSPM>(true, 32, 32);
+    m->set_th0(10.f);
+    auto compact = std::make_shared<MedipixSPM>(true, 32, 32);
+    compact->set_th0(10.f);
+    compact->set_compact_events(true);
+    EXPECT_TRUE(compact->get_compact_events());
+
+    for (const auto &detector: {m, compact}) {
+        detector->start_frame();
+        homogeneous_exposure(detector, 30.f, 2E-4, 2E7, 42);
+        detector->finish_frame();
+    }
+    EXPECT_GT(m->get_total_counts(), 1000);
+    EXPECT_NEAR(compact->get_total_counts(), m->get_total_counts(), 0.002 * m->get_total_counts());
+}
+
+TEST(EventStore, SpillTiles) {
+    for (bool compact: {false, true}) {
+        EventStore store;
+        store.set_compact(compact, 100);
+        store.set_spill(256, ".", 10, 100);
+        #pragma omp parallel for default(none) shared(store)
+        for (int k = 0; k < 1000; ++k)
+            store.add(uint32_t(k % 100), Event{float(1000 - k), 1.f});
+        store.finalize();
+        // Packed records: 10 bytes (pixel, tick, energy) or 16 bytes (pixel, time, energy)
+        EXPECT_EQ(store.get_spilled_bytes(), 1000 * (compact ? 10 : 16));
+        ASSERT_EQ(store.get_number_of_tiles(), 10);
+
+        std::vector<Event> buffer;
+        size_t n_events = 0;
+        for (size_t tile = 0; tile < store.get_number_of_tiles(); ++tile) {
+            store.load_tile(tile);
+            EXPECT_EQ(store.get_number_of_active_pixels(), 10);
+            for (size_t k = 0; k < store.get_number_of_active_pixels(); ++k) {
+                EXPECT_EQ(store.get_tile(store.get_active_pixel(k)), tile);
+                auto events = store.get_events(k, buffer);
+                for (size_t e = 1; e < events.size(); ++e)
+                    EXPECT_LT(events[e - 1].get_time(), events[e].get_time());
+            }
+            n_events += store.size();
+        }
+        EXPECT_EQ(n_events, 1000);
+        store.load_tile(store.get_tile(42));
+        EXPECT_EQ(store.find(42, buffer).size(), 10);
+
+        store.clear();
+        EXPECT_EQ(store.get_spilled_bytes(), 0);
+        EXPECT_EQ(store.get_number_of_tiles(), 1);
+    }
+}
+
+TEST(EventStore, SpillMatchesInMemory) {
+    for (bool compact: {false, true}) {
+        auto m = std::make_shared<MedipixSPM>(true, 32, 32);
+        auto spilled = std::make_shared<MedipixSPM>(true, 32, 32);
+        spilled->set_event_spill(4096, ".", 5);
+        for (const auto &detector: {m, spilled}) {
+            detector->set_th0(10.f);
+            detector->set_compact_events(compact);
+            detector->start_frame();
+            homogeneous_exposure(detector, 30.f, 2E-4, 2E7, 42);
+            detector->finish_frame();
+        }
+        EXPECT_GT(spilled->get_spilled_bytes(), 0);
+        EXPECT_EQ(m->get_spilled_bytes(), 0);
+        EXPECT_GT(m->get_total_counts(), 1000);
+        for (unsigned int i = 0; i < 32; ++i)
+            for (unsigned int j = 0; j < 32; ++j)
+                ASSERT_EQ(spilled->get_pixel_value(i, j), m->get_pixel_value(i, j));
+
+        auto windows = frame_windows(4, 50.);
+        auto frames = m->rebin(windows);
+        auto spilled_frames = spilled->rebin(windows);
+        for (unsigned int w = 0; w < windows.size(); ++w)
+            for (unsigned int p = 0; p < 32 * 32; ++p)
+                ASSERT_EQ(spilled_frames.get_frame(w)[p], frames.get_frame(w)[p]);
+    }
+}
+
+TEST(EventStore, SpillTimepix) {
+    auto m = std::make_shared<MedipixTimepix>(32, 32);
+    auto spilled = std::make_shared<MedipixTimepix>(32, 32);
+    spilled->set_event_spill(1024, ".", 4);
+    std::vector<Hit> hits, spilled_hits;
+    for (auto [detector, output]: {std::pair{m, &hits}, std::pair{spilled, &spilled_hits}}) {
+        detector->set_th0(10.0f);
+        timepix_acquisition(detector, 20.f, 5E-4, 50E-6, 1E7, HomogeneousPattern{}, 42,
+                            [output](const Hit *h, size_t n) { output->insert(output->end(), h, h + n); });
+    }
+    EXPECT_GT(hits.size(), 500);
+    ASSERT_EQ(spilled_hits.size(), hits.size());
+    for (size_t k = 0; k < hits.size(); ++k) {
+        ASSERT_EQ(spilled_hits[k].toa, hits[k].toa);
+        ASSERT_EQ(spilled_hits[k].pixel, hits[k].pixel);
+        ASSERT_EQ(spilled_hits[k].tot, hits[k].tot);
+    }
+}
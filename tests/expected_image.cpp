@@ -0,0 +1,114 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Mean count image of n_frames Monte Carlo frames
+ */
+template<typename Pattern>
+static std::vector<double> monte_carlo_mean(const std::shared_ptr<MedipixSPM> &m, double exposure_time,
+                                            double flux_density, const Pattern &pattern, unsigned int n_frames) {
+    std::vector<double> mean(m->get_image().size(), 0.);
+    for (unsigned int frame = 0; frame < n_frames; ++frame) {
+        m->start_frame();
+        exposure(m, 30.f, exposure_time, flux_density, pattern, 100 + frame);
+        m->finish_frame();
+        for (size_t k = 0; k < mean.size(); ++k)
+            mean[k] += double(m->get_image()[k]) / n_frames;
+    }
+    return mean;
+}
+
+/**
+ * Compares the sums over the columns of the expected image and the Monte Carlo mean
+ */
+static void expect_columns_match(const std::vector<double> &expected, const std::vector<double> &mean,
+                                 unsigned int nx, unsigned int ny, unsigned int n_frames) {
+    for (unsigned int i = 0; i < nx; ++i) {
+        double expected_column = std::accumulate(expected.begin() + i * ny, expected.begin() + (i + 1) * ny, 0.);
+        double mean_column = std::accumulate(mean.begin() + i * ny, mean.begin() + (i + 1) * ny, 0.);
+        EXPECT_NEAR(mean_column, expected_column, 5. * std::sqrt(expected_column / n_frames) + 0.02 * expected_column)
+                            << "column " << i;
+    }
+}
+
+TEST(ExpectedImage, FlatField) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(10.f);
+    auto expected = m->expected_image(30.f, 1E-2, 1E6, HomogeneousPattern{});
+    auto mean = monte_carlo_mean(m, 1E-2, 1E6, HomogeneousPattern{}, 4);
+    expect_columns_match(expected, mean, 32, 32, 4);
+}
+
+TEST(ExpectedImage, EdgeWithThresholdDispersion) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(8.f);
+    m->random_threshold_dispersion(1.5f, 3);
+    EdgePattern pattern{0.f, 100.f};
+    auto expected = m->expected_image(30.f, 1E-2, 1E6, pattern, 8);
+    auto mean = monte_carlo_mean(m, 1E-2, 1E6, pattern, 4);
+    expect_columns_match(expected, mean, 32, 32, 4);
+
+    // Rows in the shadow of the edge
+    for (unsigned int i = 0; i < 32; ++i)
+        EXPECT_NEAR(expected[i * 32], 0., 1E-6);
+}
+
+TEST(ExpectedImage, RegionOfInterest) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(8.f);
+    m->random_threshold_dispersion(1.5f, 3);
+    auto full = m->expected_image(30.f, 1E-2, 1E6, HomogeneousPattern{});
+    m->set_region_of_interest(4, 6, 10, 8);
+    auto roi = m->expected_image(30.f, 1E-2, 1E6, HomogeneousPattern{});
+    ASSERT_EQ(roi.size(), 10 * 8);
+    for (unsigned int i = 0; i < 10; ++i)
+        for (unsigned int j = 0; j < 8; ++j)
+            // The threshold bins cover only the region of interest, so the interpolation differs slightly
+            EXPECT_NEAR(roi[i * 8 + j], full[(i + 4) * 32 + j + 6], 0.01 * full[(i + 4) * 32 + j + 6]);
+}
+
+TEST(ExpectedImage, TimedNotSupported) {
+    auto m = std::make_shared<MedipixSPM>(true, 16, 16);
+    EXPECT_THROW((void) m->expected_image(30.f, 1E-3, 1E6, HomogeneousPattern{}), std::logic_error);
+}
+
+TEST(ExpectedImage, Sampling) {
+    std::vector<double> expected(10000, 25.);
+    auto poisson = MedipixSPM::sample_image(expected, 3);
+    auto binomial = MedipixSPM::sample_image(expected, 3, 50);
+    double mean_poisson = std::accumulate(poisson.begin(), poisson.end(), 0.) / double(expected.size());
+    double mean_binomial = std::accumulate(binomial.begin(), binomial.end(), 0.) / double(expected.size());
+    double variance_poisson = 0.;
+    double variance_binomial = 0.;
+    for (size_t k = 0; k < expected.size(); ++k) {
+        variance_poisson += std::pow(poisson[k] - mean_poisson, 2) / double(expected.size());
+        variance_binomial += std::pow(binomial[k] - mean_binomial, 2) / double(expected.size());
+    }
+    EXPECT_NEAR(mean_poisson, 25., 0.25);
+    EXPECT_NEAR(mean_binomial, 25., 0.25);
+    EXPECT_NEAR(variance_poisson, 25., 1.5);
+    EXPECT_NEAR(variance_binomial, 12.5, 1.);
+    EXPECT_EQ(poisson, MedipixSPM::sample_image(expected, 3));
+}
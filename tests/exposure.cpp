@@ -0,0 +1,78 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+/**
+ * Exposes two replicas of the detector and compares the images pixel by pixel.
+ */
+template<typename ExposureA, typename ExposureB>
+static void expect_same_image(const std::shared_ptr<Medipix> &m, ExposureA a, ExposureB b) {
+    auto replica = m->clone();
+    m->start_frame();
+    a(m);
+    m->finish_frame();
+    replica->start_frame();
+    b(replica);
+    replica->finish_frame();
+    EXPECT_GT(m->get_total_counts(), 0);
+    EXPECT_EQ(m->get_image(), replica->get_image());
+}
+
+TEST(Exposure, PatternMatchesFunction) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(6.f);
+    expect_same_image(m, [](const std::shared_ptr<Medipix> &d) {
+        exposure(d, 30.f, 1E-2, 1E6, EdgePattern{-0.5f, 20.f}, 5);
+    }, [](const std::shared_ptr<Medipix> &d) {
+        std::function<bool(float, float)> f = [](float x, float y) { return edge(x, y, -0.5f, 20.f); };
+        exposure(d, 30.f, 1E-2, 1E6, f, 5);
+    });
+}
+
+TEST(Exposure, FrequencyIsDeterministic) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(6.f);
+    auto frequency_run = [](const std::shared_ptr<Medipix> &d) {
+        frequency_exposure(d, 30.f, 1E-2, 330.f, 0.f, 1.f, 0.f, 1E6, 5);
+    };
+    expect_same_image(m, frequency_run, frequency_run);
+}
+
+TEST(Exposure, FrequencyTransmission) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(6.f);
+    m->start_frame();
+    // Period of the whole sensor: the upper half of the sin-wave transmits, the lower half is absorbed
+    float period = m->get_max_x() - m->get_min_x();
+    float phase = -2.f * std::numbers::pi_v<float> * m->get_min_x() / period;
+    frequency_exposure(m, 30.f, 1E-2, period, phase, 1.f, 0.f, 1E6, 5);
+    m->finish_frame();
+
+    unsigned int first_half = 0;
+    unsigned int second_half = 0;
+    for (unsigned int i = 0; i < 32; ++i)
+        for (unsigned int j = 0; j < 32; ++j)
+            (i < 16 ? first_half : second_half) += m->get_pixel_value(i, j);
+    EXPECT_GT(first_half, 0);
+    EXPECT_LT(second_half, first_half / 20);
+    EXPECT_FLOAT_EQ(frequency_transmission(period / 4.f, 0.f, period, 0.f, 1.f, 0.f), 1.f);
+}
@@ -0,0 +1,101 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "helper.h"
+#include "MedipixCSM.h"
+#include "MedipixSPM.h"
+#include "MedipixTimepix.h"
+#include "RandomStream.h"
+
+namespace {
+    /**
+     * Adds the same photons in batches of 256 and returns the image (counting) or the counts after finish_frame()
+     */
+    std::vector<unsigned int> deposit(Medipix &m, int radius, unsigned int n_photons) {
+        constexpr unsigned int batch_size = 256;
+        m.set_psf_sigma(20.f);
+        m.start_frame();
+        for (unsigned int first = 0; first < n_photons; first += batch_size) {
+            float energy[batch_size], x[batch_size], y[batch_size], depth[batch_size];
+            double t[batch_size];
+            bool interacting[batch_size];
+            for (unsigned int k = 0; k < batch_size; ++k) {
+                RandomStream rng(7, first + k);
+                energy[k] = rng.uniform(15.f, 40.f);
+                x[k] = rng.uniform(m.get_min_x(), m.get_max_x());
+                y[k] = rng.uniform(m.get_min_y(), m.get_max_y());
+                depth[k] = -1.f;
+                t[k] = rng.uniform(0.f, 5000.f);
+                interacting[k] = rng.uniform() < 0.9f;
+            }
+            m.add_photons(PhotonBatch{energy, x, y, depth, t, interacting, batch_size, radius});
+        }
+        m.finish_frame();
+        return m.get_image();
+    }
+}
+
+TEST(Kernels, MatchGenericPath) {
+    for (bool timed: {false, true}) {
+        for (int radius = 1; radius <= Medipix::max_kernel_radius + 1; ++radius) {
+            std::vector<std::shared_ptr<Medipix>> detectors = {std::make_shared<MedipixSPM>(timed, 16, 16),
+                                                               std::make_shared<MedipixCSM>(timed, 16, 16)};
+            for (const auto &specialized: detectors) {
+                auto generic = specialized->clone();
+                generic->set_specialized_kernels(false);
+                EXPECT_FALSE(generic->get_specialized_kernels());
+                for (const auto &m: {specialized, generic}) {
+                    m->set_th0(8.f);
+                    m->set_edge_extension(10.f, 0.f, 20.f, 5.f);
+                    m->set_region_of_interest(2, 0, 12, 16);
+                    m->random_threshold_dispersion(1.f, 3);
+                }
+                auto image = deposit(*specialized, radius, 3000);
+                EXPECT_EQ(image, deposit(*generic, radius, 3000)) << "timed " << timed << " radius " << radius;
+                EXPECT_EQ(specialized->get_real_photons(), generic->get_real_photons());
+                EXPECT_EQ(specialized->get_number_of_events(), generic->get_number_of_events());
+                // The timed charge summing mode only keeps the events
+                if (!timed || specialized == detectors[0])
+                    EXPECT_GT(specialized->get_total_counts(), 100);
+                else
+                    EXPECT_GT(specialized->get_number_of_events(), 1000);
+            }
+        }
+    }
+}
+
+TEST(Kernels, TimepixMatchesGenericPath) {
+    auto specialized = std::make_shared<MedipixTimepix>(32, 32);
+    auto generic = std::make_shared<MedipixTimepix>(32, 32);
+    generic->set_specialized_kernels(false);
+    std::vector<Hit> hits, generic_hits;
+    for (auto [detector, output]: {std::pair{specialized, &hits}, std::pair{generic, &generic_hits}}) {
+        detector->set_th0(10.0f);
+        timepix_acquisition(detector, 20.f, 2E-4, 50E-6, 1E7, HomogeneousPattern{}, 42,
+                            [output](const Hit *h, size_t n) { output->insert(output->end(), h, h + n); });
+    }
+    EXPECT_GT(hits.size(), 100);
+    ASSERT_EQ(hits.size(), generic_hits.size());
+    for (size_t k = 0; k < hits.size(); ++k) {
+        ASSERT_EQ(hits[k].toa, generic_hits[k].toa);
+        ASSERT_EQ(hits[k].tot, generic_hits[k].tot);
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include "helper.h"
+#include "Material.h"
+#include "MedipixSPM.h"
+
+TEST(Material, InterpolatesTable) {
+    auto si = Material::silicon();
+    EXPECT_NEAR(si.mass_attenuation(30.f), 1.436f, 0.01f);
+    EXPECT_NEAR(si.mass_attenuation(10.f), 33.89f, 0.2f);
+    // Log-log interpolation between 20 and 30 keV
+    float expected = std::exp(std::log(4.464f) + (std::log(25.f) - std::log(20.f)) / (std::log(30.f) - std::log(20.f)) *
+                                                 (std::log(1.436f) - std::log(4.464f)));
+    EXPECT_NEAR(si.mass_attenuation(25.f), expected, 0.01f * expected);
+    // Clamped outside of the table
+    EXPECT_NEAR(si.mass_attenuation(500.f), si.mass_attenuation(200.f), 1E-3f);
+    EXPECT_NEAR(si.linear_attenuation(30.f), 1.436f * 2.33f * 1E-4f, 1E-6f);
+}
+
+TEST(Material, AbsorptionEdges) {
+    auto cdte = Material::cadmium_telluride();
+    EXPECT_GT(cdte.mass_attenuation(26.8f), 3.f * cdte.mass_attenuation(26.6f));
+    EXPECT_GT(cdte.mass_attenuation(31.9f), 1.5f * cdte.mass_attenuation(31.7f));
+    auto gaas = Material::gallium_arsenide();
+    EXPECT_GT(gaas.mass_attenuation(10.4f), 3.f * gaas.mass_attenuation(10.3f));
+    EXPECT_GT(gaas.mass_attenuation(11.9f), 1.5f * gaas.mass_attenuation(11.8f));
+}
+
+TEST(Material, VectorizedMatchesScalar) {
+    auto gaas = Material::gallium_arsenide();
+    std::vector<float> energies;
+    for (float e = 4.f; e < 250.f; e += 0.37f)
+        energies.push_back(e);
+    std::vector<float> mu(energies.size());
+    gaas.mass_attenuation(energies.data(), mu.data(), energies.size());
+    for (size_t k = 0; k < energies.size(); ++k)
+        EXPECT_FLOAT_EQ(mu[k], gaas.mass_attenuation(energies[k]));
+}
+
+TEST(Material, FromFile) {
+    std::string filename = "material_test.txt";
+    {
+        std::ofstream file(filename);
+        file << "# energy mu/rho\n10 10\n20 1\n";
+    }
+    auto material = Material::from_file("test", 2.f, filename);
+    EXPECT_NEAR(material.mass_attenuation(std::sqrt(200.f)), std::sqrt(10.f), 1E-3f);
+    std::remove(filename.c_str());
+    EXPECT_THROW(Material::from_file("test", 2.f, filename), std::runtime_error);
+    EXPECT_THROW(Material("test", 2.f, {20.f, 10.f}, {1.f, 2.f}), std::invalid_argument);
+}
+
+TEST(SensorLayer, InteractionProbabilityAndDepth) {
+    SensorLayer sensor(Material::silicon(), 300.f);
+    float mu = Material::silicon().linear_attenuation(30.f);
+    EXPECT_NEAR(sensor.interaction_probability(30.f), 1.f - std::exp(-mu * 300.f), 1E-3f);
+    EXPECT_NEAR(sensor.mean_free_path(30.f), 1.f / mu, 0.01f / mu);
+    EXPECT_GT(SensorLayer(Material::cadmium_telluride(), 1000.f).interaction_probability(60.f), 0.95f);
+
+    double mean = 0.;
+    unsigned int n = 100000;
+    for (unsigned int k = 0; k < n; ++k) {
+        RandomStream rng(2, k);
+        float depth = sensor.draw_depth(30.f, rng);
+        ASSERT_LE(depth, 300.f);
+        mean += depth / n;
+    }
+    double expected_mean = 1. / mu - 300. * std::exp(-mu * 300.) / (1. - std::exp(-mu * 300.));
+    EXPECT_NEAR(mean, expected_mean, 1.);
+}
+
+TEST(SensorLayer, Exposure) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    auto sensor = std::make_shared<SensorLayer>(Material::silicon(), 300.f);
+    auto full = m->clone();
+    m->set_sensor(sensor);
+    m->start_frame();
+    exposure(m, 30.f, 1E-2, 1E6, HomogeneousPattern{}, 3);
+    m->finish_frame();
+    full->start_frame();
+    exposure(full, 30.f, 1E-2, 1E6, HomogeneousPattern{}, 3);
+    full->finish_frame();
+    double fraction = double(m->get_real_photons()) / double(full->get_real_photons());
+    EXPECT_NEAR(fraction, sensor->interaction_probability(30.f), 0.01);
+
+    DepthOfInteraction model{1.436f, 2.33f};
+    model.thickness = 500.f;
+    EXPECT_THROW(m->set_depth_of_interaction(model), std::invalid_argument);
+}
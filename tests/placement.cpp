@@ -0,0 +1,192 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+#include <omp.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "MedipixCSM.h"
+#include "MedipixSPM.h"
+#include "placement.h"
+#include "RandomStream.h"
+#include "test_utils.h"
+
+TEST(Placement, OwnerRange) {
+    for (size_t n: {0, 5, 1000, 1001}) {
+        size_t next = 0;
+        for (unsigned int t = 0; t < 7; ++t) {
+            auto [first, last] = owner_range(n, t, 7);
+            EXPECT_EQ(first, next);
+            EXPECT_LE(last - first, n / 7 + 1);
+            next = last;
+        }
+        EXPECT_EQ(next, n);
+    }
+
+    // The blocks of the threads cover every tile once
+    std::vector<int> owner(1000, -1);
+    for (unsigned int t = 0; t < 3; ++t) {
+        for_owned_blocks(owner.size(), 64, t, 3, [&owner, t](size_t first, size_t last) {
+            EXPECT_EQ(first / 64, (last - 1) / 64);
+            for (size_t k = first; k < last; ++k) {
+                EXPECT_EQ(owner[k], -1);
+                owner[k] = int(t);
+            }
+        });
+    }
+    EXPECT_EQ(std::count(owner.begin(), owner.end(), -1), 0);
+    EXPECT_EQ(owner[0], 0);
+    EXPECT_EQ(owner[63], 2);
+    EXPECT_EQ(owner[64], 0);
+
+    EXPECT_GE(get_numa_nodes(), 1);
+    EXPECT_LT(get_numa_node(), get_numa_nodes());
+
+    std::vector<float, DefaultInitAllocator<float>> values;
+    values.resize(100000);
+    values.assign(100000, 2.f);
+    EXPECT_EQ(values[99999], 2.f);
+    auto pages = values.size() * sizeof(float) / size_t(sysconf(_SC_PAGESIZE)) + 2;
+    EXPECT_LE(move_to_owners(values.data(), values.size() * sizeof(float)), pages);
+    EXPECT_EQ(values[12345], 2.f);
+}
+
+TEST(Placement, SameCounts) {
+    for (bool simd: {false, true}) {
+        for (size_t budget: {size_t(0), size_t(100000)}) {
+            MedipixSPM placed(true, 24, 24);
+            MedipixSPM shared(true, 24, 24);
+            placed.set_numa_placement(true);
+            EXPECT_TRUE(placed.get_numa_placement());
+            EXPECT_FALSE(shared.get_numa_placement());
+            for (auto *m: {&placed, &shared}) {
+                m->set_simd_pileup(simd);
+                m->set_th0(10.f);
+                m->random_threshold_dispersion(1.f, 2);
+                if (budget > 0)
+                    m->set_event_spill(budget, "/tmp", 4);
+                m->start_frame();
+                for (unsigned int k = 0; k < 20000; ++k) {
+                    RandomStream rng(6, k);
+                    m->add_photon(rng.uniform(10.f, 40.f), rng.uniform(m->get_min_x(), m->get_max_x()),
+                                  rng.uniform(m->get_min_y(), m->get_max_y()), 3, rng.uniform(0.f, 500.f));
+                }
+                m->finish_frame();
+            }
+            EXPECT_EQ(placed.get_image(), shared.get_image()) << "simd " << simd << " budget " << budget;
+            EXPECT_GT(placed.get_total_counts(), 1000);
+            std::vector<ShutterWindow> windows = {{0., 250.}, {250., 500.}};
+            auto placed_frames = placed.rebin(windows);
+            auto shared_frames = shared.rebin(windows);
+            for (unsigned int w = 0; w < 2; ++w) {
+                const auto *frame = placed_frames.get_frame(w);
+                const auto *shared_frame = shared_frames.get_frame(w);
+                EXPECT_EQ(std::vector<unsigned int>(frame, frame + 24 * 24),
+                          std::vector<unsigned int>(shared_frame, shared_frame + 24 * 24));
+            }
+        }
+    }
+}
+
+TEST(Placement, DetectorSetup) {
+    /**
+     * Enabling the placement pins the calling thread to one of its CPUs and gives a replica its own copies of the
+     * shared threshold dispersions. Disabling it restores the affinity of the threads.
+     */
+#ifdef __linux__
+    cpu_set_t before;
+    CPU_ZERO(&before);
+    ASSERT_EQ(sched_getaffinity(0, sizeof(before), &before), 0);
+#endif
+    MedipixTest<MedipixCSM> m(true, 16, 16);
+    m.random_threshold_dispersion(1.f, 3);
+    auto shared = m.get_th0_dispersion();
+    auto shared_th1 = m.get_th1_dispersion();
+    auto replica = std::dynamic_pointer_cast<MedipixTest<MedipixCSM>>(m.clone());
+    ASSERT_EQ(replica->get_th0_dispersion(), shared);
+    ASSERT_EQ(replica->get_th1_dispersion(), shared_th1);
+    replica->set_numa_placement(true);
+    replica->start_frame();
+    replica->finish_frame();
+    EXPECT_EQ(m.get_th0_dispersion(), shared);
+    EXPECT_EQ(m.get_th1_dispersion(), shared_th1);
+    EXPECT_NE(replica->get_th0_dispersion(), shared);
+    EXPECT_NE(replica->get_th1_dispersion(), shared_th1);
+    EXPECT_EQ(*replica->get_th0_dispersion(), *shared);
+    EXPECT_EQ(*replica->get_th1_dispersion(), *shared_th1);
+#ifdef __linux__
+    cpu_set_t after;
+    CPU_ZERO(&after);
+    ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+    if (omp_get_proc_bind() == omp_proc_bind_false) {
+        cpu_set_t both;
+        CPU_AND(&both, &before, &after);
+        EXPECT_EQ(CPU_COUNT(&after), 1);
+        EXPECT_TRUE(CPU_EQUAL(&both, &after));
+
+        // A larger team is pinned in the next frame, thread t on the t-th CPU
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &before))
+                cpus.push_back(cpu);
+        }
+        int max_threads = omp_get_max_threads();
+        omp_set_num_threads(max_threads + 2);
+        replica->start_frame();
+        replica->finish_frame();
+        std::vector<int> pinned(max_threads + 2, -1);
+        #pragma omp parallel default(none) shared(pinned)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &set))
+                        pinned[omp_get_thread_num()] = cpu;
+                }
+            }
+        }
+        for (size_t t = 0; t < pinned.size(); ++t) {
+            EXPECT_NE(pinned[t], -1) << "thread " << t;
+            EXPECT_EQ(pinned[t], cpus[t % cpus.size()]) << "thread " << t;
+        }
+
+        // A copy keeps the threads pinned, disabling the placement of the last detector restores their affinity
+        auto copy = replica->clone();
+        replica->set_numa_placement(false);
+        ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+        EXPECT_EQ(CPU_COUNT(&after), 1);
+        copy.reset();
+        std::vector<int> restored(max_threads + 2, 0);
+        #pragma omp parallel default(none) shared(restored, before)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_EQUAL(&set, &before))
+                restored[omp_get_thread_num()] = 1;
+        }
+        omp_set_num_threads(max_threads);
+        for (size_t t = 0; t < restored.size(); ++t)
+            EXPECT_EQ(restored[t], 1) << "thread " << t;
+    }
+#endif
+}
@@ -0,0 +1,91 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include "helper.h"
+#include "MedipixSPM.h"
+
+TEST(Rebin, PileupAcrossWindows) {
+    MedipixSPM m(true, 8, 8);
+    m.set_psf_sigma(1.0f);
+    m.set_th0(6.0f);
+    auto [x, y] = m.get_pixel_center(4, 4);
+    m.start_frame();
+    m.add_photon(30.f, x, y, 3, 9.5f);
+    // Piles up with the first photon, no rising crossing in the second frame
+    m.add_photon(30.f, x, y, 3, 10.2f);
+    m.add_photon(30.f, x, y, 3, 15.f);
+    m.finish_frame();
+
+    auto frames = m.rebin(frame_windows(3, 10.));
+    EXPECT_EQ(frames.get_num_frames(), 3);
+    EXPECT_EQ(frames.get_pixel_value(0, 4, 4), 1);
+    EXPECT_EQ(frames.get_pixel_value(1, 4, 4), 1);
+    EXPECT_EQ(frames.get_pixel_value(2, 4, 4), 0);
+
+    // Gated: the crossing of the third photon is outside of the window
+    auto gated = m.rebin({{0., 10.}, {16., 20.}});
+    EXPECT_EQ(gated.get_pixel_value(0, 4, 4), 1);
+    EXPECT_EQ(gated.get_pixel_value(1, 4, 4), 0);
+}
+
+TEST(Rebin, BackToBackSumsToFrame) {
+    auto m = std::make_shared<MedipixSPM>(true, 16, 16);
+    m->set_th0(10.f);
+    m->start_frame();
+    homogeneous_exposure(m, 30.f, 2E-4, 1E7, 42);
+    m->finish_frame();
+
+    auto single = m->rebin({{0., 1E6}});
+    EXPECT_EQ(single.get_total_counts(0), m->get_total_counts());
+
+    auto frames = m->rebin(frame_windows(20, 10.));
+    unsigned long counts = 0;
+    for (unsigned int frame = 0; frame < frames.get_num_frames(); ++frame)
+        counts += frames.get_total_counts(frame);
+    EXPECT_EQ(counts, m->get_total_counts());
+
+    auto gated = m->rebin(frame_windows(10, 10., 10.));
+    unsigned long gated_counts = 0;
+    for (unsigned int frame = 0; frame < gated.get_num_frames(); ++frame)
+        gated_counts += gated.get_total_counts(frame);
+    EXPECT_LT(gated_counts, counts);
+    EXPECT_GT(gated_counts, counts / 4);
+}
+
+TEST(Rebin, LongFrameWindows) {
+    // 50 ns frames one second into the acquisition, a float µs bound has steps of 0.0625 µs there
+    auto windows = frame_windows(2, 0.05, 0., 1E6);
+    EXPECT_NEAR(windows[0].end - windows[0].start, 0.05, 1E-9);
+    EXPECT_NEAR(windows[1].end - windows[1].start, 0.05, 1E-9);
+    EXPECT_EQ(windows[0].end, windows[1].start);
+}
+
+TEST(Rebin, InvalidWindows) {
+    MedipixSPM m(true, 8, 8);
+    m.start_frame();
+    m.finish_frame();
+    EXPECT_THROW((void) m.rebin({{0., 10.}, {5., 20.}}), std::invalid_argument);
+    EXPECT_THROW((void) m.rebin({{10., 10.}}), std::invalid_argument);
+
+    MedipixSPM untimed(false, 8, 8);
+    untimed.start_frame();
+    untimed.finish_frame();
+    EXPECT_THROW((void) untimed.rebin(frame_windows(2, 10.)), std::logic_error);
+}
@@ -0,0 +1,149 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "helper.h"
+#include "MedipixCSM.h"
+#include "MedipixRecorder.h"
+#include "MedipixSPM.h"
+#include "test_utils.h"
+
+namespace {
+    const std::string filename = "recorder_test_deposits.bin";
+
+    void record(float min_energy, bool timed_times) {
+        auto recorder = std::make_shared<MedipixRecorder>(filename, 32, 32, min_energy);
+        recorder->set_psf_sigma(12.f);
+        recorder->start_frame();
+        exposure(recorder, 30.f, timed_times ? 1E-4 : 1E-3, 1E7, HomogeneousPattern{}, 42);
+        recorder->finish_frame();
+    }
+
+    void expose(const std::shared_ptr<Medipix> &m, bool timed_times) {
+        m->start_frame();
+        exposure(m, 30.f, timed_times ? 1E-4 : 1E-3, 1E7, HomogeneousPattern{}, 42);
+        m->finish_frame();
+    }
+}
+
+TEST(Recorder, ReplaySpm) {
+    record(0.5f, false);
+    DepositRecord deposits(filename);
+    std::remove(filename.c_str());
+    EXPECT_GT(deposits.get_number_of_photons(), 1000);
+
+    std::vector<std::shared_ptr<Medipix>> detectors;
+    for (float th0: {5.f, 10.f, 20.f}) {
+        auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+        m->set_psf_sigma(12.f);
+        m->set_th0(th0);
+        m->random_threshold_dispersion(1.f, 7);
+        detectors.push_back(m);
+    }
+    replay(detectors, deposits);
+
+    unsigned int previous_counts = UINT32_MAX;
+    for (const auto &m: detectors) {
+        auto reference = m->clone();
+        expose(reference, false);
+        EXPECT_EQ(m->get_image(), reference->get_image());
+        EXPECT_LT(m->get_total_counts(), previous_counts);
+        previous_counts = m->get_total_counts();
+    }
+}
+
+TEST(Recorder, ReplayCsm) {
+    record(0.5f, false);
+    DepositRecord deposits(filename);
+    std::remove(filename.c_str());
+
+    auto m = std::make_shared<MedipixCSM>(false, 32, 32);
+    m->set_psf_sigma(12.f);
+    m->set_th0(5.f);
+    m->set_th1(20.f);
+    m->random_threshold_dispersion(1.f, 7);
+    replay({m}, deposits);
+
+    auto reference = m->clone();
+    expose(reference, false);
+    EXPECT_EQ(m->get_image(), reference->get_image());
+}
+
+TEST(Recorder, ReplayTimed) {
+    record(0.f, true);
+    DepositRecord deposits(filename);
+    std::remove(filename.c_str());
+
+    auto m = std::make_shared<MedipixSPM>(true, 32, 32);
+    m->set_psf_sigma(12.f);
+    m->set_th0(10.f);
+    replay({m}, deposits);
+
+    auto reference = m->clone();
+    expose(reference, true);
+    EXPECT_GT(m->get_total_counts(), 100);
+    EXPECT_NEAR(m->get_total_counts(), reference->get_total_counts(), 0.01 * reference->get_total_counts());
+}
+
+TEST(Recorder, SingleThreadedReplay) {
+    record(0.5f, false);
+    DepositRecord deposits(filename);
+    std::remove(filename.c_str());
+    auto max_team_size = std::make_shared<std::atomic<int>>(0);
+    std::vector<std::shared_ptr<Medipix>> detectors;
+    for (int d = 0; d < 4; ++d)
+        detectors.push_back(std::make_shared<TeamSizeProbe>(32, 32, max_team_size));
+    NestedParallelism nested_parallelism;
+    replay(detectors, deposits);
+    NestedParallelism::expect_inactive(*max_team_size);
+}
+
+TEST(Recorder, SmallDetector) {
+    record(0.5f, false);
+    DepositRecord deposits(filename);
+    std::remove(filename.c_str());
+    EXPECT_EQ(deposits.get_num_pixels_x(), 32);
+    EXPECT_EQ(deposits.get_num_pixels_y(), 32);
+    EXPECT_THROW(replay({std::make_shared<MedipixSPM>(false, 16, 16)}, deposits), std::invalid_argument);
+}
+
+TEST(Recorder, DifferentShape) {
+    /**
+     * A detector with the same number of pixels but another shape would decode the pixel indices to other pixels.
+     */
+    record(0.5f, false);
+    DepositRecord deposits(filename);
+    std::remove(filename.c_str());
+    EXPECT_THROW(replay({std::make_shared<MedipixSPM>(false, 64, 16)}, deposits), std::invalid_argument);
+    EXPECT_THROW(replay({std::make_shared<MedipixSPM>(false, 16, 64)}, deposits), std::invalid_argument);
+    EXPECT_NO_THROW(replay({std::make_shared<MedipixSPM>(false, 32, 32)}, deposits));
+}
+
+TEST(Recorder, NotADepositFile) {
+    {
+        std::ofstream file(filename, std::ios::binary);
+        std::vector<char> bytes(sizeof(DepositFileHeader) + sizeof(Deposit), 0);
+        file.write(bytes.data(), std::streamsize(bytes.size()));
+    }
+    EXPECT_THROW(DepositRecord deposits(filename), std::runtime_error);
+    std::remove(filename.c_str());
+}
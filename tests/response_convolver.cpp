@@ -0,0 +1,115 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include <memory_resource>
+#include <vector>
+#include "RandomStream.h"
+#include "ResponseConvolver.h"
+#include "test_utils.h"
+
+TEST(ResponseConvolver, MatchesDirectConvolution) {
+    std::vector<float> response(100);
+    for (size_t k = 0; k < response.size(); ++k)
+        response[k] = std::exp(-float(k) / 20.f) * std::sin(float(k) / 7.f);
+    ResponseConvolver convolver(response);
+    EXPECT_EQ(convolver.get_fft_size(), 512);
+    EXPECT_EQ(convolver.get_block_size(), 413);
+
+    // Shorter than one block and several blocks
+    for (size_t n_samples: {50, 3000}) {
+        std::vector<double> impulses(n_samples, 0.);
+        for (size_t k = 0; k < n_samples / 3; ++k) {
+            RandomStream rng(1, k);
+            impulses[size_t(rng.uniform(0.f, float(n_samples - 1)))] += rng.uniform(1.f, 30.f);
+        }
+        std::vector<float> signal(n_samples);
+        std::pmr::monotonic_buffer_resource resource;
+        convolver.convolve(impulses.data(), n_samples, signal.data(), resource);
+        for (size_t s = 0; s < n_samples; ++s) {
+            double expected = 0.;
+            for (size_t t = s + 1 - std::min(s + 1, response.size()); t <= s; ++t)
+                expected += impulses[t] * response[s - t];
+            EXPECT_NEAR(signal[s], expected, 1E-4) << "sample " << s;
+        }
+    }
+}
+
+TEST(ResponseConvolver, SameCrossingsAsPulseSum) {
+    MedipixTest<MedipixSPM> m(true, 4, 4);
+    m.set_fft_crossover(0.f);
+    EXPECT_THROW(m.set_fft_crossover(-1.f), std::invalid_argument);
+    m.start_frame();
+    m.add_photon(30.f, 0.f, 0.f, 3, 1000.f);
+    m.finish_frame();
+
+    std::vector<Event> events(20000);
+    for (size_t k = 0; k < events.size(); ++k) {
+        RandomStream rng(2, k);
+        events[k] = Event{rng.uniform(0.f, 1000.f), rng.uniform(1.f, 30.f)};
+    }
+    size_t first_sample;
+    auto pulses = m.calculate_pixel_signal(events, first_sample);
+    // Thresholds exactly at signal values are the hardest case
+    for (size_t s: {size_t(100), size_t(5000), size_t(77777)}) {
+        float threshold = pulses[s];
+        size_t fft_first_sample;
+        auto fft = m.calculate_pixel_signal(events, fft_first_sample, threshold);
+        EXPECT_EQ(fft_first_sample, first_sample);
+        ASSERT_EQ(fft.size(), pulses.size());
+        EXPECT_EQ(fft[s], pulses[s]);
+        for (size_t k = 0; k < pulses.size(); ++k) {
+            ASSERT_EQ(fft[k] > threshold, pulses[k] > threshold) << "sample " << k;
+            ASSERT_EQ(fft[k] < threshold, pulses[k] < threshold) << "sample " << k;
+            ASSERT_NEAR(fft[k], pulses[k], 1E-2f);
+        }
+    }
+}
+
+TEST(ResponseConvolver, SameCounts) {
+    for (bool simd: {false, true}) {
+        MedipixSPM fft(true, 6, 6);
+        MedipixSPM pulses(true, 6, 6);
+        fft.set_fft_crossover(0.f);
+        pulses.set_fft_crossover(std::numeric_limits<float>::infinity());
+        for (auto *m: {&fft, &pulses}) {
+            m->set_simd_pileup(simd);
+            m->set_th0(10.f);
+            m->random_threshold_dispersion(1.f, 5);
+            m->start_frame();
+            for (unsigned int k = 0; k < 40000; ++k) {
+                RandomStream rng(4, k);
+                m->add_photon(rng.uniform(10.f, 40.f), rng.uniform(m->get_min_x(), m->get_max_x()),
+                              rng.uniform(m->get_min_y(), m->get_max_y()), 3, rng.uniform(0.f, 1000.f));
+            }
+            m->finish_frame();
+        }
+        EXPECT_EQ(fft.get_image(), pulses.get_image()) << "simd " << simd;
+        EXPECT_GT(fft.get_total_counts(), 1000);
+        std::vector<ShutterWindow> windows = {{0., 300.}, {300., 1000.}};
+        auto fft_frames = fft.rebin(windows);
+        auto pulse_frames = pulses.rebin(windows);
+        for (unsigned int w = 0; w < 2; ++w) {
+            const auto *frame = fft_frames.get_frame(w);
+            const auto *pulse_frame = pulse_frames.get_frame(w);
+            EXPECT_EQ(std::vector<unsigned int>(frame, frame + 36), std::vector<unsigned int>(pulse_frame, pulse_frame + 36));
+        }
+    }
+}
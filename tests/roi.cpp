@@ -0,0 +1,101 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include "helper.h"
+#include "test_utils.h"
+
+/**
+ * Runs the same exposure on a full detector and on a region of interest of a replica and compares the counts.
+ */
+static void expect_roi_matches_full(const std::shared_ptr<Medipix> &full, PixelRegion region,
+                                    double exposure_time, double flux_density) {
+    auto roi = full->clone();
+    roi->set_region_of_interest(region.x0, region.y0, region.nx, region.ny);
+    auto interacting = [](float x, float y) { return edge(x, y, -0.5f, 20.f); };
+
+    full->start_frame();
+    exposure(full, 30.f, exposure_time, flux_density, interacting, 23);
+    full->finish_frame();
+    roi->start_frame();
+    exposure(roi, 30.f, exposure_time, flux_density, interacting, 23);
+    roi->finish_frame();
+
+    EXPECT_EQ(roi->get_image().size(), region.nx * region.ny);
+    EXPECT_LT(roi->get_real_photons(), full->get_real_photons());
+    unsigned int counts = 0;
+    for (unsigned int i = region.x0; i < region.x0 + region.nx; ++i) {
+        for (unsigned int j = region.y0; j < region.y0 + region.ny; ++j) {
+            EXPECT_EQ(roi->get_pixel_value(i, j), full->get_pixel_value(i, j));
+            counts += roi->get_pixel_value(i, j);
+        }
+    }
+    EXPECT_GT(counts, 0);
+    EXPECT_THROW((void) roi->get_pixel_value(region.x0 + region.nx, region.y0), std::out_of_range);
+}
+
+TEST(RegionOfInterest, Spm) {
+    auto m = std::make_shared<MedipixSPM>(false, 64, 64);
+    m->set_th0(8.f);
+    m->random_threshold_dispersion(1.5f, 3);
+    expect_roi_matches_full(m, PixelRegion{26, 27, 8, 12}, 1E-2, 1E6);
+}
+
+TEST(RegionOfInterest, SpmTimed) {
+    auto m = std::make_shared<MedipixSPM>(true, 16, 16);
+    m->set_th0(6.f);
+    m->random_threshold_dispersion(1.f, 3);
+    expect_roi_matches_full(m, PixelRegion{6, 5, 4, 4}, 1E-3, 1E7);
+}
+
+TEST(RegionOfInterest, Csm) {
+    auto m = std::make_shared<MedipixCSM>(false, 64, 64);
+    m->set_th0(5.f);
+    m->set_th1(15.f);
+    m->random_threshold_dispersion(1.5f, 3);
+    expect_roi_matches_full(m, PixelRegion{20, 24, 16, 16}, 1E-2, 1E6);
+}
+
+/**
+ * Counts the photons evaluated outside of the region of interest plus halo
+ */
+struct OutsidePattern {
+    const Medipix *medipix;
+    std::atomic<unsigned long long> *outside;
+
+    float operator()(float x, float y) const {
+        if (!medipix->in_region_of_interest(x, y, 3))
+            outside->fetch_add(1, std::memory_order_relaxed);
+        return 1.f;
+    }
+};
+
+TEST(RegionOfInterest, SkipsOutsidePhotons) {
+    auto m = std::make_shared<MedipixSPM>(false, 64, 64);
+    m->set_th0(8.f);
+    m->set_region_of_interest(28, 28, 8, 8);
+    std::atomic<unsigned long long> outside{0};
+    m->start_frame();
+    exposure(m, 30.f, 1E-3, 1E6, OutsidePattern{m.get(), &outside}, 23);
+    m->finish_frame();
+    EXPECT_EQ(outside.load(), 0);
+    EXPECT_GT(m->get_real_photons(), 0);
+    EXPECT_LT(m->get_real_photons(), get_number_of_photons(m, 1E-3, 1E6) / 10);
+}
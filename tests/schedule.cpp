@@ -0,0 +1,91 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "MedipixSPM.h"
+#include "RandomStream.h"
+#include "schedule.h"
+
+TEST(Schedule, BalanceTasks) {
+    // One heavy item and many light ones
+    std::vector<uint64_t> cost(1000, 1);
+    cost[500] = 2000;
+    auto tasks = balance_tasks(cost, 4, 8);
+    std::vector<unsigned int> seen(cost.size(), 0);
+    for (size_t t = 0; t < tasks.size(); ++t) {
+        ASSERT_FALSE(tasks.get_task(t).empty());
+        for (auto k: tasks.get_task(t))
+            seen[k] += 1;
+    }
+    EXPECT_EQ(seen, std::vector<unsigned int>(cost.size(), 1));
+    // The heavy item comes first and alone, the light items are packed into tasks of about 3000 / 32
+    ASSERT_EQ(tasks.get_task(0).size(), 1);
+    EXPECT_EQ(tasks.get_task(0)[0], 500);
+    EXPECT_EQ(tasks.get_task(1).size(), 93);
+    EXPECT_EQ(tasks.size(), 12);
+
+    EXPECT_EQ(balance_tasks(std::vector<uint64_t>{}, 4).size(), 0);
+    auto uniform = uniform_tasks(35, 16);
+    ASSERT_EQ(uniform.size(), 3);
+    EXPECT_EQ(uniform.get_task(2).size(), 3);
+    EXPECT_EQ(uniform.get_task(1)[0], 16);
+    EXPECT_EQ(uniform_tasks(0, 16).size(), 0);
+}
+
+TEST(Schedule, HotSpotCounts) {
+    for (bool simd: {false, true}) {
+        MedipixSPM balanced(true, 32, 32);
+        MedipixSPM chunked(true, 32, 32);
+        chunked.set_cost_scheduling(false);
+        EXPECT_TRUE(balanced.get_cost_scheduling());
+        EXPECT_FALSE(chunked.get_cost_scheduling());
+        for (auto *m: {&balanced, &chunked}) {
+            m->set_simd_pileup(simd);
+            m->set_th0(10.f);
+            m->start_frame();
+            // Background and a hot spot of a few pixels with most of the photons
+            for (unsigned int k = 0; k < 20000; ++k) {
+                RandomStream rng(3, k);
+                bool hot = k % 4 != 0;
+                float x = hot ? rng.uniform(-80.f, 80.f) : rng.uniform(m->get_min_x(), m->get_max_x());
+                float y = hot ? rng.uniform(-80.f, 80.f) : rng.uniform(m->get_min_y(), m->get_max_y());
+                m->add_photon(30.f, x, y, 3, rng.uniform(0.f, 1000.f));
+            }
+            m->finish_frame();
+        }
+        EXPECT_EQ(balanced.get_image(), chunked.get_image()) << "simd " << simd;
+        EXPECT_GT(balanced.get_total_counts(), 1000);
+        std::vector<ShutterWindow> windows = {{0., 500.}, {500., 1000.}};
+        auto balanced_frames = balanced.rebin(windows);
+        auto chunked_frames = chunked.rebin(windows);
+        for (unsigned int w = 0; w < 2; ++w) {
+            const auto *frame = balanced_frames.get_frame(w);
+            const auto *chunked_frame = chunked_frames.get_frame(w);
+            EXPECT_EQ(std::vector<unsigned int>(frame, frame + 32 * 32),
+                      std::vector<unsigned int>(chunked_frame, chunked_frame + 32 * 32));
+        }
+
+        auto utilization = balanced.get_pileup_utilization();
+        EXPECT_GT(utilization.threads, 0);
+        EXPECT_GT(utilization.tasks, 0);
+        EXPECT_GT(utilization.get_utilization(), 0.);
+        EXPECT_LE(utilization.get_utilization(), 1. + 1E-9);
+    }
+}
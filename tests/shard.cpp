@@ -0,0 +1,143 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <memory>
+#include "helper.h"
+#include "shard.h"
+#include "test_utils.h"
+
+TEST(Shard, Ranges) {
+    /**
+     * Shard ranges are contiguous and cover all photons.
+     */
+    unsigned long long next = 0;
+    for (unsigned int shard = 0; shard < 7; ++shard) {
+        auto [first, last] = shard_range(100, shard, 7);
+        EXPECT_EQ(first, next);
+        EXPECT_GE(last - first, 14);
+        next = last;
+    }
+    EXPECT_EQ(next, 100);
+    EXPECT_THROW(shard_range(100, 7, 7), std::invalid_argument);
+}
+
+TEST(Shard, MergeMatchesSingleRun) {
+    /**
+     * The merged partial images are identical to a single process run with the same seed.
+     */
+    auto directory = std::filesystem::temp_directory_path() / "medipix_shard_test";
+    std::filesystem::create_directories(directory);
+    auto interacting = [](float x, float y) { return edge(x, y, 0.3f, 10.f); };
+
+    auto m = std::make_shared<MedipixCSM>(false, 32, 32);
+    m->set_th0(5.f);
+    m->set_th1(12.f);
+    m->random_threshold_dispersion(1.f, 5);
+
+    std::vector<std::string> sidecars;
+    for (unsigned int shard = 0; shard < 3; ++shard) {
+        auto info = run_shard(m, 30.f, 1E-2, 1E6, interacting, 9, shard, 3, "edge");
+        auto prefix = (directory / ("shard " + std::to_string(shard))).string();
+        save_shard(m, info, prefix);
+        sidecars.push_back(prefix + ".txt");
+    }
+    std::vector<unsigned int> counts;
+    auto merged = merge_shards(sidecars, counts);
+
+    m->start_frame();
+    exposure(m, 30.f, 1E-2, 1E6, interacting, 9);
+    m->finish_frame();
+    EXPECT_EQ(merged.real_photons, m->get_real_photons());
+    EXPECT_EQ(counts, m->get_image());
+
+    sidecars.pop_back();
+    EXPECT_THROW(merge_shards(sidecars, counts), std::invalid_argument);
+    std::filesystem::remove_all(directory);
+}
+
+TEST(Shard, DetectorMismatch) {
+    /**
+     * Shards of detectors with different configurations or patterns are not merged.
+     */
+    auto directory = std::filesystem::temp_directory_path() / "medipix_shard_mismatch_test";
+    std::filesystem::create_directories(directory);
+    auto flat = [](float, float) { return true; };
+
+    auto m = std::make_shared<MedipixSPM>(false, 8, 8);
+    m->set_th0(5.f);
+    auto run = [&](unsigned int shard, const std::string &pattern, const std::string &name = "shard_") {
+        auto info = run_shard(m, 30.f, 1E-3, 1E6, flat, 3, shard, 2, pattern);
+        auto prefix = (directory / (name + std::to_string(shard))).string();
+        save_shard(m, info, prefix);
+        return prefix + ".txt";
+    };
+    std::vector<unsigned int> counts;
+
+    auto first = run(0, "flat");
+    m->set_th0(6.f);
+    EXPECT_THROW(merge_shards({first, run(1, "flat")}, counts), std::invalid_argument);
+    m->set_th0(5.f);
+    EXPECT_THROW(merge_shards({first, run(1, "edge")}, counts), std::invalid_argument);
+    m->random_threshold_dispersion(1.f, 4);
+    EXPECT_THROW(merge_shards({first, run(1, "flat")}, counts), std::invalid_argument);
+    m->random_threshold_dispersion(0.f, 0);
+    // Sensor layer and edge extensions change the photons and the pixel integrals
+    m->set_sensor(std::make_shared<SensorLayer>(Material::silicon(), 300.f));
+    EXPECT_THROW(merge_shards({first, run(1, "flat")}, counts), std::invalid_argument);
+    auto sensor = run(0, "flat", "sensor_");
+    m->set_sensor(std::make_shared<SensorLayer>(Material::silicon(), 500.f));
+    EXPECT_THROW(merge_shards({sensor, run(1, "flat")}, counts), std::invalid_argument);
+    m->set_sensor(std::make_shared<SensorLayer>(Material::cadmium_telluride(), 300.f));
+    EXPECT_THROW(merge_shards({sensor, run(1, "flat")}, counts), std::invalid_argument);
+    m->set_sensor(std::make_shared<SensorLayer>(Material::silicon(), 300.f));
+    EXPECT_NO_THROW(merge_shards({sensor, run(1, "flat")}, counts));
+    m->set_sensor(nullptr);
+    m->set_edge_extension(0.f, 0.f, 0.f, 27.5f);
+    EXPECT_THROW(merge_shards({first, run(1, "flat")}, counts), std::invalid_argument);
+    m->set_edge_extension(0.f, 0.f, 0.f, 0.f);
+    EXPECT_NO_THROW(merge_shards({first, run(1, "flat")}, counts));
+
+    // Images of the same size from different windows or detectors
+    m->set_region_of_interest(0, 0, 4, 4);
+    auto window = run(0, "flat");
+    m->set_region_of_interest(2, 2, 4, 4);
+    EXPECT_THROW(merge_shards({window, run(1, "flat")}, counts), std::invalid_argument);
+    m = std::make_shared<MedipixSPM>(false, 16, 4);
+    m->set_th0(5.f);
+    m->set_region_of_interest(0, 0, 4, 4);
+    EXPECT_THROW(merge_shards({window, run(1, "flat")}, counts), std::invalid_argument);
+
+    auto info = read_shard_info(first);
+    EXPECT_EQ(info.mode, "spm");
+    EXPECT_EQ(info.th0, 5.f);
+    EXPECT_EQ(info.pattern, "flat");
+    EXPECT_FALSE(info.sensor);
+    info = read_shard_info(sensor);
+    EXPECT_TRUE(info.sensor);
+    EXPECT_EQ(info.sensor_material, Material::silicon().get_name());
+    EXPECT_EQ(info.sensor_thickness, 300.f);
+    std::filesystem::remove_all(directory);
+}
+
+TEST(Shard, TimedNotSupported) {
+    auto m = std::make_shared<MedipixSPM>(true, 8, 8);
+    EXPECT_THROW(run_shard(m, 30.f, 1E-3, 1E6, [](float, float) { return true; }, 0, 0, 2, "flat"),
+                 std::logic_error);
+}
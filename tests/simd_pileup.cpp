@@ -0,0 +1,77 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "MedipixSPM.h"
+#include "pileup.h"
+#include "RandomStream.h"
+
+TEST(SimdPileup, CountCrossings) {
+    // Lane l has a rectangular pulse of height l in every period of 4 samples, lane 0 starts above its threshold
+    size_t n_samples = 40;
+    std::vector<std::vector<float>> signal(pileup_lanes, std::vector<float>(n_samples));
+    const float *lanes[pileup_lanes];
+    float threshold[pileup_lanes], previous[pileup_lanes];
+    uint32_t length[pileup_lanes], counts[pileup_lanes];
+    for (unsigned int l = 0; l < pileup_lanes; ++l) {
+        threshold[l] = float(l) - 0.5f;
+        previous[l] = l == 0 ? threshold[l] : 0.f;
+        length[l] = static_cast<uint32_t>(n_samples - 2 * l);
+        for (size_t s = 0; s < n_samples; ++s)
+            signal[l][s] = s % 4 == 1 ? float(l) : 0.f;
+        lanes[l] = signal[l].data();
+    }
+    count_crossings(lanes, length, threshold, previous, counts);
+    for (unsigned int l = 0; l < pileup_lanes; ++l) {
+        // Pulses at samples 1, 5, ... below length; lane 0 is never below its threshold
+        uint32_t expected = l == 0 ? 0 : (length[l] + 2) / 4;
+        EXPECT_EQ(counts[l], expected) << "lane " << l;
+    }
+    EXPECT_FALSE(pileup_isa().empty());
+}
+
+TEST(SimdPileup, SimdMatchesScalar) {
+    for (bool compact: {false, true}) {
+        auto simd = std::make_shared<MedipixSPM>(true, 24, 20);
+        auto scalar = std::make_shared<MedipixSPM>(true, 24, 20);
+        scalar->set_simd_pileup(false);
+        EXPECT_TRUE(simd->get_simd_pileup());
+        EXPECT_FALSE(scalar->get_simd_pileup());
+        for (const auto &m: {simd, scalar}) {
+            m->set_th0(10.f);
+            m->set_compact_events(compact);
+            m->set_region_of_interest(3, 1, 18, 19);
+            m->random_threshold_dispersion(1.5f, 5);
+        }
+        for (const auto &m: {simd, scalar}) {
+            m->start_frame();
+            for (unsigned int k = 0; k < 20000; ++k) {
+                RandomStream rng(11, k);
+                m->add_photon(rng.uniform(10.f, 40.f), rng.uniform(m->get_min_x(), m->get_max_x()),
+                              rng.uniform(m->get_min_y(), m->get_max_y()), 3, rng.uniform(0.f, 200.f));
+            }
+            m->finish_frame();
+        }
+        EXPECT_EQ(simd->get_image(), scalar->get_image()) << "compact " << compact;
+        EXPECT_GT(simd->get_total_counts(), 1000);
+        // Strong pile-up: fewer counts than photons
+        EXPECT_LT(simd->get_total_counts(), 20000);
+    }
+}
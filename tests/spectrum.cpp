@@ -0,0 +1,81 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include "helper.h"
+#include "MedipixSPM.h"
+#include "Spectrum.h"
+
+TEST(Spectrum, SamplingFrequencies) {
+    Spectrum spectrum({20.f, 30.f, 40.f, 50.f}, {1.f, 2.f, 0.f, 1.f});
+    EXPECT_FLOAT_EQ(spectrum.get_mean_energy(), 32.5f);
+    std::map<float, unsigned int> histogram;
+    unsigned int n = 400000;
+    for (unsigned int k = 0; k < n; ++k) {
+        RandomStream rng(1, k);
+        histogram[spectrum.sample(rng)]++;
+    }
+    EXPECT_NEAR(double(histogram[20.f]) / n, 0.25, 0.005);
+    EXPECT_NEAR(double(histogram[30.f]) / n, 0.5, 0.005);
+    EXPECT_EQ(histogram.count(40.f), 0);
+    EXPECT_NEAR(double(histogram[50.f]) / n, 0.25, 0.005);
+}
+
+TEST(Spectrum, FromFile) {
+    std::string filename = "spectrum_test.txt";
+    {
+        std::ofstream file(filename);
+        file << "# energy weight\n20 1\n\n30 3\n";
+    }
+    auto spectrum = Spectrum::from_file(filename);
+    EXPECT_EQ(spectrum.get_energies(), std::vector<float>({20.f, 30.f}));
+    EXPECT_FLOAT_EQ(spectrum.get_probabilities()[1], 0.75f);
+    std::remove(filename.c_str());
+    EXPECT_THROW(Spectrum::from_file(filename), std::runtime_error);
+    EXPECT_THROW(Spectrum({20.f}, {1.f, 2.f}), std::invalid_argument);
+}
+
+TEST(Spectrum, SingleLineMatchesMonochromatic) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(8.f);
+    auto replica = m->clone();
+    m->start_frame();
+    exposure(m, 30.f, 1E-2, 1E6, HomogeneousPattern{}, 5);
+    m->finish_frame();
+    replica->start_frame();
+    exposure(replica, Spectrum({30.f}, {1.f}), 1E-2, 1E6, HomogeneousPattern{}, 5);
+    replica->finish_frame();
+    EXPECT_EQ(m->get_image(), replica->get_image());
+}
+
+TEST(Spectrum, ThresholdCutsLowEnergies) {
+    // Half of the photons are below the threshold even without charge sharing
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(15.f);
+    m->set_psf_sigma(0.1f);
+    m->start_frame();
+    exposure(m, Spectrum({10.f, 40.f}, {1.f, 1.f}), 1E-2, 1E6, HomogeneousPattern{}, 5);
+    m->finish_frame();
+    double counts = m->get_total_counts();
+    double photons = m->get_real_photons();
+    EXPECT_NEAR(counts / photons, 0.5, 0.01);
+}
@@ -0,0 +1,90 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include "burst.h"
+#include "helper.h"
+#include "sweep.h"
+#include "test_utils.h"
+
+TEST(Sweep, SharedCalibration) {
+    /**
+     * Replicas share the threshold dispersion until one of them changes it.
+     */
+    auto m = std::make_shared<MedipixTest<MedipixSPM>>(false, 16, 16);
+    m->random_threshold_dispersion(1.0f);
+    auto replica_test = std::dynamic_pointer_cast<MedipixTest<MedipixSPM>>(m->clone());
+    ASSERT_TRUE(replica_test);
+    EXPECT_EQ(m->get_th0_dispersion(), replica_test->get_th0_dispersion());
+
+    auto before = m->get_th0_dispersion();
+    replica_test->random_threshold_dispersion(2.0f);
+    EXPECT_NE(m->get_th0_dispersion(), replica_test->get_th0_dispersion());
+    EXPECT_EQ(m->get_th0_dispersion(), before);
+}
+
+TEST(Sweep, MatchesSerialRuns) {
+    /**
+     * The table is ordered by point index and every point matches a serial run with the point seed.
+     */
+    auto m = std::make_shared<MedipixCSM>(false, 16, 16);
+    m->set_th0(5.0f);
+    SweepGrid grid;
+    grid.th1 = {10.f, 25.f};
+    grid.flux_density = {1E5, 1E6};
+    grid.energy = {30.f};
+    std::stringstream table;
+    sweep(m, grid, 1E-2, table, 11);
+
+    std::string header;
+    std::getline(table, header);
+    auto points = grid.points(m);
+    ASSERT_EQ(points.size(), 4);
+    for (unsigned int index = 0; index < points.size(); ++index) {
+        size_t row_index;
+        float th0, th1, psf_sigma, energy;
+        double flux_density;
+        int i_krum;
+        unsigned int real_photons, counts;
+        table >> row_index >> th0 >> th1 >> flux_density >> psf_sigma >> i_krum >> energy >> real_photons >> counts;
+        EXPECT_EQ(row_index, index);
+        EXPECT_FLOAT_EQ(th1, points[index].th1);
+
+        m->set_th1(points[index].th1);
+        m->start_frame();
+        homogeneous_exposure(m, energy, 1E-2, flux_density, frame_seed(11, index));
+        m->finish_frame();
+        EXPECT_EQ(real_photons, m->get_real_photons());
+        EXPECT_EQ(counts, m->get_total_counts());
+    }
+}
+
+TEST(Sweep, SingleThreadedPoints) {
+    auto max_team_size = std::make_shared<std::atomic<int>>(0);
+    auto m = std::make_shared<TeamSizeProbe>(8, 8, max_team_size);
+    NestedParallelism nested_parallelism;
+    SweepGrid grid;
+    grid.th0 = {5.f, 10.f, 15.f, 20.f};
+    grid.flux_density = {1E6};
+    grid.energy = {30.f};
+    std::stringstream table;
+    sweep(m, grid, 1E-3, table, 11);
+    NestedParallelism::expect_inactive(*max_team_size);
+}
@@ -18,6 +18,10 @@
 
 #ifndef MEDIPIX_TEST_UTILS_H
 #define MEDIPIX_TEST_UTILS_H
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+#include <omp.h>
 #include "MedipixSPM.h"
 #include "MedipixCSM.h"
 #include "Medipix.h"
@@ -35,5 +39,94 @@ public:
         return T::calculate_shared_energy(x1, y1, energy, x2, y2);
     }
 
+    float calculate_pixel_energy(float x, float y, float energy, unsigned int i, unsigned int j, float depth) const {
+        return T::calculate_pixel_energy(x, y, energy, i, j, depth);
+    }
+
+    std::shared_ptr<Medipix> clone() const override {
+        return std::make_shared<MedipixTest<T>>(*this);
+    }
+
+    std::shared_ptr<const std::vector<float>> get_th0_dispersion() const {
+        return T::th0_dispersion;
+    }
+
+    std::shared_ptr<const std::vector<float>> get_th1_dispersion() const {
+        return T::th1_dispersion;
+    }
+
+    std::vector<float> calculate_pixel_signal(std::span<const Event> events, size_t &first_sample) const {
+        Arena::Scope scope(T::arenas.local());
+        auto signal = T::calculate_pixel_signal(events, first_sample);
+        return {signal.begin(), signal.end()};
+    }
+
+    std::vector<float> calculate_pixel_signal(std::span<const Event> events, size_t &first_sample,
+                                              float threshold) const {
+        Arena::Scope scope(T::arenas.local());
+        auto signal = T::calculate_pixel_signal(events, first_sample, threshold);
+        return {signal.begin(), signal.end()};
+    }
+
+};
+
+/**
+ * Detector that records the largest team of a parallel region opened in finish_frame(). Loops that give every thread
+ * its own detector have to keep this region inactive.
+ */
+class TeamSizeProbe : public MedipixSPM {
+public:
+    TeamSizeProbe(unsigned int nx, unsigned int ny, std::shared_ptr<std::atomic<int>> max_team_size)
+            : MedipixSPM(false, nx, ny), max_team_size(std::move(max_team_size)) {}
+
+    std::shared_ptr<Medipix> clone() const override {
+        return std::make_shared<TeamSizeProbe>(*this);
+    }
+
+    void finish_frame() override {
+#pragma omp parallel num_threads(4) default(none)
+        {
+            int team_size = omp_get_num_threads();
+            int current = max_team_size->load();
+            while (team_size > current && !max_team_size->compare_exchange_weak(current, team_size));
+        }
+        MedipixSPM::finish_frame();
+    }
+
+private:
+    std::shared_ptr<std::atomic<int>> max_team_size;
+};
+/**
+ * Enables two active levels of parallel regions with two threads while it exists and restores the previous settings
+ * afterwards, also if a test fails early. Loops that give every thread its own detector have to keep the parallel
+ * regions of the detector inactive even then.
+ */
+class NestedParallelism {
+public:
+    NestedParallelism() : max_active_levels(omp_get_max_active_levels()), max_threads(omp_get_max_threads()) {
+        omp_set_max_active_levels(2);
+        omp_set_num_threads(2);
+    }
+
+    ~NestedParallelism() {
+        omp_set_max_active_levels(max_active_levels);
+        omp_set_num_threads(max_threads);
+    }
+
+    NestedParallelism(const NestedParallelism &) = delete;
+
+    NestedParallelism &operator=(const NestedParallelism &) = delete;
+
+    /**
+     * Checks that the largest team of the nested regions had one thread and that the loop restored the nesting
+     */
+    static void expect_inactive(int max_team_size) {
+        EXPECT_EQ(max_team_size, 1);
+        EXPECT_EQ(omp_get_max_active_levels(), 2);
+    }
+
+private:
+    int max_active_levels;
+    int max_threads;
 };
 #endif //MEDIPIX_TEST_UTILS_H
@@ -0,0 +1,113 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "MedipixTimepix.h"
+
+namespace {
+    std::vector<Hit> acquire(MedipixTimepix &m, const std::vector<std::pair<float, float>> &photons, float window) {
+        std::vector<Hit> hits;
+        m.start_acquisition([&hits](const Hit *h, size_t n) { hits.insert(hits.end(), h, h + n); });
+        auto [x, y] = m.get_pixel_center(4, 4);
+        size_t next = 0;
+        double start = 0.;
+        while (next < photons.size()) {
+            m.begin_window(window);
+            while (next < photons.size() && photons[next].first < start + window) {
+                m.add_photon(photons[next].second, x, y, 3, float(photons[next].first - start));
+                ++next;
+            }
+            m.end_window();
+            start += window;
+        }
+        m.finish_acquisition();
+        return hits;
+    }
+}
+
+TEST(Timepix, SingleHit) {
+    MedipixTimepix m(8, 8);
+    m.set_psf_sigma(1.0f);
+    m.set_th0(6.0f);
+    auto hits = acquire(m, {{10.f, 30.f}}, 100.f);
+    ASSERT_EQ(hits.size(), 1);
+    EXPECT_EQ(hits[0].pixel, 4 * 8 + 4);
+    EXPECT_NEAR(double(hits[0].toa), 10. * 40., 2.);
+    EXPECT_GT(hits[0].tot, 0);
+    EXPECT_EQ(m.get_pixel_value(4, 4), 1);
+    EXPECT_EQ(m.get_number_of_hits(), 1);
+    EXPECT_EQ(m.get_pending_hits(), 0);
+
+    // Higher energy, longer time over threshold
+    auto hits_high = acquire(m, {{10.f, 60.f}}, 100.f);
+    ASSERT_EQ(hits_high.size(), 1);
+    EXPECT_GT(hits_high[0].tot, hits[0].tot);
+}
+
+TEST(Timepix, Pileup) {
+    MedipixTimepix m(8, 8);
+    m.set_psf_sigma(1.0f);
+    m.set_th0(6.0f);
+    EXPECT_EQ(acquire(m, {{10.f, 30.f}, {10.5f, 30.f}}, 100.f).size(), 1);
+    EXPECT_EQ(acquire(m, {{10.f, 30.f}, {20.f, 30.f}}, 100.f).size(), 2);
+}
+
+TEST(Timepix, WindowIndependent) {
+    MedipixTimepix m(8, 8);
+    m.set_psf_sigma(1.0f);
+    m.set_th0(6.0f);
+    std::vector<std::pair<float, float>> photons;
+    for (int k = 0; k < 50; ++k)
+        photons.emplace_back(3.7f * float(k) + 0.3f, 20.f + float(k % 7));
+
+    auto reference = acquire(m, photons, 1000.f);
+    ASSERT_EQ(reference.size(), 50);
+    for (float window: {1.f, 2.5f, 13.f}) {
+        auto hits = acquire(m, photons, window);
+        ASSERT_EQ(hits.size(), reference.size()) << window;
+        for (size_t k = 0; k < hits.size(); ++k) {
+            EXPECT_NEAR(double(hits[k].toa), double(reference[k].toa), 1.) << window;
+            EXPECT_NEAR(double(hits[k].tot), double(reference[k].tot), 1.) << window;
+        }
+    }
+}
+
+TEST(Timepix, FileStream) {
+    auto m = std::make_shared<MedipixTimepix>(32, 32);
+    m->set_th0(10.0f);
+    std::string filename = "timepix_test_hits.bin";
+    {
+        HitFileWriter writer(filename);
+        timepix_acquisition(m, 20.f, 1E-3, 50E-6, 1E7, HomogeneousPattern{}, 42, writer);
+    }
+    auto hits = read_hits(filename);
+    std::remove(filename.c_str());
+
+    EXPECT_EQ(hits.size(), m->get_number_of_hits());
+    EXPECT_GT(hits.size(), 1000);
+    for (size_t k = 1; k < hits.size(); ++k)
+        ASSERT_TRUE(hits[k - 1].toa < hits[k].toa || (hits[k - 1].toa == hits[k].toa && hits[k - 1].pixel < hits[k].pixel));
+    unsigned long long counts = 0;
+    for (unsigned int i = 0; i < 32; ++i)
+        for (unsigned int j = 0; j < 32; ++j)
+            counts += m->get_pixel_value(i, j);
+    EXPECT_EQ(counts, hits.size());
+}
@@ -0,0 +1,142 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include "AliasTable.h"
+#include "helper.h"
+#include "TransmissionMap.h"
+#include "MedipixRecorder.h"
+#include "MedipixSPM.h"
+
+TEST(AliasTable, SamplingFrequencies) {
+    std::vector<float> weights{1.f, 0.f, 3.f, 4.f, 2.f};
+    AliasTable table(weights);
+    EXPECT_EQ(table.size(), weights.size());
+    EXPECT_DOUBLE_EQ(table.get_total_weight(), 10.);
+
+    std::vector<unsigned int> histogram(weights.size(), 0);
+    unsigned int n = 1000000;
+    for (unsigned int k = 0; k < n; ++k) {
+        RandomStream rng(5, k);
+        histogram[table.sample(rng)]++;
+    }
+    EXPECT_EQ(histogram[1], 0);
+    for (size_t i = 0; i < weights.size(); ++i)
+        EXPECT_NEAR(double(histogram[i]) / n, weights[i] / 10., 0.003);
+}
+
+TEST(AliasTable, InvalidWeights) {
+    EXPECT_THROW(AliasTable(std::vector<float>{0.f, 0.f}), std::invalid_argument);
+    EXPECT_THROW(AliasTable(std::vector<float>{1.f, -1.f}), std::invalid_argument);
+    EXPECT_THROW(AliasTable(std::vector<float>{1.f, std::nanf("")}), std::invalid_argument);
+}
+
+TEST(TransmissionMap, UniformMapMatchesHomogeneousStatistics) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(5.f);
+    TransmissionMap map(std::vector<float>(16 * 16, 0.5f), 16, 16, m);
+    EXPECT_DOUBLE_EQ(map.get_mean(), 0.5);
+
+    m->start_frame();
+    transmission_exposure(m, 30.f, 1E-2, 1E6, map, 7);
+    m->finish_frame();
+
+    double expected = 0.5 * 1E6 * 1E-2 * map.get_area();
+    EXPECT_NEAR(double(m->get_real_photons()), expected, 5 * std::sqrt(expected));
+}
+
+TEST(TransmissionMap, EdgeMapShadow) {
+    auto m = std::make_shared<MedipixSPM>(false, 32, 32);
+    m->set_th0(5.f);
+    m->set_psf_sigma(1.f);
+    // Left half of the sensor is fully absorbed
+    std::vector<float> values(32 * 32, 1.f);
+    std::fill(values.begin(), values.begin() + 16 * 32, 0.f);
+    TransmissionMap map(values, 32, 32, m);
+
+    m->start_frame();
+    transmission_exposure(m, 30.f, 1E-2, 1E6, map, 7);
+    m->finish_frame();
+
+    unsigned int shadow = 0;
+    unsigned int open = 0;
+    for (unsigned int i = 0; i < 32; ++i)
+        for (unsigned int j = 0; j < 32; ++j)
+            (i < 15 ? shadow : open) += m->get_pixel_value(i, j);
+    EXPECT_EQ(shadow, 0);
+    EXPECT_GT(open, 0);
+}
+
+TEST(TransmissionMap, MappedFile) {
+    auto m = std::make_shared<MedipixSPM>(false, 16, 16);
+    std::vector<float> values(8 * 4);
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = float(i % 3);
+    std::string filename = "transmission_map_test.raw";
+    {
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(values.data()), std::streamsize(values.size() * sizeof(float)));
+    }
+
+    auto mapped = TransmissionMap::from_file(filename, 8, 4, m);
+    TransmissionMap owned(values, 8, 4, m);
+    for (unsigned int i = 0; i < 8; ++i)
+        for (unsigned int j = 0; j < 4; ++j)
+            EXPECT_EQ(mapped.get_value(i, j), values[i * 4 + j]);
+    EXPECT_DOUBLE_EQ(mapped.get_mean(), owned.get_mean());
+    EXPECT_THROW(TransmissionMap::from_file(filename, 8, 8, m), std::runtime_error);
+    std::remove(filename.c_str());
+}
+
+TEST(TransmissionMap, LongFrameExposureTimes) {
+    /**
+     * The exposures draw double photon times: in the second half of a one second frame a float time would be a
+     * multiple of 0.0625 µs.
+     */
+    const std::string filename = "transmission_test_deposits.bin";
+    for (bool transmission: {false, true}) {
+        auto recorder = std::make_shared<MedipixRecorder>(filename, 16, 16);
+        recorder->start_frame();
+        if (transmission) {
+            TransmissionMap map(std::vector<float>(16 * 16, 0.5f), 16, 16, recorder);
+            transmission_exposure(recorder, 30.f, 1., 1E4, map, 7);
+        } else {
+            exposure(recorder, 30.f, 1., 1E4, HomogeneousPattern{}, 7);
+        }
+        recorder->finish_frame();
+        recorder.reset();
+
+        DepositRecord deposits(filename);
+        std::remove(filename.c_str());
+        size_t late = 0;
+        size_t resolved = 0;
+        for (size_t k = 0; k < deposits.get_number_of_photons(); ++k) {
+            double time = deposits.get_photon(k).first->time;
+            if (time < 524288.)
+                continue;
+            late++;
+            resolved += std::fmod(time, 0.0625) != 0.;
+        }
+        EXPECT_GT(late, 100);
+        EXPECT_EQ(resolved, late);
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include "shard.h"
+
+/**
+ * Sums the partial images of a sharded run: medipix_merge <output> <shard sidecars...>
+ * Writes <output>.raw and <output>.txt.
+ */
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <output> <shard sidecars...>" << std::endl;
+        return 1;
+    }
+    try {
+        std::string output = argv[1];
+        std::vector<std::string> sidecars(argv + 2, argv + argc);
+
+        std::vector<unsigned int> counts;
+        auto info = merge_shards(sidecars, counts);
+
+        std::ofstream image_file(output + ".raw", std::ios::out | std::ios::binary);
+        for (auto &count: counts) {
+            uint32_t pixel_value = count;
+            image_file.write((char *) &pixel_value, sizeof(pixel_value));
+        }
+        image_file.close();
+        info.image_file = std::filesystem::path(output + ".raw").filename().string();
+        save_shard_info(info, output + ".txt");
+
+        std::cout << "merged " << sidecars.size() << " shards, counts "
+                  << std::accumulate(counts.begin(), counts.end(), 0ull) << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * Simple Medipix simulation
+ * Copyright (C) 2023  Marcus Zuber
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include "helper.h"
+#include "MedipixCSM.h"
+#include "MedipixSPM.h"
+#include "shard.h"
+
+/**
+ * Simulates one shard of a non-timed frame and writes <output>.raw and <output>.txt.
+ *
+ * Example for 4 local processes:
+ *   for k in 0 1 2 3; do medipix_shard --shard $k --shards 4 --seed 42 --output shard_$k & done; wait
+ *   medipix_merge frame shard_*.txt
+ */
+int main(int argc, char **argv) {
+    std::map<std::string, std::string> options = {
+            {"--shard",      "0"},
+            {"--shards",     "1"},
+            {"--seed",       "0"},
+            {"--output",     "shard"},
+            {"--mode",       "spm"},
+            {"--nx",         "256"},
+            {"--ny",         "256"},
+            {"--energy",     "30"},
+            {"--time",       "0.01"},
+            {"--flux",       "1E6"},
+            {"--th0",        "6"},
+            {"--th1",        "10"},
+            {"--psf-sigma",  "13"},
+            {"--dispersion", "0"},
+    };
+    for (int k = 1; k < argc; k += 2) {
+        if (!options.contains(argv[k])) {
+            std::cerr << "Unknown option " << argv[k] << std::endl;
+            return 1;
+        }
+        // A missing value would leave the default, e.g. a shard with seed 0
+        if (k + 1 == argc) {
+            std::cerr << "Missing value of " << argv[k] << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [--option value]... with the options";
+            for (const auto &[option, value]: options)
+                std::cerr << " " << option;
+            std::cerr << std::endl;
+            return 1;
+        }
+        options[argv[k]] = argv[k + 1];
+    }
+
+    try {
+        unsigned int nx = std::stoul(options["--nx"]);
+        unsigned int ny = std::stoul(options["--ny"]);
+        unsigned int seed = std::stoul(options["--seed"]);
+        std::shared_ptr<Medipix> m;
+        if (options["--mode"] == "csm") {
+            auto csm = std::make_shared<MedipixCSM>(false, nx, ny);
+            csm->set_th1(std::stof(options["--th1"]));
+            m = csm;
+        } else {
+            m = std::make_shared<MedipixSPM>(false, nx, ny);
+        }
+        m->set_th0(std::stof(options["--th0"]));
+        m->set_psf_sigma(std::stof(options["--psf-sigma"]));
+        // The threshold dispersion is derived from the run seed, so all shards see the same detector
+        if (std::stof(options["--dispersion"]) > 0.f)
+            m->random_threshold_dispersion(std::stof(options["--dispersion"]), seed);
+
+        auto info = run_shard(m, std::stof(options["--energy"]), std::stod(options["--time"]),
+                              std::stod(options["--flux"]), [](float, float) { return true; }, seed,
+                              std::stoul(options["--shard"]), std::stoul(options["--shards"]), "flat");
+        save_shard(m, info, options["--output"]);
+        std::cout << "photons " << info.first_photon << " - " << info.last_photon << " of " << info.total_photons
+                  << ", counts " << m->get_total_counts() << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}